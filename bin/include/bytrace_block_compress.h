@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_BLOCK_COMPRESS_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_BLOCK_COMPRESS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "bytrace_dump.h"
+
+/**
+ * Block-compressed trace container, in the style of BGZF.
+ *
+ * The output is a sequence of gzip members, so "zcat" still restores the whole text:
+ *   - one data member per block of trace text, cut at a line boundary;
+ *   - one or more empty members whose FEXTRA field ("BI") carries the block index;
+ *   - a fixed-size empty member whose FEXTRA field ("BF") locates the index.
+ * Each index entry maps a block to its byte range and the timestamp range of its lines,
+ * so a time window can be extracted by inflating only the blocks that overlap it.
+ */
+const uint32_t BLOCK_CONTAINER_VERSION = 1;
+const size_t BLOCK_FOOTER_SIZE = 42; // gzip header 12 + "BF" subfield 20 + empty deflate 2 + trailer 8
+
+struct TraceBlockIndex {
+    uint64_t offset;          // offset of the data member from the start of the container
+    uint32_t compressedSize;  // size of the data member in bytes
+    uint32_t rawSize;         // size of the inflated block in bytes
+    uint64_t beginUs;         // smallest timestamp in the block, in microseconds
+    uint64_t endUs;           // largest timestamp in the block, in microseconds
+};
+
+class BlockTraceWriter : public DumpCompressor {
+public:
+    explicit BlockTraceWriter(size_t blockSize);
+    ~BlockTraceWriter() override = default;
+
+    bool Compress(const char* data, size_t len, const DumpSink& sink) override;
+    bool Finish(const DumpSink& sink) override;
+    const std::vector<TraceBlockIndex>& GetIndex() const
+    {
+        return index_;
+    }
+
+private:
+    bool FlushBlock(size_t len, const DumpSink& sink);
+    bool WriteIndex(const DumpSink& sink);
+
+    size_t blockSize_;
+    uint64_t offset_ = 0;
+    std::string pending_;
+    std::vector<uint8_t> out_;
+    std::vector<TraceBlockIndex> index_;
+};
+
+/**
+ * The timestamp of one ftrace text line in us, e.g. "... [001] d..2 1234.567890: sched_switch: ...", as
+ * ParseTraceLine() reads it. Returns false for comment lines and lines that are not events.
+ */
+bool ParseTraceTimestamp(const char* line, size_t len, uint64_t& us);
+
+bool DumpBlockCompressedTrace(int traceFd, int outFd, size_t blockSize, const std::string& preamble,
+    DumpStageStats* stats = nullptr);
+bool ReadBlockIndex(int fd, std::vector<TraceBlockIndex>& index);
+bool ExtractTraceWindow(int inFd, int outFd, uint64_t beginUs, uint64_t endUs);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_BLOCK_COMPRESS_H
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CAPABILITY_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CAPABILITY_H
+
+#include <map>
+#include <string>
+#include "bytrace_tracefs.h"
+
+enum FileAccess { FILE_MISSING, FILE_READONLY, FILE_WRITABLE };
+
+/**
+ * On-disk cache of which tracefs files exist and which are writable, so that listing or checking
+ * categories does not probe every enable file on each run.
+ *
+ * The file starts with a key made of the kernel release and build, the tracing directory and the
+ * device it is mounted on, and the effective uid; a cache written under any other key is ignored
+ * and rewritten. Each following line is "<w|r|-> <file>".
+ *
+ * Every user has a cache file of its own, "<cachePath>.<euid>", so that root and the shell user do not
+ * rewrite each other's. Only a regular file owned by the user is read.
+ */
+class CapabilityCache {
+public:
+    CapabilityCache(TraceFs& traceFs, const std::string& cachePath);
+
+    // Loads the cache if it was written for the current kernel, mount and uid.
+    bool Load();
+    // Writes the cache back if a probe added to it.
+    bool Save();
+    FileAccess Probe(const std::string& file);
+    const std::string& GetKey() const
+    {
+        return key_;
+    }
+
+private:
+    std::string MakeKey() const;
+
+    TraceFs& traceFs_;
+    std::string cachePath_;
+    std::string key_;
+    std::map<std::string, FileAccess> entries_;
+    bool dirty_ = false;
+};
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CAPABILITY_H
@@ -17,19 +17,6 @@
 #define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CAPTURE_H
 
 #include <string>
-#include <map>
-
-const int MAX_SYS_FILES = 11;
-enum TraceType { USER, KERNEL };
-struct TagCategory {
-    std::string name;
-    std::string description;
-    uint64_t tag;
-    TraceType type;
-    struct {
-        std::string path;
-    } sysfiles[MAX_SYS_FILES];
-};
 
 std::string GetPropertyInner(const std::string& property, const std::string& value);
 bool SetPropertyInner(const std::string& property, const std::string& value);
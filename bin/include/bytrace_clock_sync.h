@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CLOCK_SYNC_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CLOCK_SYNC_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * One reading of the clock domains a trace may have to be aligned with, all in nanoseconds. The
+ * realtime and monotonic clocks are read between two readings of the boot clock; bootNs is their
+ * midpoint, so that each of the other clocks was read within errorNs of it.
+ */
+struct ClockSyncSample {
+    uint64_t seq = 0;
+    int64_t bootNs = 0;
+    int64_t monoNs = 0;
+    int64_t realtimeNs = 0;
+    int64_t errorNs = 0;
+};
+
+// The tightest of a few bracketed readings; seq is left to the caller.
+bool SampleClocks(ClockSyncSample& sample);
+
+/**
+ * trace_marker text of a sample, one write per line:
+ *   trace_event_clock_sync: realtime_ts=<ms>                  (bytrace_multi.py, systrace)
+ *   trace_event_clock_sync: parent_ts=<s>.<us>                (systrace)
+ *   trace_event_clock_sync: bytrace seq=<n> boot=<ns> mono=<ns> realtime=<ns> error=<ns>
+ * The first two are kept for the existing tools.
+ */
+std::string FormatClockSyncMarkers(const ClockSyncSample& sample);
+
+// Parses the payload of a marker of the last kind, from "trace_event_clock_sync: bytrace" on.
+bool ParseClockSyncMarker(const std::string& payload, ClockSyncSample& sample);
+
+/**
+ * Writes samples to a trace_marker fd, which it owns: on demand with Mark(), and every intervalMs
+ * from a thread of its own between Start() and Stop().
+ */
+class ClockSyncWriter {
+public:
+    explicit ClockSyncWriter(int markerFd) : markerFd_(markerFd) {}
+    ~ClockSyncWriter();
+    ClockSyncWriter(const ClockSyncWriter&) = delete;
+    ClockSyncWriter& operator=(const ClockSyncWriter&) = delete;
+
+    // Writes one sample at once. Returns false if the clocks cannot be read; a marker that cannot be
+    // written is reported on stderr only, as the capture is still usable without it.
+    bool Mark();
+    void Start(int intervalMs);
+    void Stop();
+
+private:
+    void Run(int intervalMs);
+
+    int markerFd_;
+    std::mutex markMutex_; // keeps the lines of a sample together
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_ = false;
+};
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CLOCK_SYNC_H
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CONVERT_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+enum ConvertFormat : uint8_t {
+    CONVERT_JSON,     // Chrome Trace Event JSON, for chrome://tracing and the Perfetto UI
+    CONVERT_PERFETTO, // Perfetto protobuf, a Trace of TracePackets
+};
+
+// "json" or "perfetto".
+bool ParseConvertFormat(std::string_view name, ConvertFormat& format);
+
+struct ConvertStats {
+    uint64_t lines = 0;
+    uint64_t markers = 0;     // tracing_mark_write events converted to slices, async slices and counters
+    uint64_t schedEvents = 0; // sched_switch and wakeup events converted to thread states
+    uint64_t skipped = 0;     // lines that are not events, and markers that cannot be parsed
+};
+
+using ConvertSink = std::function<bool(const char* data, size_t len)>;
+
+/**
+ * Converts the ftrace text of a bytrace trace read from inFd, and hands the output to sink.
+ *
+ * The B, E, S, F and C markers become slices of their thread, async slices and counters of their
+ * process, with the names of the threads and processes. The sched_switch and wakeup events become the
+ * thread states: in the JSON, their lines go to "systemTraceEvents", which the viewers parse like a
+ * systrace; in the protobuf, they become ftrace event bundles. The JSON needs a second pass over the
+ * trace for those lines, so inFd is read twice when it can seek, and the thread states are left out
+ * when it cannot.
+ *
+ * The trace is streamed: the memory used depends on the number of threads, processes and counters,
+ * not on the size of the trace.
+ */
+bool ConvertTrace(int inFd, ConvertFormat format, const ConvertSink& sink, ConvertStats* stats = nullptr);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CONVERT_H
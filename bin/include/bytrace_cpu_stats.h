@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CPU_STATS_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CPU_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "bytrace_tracefs.h"
+
+/**
+ * Counters of one per-CPU ring buffer, from per_cpu/cpuN/stats.
+ */
+struct CpuTraceStats {
+    uint64_t entries = 0;        // events in the buffer
+    uint64_t overrun = 0;        // events overwritten because the buffer was full
+    uint64_t commitOverrun = 0;  // events lost because of nested writers
+    uint64_t bytes = 0;          // bytes in the buffer
+    uint64_t dropped = 0;        // events discarded because the buffer was full and not overwriting
+    uint64_t readEvents = 0;     // events consumed by readers
+    uint64_t oldestUs = 0;       // timestamp of the oldest event in the buffer, 0 if unknown
+    uint64_t nowUs = 0;          // current trace clock
+};
+
+const int MIN_CPU_BUFFER_KB = 128;
+
+bool ParseCpuStats(const std::string& text, CpuTraceStats& stats);
+bool ReadCpuStats(const TraceFs& traceFs, int cpu, CpuTraceStats& stats);
+// CPUs that have a per_cpu directory, i.e. their own ring buffer.
+int GetTraceCpuCount(const TraceFs& traceFs);
+
+/**
+ * Metadata section embedded ahead of the trace, one comment line per CPU with the counters accumulated
+ * between begin and end, so that a reader can tell whether the trace is complete:
+ *   # cpu_stats: cpu entries overrun commit_overrun dropped bytes oldest_ts now_ts
+ *   # cpu_stats: 0 52311 0 0 0 3145728 5321.123456 5326.123901
+ * begin may be empty, the counters then count from the last time the buffer was cleared.
+ */
+std::string FormatCpuStats(const std::vector<CpuTraceStats>& begin, const std::vector<CpuTraceStats>& end);
+
+/**
+ * One line for stderr: the events kept and, per CPU, the events overwritten or dropped.
+ */
+std::string SummarizeCpuStats(const std::vector<CpuTraceStats>& begin, const std::vector<CpuTraceStats>& end);
+
+/**
+ * Per-CPU buffer sizes in KB, from the buffer usage of each CPU during a warm-up of sampleSec seconds,
+ * so that every CPU holds durationSec seconds of events plus some headroom. Events lost during the
+ * warm-up are accounted for. When the sizes do not fit into budgetKB altogether, they are scaled
+ * down in proportion; every CPU gets at least MIN_CPU_BUFFER_KB.
+ */
+std::vector<int> PlanCpuBufferSizes(const std::vector<CpuTraceStats>& begin, const std::vector<CpuTraceStats>& end,
+    double sampleSec, int durationSec, int budgetKB);
+
+/**
+ * CPU list such as "4-7" or "0,2,4-7" into sorted, unique CPU numbers below maxCpus.
+ */
+bool ParseCpuList(const std::string& arg, int maxCpus, std::vector<int>& cpus);
+
+/**
+ * Mask in the format of tracing_cpumask: hex, in comma separated groups of 32 CPUs, e.g. "f0" or "1,00000000".
+ */
+std::string FormatCpuMask(const std::vector<int>& cpus);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_CPU_STATS_H
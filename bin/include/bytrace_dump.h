@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_DUMP_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_DUMP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+enum DumpMethod { DUMP_SENDFILE, DUMP_SPLICE, DUMP_COPY };
+
+struct DumpStats {
+    uint64_t bytes = 0;
+    uint64_t syscalls = 0;
+    DumpMethod method = DUMP_COPY;
+};
+
+/**
+ * Busy time of each stage of a pipelined dump. Waiting for a buffer from another stage is not counted,
+ * so totalMs close to the largest stage means the stages overlapped well.
+ */
+struct DumpStageStats {
+    double readMs = 0;
+    double compressMs = 0;
+    double writeMs = 0;
+    double totalMs = 0;
+    uint64_t rawBytes = 0;
+    uint64_t outBytes = 0;
+};
+
+using DumpSink = std::function<bool(const void* data, size_t len)>;
+
+/**
+ * Compression stage of a pipelined dump. Compressed output is handed to the sink, which may block
+ * until the writer stage has returned a buffer.
+ */
+class DumpCompressor {
+public:
+    virtual ~DumpCompressor() = default;
+    virtual bool Compress(const char* data, size_t len, const DumpSink& sink) = 0;
+    virtual bool Finish(const DumpSink& sink) = 0;
+};
+
+std::unique_ptr<DumpCompressor> CreateZlibCompressor();
+
+/**
+ * Read traceFd, compress it and write outFd with the three stages running concurrently. They are
+ * connected by bounded queues of reusable buffers, so memory use does not depend on the trace size.
+ * The preamble is compressed ahead of the trace.
+ */
+bool DumpPipelined(int traceFd, int outFd, DumpCompressor& compressor, const std::string& preamble,
+    DumpStageStats* stats = nullptr);
+
+/**
+ * Write the whole buffer, retrying on EINTR and on short writes.
+ */
+bool WriteFully(int fd, const void* data, size_t len);
+
+/**
+ * Copy traceFd to outFd until EOF. sendfile() is tried first, then splice() through a pipe,
+ * then read()/write() with a large page-aligned buffer; a method that is not supported by
+ * the kernel for this pair of files falls through to the next one without losing data.
+ * When outFd is a regular file, sizeHint bytes are preallocated up front and whatever is
+ * not used is released again at the end.
+ */
+bool DumpRawTrace(int traceFd, int outFd, size_t sizeHint, DumpStats* stats = nullptr);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_DUMP_H
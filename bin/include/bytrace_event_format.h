@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_EVENT_FORMAT_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_EVENT_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum EventFieldKind : uint8_t {
+    EVENT_FIELD_INT,      // an integer of 1, 2, 4 or 8 bytes
+    EVENT_FIELD_CHARS,    // char name[N], NUL-terminated within N; char name[] runs to the end of the record
+    EVENT_FIELD_DATA_LOC, // __data_loc: offset (low 16 bits) and length (high 16 bits) of data in the record
+    EVENT_FIELD_ARRAY,    // any other array
+};
+
+struct EventField {
+    std::string name;
+    std::string type; // the declaration without the name, e.g. "pid_t" or "char[16]"
+    uint16_t offset = 0;
+    uint16_t size = 0;
+    bool isSigned = false;
+    EventFieldKind kind = EVENT_FIELD_INT;
+};
+
+/**
+ * Parses the "field:" lines of a format file, or of events/header_page, into fields in their order.
+ */
+bool ParseEventFields(std::string_view text, std::vector<EventField>& fields);
+
+/**
+ * Layout of the records of one event type, from events/<system>/<event>/format, e.g.
+ *   name: sched_wakeup
+ *   ID: 73
+ *   format:
+ *           field:unsigned short common_type;       offset:0;       size:2; signed:0;
+ *           ...
+ *           field:char comm[16];    offset:8;       size:16;        signed:1;
+ *   print fmt: "comm=%s pid=%d prio=%d target_cpu=%03d", REC->comm, REC->pid, REC->prio, REC->target_cpu
+ *
+ * The print fmt is compiled once into a printf format and a tree per argument, so that a record is
+ * printed as the kernel prints it. The arguments may use the integer operators of C, casts, "?:",
+ * string literals, __get_str(), __get_dynamic_array(), __print_flags() and __print_symbolic(). Pointers
+ * (%p, %ps, ...) are printed in hex, as the kernel's symbols and pointer hashes are not available.
+ * A print fmt with anything else is not compiled, and the fields are printed as "name=value" instead.
+ */
+class EventFormat {
+public:
+    EventFormat();
+    ~EventFormat();
+    EventFormat(const EventFormat&) = delete;
+    EventFormat& operator=(const EventFormat&) = delete;
+
+    bool Parse(const std::string& system, std::string_view text);
+
+    uint16_t GetId() const
+    {
+        return id_;
+    }
+    const std::string& GetSystem() const
+    {
+        return system_;
+    }
+    const std::string& GetName() const
+    {
+        return name_;
+    }
+    const std::vector<EventField>& GetFields() const
+    {
+        return fields_;
+    }
+    // True when the print fmt was compiled.
+    bool HasPrintFormat() const
+    {
+        return printable_;
+    }
+    const EventField* FindField(std::string_view name) const;
+
+    // Values of a field in a record of size bytes, from common_type on; 0 or empty when out of bounds.
+    static int64_t ReadInt(const EventField& field, const uint8_t* data, size_t size);
+    static std::string_view ReadString(const EventField& field, const uint8_t* data, size_t size);
+
+    // Appends the payload of a record, what the kernel prints after "<event>: ".
+    void FormatPayload(const uint8_t* data, size_t size, std::string& out) const;
+
+    struct Expr;
+    struct Conversion;
+
+private:
+    bool CompilePrintFormat(std::string_view text);
+    void FormatFields(const uint8_t* data, size_t size, std::string& out) const;
+
+    uint16_t id_ = 0;
+    std::string system_;
+    std::string name_;
+    std::vector<EventField> fields_;
+    bool printable_ = false;
+    std::vector<Conversion> conversions_;
+    std::vector<std::unique_ptr<Expr>> args_;
+    std::string tail_; // literal text after the last conversion
+};
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_EVENT_FORMAT_H
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_EVENT_SETTINGS_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_EVENT_SETTINGS_H
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "bytrace_tracefs.h"
+
+// system name -> event names, as listed by available_events
+using EventTable = std::map<std::string, std::set<std::string>>;
+
+struct EventSettingsStats {
+    size_t enabled = 0;   // events switched on
+    size_t disabled = 0;  // events switched off
+    size_t commands = 0;  // set_event commands written, or enable files written without set_event
+    bool bulk = false;    // applied through set_event
+};
+
+/**
+ * Applies ftrace event settings as a diff against the current state of the kernel.
+ *
+ * available_events and set_event are read once, the enable files of the tags ("events/sys/enable"
+ * or "events/sys/event/enable") are expanded to event names, and only the events whose state has
+ * to change are written to set_event in a single open. A whole subsystem is switched with one
+ * "sys:*" command when possible. Events outside the managed set are never touched.
+ * Without a readable set_event, every managed enable file is written as before.
+ */
+class EventSettings {
+public:
+    explicit EventSettings(TraceFs& traceFs);
+
+    bool Apply(const std::vector<std::string>& managedPaths, const std::vector<std::string>& enabledPaths);
+    const EventSettingsStats& GetStats() const
+    {
+        return stats_;
+    }
+
+private:
+    bool Load();
+    void Expand(const std::vector<std::string>& paths, std::set<std::string>& events) const;
+    bool ApplyPerFile(const std::vector<std::string>& managedPaths, const std::vector<std::string>& enabledPaths);
+
+    TraceFs& traceFs_;
+    EventTable available_;
+    std::set<std::string> enabled_;
+    EventSettingsStats stats_;
+};
+
+/**
+ * Split "events/sys/enable" or "events/sys/event/enable" into its system and event names;
+ * the event name is empty for a whole subsystem.
+ */
+bool ParseEventPath(const std::string& path, std::string& system, std::string& event);
+
+/**
+ * set_event commands ("sys:event", "sys:*", "!sys:event", "!sys:*") that turn the enabled events
+ * of the managed set into exactly the wanted ones. Events are named "sys:event".
+ */
+std::vector<std::string> DiffEventCommands(const EventTable& available, const std::set<std::string>& enabled,
+    const std::set<std::string>& managed, const std::set<std::string>& wanted);
+
+struct EventFilter {
+    std::string system;
+    std::string event;      // empty for every event of the system
+    std::string expression; // ftrace filter expression, e.g. "prev_pid == 1234"
+};
+
+/**
+ * Kernel-side filters of a capture: expressions written to events/sys[/event]/filter and the pids of
+ * set_event_pid, so that events nobody asked for never reach the ring buffer. Clear() undoes what
+ * Apply() set and restores options/event-fork.
+ */
+class EventFilters {
+public:
+    explicit EventFilters(TraceFs& traceFs);
+
+    bool Apply(const std::vector<EventFilter>& filters, const std::vector<int>& pids, bool followFork);
+    bool Clear();
+
+private:
+    TraceFs& traceFs_;
+    std::vector<std::string> filterPaths_; // filter files that were written
+    bool pidsSet_ = false;
+    std::string eventFork_; // options/event-fork before Apply(), empty when it was not changed
+};
+
+/**
+ * "sys/event:expression" or "sys:expression".
+ */
+bool ParseEventFilter(const std::string& arg, EventFilter& filter);
+
+/**
+ * Comma separated pids, e.g. "1234,5678".
+ */
+bool ParsePidList(const std::string& arg, std::vector<int>& pids);
+
+/**
+ * Pids of the running processes whose name, the first word of /proc/<pid>/cmdline, is name.
+ */
+std::vector<int> FindProcessPids(const std::string& name, const std::string& procDir = "/proc");
+
+/**
+ * Pids of the processes in a cgroup directory, from cgroup.procs, or from tasks on a cgroup v1 hierarchy
+ * without it.
+ */
+std::vector<int> FindCgroupPids(const std::string& cgroupDir);
+
+/**
+ * The pid followed by the ids of its other threads. set_event_pid matches threads, not processes,
+ * so a process is only traced as a whole with all of them. Just the pid when it has no task directory.
+ */
+std::vector<int> FindProcessThreads(int pid, const std::string& procDir = "/proc");
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_EVENT_SETTINGS_H
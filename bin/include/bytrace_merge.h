@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_MERGE_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_MERGE_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Merge text traces that are each in time order, such as the trace files of several ftrace instances,
+ * into one by the timestamps of their lines. The comment lines ('#') at the head of the first trace are
+ * kept and those of the others dropped. Lines without a timestamp stay behind the line they follow;
+ * lines with equal timestamps keep the order of traceFds. Reading uses bounded buffers.
+ */
+bool MergeTraces(const std::vector<int>& traceFds, int outFd);
+
+/**
+ * Merges the traces of several devices into one timeline, with the output of script/bytrace_multi.py:
+ * only the binder_transaction and tracing_mark_write lines are kept, each prefixed with
+ * "[device_<n>]", n counting the files, and moved by the offset between the last realtime_ts clock
+ * sync marker of its trace and the one of the device with the earliest marker. A trace without one is
+ * put 0.5s after that device. Lines with equal timestamps keep the order of the devices, then the
+ * order of their trace.
+ *
+ * The files are mapped, each one is read twice (once for its marker and once to merge it) and the
+ * devices are merged with a heap. Only a trace that is not in time order has its lines indexed and
+ * sorted. files that cannot be opened are skipped with a warning, as the script does.
+ */
+bool MergeDeviceTraces(const std::vector<std::string>& files, int outFd);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_MERGE_H
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_PARSER_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Parser of the ftrace text format that bytrace writes, for the tools that read its traces.
+ *
+ * One event per line:
+ *   <task>-<pid> [(<tgid>)] [<cpu>] [<flags>] <seconds>.<fraction>: <event>: <payload>
+ * e.g.
+ *   surfaceflinger-512   (  512) [003] d..2 1234.567890: tracing_mark_write: B|512|onVsync
+ * The tgid is only there with options/record-tgid, and is "-----" when unknown.
+ *
+ * The string views of an event point into the parsed text, which must outlive them.
+ */
+struct TraceEvent {
+    std::string_view task;
+    std::string_view flags;   // empty without the irq-info option
+    std::string_view name;    // of the event, e.g. "sched_switch"
+    std::string_view payload; // what follows "<event>: "
+    uint64_t timestampNs = 0;
+    int32_t pid = 0;
+    int32_t tgid = -1; // -1 when unknown
+    int32_t cpu = 0;
+};
+
+// False for the lines that are not events, such as the comments of the header.
+bool ParseTraceLine(std::string_view line, TraceEvent& event);
+
+// A trace clock value as ftrace prints it, "<seconds>.<fraction>", in ns.
+bool ParseTraceSeconds(std::string_view text, uint64_t& ns);
+
+enum TraceMarkerType : uint8_t {
+    TRACE_MARKER_BEGIN,       // B: a slice starts on the thread
+    TRACE_MARKER_END,         // E: the last slice of the thread ends
+    TRACE_MARKER_ASYNC_BEGIN, // S: an asynchronous slice starts, value is its id
+    TRACE_MARKER_ASYNC_END,   // F: the asynchronous slice with the id value ends
+    TRACE_MARKER_COUNTER,     // C: a counter is set to value
+};
+
+/**
+ * Payload of a tracing_mark_write event. Both the bytrace format, "S|pid|name value", and the one of
+ * systrace, "S|pid|name|value", are accepted; the pid and name of E are optional.
+ */
+struct TraceMarker {
+    TraceMarkerType type = TRACE_MARKER_BEGIN;
+    int32_t pid = -1; // -1 when absent
+    std::string_view name;
+    int64_t value = 0;
+};
+
+bool ParseTraceMarker(std::string_view payload, TraceMarker& marker);
+
+struct TraceParseStats {
+    size_t lines = 0;
+    size_t skipped = 0; // lines that are not events
+};
+
+/**
+ * Parses text into events in the order of its lines. The text is split at line ends into one chunk
+ * per thread (threads 0: one per CPU), parsed in parallel; small texts are parsed on the caller's
+ * thread.
+ */
+TraceParseStats ParseTraceText(std::string_view text, std::vector<TraceEvent>& events, int threads = 0);
+
+/**
+ * A trace file mapped into memory, for the views of its events to point into.
+ */
+class MappedTraceFile {
+public:
+    MappedTraceFile() = default;
+    ~MappedTraceFile();
+    MappedTraceFile(const MappedTraceFile&) = delete;
+    MappedTraceFile& operator=(const MappedTraceFile&) = delete;
+
+    bool Open(const std::string& path);
+    std::string_view Text() const
+    {
+        return std::string_view(data_, size_);
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_PARSER_H
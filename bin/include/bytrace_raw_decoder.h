@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_RAW_DECODER_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_RAW_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "bytrace_event_format.h"
+
+/**
+ * An event of a ring-buffer page, with the common fields every record starts with.
+ */
+struct RawEvent {
+    uint64_t timestamp = 0;              // in the unit of the trace clock, ns for the default boot clock
+    const EventFormat* format = nullptr; // nullptr when the format of the id is not loaded
+    const uint8_t* data = nullptr;       // the record from common_type on, within the decoded page
+    uint32_t size = 0;
+    uint16_t id = 0;
+    uint8_t flags = 0; // irqs-off, need-resched, hardirq, softirq, ...
+    uint8_t preemptCount = 0;
+    int32_t pid = 0;
+};
+
+// Columns of the kernel's trace file that depend on its options and on the trace clock.
+struct RawTextOptions {
+    bool recordTgid = true; // options/record-tgid
+    bool irqInfo = true;    // options/irq-info
+    bool timeInNs = true;   // false for the counter, uptime and x86-tsc clocks
+};
+
+/**
+ * Decoder of the binary ring-buffer pages read from per_cpu/cpuN/trace_pipe_raw. The layout of the
+ * pages comes from events/header_page and that of the records from the format file of each event id,
+ * so that a page is decoded without a pass through the kernel's text output. Events are formatted as
+ * the lines of the trace file.
+ */
+class RawEventDecoder {
+public:
+    // Without a header page, the layout of a 64-bit kernel is assumed.
+    bool SetHeaderPage(std::string_view text);
+    bool AddFormat(const std::string& system, std::string_view text);
+
+    /**
+     * Reads events/header_page, the format of ftrace/print (trace_marker) and those of the events under
+     * eventDirs: "events/<system>" for all the events of a system, "events/<system>/<event>" for one.
+     * Directories that the kernel does not have are skipped.
+     */
+    bool LoadFormats(const std::string& tracingPath, const std::vector<std::string>& eventDirs);
+    // Task names and tgids from saved_cmdlines and saved_tgids, for the text.
+    void LoadTaskNames(const std::string& tracingPath);
+    void SetTaskName(int32_t pid, const std::string& name);
+    void SetTgid(int32_t pid, int32_t tgid);
+    void SetTextOptions(const RawTextOptions& options)
+    {
+        options_ = options;
+    }
+
+    const EventFormat* FindFormat(uint16_t id) const;
+    size_t GetPageSize() const
+    {
+        return dataOffset_ + dataSize_;
+    }
+
+    /**
+     * Appends the events of a page in time order. lostEvents is the number of events dropped ahead of
+     * the page, -1 when the kernel did not store it. False when the page is malformed; the events
+     * decoded before the fault are kept.
+     */
+    bool DecodePage(const uint8_t* page, size_t size, std::vector<RawEvent>& events, int64_t& lostEvents) const;
+
+    // Appends the line of the trace file for the event, or the header of the file.
+    void FormatEvent(const RawEvent& event, int cpu, std::string& out) const;
+    std::string FormatHeader() const;
+
+private:
+    size_t timestampOffset_ = 0;
+    size_t commitOffset_ = 8;  // 8: after the u64 timestamp
+    size_t commitSize_ = 8;    // 8: local_t of a 64-bit kernel
+    size_t dataOffset_ = 16;   // 16: after the timestamp and the commit
+    size_t dataSize_ = 4080;   // 4080: the rest of a 4 KB page
+    std::vector<std::unique_ptr<EventFormat>> formats_; // by id
+    std::unordered_map<int32_t, std::string> taskNames_;
+    std::unordered_map<int32_t, int32_t> tgids_;
+    RawTextOptions options_;
+};
+
+struct RawDecodeStats {
+    uint64_t pages = 0;
+    uint64_t events = 0;
+    uint64_t lostEvents = 0; // the counts the kernel stored
+    uint64_t badPages = 0;
+};
+
+using RawTextSink = std::function<bool(const char* data, size_t len)>;
+
+/**
+ * Reads the pages of every CPU until its fd has none left, cpuFds[N] being the trace_pipe_raw (or
+ * snapshot_raw) of CPU N or -1, and hands the text of the events to sink, merged across the CPUs in time
+ * order. Only the current page of each CPU is kept in memory.
+ */
+bool DecodeRawBuffers(const RawEventDecoder& decoder, const std::vector<int>& cpuFds, const RawTextSink& sink,
+    RawDecodeStats* stats = nullptr);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_RAW_DECODER_H
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_RECORDER_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_RECORDER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "bytrace_tracefs.h"
+
+/**
+ * Flight recorder: tracing stays on in overwrite mode and the buffer is only dumped when a trigger fires.
+ * Triggers are SIGUSR1, a change of the mtime of a file, a trace_marker write containing a string
+ * (through a "traceoff" trigger on events/ftrace/print, kernel 4.17 or later) and a "dump" command
+ * on a local socket. Dumps closer together than minInterval seconds are dropped.
+ */
+struct RecorderConfig {
+    std::string triggerFile;
+    std::string triggerMarker;
+    std::string triggerSocket;
+    int minInterval = 30;  // seconds
+    int maxDumps = 0;      // 0: no limit
+};
+
+enum RecorderTrigger { TRIGGER_SIGNAL, TRIGGER_FILE, TRIGGER_MARKER, TRIGGER_SOCKET };
+
+// Dumps the buffer once; tracing must be running again when it returns.
+using RecorderDump = std::function<bool(RecorderTrigger trigger, int index)>;
+
+class FlightRecorder {
+public:
+    FlightRecorder(const RecorderConfig& config, TraceFs& traceFs);
+    ~FlightRecorder();
+
+    // Blocks until SIGINT/SIGTERM, a "stop" socket command or maxDumps dumps.
+    bool Run(const RecorderDump& dump);
+
+private:
+    bool Arm();
+    void Disarm();
+    bool ArmMarkerTrigger();
+    bool IsMarkerTriggered();
+    bool IsFileTriggered();
+    bool HandleSocket(bool& stop, bool& triggered);
+    bool Fire(RecorderTrigger trigger, const RecorderDump& dump);
+
+    RecorderConfig config_;
+    TraceFs& traceFs_;
+    bool armed_ = false;
+    int listenFd_ = -1;
+    int64_t fileMtimeNs_ = 0;
+    int64_t lastDumpSec_ = -1;
+    int dumps_ = 0;
+};
+
+const char* GetTriggerName(RecorderTrigger trigger);
+
+/**
+ * Current time of the trace clock in microseconds, read from per_cpu/cpu0/stats.
+ */
+bool ReadTraceClockNow(const TraceFs& traceFs, uint64_t& us);
+
+/**
+ * Skip the lines of a time-ordered text trace older than cutoffUs. Header lines are kept.
+ * The kept header and the unconsumed tail of the last chunk read are returned in carry;
+ * traceFd is left positioned right after them.
+ */
+bool SkipTraceBefore(int traceFd, uint64_t cutoffUs, std::string& carry);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_RECORDER_H
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_ROTATE_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_ROTATE_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <zlib.h>
+#include "bytrace_stream.h"
+
+/**
+ * Keeps the newest maxFiles of the files added and deletes the older ones; 0 keeps them all.
+ */
+class FileRing {
+public:
+    explicit FileRing(int maxFiles) : maxFiles_(maxFiles) {}
+    void Add(const std::string& path);
+
+private:
+    int maxFiles_;
+    std::deque<std::string> files_;
+};
+
+struct RotationConfig {
+    std::string output;        // files are <output>.0, <output>.1, ...
+    uint64_t maxFileBytes = 0; // of trace text, 0: no limit
+    int maxFileSec = 0;        // 0: no limit
+    int maxFiles = 0;          // 0: all files are kept
+    bool compress = false;     // every file is a gzip file of its own
+};
+
+// Text of the file with the given index, written at its beginning or at its end.
+using RotationHook = std::function<std::string(int index)>;
+
+/**
+ * Writes a capture into a sequence of files, each of them readable on its own: a file is closed at
+ * the first line boundary past maxFileBytes or maxFileSec, and the next one starts with the header
+ * again when more lines come. The oldest files are deleted so that at most maxFiles remain.
+ */
+class RotatingTraceWriter : public TraceSink {
+public:
+    RotatingTraceWriter(const RotationConfig& config, const RotationHook& header, const RotationHook& footer);
+    ~RotatingTraceWriter() override;
+    RotatingTraceWriter(const RotatingTraceWriter&) = delete;
+    RotatingTraceWriter& operator=(const RotatingTraceWriter&) = delete;
+
+    // Starts the first file now rather than at the first Write().
+    bool Open();
+    bool Write(const char* data, size_t len) override;
+    // Closes a file that has been open for maxFileSec, even without new lines.
+    bool Flush() override;
+    bool Close() override;
+    int GetFileCount() const
+    {
+        return index_;
+    }
+    uint64_t GetRawBytes() const
+    {
+        return rawBytes_;
+    }
+
+private:
+    bool IsExpired() const;
+    bool WriteFile(const char* data, size_t len);
+    bool CloseFile();
+
+    RotationConfig config_;
+    RotationHook header_;
+    RotationHook footer_;
+    FileRing ring_;
+    int index_ = 0; // of the next file
+    int fd_ = -1;
+    gzFile gz_ = nullptr;
+    bool hasLines_ = false;
+    bool atLineStart_ = true;
+    uint64_t fileBytes_ = 0;
+    uint64_t rawBytes_ = 0;
+    std::chrono::steady_clock::time_point fileBegin_;
+};
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_ROTATE_H
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_SERVICE_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_SERVICE_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * Protocol between the bytrace command line and the bytrace service on a local stream socket.
+ *
+ * The client sends one request: the magic "BYTRACE2", then the number of arguments and each argument
+ * as a 32-bit length followed by the bytes. Its stdout and stderr, and the "-o" file when there is one,
+ * are passed along with SCM_RIGHTS, so that the service writes to them directly: the service runs as
+ * root and never opens a path a client chose. The service answers with the 32-bit exit status of the
+ * command once it is done.
+ */
+struct ServiceRequest {
+    std::vector<std::string> args; // the command line of the client, args[0] is the program name
+    int outFd = -1;
+    int errFd = -1;
+    int outputFd = -1; // the "-o" file, opened by the client
+};
+
+// Returns the listening socket, or -1. A socket file left behind by a former service is replaced.
+int ListenServiceSocket(const std::string& path);
+// Returns the connected socket, or -1 when no service is listening on path.
+int ConnectServiceSocket(const std::string& path);
+// Whether the process at the other end of sockFd runs as one of uids.
+bool CheckServicePeer(int sockFd, const std::vector<uid_t>& uids);
+// The users the service takes requests from: root, the user of the service and the shell user.
+std::vector<uid_t> GetServiceUids();
+
+bool SendServiceRequest(int sockFd, const ServiceRequest& request);
+// The received outFd and errFd belong to the caller.
+bool ReceiveServiceRequest(int sockFd, ServiceRequest& request);
+bool SendServiceResult(int sockFd, int status);
+bool ReceiveServiceResult(int sockFd, int& status);
+
+/**
+ * Copies what is read from traceFd, e.g. trace_pipe, to outFd until stopFd, when not -1, is readable or
+ * hung up, or until outFd is closed by its reader.
+ */
+bool StreamTrace(int traceFd, int outFd, int stopFd);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_SERVICE_H
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_SESSION_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_SESSION_H
+
+#include <string>
+
+/**
+ * A capture session in its own ftrace instance, instances/bytrace_<name>/ of the tracing directory, with
+ * a buffer, clock and event set of its own, so that concurrent captures do not clobber each other.
+ *
+ * The process using a session holds an flock on <lockDir>/bytrace_session_<name>.lock; a second process
+ * cannot acquire the session meanwhile. The mtime of the lock file is the last use of the session.
+ */
+class TraceSession {
+public:
+    TraceSession(const std::string& tracingRoot, const std::string& name, const std::string& lockDir);
+    ~TraceSession();
+    TraceSession(const TraceSession&) = delete;
+    TraceSession& operator=(const TraceSession&) = delete;
+
+    // Takes the lock and creates the instance if it does not exist yet.
+    bool Acquire();
+    // Removes the instance. While another process has one of its files open, it is left to
+    // CleanAbandonedSessions().
+    bool Remove();
+    void Release();
+    // The instance directory, with a trailing '/'.
+    std::string GetRootPath() const;
+    // The name of the instance directory, "bytrace_<name>".
+    std::string GetInstanceName() const;
+
+    static bool IsValidName(const std::string& name);
+
+private:
+    std::string tracingRoot_;
+    std::string name_;
+    std::string lockPath_;
+    int lockFd_ = -1;
+};
+
+/**
+ * Removes the instances of sessions that no process holds and that have not been used for idleSec
+ * seconds, e.g. left behind by a capture that was killed. Returns the number of instances removed.
+ */
+int CleanAbandonedSessions(const std::string& tracingRoot, const std::string& lockDir, int idleSec);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_SESSION_H
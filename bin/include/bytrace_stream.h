@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_STREAM_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+/**
+ * Streaming of a capture to a collector on the host, see script/bytrace_collector.py.
+ *
+ * Every frame starts with a 24-byte little-endian header:
+ *   magic "BYTF", type, sequence (64 bits), flags, payload length
+ * HELLO opens a connection; its sequence is the id of the stream, so that a reconnection resumes the
+ * same output. DATA carries one chunk of trace text, compressed on its own with zlib when
+ * STREAM_FLAG_ZLIB is set, numbered from 0. END closes the stream. The collector answers each frame
+ * with the 64-bit sequence of the next chunk it expects.
+ *
+ * Chunks stay buffered until they are acknowledged; after a reconnection the unacknowledged ones are
+ * sent again. At most STREAM_WINDOW chunks are in flight: a slow collector stalls the reader of the
+ * trace, and the kernel ring buffer absorbs the backlog, with any overrun reported by the cpu stats.
+ */
+const uint32_t STREAM_FRAME_MAGIC = 0x46545942; // "BYTF"
+const size_t STREAM_HEADER_SIZE = 24;
+const uint32_t STREAM_FLAG_ZLIB = 1;
+const size_t STREAM_WINDOW = 64;
+enum StreamFrameType : uint32_t { STREAM_HELLO = 1, STREAM_DATA = 2, STREAM_END = 3 };
+
+// "unix:/path" or "tcp:host:port"; "host:port" is taken as tcp.
+struct StreamTarget {
+    std::string path;
+    std::string host;
+    int port = 0;
+};
+
+bool ParseStreamTarget(const std::string& arg, StreamTarget& target);
+
+// Where a capture read from trace_pipe goes while it is recorded.
+class TraceSink {
+public:
+    virtual ~TraceSink() = default;
+    virtual bool Write(const char* data, size_t len) = 0;
+    // Called whenever the trace is idle.
+    virtual bool Flush() = 0;
+    virtual bool Close() = 0;
+};
+
+class TraceStreamer : public TraceSink {
+public:
+    TraceStreamer(const StreamTarget& target, bool compress, size_t chunkSize = 256 * 1024);
+    ~TraceStreamer() override;
+    TraceStreamer(const TraceStreamer&) = delete;
+    TraceStreamer& operator=(const TraceStreamer&) = delete;
+
+    bool Open();
+    // Chunks are sealed at chunkSize bytes; a partial chunk waits for more data or Flush().
+    bool Write(const char* data, size_t len) override;
+    bool Flush() override;
+    // Sends the rest and END, and waits until the collector has everything.
+    bool Close() override;
+    uint64_t GetRawBytes() const
+    {
+        return rawBytes_;
+    }
+    uint64_t GetSentBytes() const
+    {
+        return sentBytes_;
+    }
+
+private:
+    struct Chunk {
+        uint64_t seq;
+        uint32_t flags;
+        std::string payload;
+    };
+
+    bool Connect();
+    bool Hello();
+    bool Reconnect();
+    bool SendFrame(uint32_t type, uint64_t seq, uint32_t flags, const std::string& payload);
+    bool ReadAcks(bool wait);
+    void Acknowledge(uint64_t next);
+    bool SendPending();
+
+    StreamTarget target_;
+    bool compress_;
+    size_t chunkSize_;
+    uint64_t streamId_ = 0;
+    int sockFd_ = -1;
+    std::string current_;
+    std::deque<Chunk> pending_; // sealed and not acknowledged yet
+    size_t sentInPending_ = 0;  // pending_ chunks sent on the current connection
+    uint64_t nextSeq_ = 0;
+    std::string ackBuffer_;
+    uint64_t rawBytes_ = 0;
+    uint64_t sentBytes_ = 0;
+};
+
+/**
+ * Writes what is read from traceFd, a non-blocking trace_pipe, to the sink for durationMs, or only
+ * what it holds already when durationMs is 0. The sink is flushed whenever the trace is idle.
+ */
+bool StreamTracePipe(int traceFd, TraceSink& sink, int durationMs);
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_STREAM_H
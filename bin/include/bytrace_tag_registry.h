@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_TAG_REGISTRY_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_TAG_REGISTRY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum TraceType { USER, KERNEL };
+
+struct TagCategory {
+    std::string_view name;
+    std::string_view description;
+    uint64_t tag;
+    TraceType type;
+    const std::string_view* sysfiles; // enable files of a KERNEL category
+    size_t sysfileCount;
+};
+
+/**
+ * Trace categories by name. The built-in categories are a constexpr table sorted by name, so nothing
+ * is built at startup and a lookup is a binary search. Vendor categories can be added from a data file,
+ * one per line:
+ *     name|description|events/sys/enable,events/sys/event/enable
+ * Empty lines and lines starting with '#' are skipped. A built-in category is never replaced.
+ */
+class TagRegistry {
+public:
+    bool LoadVendorTags(const std::string& path);
+    const TagCategory* Find(std::string_view name) const;
+    // All categories, in name order.
+    std::vector<const TagCategory*> GetAll() const;
+
+private:
+    struct VendorTag {
+        std::string name;
+        std::string description;
+        std::vector<std::string> files;
+        std::vector<std::string_view> fileViews;
+        TagCategory category;
+    };
+    std::vector<std::unique_ptr<VendorTag>> vendorTags_; // sorted by name
+};
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_TAG_REGISTRY_H
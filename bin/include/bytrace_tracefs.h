@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_TRACEFS_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_TRACEFS_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+/**
+ * Handle on the tracing directory. The directory is opened once and files are resolved relative to it
+ * with openat(). The control files written on every start, stop or marker (tracing_on, trace_marker,
+ * set_event and the enable files) keep a write-only fd open and are written with pwrite(), so toggling one
+ * costs a single syscall after the first time. Other files are opened, written and closed again.
+ * File names are relative to the tracing directory, e.g. "events/sched/enable".
+ */
+class TraceFs {
+public:
+    TraceFs() = default;
+    ~TraceFs();
+    TraceFs(const TraceFs&) = delete;
+    TraceFs& operator=(const TraceFs&) = delete;
+
+    bool Open(const std::string& rootPath);
+    void Close();
+    bool IsOpen() const
+    {
+        return rootFd_ != -1;
+    }
+    const std::string& GetRootPath() const
+    {
+        return rootPath_;
+    }
+
+    bool Exists(const std::string& file) const;
+    bool IsWritable(const std::string& file) const;
+
+    // Writes through the cached fd of a hot file, or a fresh open of any other; errno is set on failure.
+    bool Write(const std::string& file, const std::string& value);
+    // Reads the whole file from a fresh open, for files whose content is generated on open.
+    bool Read(const std::string& file, std::string& value) const;
+    // Reads the leading "0"/"1" of a flag file from a read-only open of its own.
+    bool ReadFlag(const std::string& file, bool& enabled) const;
+    // Opens a file that is not cached, e.g. with O_TRUNC or for a dump. The caller closes it.
+    int OpenFile(const std::string& file, int flags) const;
+
+private:
+    int GetFd(const std::string& file);
+
+    int rootFd_ = -1;
+    std::string rootPath_;
+    std::map<std::string, int> fds_;
+};
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_INCLUDE_BYTRACE_TRACEFS_H
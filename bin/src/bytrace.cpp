@@ -14,24 +14,44 @@
  */
 
 #include "bytrace.h"
+#include <algorithm>
+#include <chrono>
 #include <cinttypes>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
-#include <fstream>
 #include <regex>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <future>
+#include <thread>
 #include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <zlib.h>
+#include "bytrace_block_compress.h"
+#include "bytrace_capability.h"
 #include "bytrace_capture.h"
+#include "bytrace_clock_sync.h"
+#include "bytrace_convert.h"
+#include "bytrace_cpu_stats.h"
+#include "bytrace_dump.h"
+#include "bytrace_event_settings.h"
+#include "bytrace_merge.h"
+#include "bytrace_raw_decoder.h"
+#include "bytrace_recorder.h"
+#include "bytrace_rotate.h"
+#include "bytrace_service.h"
+#include "bytrace_session.h"
+#include "bytrace_stream.h"
+#include "bytrace_tag_registry.h"
+#include "bytrace_tracefs.h"
 #include "securec.h"
 
 using namespace std;
@@ -47,11 +67,42 @@ struct option g_longOptions[] = {
     { "trace_dump",        no_argument,       nullptr, 0 },
     { "list_categories",   no_argument,       nullptr, 0 },
     { "overwrite",         no_argument,       nullptr, 0 },
+    { "block_size",        required_argument, nullptr, 0 },
+    { "snapshot",          no_argument,       nullptr, 0 },
+    { "keep_warm",         no_argument,       nullptr, 0 },
+    { "auto_buffer",       required_argument, nullptr, 0 },
+    { "recorder",          no_argument,       nullptr, 0 },
+    { "trigger_file",      required_argument, nullptr, 0 },
+    { "trigger_marker",    required_argument, nullptr, 0 },
+    { "trigger_socket",    required_argument, nullptr, 0 },
+    { "dump_interval",     required_argument, nullptr, 0 },
+    { "max_dumps",         required_argument, nullptr, 0 },
+    { "filter",            required_argument, nullptr, 0 },
+    { "pid",               required_argument, nullptr, 0 },
+    { "follow_fork",       no_argument,       nullptr, 0 },
+    { "app",               required_argument, nullptr, 0 },
+    { "app_filter",        no_argument,       nullptr, 0 },
+    { "cpumask",           required_argument, nullptr, 0 },
+    { "cgroup",            required_argument, nullptr, 0 },
+    { "session",           required_argument, nullptr, 0 },
+    { "isolate",           required_argument, nullptr, 0 },
+    { "stream_to",         required_argument, nullptr, 0 },
+    { "max_file_size",     required_argument, nullptr, 0 },
+    { "max_file_time",     required_argument, nullptr, 0 },
+    { "max_files",         required_argument, nullptr, 0 },
+    { "clock_sync",        required_argument, nullptr, 0 },
+    { "decode_raw",        no_argument,       nullptr, 0 },
+    { nullptr,             0,                 nullptr, 0 },
 };
-const int CHUNK_SIZE = 65536;
-const int BLOCK_SIZE = 4096;
+const string SHORT_OPTIONS = "a:b:c:hlo:t:z";
 
 const string TRACE_TAG_PROPERTY = "debug.bytrace.tags.enableflags";
+const string APP_NUMBER_PROPERTY = "debug.bytrace.app_number";
+const string APP_PROPERTY_PREFIX = "debug.bytrace.app_";
+const string ALL_APPS = "*";
+const string INSTANCE_NUMBER_PROPERTY = "debug.bytrace.instance_number";
+const string INSTANCE_PROPERTY_PREFIX = "debug.bytrace.instance_";
+const string ISOLATED_SESSION_PREFIX = "markers_";
 
 // various operating paths of ftrace
 const string TRACING_ON_PATH = "tracing_on";
@@ -62,6 +113,21 @@ const string CURRENT_TRACER_PATH = "current_tracer";
 const string TRACE_CLOCK_PATH = "trace_clock";
 const string OVER_WRITE_PATH = "options/overwrite";
 const string RECORD_TGID_PATH = "options/record-tgid";
+const string IRQ_INFO_PATH = "options/irq-info";
+const string SET_EVENT_PATH = "set_event";
+const string SNAPSHOT_PATH = "snapshot";
+const string TRACING_CPUMASK_PATH = "tracing_cpumask";
+const string CAPABILITY_CACHE_PATH = "/data/local/tmp/bytrace_capabilities";
+const string VENDOR_TAGS_PATH = "/system/etc/bytrace/vendor_tags.conf";
+const string SESSION_LOCK_DIR = "/data/local/tmp/";
+const int SESSION_IDLE_SEC = 600; // an unused session instance is removed after 10 minutes
+const string SERVICE_SOCKET_PATH = "/data/local/tmp/bytrace.sock";
+const int SERVICE_TIMEOUT_SEC = 5; // for a client to send its request
+const string TRACE_PIPE_PATH = "trace_pipe";
+// Commands of the snapshot file: free the spare buffer, swap it with the live one, or clear it.
+const string SNAPSHOT_FREE = "0";
+const string SNAPSHOT_SWAP = "1";
+const string SNAPSHOT_CLEAR = "2";
 
 // support customization of some parameters
 
@@ -69,22 +135,90 @@ const int MIN_BUFFER_SIZE = 256;
 const int MAX_BUFFER_SIZE = 307200; // 300 MB
 constexpr unsigned int MAX_OUTPUT_LEN = 255;
 const int PAGE_SIZE_KB = 4; // 4 KB
+const int MIN_BLOCK_SIZE_MB = 1;
+const int MAX_BLOCK_SIZE_MB = 64;
+const size_t BYTES_PER_MB = 1024 * 1024;
+const double US_PER_SECOND = 1000000.0;
+const uint64_t US_PER_SECOND_INT = 1000000;
+const int MS_PER_SECOND = 1000;
+const int MIN_DUMP_INTERVAL = 1;
+const int MIN_CLOCK_SYNC_MS = 10;
+const int AUTO_BUFFER_WARMUP_SEC = 1;
+const string PER_CPU_PATH = "per_cpu/cpu";
+const string TRACE_PIPE_RAW_NAME = "/trace_pipe_raw";
+const string SNAPSHOT_RAW_NAME = "/snapshot_raw";
+constexpr unsigned int MAX_MARKER_LEN = 128;
+constexpr unsigned int MAX_APP_NAME_LEN = 96; // longest system parameter value
+const size_t MAX_APP_NUMBER = 16;
+const size_t MAX_ISOLATED_NUMBER = 4; // routes the library supports
 int g_traceDuration = 5;
 int g_bufferSizeKB = 2048;
 string g_clock = "boot";
 bool g_overwrite = true;
 string g_outputFile;
+int g_outputFd = -1; // in the service, the "-o" file the client opened
 bool g_compress = false;
+size_t g_blockSize = 0; // block-compressed output when not zero
+bool g_decodeRaw = false; // dumps from the binary per-CPU buffers instead of the kernel's text
+bool g_snapshot = false;
+bool g_keepWarm = false;
+int g_autoBufferKB = 0; // total budget of the per-CPU buffers sized from a warm-up, when not zero
+future<bool> g_bufferResized;
+vector<CpuTraceStats> g_startStats; // per-CPU counters when the current capture began
+int g_clockSyncMs = 1000;           // between the clock sync markers of a capture, 0: only at its ends
+unique_ptr<ClockSyncWriter> g_clockSync;
 
 string g_traceRootPath;
+TraceFs g_traceFs;
+unique_ptr<CapabilityCache> g_capabilities;
 
 bool g_traceStart = true;
 bool g_traceStop = true;
 bool g_traceDump = true;
 
-map<string, TagCategory> g_tagMap;
+bool g_recorder = false;
+RecorderConfig g_recorderConfig;
+bool g_recorderSnapshot = false; // the recorder dumps through the snapshot buffer, see RunRecorder()
+FileRing g_recorderFiles(0); // dumps of the recorder, see --max_files
+
+TagRegistry g_tagRegistry;
 vector<uint64_t> g_userEnabledTags;
 vector<string> g_kernelEnabledPaths;
+EventSettingsStats g_eventStats;
+vector<EventFilter> g_eventFilters;
+vector<int> g_filterPids;
+bool g_followFork = false;
+vector<string> g_apps; // processes whose app tag is enabled, all debuggable ones when empty
+bool g_appFilter = false;
+vector<int> g_traceCpus; // CPUs whose events are recorded, all when empty
+string g_savedCpuMask;   // tracing_cpumask before the capture, empty when it was not changed
+vector<string> g_cgroups;
+string g_sessionName;
+unique_ptr<TraceSession> g_session;
+
+// User tags whose markers go to an ftrace instance of their own, see --isolate.
+struct IsolatedTags {
+    string name;
+    uint64_t tags = 0;
+    unique_ptr<TraceSession> session;
+    unique_ptr<TraceFs> traceFs;
+};
+vector<IsolatedTags> g_isolated;
+EventFilters g_filters(g_traceFs);
+
+bool g_stream = false;
+StreamTarget g_streamTarget;
+unique_ptr<TraceStreamer> g_streamer;
+int g_streamPipeFd = -1;
+RotationConfig g_rotation; // of the -o file, see --max_file_size
+unique_ptr<RotatingTraceWriter> g_rotator;
+
+// The service keeps the tracefs, the categories and the buffers between the captures of its clients.
+bool g_serviceMode = false;
+bool g_captureRunning = false; // started with --trace_begin and not finished yet
+volatile sig_atomic_t g_serviceStop = 0;
+chrono::steady_clock::time_point g_serviceStartTime;
+uint64_t g_serviceRequests = 0;
 }
 
 static bool IsTraceMounted()
@@ -94,42 +228,34 @@ static bool IsTraceMounted()
 
     if (access((debugfsPath + TRACE_MARKER_PATH).c_str(), F_OK) != -1) {
         g_traceRootPath = debugfsPath;
-        return true;
-    }
-    if (access((tracefsPath + TRACE_MARKER_PATH).c_str(), F_OK) != -1) {
+    } else if (access((tracefsPath + TRACE_MARKER_PATH).c_str(), F_OK) != -1) {
         g_traceRootPath = tracefsPath;
-        return true;
+    }
+    if (!g_traceRootPath.empty()) {
+        if (g_traceFs.Open(g_traceRootPath)) {
+            g_capabilities = make_unique<CapabilityCache>(g_traceFs, CAPABILITY_CACHE_PATH);
+            g_capabilities->Load();
+            return true;
+        }
+        fprintf(stderr, "Error: opening %s: %s (%d)\n", g_traceRootPath.c_str(), strerror(errno), errno);
+        return false;
     }
 
     fprintf(stderr, "Error: Did not find trace folder\n");
     return false;
 }
 
-static bool IsFileExit(const string& filename)
-{
-    return access((g_traceRootPath + filename).c_str(), F_OK) != -1;
-}
-
 static bool IsWritableFile(const string& filename)
 {
-    return access((g_traceRootPath + filename).c_str(), W_OK) != -1;
+    return g_traceFs.IsWritable(filename);
 }
 
 static bool WriteStrToFile(const string& filename, const std::string& str)
 {
-    ofstream out;
-    out.open(g_traceRootPath + filename, ios::out);
-    if (out.fail()) {
-        fprintf(stderr, "Error: Did not open %s.\n", filename.c_str());
-        return false;
-    }
-    out << str;
-    if (out.bad()) {
-        fprintf(stderr, "Error: Did not write %s.\n", filename.c_str());
-        out.close();
+    if (!g_traceFs.Write(filename, str)) {
+        fprintf(stderr, "Error: Did not write %s: %s (%d).\n", filename.c_str(), strerror(errno), errno);
         return false;
     }
-    out.close();
     return true;
 }
 
@@ -140,25 +266,22 @@ static bool SetFtraceEnabled(const string& path, bool enabled)
 
 static bool IsTagSupported(const string& name)
 {
-    auto it = g_tagMap.find(name);
-    if (it == g_tagMap.end()) {
+    const TagCategory* tagCategory = g_tagRegistry.Find(name);
+    if (tagCategory == nullptr) {
         return false;
     }
 
-    TagCategory tagCategory = it->second;
-    if (tagCategory.type != KERNEL) {
-        g_userEnabledTags.push_back(tagCategory.tag);
+    if (tagCategory->type != KERNEL) {
+        g_userEnabledTags.push_back(tagCategory->tag);
         return true;
     }
 
-    for (int i = 0; i < MAX_SYS_FILES; i++) {
-        const string path = tagCategory.sysfiles[i].path;
-        if (path.size() == 0) {
-            continue;
-        }
-        if (IsWritableFile(path)) {
+    for (size_t i = 0; i < tagCategory->sysfileCount; i++) {
+        const string path(tagCategory->sysfiles[i]);
+        FileAccess access = g_capabilities->Probe(path);
+        if (access == FILE_WRITABLE) {
             g_kernelEnabledPaths.push_back(path);
-        } else if (IsFileExit(path)) {
+        } else if (access == FILE_READONLY) {
             fprintf(stderr, "Warning: category \"%s\" requires root "
                 "privileges.\n", name.c_str());
             return false;
@@ -171,23 +294,63 @@ static bool IsTagSupported(const string& name)
 
 static string ReadFile(const string& filename)
 {
-    ifstream fin((g_traceRootPath + filename).c_str());
-    if (!fin.is_open()) {
+    string str;
+    if (!g_traceFs.Read(filename, str)) {
         fprintf(stderr, "open file: %s failed!", (g_traceRootPath + filename).c_str());
         return "";
     }
-
-    string str((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
-    fin.close();
     return str;
 }
 
+// Writes only when the file does not hold the value yet, which spares the kernel a buffer resize
+// or a tracer switch between captures with the same settings.
+static bool UpdateStrToFile(const string& filename, const string& str)
+{
+    string current = ReadFile(filename);
+    if (!current.empty() && current.back() == '\n') {
+        current.pop_back();
+    }
+    return current == str || WriteStrToFile(filename, str);
+}
+
+// May run on its own thread, so only the const TraceFs calls, which share no state, are used.
+static bool ResizeBuffer(int bufferSize)
+{
+    string current;
+    if (g_traceFs.Read(BUFFER_SIZE_PATH, current) && current == to_string(bufferSize) + "\n") {
+        return true;
+    }
+    int fd = g_traceFs.OpenFile(BUFFER_SIZE_PATH, O_WRONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error: Did not open %s.\n", BUFFER_SIZE_PATH.c_str());
+        return false;
+    }
+    string value = to_string(bufferSize);
+    bool isTrue = WriteFully(fd, value.data(), value.size());
+    close(fd);
+    return isTrue;
+}
+
 static bool SetBufferSize(int bufferSize)
 {
-    if (!WriteStrToFile(CURRENT_TRACER_PATH, "nop")) {
+    if (!UpdateStrToFile(CURRENT_TRACER_PATH, "nop")) {
+        fprintf(stderr, "Error: write \"nop\" to %s.\n", CURRENT_TRACER_PATH.c_str());
+    }
+    return ResizeBuffer(bufferSize);
+}
+
+// Allocating a large buffer takes long; it overlaps with the rest of the setup until WaitBufferSize().
+static void SetBufferSizeAsync(int bufferSize)
+{
+    if (!UpdateStrToFile(CURRENT_TRACER_PATH, "nop")) {
         fprintf(stderr, "Error: write \"nop\" to %s.\n", CURRENT_TRACER_PATH.c_str());
     }
-    return WriteStrToFile(BUFFER_SIZE_PATH, to_string(bufferSize));
+    g_bufferResized = async(launch::async, ResizeBuffer, bufferSize);
+}
+
+static bool WaitBufferSize()
+{
+    return !g_bufferResized.valid() || g_bufferResized.get();
 }
 
 static bool SetClock(const string& timeclock)
@@ -224,29 +387,25 @@ static bool SetClock(const string& timeclock)
 
 static bool SetOverWriteEnable(bool enabled)
 {
-    return SetFtraceEnabled(OVER_WRITE_PATH, enabled);
+    return UpdateStrToFile(OVER_WRITE_PATH, enabled ? "1" : "0");
 }
 
 static bool SetTgidEnable(bool enabled)
 {
-    return SetFtraceEnabled(RECORD_TGID_PATH, enabled);
+    return UpdateStrToFile(RECORD_TGID_PATH, enabled ? "1" : "0");
 }
 
-static bool DisableAllFtraceEvents()
+static bool SetFtraceEvents(const vector<string>& enabledPaths)
 {
-    bool isTrue = true;
-    for (auto it = g_tagMap.begin(); it != g_tagMap.end(); ++it) {
-        TagCategory tag = it->second;
-        if (tag.type != KERNEL) {
-            continue;
-        }
-        for (int i = 0; i < MAX_SYS_FILES; i++) {
-            const string path = tag.sysfiles[i].path;
-            if (path.size() > 0 && IsWritableFile(path)) {
-                isTrue = isTrue && SetFtraceEnabled(path, false);
-            }
+    vector<string> managedPaths;
+    for (const TagCategory* tag : g_tagRegistry.GetAll()) {
+        for (size_t i = 0; i < tag->sysfileCount; i++) {
+            managedPaths.emplace_back(tag->sysfiles[i]);
         }
     }
+    EventSettings settings(g_traceFs);
+    bool isTrue = settings.Apply(managedPaths, enabledPaths);
+    g_eventStats = settings.GetStats();
     return isTrue;
 }
 
@@ -267,33 +426,224 @@ static bool RefreshServices()
     return RefreshHalServices();
 }
 
+// A list in parameters "<prefix>0".."<prefix>N-1" with N in numberProperty, as the library reads them.
+static bool SetPropertyList(const string& numberProperty, const string& prefix, const vector<string>& values)
+{
+    bool isTrue = true;
+    for (size_t i = 0; i < values.size(); i++) {
+        isTrue = isTrue && SetProperty(prefix + to_string(i), values[i]);
+    }
+    return isTrue && SetProperty(numberProperty, to_string(values.size()));
+}
+
+static bool ClearPropertyList(const string& numberProperty, const string& prefix)
+{
+    long number = strtol(GetPropertyInner(numberProperty, "0").c_str(), nullptr, 10);
+    if (number <= 0) {
+        return true;
+    }
+    bool isTrue = SetProperty(numberProperty, "0");
+    for (long i = 0; i < number; i++) {
+        isTrue = SetProperty(prefix + to_string(i), "") && isTrue;
+    }
+    return isTrue;
+}
+
+// Routes the markers of the isolated tags to their instances, see LoadMarkerRoutes() of the library.
+static bool SetMarkerRoutes()
+{
+    vector<string> routes;
+    for (const auto& isolated : g_isolated) {
+        routes.push_back(isolated.session->GetInstanceName() + ":" + to_string(isolated.tags));
+    }
+    return SetPropertyList(INSTANCE_NUMBER_PROPERTY, INSTANCE_PROPERTY_PREFIX, routes);
+}
+
 static bool SetUserSpaceSettings()
 {
     uint64_t enabledTags = 0;
     for (auto tag: g_userEnabledTags) {
         enabledTags |= tag;
     }
+    // The library keeps the app tag only in the processes named by these parameters, see IsAppValid().
+    if (!g_apps.empty() && !SetPropertyList(APP_NUMBER_PROPERTY, APP_PROPERTY_PREFIX, g_apps)) {
+        return false;
+    }
+    if (!g_isolated.empty() && !SetMarkerRoutes()) {
+        return false;
+    }
     return SetTraceTagsEnabled(enabledTags) && RefreshServices();
 }
 
 static bool ClearUserSpaceSettings()
 {
-    return SetTraceTagsEnabled(0) && RefreshServices();
+    bool isTrue = ClearPropertyList(APP_NUMBER_PROPERTY, APP_PROPERTY_PREFIX);
+    isTrue = ClearPropertyList(INSTANCE_NUMBER_PROPERTY, INSTANCE_PROPERTY_PREFIX) && isTrue;
+    return SetTraceTagsEnabled(0) && RefreshServices() && isTrue;
+}
+
+static bool TruncateFile(const string& path)
+{
+    int fd = g_traceFs.OpenFile(path, O_WRONLY | O_TRUNC);
+    if (fd == -1) {
+        fprintf(stderr, "Error: clear %s: %s (%d)\n", (g_traceRootPath + path).c_str(),
+            strerror(errno), errno);
+        return false;
+    }
+    close(fd);
+    fd = -1;
+    return true;
+}
+
+static bool ClearTrace()
+{
+    bool isTrue = TruncateFile(TRACE_PATH);
+    for (const auto& isolated : g_isolated) {
+        int fd = isolated.traceFs != nullptr ? isolated.traceFs->OpenFile(TRACE_PATH, O_WRONLY | O_TRUNC) : -1;
+        if (fd == -1) {
+            continue;
+        }
+        close(fd);
+    }
+    return isTrue;
+}
+
+static bool SetTracingOn(bool enabled)
+{
+    bool isTrue = true;
+    for (const auto& isolated : g_isolated) {
+        if (isolated.traceFs != nullptr) {
+            isTrue = isolated.traceFs->Write(TRACING_ON_PATH, enabled ? "1" : "0") && isTrue;
+        }
+    }
+    return SetFtraceEnabled(TRACING_ON_PATH, enabled) && isTrue;
+}
+
+static bool AllocSnapshot()
+{
+    // The first swap allocates a spare buffer as large as the live one; do it before tracing starts
+    // so that the first dump does not pay for the allocation.
+    return WriteStrToFile(SNAPSHOT_PATH, SNAPSHOT_SWAP) && WriteStrToFile(SNAPSHOT_PATH, SNAPSHOT_CLEAR);
+}
+
+static bool SetCpuMask(const vector<int>& cpus)
+{
+    if (cpus.empty()) {
+        return true;
+    }
+    string current = ReadFile(TRACING_CPUMASK_PATH);
+    if (!current.empty() && current.back() == '\n') {
+        current.pop_back();
+    }
+    string mask = FormatCpuMask(cpus);
+    if (current.empty() || !WriteStrToFile(TRACING_CPUMASK_PATH, mask)) {
+        return false;
+    }
+    g_savedCpuMask = current;
+    return true;
+}
+
+static bool RestoreCpuMask()
+{
+    if (g_savedCpuMask.empty()) {
+        return true;
+    }
+    bool isTrue = WriteStrToFile(TRACING_CPUMASK_PATH, g_savedCpuMask);
+    g_savedCpuMask.clear();
+    return isTrue;
+}
+
+static string GetCurrentClock()
+{
+    string allClocks = ReadFile(TRACE_CLOCK_PATH);
+    size_t begin = allClocks.find("[");
+    size_t end = allClocks.find("]");
+    return (begin != string::npos && end != string::npos && end > begin) ?
+        allClocks.substr(begin + 1, end - begin - 1) : "";
+}
+
+// Each instance gets the buffer size, clock and overwrite mode of the top-level buffer.
+static bool SetIsolatedInstances()
+{
+    if (g_isolated.empty()) {
+        return true;
+    }
+    CleanAbandonedSessions(g_traceRootPath, SESSION_LOCK_DIR, SESSION_IDLE_SEC);
+    string clock = GetCurrentClock();
+    for (auto& isolated : g_isolated) {
+        isolated.session = make_unique<TraceSession>(g_traceRootPath, isolated.name, SESSION_LOCK_DIR);
+        if (!isolated.session->Acquire()) {
+            return false;
+        }
+        auto traceFs = make_unique<TraceFs>();
+        if (!traceFs->Open(isolated.session->GetRootPath())) {
+            fprintf(stderr, "Error: opening %s: %s (%d)\n", isolated.session->GetRootPath().c_str(),
+                strerror(errno), errno);
+            return false;
+        }
+        isolated.traceFs = move(traceFs);
+        if (!isolated.traceFs->Write(TRACING_ON_PATH, "0") ||
+            !isolated.traceFs->Write(BUFFER_SIZE_PATH, to_string(g_bufferSizeKB)) ||
+            (!clock.empty() && !isolated.traceFs->Write(TRACE_CLOCK_PATH, clock)) ||
+            !isolated.traceFs->Write(OVER_WRITE_PATH, g_overwrite ? "1" : "0")) {
+            fprintf(stderr, "Error: setting up %s: %s (%d)\n", isolated.session->GetRootPath().c_str(),
+                strerror(errno), errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool RemoveIsolatedInstances()
+{
+    bool isTrue = true;
+    for (auto& isolated : g_isolated) {
+        isolated.traceFs.reset();
+        if (isolated.session != nullptr && !g_keepWarm) {
+            isTrue = isolated.session->Remove() && isTrue;
+        }
+        isolated.session.reset();
+    }
+    return isTrue;
 }
 
 static bool SetKernelSpaceSettings()
 {
-    bool isTrue = SetBufferSize(g_bufferSizeKB) && SetClock(g_clock) &&
-        SetOverWriteEnable(g_overwrite) && DisableAllFtraceEvents();
-    for (const auto& path : g_kernelEnabledPaths) {
-        SetFtraceEnabled(path, true);
+    SetBufferSizeAsync(g_bufferSizeKB);
+    return SetClock(g_clock) && SetOverWriteEnable(g_overwrite) && SetCpuMask(g_traceCpus) &&
+        g_filters.Apply(g_eventFilters, g_filterPids, g_followFork) && SetFtraceEvents(g_kernelEnabledPaths) &&
+        SetIsolatedInstances();
+}
+
+// Completes SetKernelSpaceSettings() once the buffer is allocated; tracing must not start before.
+static bool FinishKernelSpaceSettings()
+{
+    bool isTrue = WaitBufferSize();
+    if (isTrue && g_snapshot && g_traceStart) {
+        isTrue = AllocSnapshot();
     }
     return isTrue;
 }
 
 static bool ClearKernelSpaceSettings()
 {
-    return DisableAllFtraceEvents() && SetOverWriteEnable(true) && SetBufferSize(1) && SetClock("boot");
+    bool isTrue = WaitBufferSize();
+    isTrue = g_filters.Clear() && isTrue;
+    isTrue = RestoreCpuMask() && isTrue;
+    isTrue = RemoveIsolatedInstances() && isTrue;
+    if (g_keepWarm) {
+        // The buffers stay allocated for the next capture; only what they hold is dropped.
+        return SetFtraceEvents({}) && SetOverWriteEnable(true) && SetClock("boot") && ClearTrace() && isTrue;
+    }
+    if (g_session != nullptr) {
+        // Removing the instance frees its buffers and drops all of its settings at once.
+        g_traceFs.Close();
+        return g_session->Remove() && isTrue;
+    }
+    if (g_snapshot) {
+        WriteStrToFile(SNAPSHOT_PATH, SNAPSHOT_FREE);
+    }
+    return SetFtraceEvents({}) && SetOverWriteEnable(true) && SetBufferSize(1) && SetClock("boot") && isTrue;
 }
 
 static bool SetViewStyle()
@@ -304,13 +654,13 @@ static bool SetViewStyle()
 static void ShowListCategory()
 {
     printf("  %18s   description:\n", "tagName:");
-    for (auto it = g_tagMap.begin(); it != g_tagMap.end(); ++it) {
-        string key = it->first;
-        TagCategory tag = it->second;
-        if (IsTagSupported(key)) {
-            printf("  %18s - %s\n", tag.name.c_str(), tag.description.c_str());
+    for (const TagCategory* tag : g_tagRegistry.GetAll()) {
+        if (IsTagSupported(string(tag->name))) {
+            printf("  %18.*s - %.*s\n", static_cast<int>(tag->name.size()), tag->name.data(),
+                static_cast<int>(tag->description.size()), tag->description.data());
         }
     }
+    g_capabilities->Save();
 }
 
 static void ShowHelp(const string& cmd)
@@ -320,7 +670,8 @@ static void ShowHelp(const string& cmd)
            "  -b N               Sets the size of the buffer (KB) for storing and reading traces. The default \n"
            "                     buffer size is 2048 KB.\n"
            "  --buffer_size N    Like \"-b N\".\n"
-           "  -l                 Lists available bytrace categories.\n"
+           "  -l                 Lists available bytrace categories. What the kernel supports is probed once and\n"
+           "                     cached in /data/local/tmp/bytrace_capabilities until the kernel changes.\n"
            "  --list_categories  Like \"-l\".\n"
            "  -t N               Sets the bytrace running duration in seconds (5s by default), which depends on"
            "                     the time required for analysis.\n"
@@ -338,7 +689,86 @@ static void ShowHelp(const string& cmd)
            "  --output filename\n"
            "                     Like \"-o filename\".\n"
            "  -z                 Compresses a captured trace.\n"
+           "  -a process         Limits the \"app\" category to the named process (\"*\" for every debuggable one).\n"
+           "                     Can be repeated.\n"
+           "  --app process      Like \"-a process\".\n"
+           "  --app_filter       With \"-a\", also records only the kernel events of the threads of those processes,\n"
+           "                     and of the threads they start during the capture.\n"
+           "  --recorder         Keeps tracing in overwrite mode until SIGINT and dumps the last N seconds (-t N)\n"
+           "                     to \"<output>.<time>_<n>\" whenever a trigger fires. SIGUSR1 is always a trigger.\n"
+           "                     Dumps go through the snapshot buffer (see \"--snapshot\") whenever the kernel has\n"
+           "                     one, so tracing goes on during a dump; without it, or with \"--isolate\", tracing\n"
+           "                     stops while a dump is written and events of that time are lost.\n"
+           "  --trigger_file path\n"
+           "                     Recorder trigger: the modification time of the file changes.\n"
+           "  --trigger_marker str\n"
+           "                     Recorder trigger: a trace_marker write contains str.\n"
+           "  --trigger_socket path\n"
+           "                     Recorder trigger: \"dump\" is sent to the local socket path (\"stop\" ends recording).\n"
+           "  --dump_interval N  Ignores recorder triggers within N seconds (30 by default) of the previous dump.\n"
+           "  --max_dumps N      Stops recording after N dumps (no limit by default).\n"
+           "  --max_file_size N  Writes the capture to \"<output>.0\", \"<output>.1\", ... as it is recorded, and\n"
+           "                     starts the next file once one holds N MB of trace. Every file has its own header,\n"
+           "                     clock sync markers and cpu stats, and is compressed on its own with \"-z\".\n"
+           "  --max_file_time N  Like \"--max_file_size\", starting the next file every N seconds.\n"
+           "  --max_files N      Keeps only the newest N files of \"--max_file_size\", \"--max_file_time\" or\n"
+           "                     \"--recorder\" and deletes the older ones.\n"
+           "  --clock_sync N     Writes clock sync markers every N ms (1000 by default) while the capture runs, with\n"
+           "                     the boot, monotonic and realtime clocks in ns, so that long captures and the traces\n"
+           "                     of several devices can be aligned. 0 writes them only at the start and the end.\n"
+           "  --snapshot         Dumps traces from the snapshot buffer without stopping the capture. The live\n"
+           "                     buffer is swapped with a spare one of the same size, so twice the buffer memory\n"
+           "                     is used. With \"--trace_begin\" and \"--trace_dump\" the capture keeps running,\n"
+           "                     and each dump holds the traces recorded since the previous one.\n"
+           "  --keep_warm        Leaves the buffer allocated when the capture ends, so that the next capture with\n"
+           "                     the same buffer size starts without reallocating it. Only its content is cleared.\n"
+           "  --auto_buffer N    Samples the event rate of each CPU for 1s and sizes the buffer of every CPU to hold\n"
+           "                     the capture duration (-t), within a total of N KB for all CPUs.\n"
+           "  --filter sys/event:expr\n"
+           "                     Records only the events of sys/event (or of every event of sys with\n"
+           "                     \"sys:expr\") that match the ftrace filter expression, e.g.\n"
+           "                     \"sched/sched_wakeup:pid == 1234\". Can be repeated.\n"
+           "  --pid pid[,pid...] Records only the events of the given processes and their threads. Can be repeated.\n"
+           "  --cpumask cpus     Records only the events of the given CPUs, e.g. \"4-7\" or \"0,2,4-7\".\n"
+           "  --cgroup path      Records only the events of the processes in the cgroup directory path, and of\n"
+           "                     their children. Can be repeated.\n"
+           "  --isolate tag[,tag...]\n"
+           "                     Records the user space categories tag in an ftrace instance of their own, so that\n"
+           "                     they do not evict the events of other categories. The instance has the same buffer\n"
+           "                     size and is merged into the dump by timestamp. Can be repeated, up to 4 times.\n"
+           "  --session name     Captures in the ftrace instance of session name, with a buffer, clock and events of\n"
+           "                     its own, so that it runs alongside other captures. Only kernel categories are\n"
+           "                     supported. With \"--keep_warm\" the instance is kept for the next capture.\n"
+           "  --follow_fork      With \"--pid\", also records the children the pids fork during the capture.\n"
+           "  --stream_to dest   Streams the capture as it is recorded to a collector at dest, \"tcp:host:port\" or\n"
+           "                     \"unix:path\", such as script/bytrace_collector.py, instead of writing it on the\n"
+           "                     device. With \"-z\" every chunk is compressed. The stream resumes when the\n"
+           "                     collector reconnects within 30s.\n"
+           "  --block_size N     Compresses a captured trace into independently compressed blocks of N MB\n"
+           "                     with a time index, so that a time window can be extracted later.\n"
+           "  --decode_raw       Dumps the trace from the binary buffers of the CPUs (trace_pipe_raw), decoded with\n"
+           "                     the event formats of the kernel, instead of reading the text the kernel renders.\n"
+           "                     The dump is faster, but it consumes the buffers as it reads them.\n"
     );
+    printf("\nusage: %s extract --window begin,end [-o filename] file\n", cmd.c_str());
+    printf("  Extracts the lines within [begin, end] seconds from a trace written with --block_size.\n");
+    printf("\nusage: %s merge [-o filename] file...\n", cmd.c_str());
+    printf("  Merges the traces of several devices into one timeline by their clock sync markers, like\n"
+           "  script/bytrace_multi.py, to filename (multi_trace_<time>.ftrace by default).\n");
+    printf("\nusage: %s convert [--format json|perfetto] [-o filename] file\n", cmd.c_str());
+    printf("  Converts a text trace to Chrome Trace Event JSON (by default) or to Perfetto protobuf, for the web\n"
+           "  viewers: the B, E, S, F and C markers become slices, async slices and counters, and the sched\n"
+           "  events thread states. The trace is streamed, so any size can be converted.\n");
+    printf("\nusage: %s service [--stop]\n", cmd.c_str());
+    printf("  Runs the bytrace service, which keeps the tracefs, the categories and the buffer ready between\n"
+           "  captures. While it runs, every bytrace command except \"--session\" and \"--recorder\" is run by\n"
+           "  the service, and a capture started with \"--trace_begin\" returns at once and runs until\n"
+           "  \"--trace_finish\". \"--stop\" ends the service and frees the buffer.\n");
+    printf("\nusage: %s status\n", cmd.c_str());
+    printf("  Shows the state of the service and of the capture.\n");
+    printf("\nusage: %s stream\n", cmd.c_str());
+    printf("  Writes the events of the running capture to stdout as they are recorded, until interrupted.\n"
+           "  Streamed events are consumed and are missing from a later dump.\n");
 }
 
 template <typename T>
@@ -348,6 +778,51 @@ inline bool StrToNum(const std::string& sString, T &tX)
     return (iStream >> tX) ? true : false;
 }
 
+static bool AddApp(const char* name)
+{
+    size_t len = strnlen(name, MAX_APP_NAME_LEN);
+    if (len == 0 || len == MAX_APP_NAME_LEN) {
+        printf("Error: the process name is illegal input. eg: \"-a com.example.myapplication.\"\n");
+        return false;
+    }
+    if (g_apps.size() == MAX_APP_NUMBER) {
+        printf("Error: at most %zu processes can be given with \"-a\".\n", MAX_APP_NUMBER);
+        return false;
+    }
+    g_apps.push_back(name);
+    return true;
+}
+
+static bool AddIsolatedTags(const string& arg)
+{
+    IsolatedTags isolated;
+    istringstream in(arg);
+    string name;
+    while (getline(in, name, ',')) {
+        const TagCategory* tag = g_tagRegistry.Find(name);
+        if (tag == nullptr || tag->type != USER) {
+            printf("Error: \"%s\" is not a user space category. eg: \"--isolate graphic,ace.\"\n", name.c_str());
+            return false;
+        }
+        isolated.tags |= tag->tag;
+        if (isolated.name.empty()) {
+            isolated.name = ISOLATED_SESSION_PREFIX + name;
+        }
+        // An isolated category is captured as well.
+        g_userEnabledTags.push_back(tag->tag);
+    }
+    if (isolated.tags == 0 || !TraceSession::IsValidName(isolated.name)) {
+        printf("Error: the isolated categories are illegal input. eg: \"--isolate graphic,ace.\"\n");
+        return false;
+    }
+    if (g_isolated.size() == MAX_ISOLATED_NUMBER) {
+        printf("Error: at most %zu \"--isolate\" can be given.\n", MAX_ISOLATED_NUMBER);
+        return false;
+    }
+    g_isolated.push_back(move(isolated));
+    return true;
+}
+
 static void ParseLongOpt(const string& cmd,
                          int optionIndex,
                          bool& isTrue)
@@ -387,7 +862,7 @@ static void ParseLongOpt(const string& cmd,
         struct stat buf;
         size_t len = strnlen(optarg, MAX_OUTPUT_LEN);
         if (len == MAX_OUTPUT_LEN || len < 1 ||
-            (stat(optarg, &buf) == 0 && (buf.st_mode & S_IFDIR) != 0)) {
+            (!g_serviceMode && stat(optarg, &buf) == 0 && (buf.st_mode & S_IFDIR) != 0)) {
             printf("Error: output file is illegal.\n");
             isTrue &= false;
         } else {
@@ -395,6 +870,123 @@ static void ParseLongOpt(const string& cmd,
         }
     } else if (!strcmp(g_longOptions[optionIndex].name, "overwrite")) {
         g_overwrite = false;
+    } else if (!strcmp(g_longOptions[optionIndex].name, "recorder")) {
+        g_recorder = true;
+    } else if (!strcmp(g_longOptions[optionIndex].name, "trigger_file")) {
+        g_recorderConfig.triggerFile = optarg;
+    } else if (!strcmp(g_longOptions[optionIndex].name, "trigger_marker")) {
+        size_t len = strnlen(optarg, MAX_MARKER_LEN);
+        if (len == 0 || len == MAX_MARKER_LEN || strpbrk(optarg, "\"*") != nullptr) {
+            printf("Error: the trigger marker is illegal input. eg: \"--trigger_marker jank_detected.\"\n");
+            isTrue &= false;
+        } else {
+            g_recorderConfig.triggerMarker = optarg;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "trigger_socket")) {
+        g_recorderConfig.triggerSocket = optarg;
+    } else if (!strcmp(g_longOptions[optionIndex].name, "dump_interval")) {
+        if (!StrToNum(optarg, g_recorderConfig.minInterval) || g_recorderConfig.minInterval < MIN_DUMP_INTERVAL) {
+            printf("Error: the dump interval is illegal input. eg: \"--dump_interval 30.\"\n");
+            isTrue &= false;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "max_dumps")) {
+        if (!StrToNum(optarg, g_recorderConfig.maxDumps) || g_recorderConfig.maxDumps < 0) {
+            printf("Error: the max dumps is illegal input. eg: \"--max_dumps 10.\"\n");
+            isTrue &= false;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "snapshot")) {
+        g_snapshot = true;
+    } else if (!strcmp(g_longOptions[optionIndex].name, "keep_warm")) {
+        g_keepWarm = true;
+    } else if (!strcmp(g_longOptions[optionIndex].name, "auto_buffer")) {
+        if (!StrToNum(optarg, g_autoBufferKB) || g_autoBufferKB < MIN_BUFFER_SIZE) {
+            printf("Error: the auto buffer budget should be at least 256 KB. eg: \"--auto_buffer 65536.\"\n");
+            isTrue &= false;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "filter")) {
+        EventFilter filter;
+        if (!ParseEventFilter(optarg, filter)) {
+            printf("Error: the filter is illegal input. eg: \"--filter 'sched/sched_switch:prev_pid == 1234'.\"\n");
+            isTrue &= false;
+        } else {
+            g_eventFilters.push_back(filter);
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "pid")) {
+        if (!ParsePidList(optarg, g_filterPids)) {
+            printf("Error: the pid is illegal input. eg: \"--pid 1234,5678.\"\n");
+            isTrue &= false;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "follow_fork")) {
+        g_followFork = true;
+    } else if (!strcmp(g_longOptions[optionIndex].name, "app")) {
+        isTrue &= AddApp(optarg);
+    } else if (!strcmp(g_longOptions[optionIndex].name, "app_filter")) {
+        g_appFilter = true;
+    } else if (!strcmp(g_longOptions[optionIndex].name, "isolate")) {
+        isTrue &= AddIsolatedTags(optarg);
+    } else if (!strcmp(g_longOptions[optionIndex].name, "session")) {
+        if (!TraceSession::IsValidName(optarg)) {
+            printf("Error: the session name is illegal input, use up to 32 letters, digits, '_' and '-'. "
+                "eg: \"--session ci.\"\n");
+            isTrue &= false;
+        } else {
+            g_sessionName = optarg;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "stream_to")) {
+        if (!ParseStreamTarget(optarg, g_streamTarget)) {
+            printf("Error: the stream target is illegal input. eg: \"--stream_to tcp:127.0.0.1:9999.\"\n");
+            isTrue &= false;
+        } else {
+            g_stream = true;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "max_file_size")) {
+        int maxFileMB = 0;
+        if (!StrToNum(optarg, maxFileMB) || maxFileMB < 1) {
+            printf("Error: the max file size should be at least 1 MB. eg: \"--max_file_size 16.\"\n");
+            isTrue &= false;
+        } else {
+            g_rotation.maxFileBytes = static_cast<uint64_t>(maxFileMB) * BYTES_PER_MB;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "max_file_time")) {
+        if (!StrToNum(optarg, g_rotation.maxFileSec) || g_rotation.maxFileSec < 1) {
+            printf("Error: the max file time is illegal input. eg: \"--max_file_time 60.\"\n");
+            isTrue &= false;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "max_files")) {
+        if (!StrToNum(optarg, g_rotation.maxFiles) || g_rotation.maxFiles < 1) {
+            printf("Error: the max files is illegal input. eg: \"--max_files 8.\"\n");
+            isTrue &= false;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "clock_sync")) {
+        if (!StrToNum(optarg, g_clockSyncMs) || (g_clockSyncMs != 0 && g_clockSyncMs < MIN_CLOCK_SYNC_MS)) {
+            printf("Error: the clock sync interval should be 0 or at least 10 ms. eg: \"--clock_sync 1000.\"\n");
+            isTrue &= false;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "decode_raw")) {
+        g_decodeRaw = true;
+    } else if (!strcmp(g_longOptions[optionIndex].name, "cpumask")) {
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        if (!ParseCpuList(optarg, static_cast<int>(cpus > 0 ? cpus : 1), g_traceCpus)) {
+            printf("Error: the cpumask is illegal input. eg: \"--cpumask 4-7.\"\n");
+            isTrue &= false;
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "cgroup")) {
+        struct stat buf;
+        if (stat(optarg, &buf) != 0 || (buf.st_mode & S_IFDIR) == 0) {
+            printf("Error: the cgroup is illegal input. eg: \"--cgroup /dev/cpuctl/top-app.\"\n");
+            isTrue &= false;
+        } else {
+            g_cgroups.push_back(optarg);
+        }
+    } else if (!strcmp(g_longOptions[optionIndex].name, "block_size")) {
+        int blockSizeMB = 0;
+        if (!StrToNum(optarg, blockSizeMB) || blockSizeMB < MIN_BLOCK_SIZE_MB || blockSizeMB > MAX_BLOCK_SIZE_MB) {
+            printf("Error: the block size should be within 1 MB to 64 MB. eg: \"--block_size 4.\"\n");
+            isTrue &= false;
+        } else {
+            g_compress = true;
+            g_blockSize = static_cast<size_t>(blockSizeMB) * BYTES_PER_MB;
+        }
     } else if (!strcmp(g_longOptions[optionIndex].name, "trace_begin")) {
         g_traceStart = true;
         g_traceStop = false;
@@ -447,7 +1039,7 @@ static bool ParseOpt(int opt, char** argv, int optIndex)
             struct stat buf;
             size_t len = strnlen(optarg, MAX_OUTPUT_LEN);
             if (len == MAX_OUTPUT_LEN || len < 1 ||
-                (stat(optarg, &buf) == 0 && (buf.st_mode & S_IFDIR) != 0)) {
+                (!g_serviceMode && stat(optarg, &buf) == 0 && (buf.st_mode & S_IFDIR) != 0)) {
                 printf("Error: output file is illegal.\n");
                 isTrue &= false;
             } else {
@@ -458,6 +1050,9 @@ static bool ParseOpt(int opt, char** argv, int optIndex)
         case 'z':
             g_compress = true;
             break;
+        case 'a':
+            isTrue &= AddApp(optarg);
+            break;
         case 0: // long options
             ParseLongOpt(argv[0], optIndex, isTrue);
             break;
@@ -469,27 +1064,34 @@ static bool ParseOpt(int opt, char** argv, int optIndex)
     return isTrue;
 }
 
-static void IsInvalidOpt(int argc, char** argv)
+static bool IsInvalidOpt(int argc, char** argv)
 {
     for (int i = optind; i < argc; i++) {
         if (!IsTagSupported(argv[i])) {
+            g_capabilities->Save();
             fprintf(stderr, "Error: \"%s\" is not support category on this device.\n", argv[i]);
-            exit(0);
+            return true;
         }
     }
+    g_capabilities->Save();
+    return false;
 }
 
-static bool HandleOpt(int argc, char** argv)
+// On failure, status is the exit code: an unsupported category is not a usage error.
+static bool HandleOpt(int argc, char** argv, int& status)
 {
     bool isTrue = true;
     int opt = 0;
     int optionIndex = 0;
-    string shortOption = "b:c:hlo:t:z";
     int argcSize = argc;
+    status = -1;
     while (isTrue && argcSize-- > 0) {
-        opt = getopt_long(argc, argv, shortOption.c_str(), g_longOptions, &optionIndex);
+        opt = getopt_long(argc, argv, SHORT_OPTIONS.c_str(), g_longOptions, &optionIndex);
         if (opt < 0) {
-            IsInvalidOpt(argc, argv);
+            if (IsInvalidOpt(argc, argv)) {
+                status = 0;
+                isTrue = false;
+            }
             break;
         }
         isTrue &= ParseOpt(opt, argv, optionIndex);
@@ -497,305 +1099,754 @@ static bool HandleOpt(int argc, char** argv)
     return isTrue;
 }
 
-static bool TruncateFile(const string& path)
+// The service parses the options of every request into the same globals.
+static void ResetOptions()
 {
-    int fd = creat((g_traceRootPath + path).c_str(), 0);
-    if (fd == -1) {
-        fprintf(stderr, "Error: clear %s: %s (%d)\n", (g_traceRootPath + path).c_str(),
-            strerror(errno), errno);
-        return false;
+    optind = 0; // getopt starts over
+    g_traceDuration = 5;
+    g_bufferSizeKB = 2048;
+    g_clock = "boot";
+    g_overwrite = true;
+    g_outputFile.clear();
+    g_compress = false;
+    g_blockSize = 0;
+    g_snapshot = false;
+    g_keepWarm = g_serviceMode;
+    g_autoBufferKB = 0;
+    g_traceStart = true;
+    g_traceStop = true;
+    g_traceDump = true;
+    g_recorder = false;
+    g_recorderConfig = RecorderConfig();
+    g_eventFilters.clear();
+    g_filterPids.clear();
+    g_followFork = false;
+    g_apps.clear();
+    g_appFilter = false;
+    g_traceCpus.clear();
+    g_cgroups.clear();
+    g_sessionName.clear();
+    g_stream = false;
+    g_rotation = RotationConfig();
+    g_clockSyncMs = 1000; // 1000: the default interval
+    g_decodeRaw = false;
+    if (!g_captureRunning) {
+        // A running capture is finished with what it was started with.
+        g_userEnabledTags.clear();
+        g_kernelEnabledPaths.clear();
+        g_isolated.clear();
     }
-    close(fd);
-    fd = -1;
-    return true;
 }
 
-static bool ClearTrace()
+static vector<CpuTraceStats> ReadAllCpuStats()
 {
-    return TruncateFile(TRACE_PATH);
+    vector<CpuTraceStats> stats(GetTraceCpuCount(g_traceFs));
+    for (size_t i = 0; i < stats.size(); i++) {
+        ReadCpuStats(g_traceFs, static_cast<int>(i), stats[i]);
+    }
+    return stats;
 }
 
-static bool StartTrace()
+// Counters since the capture began, summarized on stderr and returned as the metadata section of the dump.
+static string CollectCpuStats()
 {
-    if (!SetFtraceEnabled(TRACING_ON_PATH, true)) {
-        return false;
+    vector<CpuTraceStats> endStats = ReadAllCpuStats();
+    if (endStats.empty()) {
+        return "";
     }
-    ClearTrace();
-    printf("capturing trace...\n");
-    fflush(stdout);
-    struct timespec ts = {0, 0};
-    ts.tv_sec = g_traceDuration;
-    ts.tv_nsec = 0;
-    while ((nanosleep(&ts, &ts) == -1) && (errno == EINTR)) {}
-    return true;
+    fprintf(stderr, "%s\n", SummarizeCpuStats(g_startStats, endStats).c_str());
+    return FormatCpuStats(g_startStats, endStats);
 }
 
-static bool StopTrace()
+// Markers that align the trace clock with the other clocks, for tools and for merging traces of several devices.
+static bool MarkOthersClockSync()
 {
-    return SetFtraceEnabled(TRACING_ON_PATH, false);
+    if (g_clockSync == nullptr) {
+        int fd = g_traceFs.OpenFile(TRACE_MARKER_PATH, O_WRONLY);
+        if (fd == -1) {
+            // The capture is still usable without the markers.
+            fprintf(stderr, "Error: opening %s: %s (%d)\n", TRACE_MARKER_PATH.c_str(), strerror(errno), errno);
+            return true;
+        }
+        g_clockSync = make_unique<ClockSyncWriter>(fd);
+    }
+    return g_clockSync->Mark();
 }
 
-static void DumpCompressedTrace(int traceFd, int outFd)
+// Periodic markers while bytrace runs the capture itself, so that a long one does not drift.
+static void StartClockSync()
 {
-    z_stream zs { 0 };
-    ssize_t bytesWritten;
-    ssize_t bytesRead;
-    if (memset_s(&zs, sizeof(zs), 0, sizeof(zs)) != 0) {
-        fprintf(stderr, "Error: zip stream buffer init failed.");
-        return;
-    }
-    int ret = deflateInit(&zs, Z_DEFAULT_COMPRESSION);
-    if (ret != Z_OK) {
-        fprintf(stderr, "Error: initializing zlib: %d\n", ret);
-        return;
-    }
-    int have;
-    std::unique_ptr<uint8_t[]>  in = std::make_unique<uint8_t[]>(CHUNK_SIZE);
-    std::unique_ptr<uint8_t[]>  out = std::make_unique<uint8_t[]>(CHUNK_SIZE);
-    int flush = Z_NO_FLUSH;
-    if (!in || !out) {
-        fprintf(stderr, "Error: couldn't allocate buffers.\n");
-        return;
+    if (g_clockSyncMs > 0 && g_clockSync != nullptr) {
+        g_clockSync->Start(g_clockSyncMs);
     }
-    do {
-        bytesRead = TEMP_FAILURE_RETRY(read(traceFd, in.get(), CHUNK_SIZE));
-        if (bytesRead == 0) {
-            flush = Z_FINISH;
-        } else if (bytesRead == -1) {
-            fprintf(stderr, "Error: reading trace: %s (%d)\n", strerror(errno), errno);
-            break;
-        }
-        zs.next_in = reinterpret_cast<Bytef*>(in.get());
-        zs.avail_in = bytesRead;
-        do {
-            zs.next_out = reinterpret_cast<Bytef*>(out.get());
-            zs.avail_out = CHUNK_SIZE;
-            ret = deflate(&zs, flush);
-            if (ret != Z_OK) {
-                fprintf(stderr, "Error: deflate zlib: %d\n", ret);
-                break;
-            }
-            have = CHUNK_SIZE - zs.avail_out;
-            bytesWritten = TEMP_FAILURE_RETRY(write(outFd, out.get(), have));
-            if (bytesWritten < 0 || (static_cast<size_t>(bytesWritten) < static_cast<size_t>(have)) ||
-                bytesWritten == -1) {
-                fprintf(stderr, "Error: writing deflated trace: %s (%d)\n", strerror(errno), errno);
-                break;
-            }
-        } while (zs.avail_out == 0);
-    } while (flush != Z_FINISH);
-    deflateEnd(&zs);
 }
 
-static void DumpTrace(int outFd, const string& path)
+// Where the capture goes as it is recorded: the collector of --stream_to or the files of --max_file_size.
+static TraceSink* GetCaptureSink()
 {
-    int traceFd = open((g_traceRootPath + path).c_str(), O_RDWR);
-    if (traceFd == -1) {
-        fprintf(stderr, "error opening %s: %s (%d)\n", path.c_str(),
-                strerror(errno), errno);
-        return;
+    if (g_streamer != nullptr) {
+        return g_streamer.get();
     }
-    ssize_t bytesWritten;
-    ssize_t bytesRead;
-    if (g_compress) {
-        DumpCompressedTrace(traceFd, outFd);
-    } else {
-        char buffer[BLOCK_SIZE];
-        do {
-            bytesRead = TEMP_FAILURE_RETRY(read(traceFd, buffer, BLOCK_SIZE));
-            if ((bytesRead == 0) || (bytesRead == -1)) {
-                break;
-            }
-            bytesWritten = TEMP_FAILURE_RETRY(write(outFd, buffer, bytesRead));
-        } while (bytesWritten > 0);
+    return g_rotator.get();
+}
+
+static bool StreamCapture(int durationMs)
+{
+    if (g_streamPipeFd == -1) {
+        g_streamPipeFd = g_traceFs.OpenFile(TRACE_PIPE_PATH, O_RDONLY | O_NONBLOCK);
+        if (g_streamPipeFd == -1) {
+            fprintf(stderr, "Error: opening %s: %s (%d)\n", TRACE_PIPE_PATH.c_str(), strerror(errno), errno);
+            return false;
+        }
     }
-    close(traceFd);
+    return StreamTracePipe(g_streamPipeFd, *GetCaptureSink(), durationMs);
 }
 
-static bool MarkOthersClockSync()
+static void CloseStream()
 {
-    constexpr unsigned int bufferSize = 128; // buffer size
-    char buffer[bufferSize] = { 0 };
-    int fd = open((g_traceRootPath + TRACE_MARKER_PATH).c_str(), O_WRONLY);
-    if (fd == -1) {
-        fprintf(stderr, "Error: opening %s: %s (%d)\n", TRACE_MARKER_PATH.c_str(), strerror(errno), errno);
-        return false;
+    if (g_streamPipeFd != -1) {
+        close(g_streamPipeFd);
+        g_streamPipeFd = -1;
     }
+    g_streamer.reset();
+    g_rotator.reset();
+}
 
-    struct timespec mts = {0, 0};
-    struct timespec rts = {0, 0};
-    if (clock_gettime(CLOCK_REALTIME, &rts) == -1) {
-        fprintf(stderr, "Error: get realtime %s (%d)\n", strerror(errno), errno);
-        close(fd);
-        return false;
-    } else if (clock_gettime(CLOCK_MONOTONIC, &mts) == -1) {
-        fprintf(stderr, "Error: get parent_ts %s (%d)\n", strerror(errno), errno);
-        close(fd);
+// Sends what is left once tracing is off, then the cpu stats, which are only known at the end.
+static bool FinishStream()
+{
+    bool isTrue = StreamCapture(0);
+    if (g_rotator != nullptr) {
+        // The last file gets its cpu stats from the footer.
+        isTrue = isTrue && g_rotator->Close();
+        if (isTrue) {
+            fprintf(stderr, "rotation: %" PRIu64 " bytes in %d files\n", g_rotator->GetRawBytes(),
+                g_rotator->GetFileCount());
+        }
+        CloseStream();
+        return isTrue;
+    }
+    string metadata = CollectCpuStats();
+    isTrue = isTrue && g_streamer->Write(metadata.data(), metadata.size()) && g_streamer->Close();
+    if (isTrue) {
+        fprintf(stderr, "stream: %" PRIu64 " bytes -> %" PRIu64 " bytes sent\n", g_streamer->GetRawBytes(),
+            g_streamer->GetSentBytes());
+    }
+    CloseStream();
+    return isTrue;
+}
+
+static bool StartTrace()
+{
+    if (!SetTracingOn(true)) {
         return false;
     }
-    constexpr unsigned int nanoSeconds = 1000000000; // seconds converted to nanoseconds
-    constexpr unsigned int nanoToMill = 1000000; // millisecond converted to nanoseconds
-    constexpr float nanoToSecond = 1000000000.0f; // consistent with the ftrace timestamp format
-    int len = snprintf_s(buffer, sizeof(buffer), sizeof(buffer) - 1,
-        "trace_event_clock_sync: realtime_ts=%" PRId64 "\n",
-        static_cast<int64_t>((rts.tv_sec * nanoSeconds + rts.tv_nsec) / nanoToMill));
-    if (len < 0) {
-        fprintf(stderr, "Error: entering data into buffer %s (%d)\n", strerror(errno), errno);
-        close(fd);
+    ClearTrace();
+    g_startStats = ReadAllCpuStats();
+    printf("capturing trace...\n");
+    fflush(stdout);
+    // The capture starts with a sync, a rotated file with the one of its header.
+    if (g_rotator != nullptr ? !g_rotator->Open() : !MarkOthersClockSync()) {
         return false;
     }
-    if (write(fd, buffer, len) < 0) {
-        fprintf(stderr, "Error: writing clock sync marker %s (%d)\n", strerror(errno), errno);
+    if (g_traceStop || g_serviceMode) {
+        StartClockSync();
     }
-    len = snprintf_s(buffer, sizeof(buffer), sizeof(buffer) - 1, "trace_event_clock_sync: parent_ts=%f\n",
-        static_cast<float>(((static_cast<float>(mts.tv_sec)) * nanoSeconds + mts.tv_nsec) / nanoToSecond));
-    if (len < 0) {
-        fprintf(stderr, "Error: entering data into buffer %s (%d)\n", strerror(errno), errno);
-        close(fd);
+    if (GetCaptureSink() != nullptr) {
+        return StreamCapture(g_traceDuration * MS_PER_SECOND);
+    }
+    if (g_serviceMode && !g_traceStop) {
+        // The service keeps the capture running until "--trace_finish".
+        return true;
+    }
+    struct timespec ts = {0, 0};
+    ts.tv_sec = g_traceDuration;
+    ts.tv_nsec = 0;
+    while ((nanosleep(&ts, &ts) == -1) && (errno == EINTR)) {}
+    return true;
+}
+
+static bool StopTrace()
+{
+    if (g_clockSync != nullptr) {
+        g_clockSync->Stop();
+    }
+    return SetTracingOn(false);
+}
+
+static void ShowSetupStats(double kernelMs, double userMs, double bufferMs)
+{
+    fprintf(stderr, "setup: kernel %.1f ms (%zu events on, %zu events off, %zu %s), user %.1f ms, "
+        "buffer wait %.1f ms\n", kernelMs, g_eventStats.enabled, g_eventStats.disabled, g_eventStats.commands,
+        g_eventStats.bulk ? "set_event commands" : "enable file writes", userMs, bufferMs);
+}
+
+static void ShowDumpStats(const DumpStageStats& stats)
+{
+    fprintf(stderr, "dump: %" PRIu64 " bytes -> %" PRIu64 " bytes, read %.1f ms, compress %.1f ms, "
+        "write %.1f ms, total %.1f ms\n", stats.rawBytes, stats.outBytes, stats.readMs, stats.compressMs,
+        stats.writeMs, stats.totalMs);
+}
+
+static void DumpTraceFd(int traceFd, int outFd, const string& path, const string& metadata, uint64_t cutoffUs)
+{
+    // Lines older than cutoffUs are skipped; what was read past them is dumped ahead of the rest.
+    string carry;
+    if (cutoffUs > 0 && !SkipTraceBefore(traceFd, cutoffUs, carry)) {
+        return;
+    }
+    string preamble = metadata + carry;
+    if (g_compress) {
+        DumpStageStats stats;
+        bool isTrue = false;
+        if (g_blockSize > 0) {
+            isTrue = DumpBlockCompressedTrace(traceFd, outFd, g_blockSize, "TRACE:\n" + preamble, &stats);
+        } else {
+            unique_ptr<DumpCompressor> compressor = CreateZlibCompressor();
+            isTrue = DumpPipelined(traceFd, outFd, *compressor, preamble, &stats);
+        }
+        if (isTrue) {
+            ShowDumpStats(stats);
+        } else {
+            fprintf(stderr, "Error: dumping %s failed.\n", path.c_str());
+        }
+    } else {
+        // The text is larger than the binary events it is rendered from, so preallocating what the ring
+        // buffers hold never reserves space the dump does not use, however large the buffers are.
+        uint64_t sizeHint = 0;
+        if (path == TRACE_PATH) {
+            for (const auto& stats : ReadAllCpuStats()) {
+                sizeHint += stats.bytes;
+            }
+        }
+        if (!WriteFully(outFd, preamble.data(), preamble.size()) ||
+            !DumpRawTrace(traceFd, outFd, static_cast<size_t>(sizeHint))) {
+            fprintf(stderr, "Error: dumping %s failed.\n", path.c_str());
+        }
+    }
+}
+
+// The event directories of the decoder: the enabled events as set_event lists them ("sys:event"), or
+// the enable files of the kernel categories when set_event cannot be read.
+static vector<string> GetEnabledEventDirs()
+{
+    vector<string> dirs;
+    string events;
+    if (g_traceFs.Read(SET_EVENT_PATH, events)) {
+        istringstream lines(events);
+        string line;
+        while (getline(lines, line)) {
+            size_t colon = line.find(':');
+            if (colon != string::npos) {
+                dirs.push_back("events/" + line.substr(0, colon) + "/" + line.substr(colon + 1));
+            }
+        }
+        return dirs;
+    }
+    const string enableName = "/enable";
+    for (const string& path : g_kernelEnabledPaths) {
+        if (path.size() > enableName.size() &&
+            path.compare(path.size() - enableName.size(), enableName.size(), enableName) == 0) {
+            dirs.push_back(path.substr(0, path.size() - enableName.size()));
+        }
+    }
+    return dirs;
+}
+
+static RawTextOptions GetRawTextOptions()
+{
+    RawTextOptions options;
+    string value;
+    options.recordTgid = g_traceFs.Read(RECORD_TGID_PATH, value) && value.compare(0, 1, "1") == 0;
+    options.irqInfo = !g_traceFs.Read(IRQ_INFO_PATH, value) || value.compare(0, 1, "1") == 0;
+    // The selected clock is in brackets, e.g. "local global [boot] counter".
+    if (g_traceFs.Read(TRACE_CLOCK_PATH, value)) {
+        size_t begin = value.find('[');
+        size_t end = value.find(']', begin);
+        string clock = begin != string::npos && end != string::npos ? value.substr(begin + 1, end - begin - 1) : "";
+        options.timeInNs = clock != "counter" && clock != "uptime" && clock != "x86-tsc";
+    }
+    return options;
+}
+
+// The trace decoded from the binary buffers of the CPUs, per_cpu/cpuN/trace_pipe_raw or, for the snapshot,
+// snapshot_raw, read from the returned pipe while the decoder thread fills it. See --decode_raw.
+static int OpenDecodedTrace(const string& path, thread& decoder)
+{
+    auto rawDecoder = make_shared<RawEventDecoder>();
+    if (!rawDecoder->LoadFormats(g_traceFs.GetRootPath(), GetEnabledEventDirs())) {
+        return -1;
+    }
+    rawDecoder->LoadTaskNames(g_traceFs.GetRootPath());
+    rawDecoder->SetTextOptions(GetRawTextOptions());
+
+    const string& rawName = path == SNAPSHOT_PATH ? SNAPSHOT_RAW_NAME : TRACE_PIPE_RAW_NAME;
+    vector<int> cpuFds(max(GetTraceCpuCount(g_traceFs), 1), -1);
+    for (size_t i = 0; i < cpuFds.size(); i++) {
+        // Without O_NONBLOCK, a read of an empty trace_pipe_raw waits for the next page.
+        cpuFds[i] = g_traceFs.OpenFile(PER_CPU_PATH + to_string(i) + rawName, O_RDONLY | O_NONBLOCK);
+    }
+    int pipeFds[2] = { -1, -1 };
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        fprintf(stderr, "Error: creating pipe: %s (%d)\n", strerror(errno), errno);
+        for (int fd : cpuFds) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+        return -1;
+    }
+    decoder = thread([rawDecoder, cpuFds, outFd = pipeFds[1]]() {
+        string header = rawDecoder->FormatHeader();
+        RawDecodeStats stats;
+        auto sink = [outFd](const char* data, size_t len) {
+            return WriteFully(outFd, data, len);
+        };
+        if (sink(header.data(), header.size()) && DecodeRawBuffers(*rawDecoder, cpuFds, sink, &stats)) {
+            fprintf(stderr, "decode: %" PRIu64 " pages, %" PRIu64 " events, %" PRIu64 " lost events, %" PRIu64
+                " bad pages\n", stats.pages, stats.events, stats.lostEvents, stats.badPages);
+        }
+        close(outFd);
+        for (int fd : cpuFds) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+    });
+    return pipeFds[0];
+}
+
+// The top-level trace merged with those of the isolated instances, read from the returned pipe while
+// the merger thread fills it. traceFd is taken over.
+static int OpenMergedTrace(int traceFd, thread& merger)
+{
+    vector<int> traceFds = { traceFd };
+    for (const auto& isolated : g_isolated) {
+        int fd = isolated.traceFs != nullptr ? isolated.traceFs->OpenFile(TRACE_PATH, O_RDONLY) : -1;
+        if (fd != -1) {
+            traceFds.push_back(fd);
+        }
+    }
+    int pipeFds[2] = { -1, -1 };
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        fprintf(stderr, "Error: creating pipe: %s (%d)\n", strerror(errno), errno);
+        for (int fd : traceFds) {
+            close(fd);
+        }
+        return -1;
+    }
+    merger = thread([traceFds, outFd = pipeFds[1]]() {
+        MergeTraces(traceFds, outFd);
+        close(outFd);
+        for (int fd : traceFds) {
+            close(fd);
+        }
+    });
+    return pipeFds[0];
+}
+
+static void DumpTrace(int outFd, const string& path, const string& metadata, uint64_t cutoffUs)
+{
+    if (g_decodeRaw) {
+        thread decoder;
+        int traceFd = OpenDecodedTrace(path, decoder);
+        if (traceFd == -1) {
+            fprintf(stderr, "Error: dumping %s failed.\n", path.c_str());
+            return;
+        }
+        DumpTraceFd(traceFd, outFd, path, metadata, cutoffUs);
+        close(traceFd);
+        decoder.join();
+        return;
+    }
+    int traceFd = g_traceFs.OpenFile(path, O_RDONLY);
+    if (traceFd == -1) {
+        fprintf(stderr, "error opening %s: %s (%d)\n", path.c_str(),
+                strerror(errno), errno);
+        return;
+    }
+    thread merger;
+    if (path == TRACE_PATH && !g_isolated.empty()) {
+        traceFd = OpenMergedTrace(traceFd, merger);
+        if (traceFd == -1) {
+            return;
+        }
+    }
+    DumpTraceFd(traceFd, outFd, path, metadata, cutoffUs);
+    // A merger still writing gets EPIPE once the reading end is closed.
+    close(traceFd);
+    if (merger.joinable()) {
+        merger.join();
+    }
+}
+
+static bool DumpTraceToFile(const string& outputFile, const string& path, const string& metadata,
+    uint64_t cutoffUs = 0)
+{
+    int outFd = STDOUT_FILENO;
+    if (outputFile.size() > 0) {
+        printf("write trace to %s\n", outputFile.c_str());
+        // The service writes to the file its client opened, never to a path the client chose.
+        outFd = g_serviceMode ? dup(g_outputFd) :
+            open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
+    if (outFd == -1) {
+        printf("Failed to open '%s', err=%d", outputFile.c_str(), errno);
         return false;
     }
-    if (write(fd, buffer, len) < 0) {
-        fprintf(stderr, "Error: writing clock sync marker %s (%d)\n", strerror(errno), errno);
+    if (g_blockSize == 0) {
+        dprintf(outFd, "TRACE:\n");
     }
-    close(fd);
+    DumpTrace(outFd, path, metadata, cutoffUs);
+    if (outFd != STDOUT_FILENO) {
+        close(outFd);
+        outFd = -1;
+    }
+    return true;
+}
+
+static bool DumpSnapshotToFile(const string& outputFile, uint64_t cutoffUs = 0)
+{
+    // Tracing goes on into the former spare buffer while the swapped-out one is dumped.
+    // The per-CPU counters only cover the live buffer, so they are taken right before the swap.
+    string metadata = CollectCpuStats();
+    if (!WriteStrToFile(SNAPSHOT_PATH, SNAPSHOT_SWAP)) {
+        return false;
+    }
+    g_startStats = ReadAllCpuStats();
+    bool isTrue = DumpTraceToFile(outputFile, SNAPSHOT_PATH, metadata, cutoffUs);
+    return WriteStrToFile(SNAPSHOT_PATH, SNAPSHOT_CLEAR) && isTrue;
+}
+
+// Every rotated file starts with its own header and clock sync markers, which are read back into it.
+static string RotationHeader(int index)
+{
+    constexpr unsigned int timeLen = 32;
+    char timeStr[timeLen] = { 0 };
+    time_t now = time(nullptr);
+    struct tm localTime = {};
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", localtime_r(&now, &localTime));
+    MarkOthersClockSync();
+    return "TRACE:\n# rotation: file " + to_string(index) + " of " + g_outputFile + ", started " + timeStr + "\n";
+}
+
+// ... and ends with the cpu stats of the time it covers.
+static string RotationFooter(int)
+{
+    vector<CpuTraceStats> endStats = ReadAllCpuStats();
+    if (endStats.empty()) {
+        return "";
+    }
+    string metadata = FormatCpuStats(g_startStats, endStats);
+    g_startStats = endStats;
+    return metadata;
+}
+
+static bool AutoSizeBuffers()
+{
+    int cpus = GetTraceCpuCount(g_traceFs);
+    if (cpus == 0 || !SetFtraceEnabled(TRACING_ON_PATH, true) || !ClearTrace()) {
+        return false;
+    }
+    auto sampleBegin = chrono::steady_clock::now();
+    vector<CpuTraceStats> begin = ReadAllCpuStats();
+    struct timespec ts = { AUTO_BUFFER_WARMUP_SEC, 0 };
+    while ((nanosleep(&ts, &ts) == -1) && (errno == EINTR)) {}
+    vector<CpuTraceStats> end = ReadAllCpuStats();
+    double sampleSec = chrono::duration<double>(chrono::steady_clock::now() - sampleBegin).count();
+    StopTrace();
+
+    vector<int> sizes = PlanCpuBufferSizes(begin, end, sampleSec, g_traceDuration, g_autoBufferKB);
+    bool isTrue = true;
+    string summary;
+    for (int i = 0; i < static_cast<int>(sizes.size()); i++) {
+        isTrue = WriteStrToFile(PER_CPU_PATH + to_string(i) + "/" + BUFFER_SIZE_PATH, to_string(sizes[i])) && isTrue;
+        summary += " cpu" + to_string(i) + "=" + to_string(sizes[i]) + "KB";
+    }
+    fprintf(stderr, "auto buffer:%s\n", summary.c_str());
+    return isTrue;
+}
+
+static bool RecorderDumpTrace(RecorderTrigger trigger, int index)
+{
+    // Only the last g_traceDuration seconds before the trigger are kept.
+    uint64_t nowUs = 0;
+    uint64_t cutoffUs = 0;
+    uint64_t windowUs = static_cast<uint64_t>(g_traceDuration) * US_PER_SECOND_INT;
+    if (ReadTraceClockNow(g_traceFs, nowUs) && nowUs > windowUs) {
+        cutoffUs = nowUs - windowUs;
+    }
+    MarkOthersClockSync();
+    if (!g_recorderSnapshot) {
+        StopTrace();
+    }
+
+    constexpr unsigned int timeLen = 32;
+    char timeStr[timeLen] = { 0 };
+    time_t now = time(nullptr);
+    struct tm localTime = {};
+    strftime(timeStr, sizeof(timeStr), "%Y%m%d_%H%M%S", localtime_r(&now, &localTime));
+    string outputFile = g_outputFile + "." + timeStr + "_" + to_string(index);
+    fprintf(stderr, "%s trigger: ", GetTriggerName(trigger));
+    fflush(stderr);
+    bool isTrue = false;
+    if (g_recorderSnapshot) {
+        isTrue = DumpSnapshotToFile(outputFile, cutoffUs);
+    } else {
+        isTrue = DumpTraceToFile(outputFile, TRACE_PATH, CollectCpuStats(), cutoffUs);
+        ClearTrace();
+        g_startStats = ReadAllCpuStats();
+    }
+    g_recorderFiles.Add(outputFile);
+    fflush(stdout);
+    isTrue = SetTracingOn(true) && isTrue;
+    StartClockSync();
+    return isTrue;
+}
+
+static bool RunRecorder()
+{
+    // A dump swaps out the snapshot buffer whenever the kernel has one, so that tracing never stops for it.
+    // Isolated instances have no snapshot buffer of their own; they are stopped, dumped and restarted.
+    bool allocSnapshot = !g_snapshot && g_isolated.empty() && IsWritableFile(SNAPSHOT_PATH);
+    g_recorderSnapshot = g_snapshot || (allocSnapshot && AllocSnapshot());
+    if (!g_recorderSnapshot) {
+        fprintf(stderr, "Warning: no snapshot buffer, tracing stops while a dump is written.\n");
+    }
+    bool isTrue = SetTracingOn(true);
+    if (isTrue) {
+        ClearTrace();
+        g_startStats = ReadAllCpuStats();
+        g_recorderFiles = FileRing(g_rotation.maxFiles);
+        MarkOthersClockSync();
+        StartClockSync();
+        printf("recording trace, send SIGUSR1 to dump and SIGINT to stop...\n");
+        fflush(stdout);
+        FlightRecorder recorder(g_recorderConfig, g_traceFs);
+        isTrue = recorder.Run(RecorderDumpTrace);
+    }
+    isTrue = StopTrace() && isTrue;
+    if (allocSnapshot) {
+        WriteStrToFile(SNAPSHOT_PATH, SNAPSHOT_FREE);
+    }
+    g_recorderSnapshot = false;
+    return isTrue;
+}
+
+static bool ParseTimeWindow(const string& window, uint64_t& beginUs, uint64_t& endUs)
+{
+    size_t comma = window.find(',');
+    double begin = 0;
+    double end = 0;
+    if (comma == string::npos || !StrToNum(window.substr(0, comma), begin) ||
+        !StrToNum(window.substr(comma + 1), end) || begin < 0 || end < begin) {
+        return false;
+    }
+    beginUs = static_cast<uint64_t>(begin * US_PER_SECOND);
+    endUs = static_cast<uint64_t>(end * US_PER_SECOND);
+    return true;
+}
+
+static int RunExtract(int argc, char** argv)
+{
+    const struct option extractOptions[] = {
+        { "window", required_argument, nullptr, 'w' },
+        { "output", required_argument, nullptr, 'o' },
+        { nullptr,  0,                 nullptr, 0 },
+    };
+    uint64_t beginUs = 0;
+    uint64_t endUs = UINT64_MAX;
+    string output;
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "w:o:", extractOptions, nullptr)) != -1) {
+        if (opt == 'w' && ParseTimeWindow(optarg, beginUs, endUs)) {
+            continue;
+        } else if (opt == 'o') {
+            output = optarg;
+            continue;
+        }
+        ShowHelp("bytrace");
+        return -1;
+    }
+    if (optind != argc - 1) {
+        ShowHelp("bytrace");
+        return -1;
+    }
+    int inFd = open(argv[optind], O_RDONLY);
+    if (inFd == -1) {
+        fprintf(stderr, "Error: opening %s: %s (%d)\n", argv[optind], strerror(errno), errno);
+        return -1;
+    }
+    int outFd = STDOUT_FILENO;
+    if (output.size() > 0) {
+        outFd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (outFd == -1) {
+            fprintf(stderr, "Error: opening %s: %s (%d)\n", output.c_str(), strerror(errno), errno);
+            close(inFd);
+            return -1;
+        }
+    }
+    bool isTrue = ExtractTraceWindow(inFd, outFd, beginUs, endUs);
+    if (outFd != STDOUT_FILENO) {
+        close(outFd);
+    }
+    close(inFd);
+    return isTrue ? 0 : -1;
+}
+
+static int RunMerge(int argc, char** argv)
+{
+    const struct option mergeOptions[] = {
+        { "output", required_argument, nullptr, 'o' },
+        { nullptr,  0,                 nullptr, 0 },
+    };
+    string output;
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "o:", mergeOptions, nullptr)) != -1) {
+        if (opt == 'o') {
+            output = optarg;
+            continue;
+        }
+        ShowHelp("bytrace");
+        return -1;
+    }
+    if (optind >= argc) {
+        ShowHelp("bytrace");
+        return -1;
+    }
+    if (output.empty()) {
+        // The name bytrace_multi.py writes to.
+        constexpr unsigned int timeLen = 32;
+        char timeStr[timeLen] = { 0 };
+        time_t now = time(nullptr);
+        struct tm localTime = {};
+        strftime(timeStr, sizeof(timeStr), "%Y%m%d_%H%M%S", localtime_r(&now, &localTime));
+        output = string("multi_trace_") + timeStr + ".ftrace";
+    }
+    int outFd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (outFd == -1) {
+        fprintf(stderr, "Error: opening %s: %s (%d)\n", output.c_str(), strerror(errno), errno);
+        return -1;
+    }
+    bool isTrue = MergeDeviceTraces(vector<string>(argv + optind, argv + argc), outFd);
+    close(outFd);
+    if (!isTrue) {
+        fprintf(stderr, "Error: merging the traces into %s failed.\n", output.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+static int RunConvert(int argc, char** argv)
+{
+    const struct option convertOptions[] = {
+        { "format", required_argument, nullptr, 'f' },
+        { "output", required_argument, nullptr, 'o' },
+        { nullptr,  0,                 nullptr, 0 },
+    };
+    ConvertFormat format = CONVERT_JSON;
+    string output;
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "f:o:", convertOptions, nullptr)) != -1) {
+        if (opt == 'f' && ParseConvertFormat(optarg, format)) {
+            continue;
+        } else if (opt == 'o') {
+            output = optarg;
+            continue;
+        }
+        ShowHelp("bytrace");
+        return -1;
+    }
+    if (optind != argc - 1) {
+        ShowHelp("bytrace");
+        return -1;
+    }
+    int inFd = open(argv[optind], O_RDONLY);
+    if (inFd == -1) {
+        fprintf(stderr, "Error: opening %s: %s (%d)\n", argv[optind], strerror(errno), errno);
+        return -1;
+    }
+    int outFd = STDOUT_FILENO;
+    if (output.size() > 0) {
+        outFd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (outFd == -1) {
+            fprintf(stderr, "Error: opening %s: %s (%d)\n", output.c_str(), strerror(errno), errno);
+            close(inFd);
+            return -1;
+        }
+    }
+    ConvertStats stats;
+    bool isTrue = ConvertTrace(inFd, format, [outFd](const char* data, size_t len) {
+        return WriteFully(outFd, data, len);
+    }, &stats);
+    if (outFd != STDOUT_FILENO) {
+        close(outFd);
+    }
+    close(inFd);
+    if (!isTrue) {
+        fprintf(stderr, "Error: converting %s failed.\n", argv[optind]);
+        return -1;
+    }
+    fprintf(stderr, "convert: %" PRIu64 " lines, %" PRIu64 " markers, %" PRIu64 " sched events, %" PRIu64
+        " skipped\n", stats.lines, stats.markers, stats.schedEvents, stats.skipped);
+    return 0;
+}
+
+// Adds the pids of the "-a" processes to the kernel pid filter; they must be running already.
+static bool AddAppPids()
+{
+    if (g_apps.empty()) {
+        fprintf(stderr, "Error: \"--app_filter\" requires \"-a process\".\n");
+        return false;
+    }
+    for (const auto& app : g_apps) {
+        vector<int> pids = app == ALL_APPS ? vector<int>() : FindProcessPids(app);
+        if (pids.empty()) {
+            fprintf(stderr, "Error: \"--app_filter\" found no running process \"%s\".\n", app.c_str());
+            return false;
+        }
+        g_filterPids.insert(g_filterPids.end(), pids.begin(), pids.end());
+    }
+    // Threads the app starts during the capture are traced as well.
+    g_followFork = true;
     return true;
 }
 
-static void InitDiskSupportTags()
-{
-    g_tagMap["disk"] = { "disk", "Disk I/O", 0, KERNEL, {
-        { "events/f2fs/f2fs_sync_file_enter/enable" },
-        { "events/f2fs/f2fs_sync_file_exit/enable" },
-        { "events/f2fs/f2fs_write_begin/enable" },
-        { "events/f2fs/f2fs_write_end/enable" },
-        { "events/ext4/ext4_da_write_begin/enable" },
-        { "events/ext4/ext4_da_write_end/enable" },
-        { "events/ext4/ext4_sync_file_enter/enable" },
-        { "events/ext4/ext4_sync_file_exit/enable" },
-        { "events/block/block_rq_issue/enable" },
-        { "events/block/block_rq_complete/enable" },
-    }};
-    g_tagMap["mmc"] = { "mmc", "eMMC commands", 0, KERNEL, {
-        { "events/mmc/enable" },
-    }};
-}
-
-static void  InitHardwareSupportTags()
-{
-    g_tagMap["irq"] = { "irq", "IRQ Events", 0, KERNEL, {
-        { "events/irq/enable" },
-        { "events/ipi/enable" },
-    }};
-    g_tagMap["irqoff"] = { "irqoff", "IRQ-disabled code section tracing", 0, KERNEL, {
-        { "events/preemptirq/irq_enable/enable" },
-        { "events/preemptirq/irq_disable/enable" },
-    }};
-    InitDiskSupportTags();
-    g_tagMap["i2c"] = { "i2c", "I2C Events", 0, KERNEL, {
-        { "events/i2c/enable" },
-        { "events/i2c/i2c_read/enable" },
-        { "events/i2c/i2c_write/enable" },
-        { "events/i2c/i2c_result/enable" },
-        { "events/i2c/i2c_reply/enable" },
-        { "events/i2c/smbus_read/enable" },
-        { "events/i2c/smbus_write/enable" },
-        { "events/i2c/smbus_result/enable" },
-        { "events/i2c/smbus_reply/enable" },
-    }};
-    g_tagMap["freq"] = { "freq", "CPU Frequency", 0, KERNEL, {
-        { "events/power/cpu_frequency/enable" },
-        { "events/power/clock_set_rate/enable" },
-        { "events/power/clock_disable/enable" },
-        { "events/power/clock_enable/enable" },
-        { "events/clk/clk_set_rate/enable" },
-        { "events/clk/clk_disable/enable" },
-        { "events/clk/clk_enable/enable" },
-        { "events/power/cpu_frequency_limits/enable" },
-    }};
-    g_tagMap["ufs"] = { "ufs", "UFS commands", 0, KERNEL, {
-        { "events/ufs/enable" },
-    }};
-    g_tagMap["regulators"] = { "regulators", "Voltage and Current Regulators", 0, KERNEL, {
-        { "events/regulator/enable" },
-    }};
-    g_tagMap["membus"] = { "membus", "Memory Bus Utilization", 0, KERNEL, {
-        { "events/memory_bus/enable" },
-    }};
-}
-
-static void InitKernelSupportTags()
-{
-    g_tagMap["sched"] = { "sched", "CPU Scheduling", 0, KERNEL, {
-        { "events/sched/sched_switch/enable" },
-        { "events/sched/sched_wakeup/enable" },
-        { "events/sched/sched_wakeup_new/enable" },
-        { "events/sched/sched_waking/enable" },
-        { "events/sched/sched_blocked_reason/enable" },
-        { "events/sched/sched_pi_setprio/enable" },
-        { "events/sched/sched_process_exit/enable" },
-        { "events/cgroup/enable" },
-        { "events/oom/oom_score_adj_update/enable" },
-        { "events/task/task_rename/enable" },
-        { "events/task/task_newtask/enable" },
-    }};
-    g_tagMap["preemptoff"] = { "preemptoff", "Preempt-disabled code section tracing", 0, KERNEL, {
-        { "events/preemptirq/preempt_enable/enable" },
-        { "events/preemptirq/preempt_disable/enable" },
-    }};
-    g_tagMap["idle"] = { "idle", "CPU Idle", 0, KERNEL, {
-        { "events/power/cpu_idle/enable" },
-    }};
-
-    g_tagMap["load"] = { "load", "CPU Load", 0, KERNEL, {
-        { "events/cpufreq_interactive/enable" },
-    }};
-    g_tagMap["sync"] = { "sync", "Synchronization", 0, KERNEL, {
-        // linux kernel > 4.9
-        { "events/dma_fence/enable" },
-    }};
-    g_tagMap["workq"] = { "workq", "Kernel Workqueues", 0, KERNEL, {
-        { "events/workqueue/enable" },
-    }};
-    g_tagMap["memreclaim"] = { "memreclaim", "Kernel Memory Reclaim", 0, KERNEL, {
-        { "events/vmscan/mm_vmscan_direct_reclaim_begin/enable" },
-        { "events/vmscan/mm_vmscan_direct_reclaim_end/enable" },
-        { "events/vmscan/mm_vmscan_kswapd_wake/enable" },
-        { "events/vmscan/mm_vmscan_kswapd_sleep/enable" },
-        { "events/lowmemorykiller/enable" },
-    }};
-    g_tagMap["pagecache"] = { "pagecache", "Page cache", 0, KERNEL, {
-        { "events/filemap/enable" },
-    }};
-    g_tagMap["memory"] = { "memory", "Memory", 0, KERNEL, {
-        { "events/kmem/rss_stat/enable" },
-        { "events/kmem/ion_heap_grow/enable" },
-        { "events/kmem/ion_heap_shrink/enable" },
-    }};
-    InitHardwareSupportTags();
-}
-
-static void InitAllSupportTags()
-{
-    // OHOS
-    g_tagMap["ohos"] = { "ohos", "OpenHarmony", BYTRACE_TAG_OHOS, USER, {}};
-    g_tagMap["ability"] = { "ability", "Ability Manager", BYTRACE_TAG_ABILITY_MANAGER, USER, {}};
-    g_tagMap["zcamera"] = { "zcamera", "OpenHarmony Camera Module", BYTRACE_TAG_ZCAMERA, USER, {}};
-    g_tagMap["zmedia"] = { "zmedia", "OpenHarmony Media Module", BYTRACE_TAG_ZMEDIA, USER, {}};
-    g_tagMap["zimage"] = { "zimage", "OpenHarmony Image Module", BYTRACE_TAG_ZIMAGE, USER, {}};
-    g_tagMap["zaudio"] = { "zaudio", "OpenHarmony Audio Module", BYTRACE_TAG_ZAUDIO, USER, {}};
-    g_tagMap["distributeddatamgr"] = { "distributeddatamgr", "Distributed Data Manager",
-        BYTRACE_TAG_DISTRIBUTEDDATA, USER, {}};
-    g_tagMap["mdfs"] = { "mdfs", "Mobile Distributed File System", BYTRACE_TAG_MDFS, USER, {}};
-    g_tagMap["graphic"] = { "graphic", "Graphic Module", BYTRACE_TAG_GRAPHIC_AGP, USER, {}};
-    g_tagMap["ace"] = { "ace", "ACE development framework", BYTRACE_TAG_ACE, USER, {}};
-    g_tagMap["notification"] = { "notification", "Notification Module", BYTRACE_TAG_NOTIFICATION, USER, {}};
-    g_tagMap["app"] = { "app", "APP Module", BYTRACE_TAG_APP, USER, {}};
-    g_tagMap["zbinder"] = { "zbinder", "Harmony binder communication", 0, KERNEL, {
-        { "events/zbinder/enable" },
-    }};
-
-    // Kernel os
-    InitKernelSupportTags();
+// Moves every following tracefs access into the instance of the session.
+static bool OpenSession()
+{
+    if (!g_userEnabledTags.empty() || !g_apps.empty()) {
+        fprintf(stderr, "Error: \"--session\" only supports kernel categories, user space ones are "
+            "written to the top-level buffer.\n");
+        return false;
+    }
+    CleanAbandonedSessions(g_traceRootPath, SESSION_LOCK_DIR, SESSION_IDLE_SEC);
+    g_session = make_unique<TraceSession>(g_traceRootPath, g_sessionName, SESSION_LOCK_DIR);
+    if (!g_session->Acquire()) {
+        return false;
+    }
+    g_traceRootPath = g_session->GetRootPath();
+    if (!g_traceFs.Open(g_traceRootPath)) {
+        fprintf(stderr, "Error: opening %s: %s (%d)\n", g_traceRootPath.c_str(), strerror(errno), errno);
+        g_session->Remove();
+        return false;
+    }
+    return true;
+}
+
+// ftrace events carry no cgroup, so a cgroup is filtered through the pids it holds when the capture starts.
+static bool AddCgroupPids()
+{
+    for (const auto& cgroup : g_cgroups) {
+        vector<int> pids = FindCgroupPids(cgroup);
+        if (pids.empty()) {
+            fprintf(stderr, "Error: \"--cgroup\" found no process in %s.\n", cgroup.c_str());
+            return false;
+        }
+        g_filterPids.insert(g_filterPids.end(), pids.begin(), pids.end());
+        g_followFork = true;
+    }
+    return true;
 }
 
 static void InterruptExit(int signo)
@@ -803,34 +1854,161 @@ static void InterruptExit(int signo)
     _exit(-1);
 }
 
-int main(int argc, char **argv)
+static int RunBytrace(int argc, char** argv)
 {
-    signal(SIGKILL, InterruptExit);
-    signal(SIGINT, InterruptExit);
+    int status = -1;
+    if (!HandleOpt(argc, argv, status)) {
+        return status;
+    }
 
-    if (!IsTraceMounted()) {
-        exit(-1);
+    // They write files of their own, which the service does not open for its clients.
+    if (g_serviceMode && (g_recorder || !g_sessionName.empty() || g_rotation.maxFileBytes > 0 ||
+        g_rotation.maxFileSec > 0)) {
+        fprintf(stderr, "Error: \"--recorder\", \"--session\", \"--max_file_size\" and \"--max_file_time\" are "
+            "not supported by the service.\n");
+        return -1;
+    }
+    if (g_captureRunning && g_traceStart) {
+        fprintf(stderr, "Error: a capture started with \"--trace_begin\" is running, end it with "
+            "\"--trace_finish\".\n");
+        return -1;
     }
 
-    InitAllSupportTags();
+    if (g_recorder) {
+        if (g_outputFile.empty()) {
+            fprintf(stderr, "Error: \"--recorder\" requires \"-o filename\".\n");
+            return -1;
+        }
+        g_overwrite = true;
+        g_traceStart = true;
+        g_traceStop = true;
+        g_traceDump = true;
+    }
 
-    if (!HandleOpt(argc, argv)) {
-        exit(-1);
+    if (!g_sessionName.empty() && !OpenSession()) {
+        return -1;
+    }
+
+    if ((g_appFilter && !AddAppPids()) || !AddCgroupPids()) {
+        return -1;
+    }
+    if (!g_filterPids.empty()) {
+        vector<int> tids;
+        for (int pid : g_filterPids) {
+            vector<int> threads = FindProcessThreads(pid);
+            tids.insert(tids.end(), threads.begin(), threads.end());
+        }
+        sort(tids.begin(), tids.end());
+        tids.erase(unique(tids.begin(), tids.end()), tids.end());
+        g_filterPids = tids;
+    }
+
+    if (g_autoBufferKB > 0) {
+        // The warm-up runs with the budget shared evenly.
+        int cpus = max(GetTraceCpuCount(g_traceFs), 1);
+        g_bufferSizeKB = max(g_autoBufferKB / cpus / PAGE_SIZE_KB * PAGE_SIZE_KB, MIN_CPU_BUFFER_KB);
+    }
+
+    if (g_snapshot && !g_isolated.empty()) {
+        fprintf(stderr, "Error: \"--isolate\" cannot be combined with \"--snapshot\".\n");
+        return -1;
     }
 
-    if (!SetKernelSpaceSettings()) {
+    if (g_stream && (g_recorder || g_snapshot || g_blockSize > 0 || !g_isolated.empty() || !g_outputFile.empty() ||
+        !g_traceStart || !g_traceStop)) {
+        fprintf(stderr, "Error: \"--stream_to\" streams a whole capture, it cannot be combined with \"-o\", "
+            "\"--recorder\", \"--snapshot\", \"--block_size\", \"--isolate\" or \"--trace_begin\", "
+            "\"--trace_dump\" and \"--trace_finish\".\n");
+        return -1;
+    }
+
+    bool rotate = g_rotation.maxFileBytes > 0 || g_rotation.maxFileSec > 0;
+    if (rotate && (g_outputFile.empty() || g_stream || g_recorder || g_snapshot || g_blockSize > 0 ||
+        !g_isolated.empty() || !g_traceStart || !g_traceStop)) {
+        fprintf(stderr, "Error: \"--max_file_size\" and \"--max_file_time\" rotate a whole capture, they require "
+            "\"-o filename\" and cannot be combined with \"--stream_to\", \"--recorder\", \"--snapshot\", "
+            "\"--block_size\", \"--isolate\" or \"--trace_begin\", \"--trace_dump\" and \"--trace_finish\".\n");
+        return -1;
+    }
+    if (g_decodeRaw && (g_stream || rotate || !g_isolated.empty())) {
+        fprintf(stderr, "Error: \"--decode_raw\" cannot be combined with \"--stream_to\", \"--max_file_size\", "
+            "\"--max_file_time\" or \"--isolate\".\n");
+        return -1;
+    }
+    if (g_rotation.maxFiles > 0 && !rotate && !g_recorder) {
+        fprintf(stderr, "Error: \"--max_files\" requires \"--max_file_size\", \"--max_file_time\" or "
+            "\"--recorder\".\n");
+        return -1;
+    }
+
+    if (g_snapshot && !IsWritableFile(SNAPSHOT_PATH)) {
+        fprintf(stderr, "Error: \"--snapshot\" is not supported, the kernel has no %s%s.\n",
+            g_traceRootPath.c_str(), SNAPSHOT_PATH.c_str());
+        return -1;
+    }
+
+    // A snapshot dump of a running capture must not touch its settings, or events would be lost;
+    // neither must a dump of the capture the service keeps running.
+    bool joinCapture = (g_snapshot || g_captureRunning) && !g_traceStart;
+    auto setupBegin = chrono::steady_clock::now();
+    if (!joinCapture && !SetKernelSpaceSettings()) {
         ClearKernelSpaceSettings();
-        exit(-1);
+        return -1;
     }
 
-    if (!SetUserSpaceSettings()) {
+    auto kernelEnd = chrono::steady_clock::now();
+    if (!joinCapture && !SetUserSpaceSettings()) {
         ClearKernelSpaceSettings();
         ClearUserSpaceSettings();
-        exit(-1);
+        return -1;
+    }
+    auto userEnd = chrono::steady_clock::now();
+    if (!joinCapture && !FinishKernelSpaceSettings()) {
+        ClearKernelSpaceSettings();
+        ClearUserSpaceSettings();
+        return -1;
+    }
+    if (!joinCapture) {
+        auto bufferEnd = chrono::steady_clock::now();
+        ShowSetupStats(chrono::duration<double, milli>(kernelEnd - setupBegin).count(),
+            chrono::duration<double, milli>(userEnd - kernelEnd).count(),
+            chrono::duration<double, milli>(bufferEnd - userEnd).count());
+    }
+
+    if (g_autoBufferKB > 0 && g_traceStart && !joinCapture && !AutoSizeBuffers()) {
+        ClearKernelSpaceSettings();
+        ClearUserSpaceSettings();
+        return -1;
+    }
+
+    if (g_stream) {
+        const string header = "TRACE:\n";
+        g_streamer = make_unique<TraceStreamer>(g_streamTarget, g_compress);
+        if (!g_streamer->Open() || !g_streamer->Write(header.data(), header.size())) {
+            g_streamer.reset();
+            ClearKernelSpaceSettings();
+            ClearUserSpaceSettings();
+            return -1;
+        }
+    }
+
+    if (rotate) {
+        g_rotation.output = g_outputFile;
+        g_rotation.compress = g_compress;
+        g_rotator = make_unique<RotatingTraceWriter>(g_rotation, RotationHeader, RotationFooter);
     }
 
     bool isTrue = true;
 
+    if (g_recorder) {
+        SetViewStyle();
+        isTrue = RunRecorder();
+        ClearTrace();
+        ClearUserSpaceSettings();
+        ClearKernelSpaceSettings();
+        return isTrue;
+    }
+
     if (g_traceStart) {
         SetViewStyle();
         isTrue &= StartTrace();
@@ -838,31 +2016,293 @@ int main(int argc, char **argv)
 
     isTrue &= MarkOthersClockSync();
 
-    if (g_traceStop) {
+    if (g_snapshot) {
+        if (isTrue && g_traceDump) {
+            isTrue &= DumpSnapshotToFile(g_outputFile);
+        }
+        if (!g_traceStop) {
+            // The capture keeps running for the next "--snapshot --trace_dump".
+            g_captureRunning = true;
+            return isTrue;
+        }
         isTrue &= StopTrace();
-    }
-
-    if (isTrue && g_traceDump) {
-        int outFd = STDOUT_FILENO;
-        if (g_outputFile.size() > 0) {
-            printf("write trace to %s\n", g_outputFile.c_str());
-            outFd = open(g_outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    } else {
+        if (g_traceStop) {
+            isTrue &= StopTrace();
         }
-        if (outFd == -1) {
-            printf("Failed to open '%s', err=%d", g_outputFile.c_str(), errno);
-        } else {
-            dprintf(outFd, "TRACE:\n");
-            DumpTrace(outFd, TRACE_PATH);
-            if (outFd != STDOUT_FILENO) {
-                close(outFd);
-                outFd = -1;
-            }
+        if (isTrue && g_traceDump && GetCaptureSink() != nullptr) {
+            isTrue = FinishStream();
+        } else if (isTrue && g_traceDump) {
+            DumpTraceToFile(g_outputFile, TRACE_PATH, CollectCpuStats());
+            ClearTrace();
+        }
+        if (g_serviceMode && !g_traceStop && (isTrue || g_captureRunning)) {
+            g_startStats = ReadAllCpuStats();
+            g_captureRunning = true;
+            return isTrue;
         }
-        ClearTrace();
     }
 
+    g_captureRunning = false;
+    CloseStream();
     ClearUserSpaceSettings();
     ClearKernelSpaceSettings();
 
     return isTrue;
 }
+
+static int ShowStatus()
+{
+    if (g_serviceMode) {
+        auto uptime = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - g_serviceStartTime);
+        printf("service: pid %d, up %lld s, %" PRIu64 " requests\n", getpid(),
+            static_cast<long long>(uptime.count()), g_serviceRequests);
+        printf("capture: %s\n", g_captureRunning ? "running" : "idle");
+    } else {
+        printf("service: not running\n");
+    }
+    string tracingOn = ReadFile(TRACING_ON_PATH);
+    string bufferSize = ReadFile(BUFFER_SIZE_PATH);
+    printf("tracing_on: %s", tracingOn.empty() ? "unknown\n" : tracingOn.c_str());
+    printf("buffer_size_kb: %s", bufferSize.empty() ? "unknown\n" : bufferSize.c_str());
+    printf("trace_clock: %s\n", GetCurrentClock().c_str());
+    return 0;
+}
+
+// Events of the running capture as they are recorded; trace_pipe consumes them, so a later dump misses them.
+static int RunStream(int outFd, int stopFd)
+{
+    int traceFd = g_traceFs.OpenFile(TRACE_PIPE_PATH, O_RDONLY | O_NONBLOCK);
+    if (traceFd == -1) {
+        dprintf(outFd, "Error: opening %s: %s (%d)\n", TRACE_PIPE_PATH.c_str(), strerror(errno), errno);
+        return -1;
+    }
+    bool isTrue = StreamTrace(traceFd, outFd, stopFd);
+    close(traceFd);
+    return isTrue ? 0 : -1;
+}
+
+static int HandleServiceRequest(ServiceRequest& request)
+{
+    vector<char*> argv;
+    for (auto& arg : request.args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    int argc = static_cast<int>(request.args.size());
+
+    g_outputFd = request.outputFd;
+    fflush(stdout);
+    fflush(stderr);
+    int savedOut = dup(STDOUT_FILENO);
+    int savedErr = dup(STDERR_FILENO);
+    dup2(request.outFd, STDOUT_FILENO);
+    dup2(request.errFd, STDERR_FILENO);
+
+    int status = 0;
+    ResetOptions();
+    if (argc > 1 && !strcmp(argv[1], "status")) {
+        status = ShowStatus();
+    } else if (argc > 1 && !strcmp(argv[1], "service")) {
+        if (argc > 2 && !strcmp(argv[2], "--stop")) {
+            g_serviceStop = 1;
+        } else {
+            fprintf(stderr, "Error: the bytrace service is running already.\n");
+            status = -1;
+        }
+    } else {
+        status = RunBytrace(argc, argv.data());
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(savedOut, STDOUT_FILENO);
+    dup2(savedErr, STDERR_FILENO);
+    close(savedOut);
+    close(savedErr);
+    g_outputFd = -1;
+    return status;
+}
+
+static void StopService(int signo)
+{
+    g_serviceStop = 1;
+}
+
+// Serves one request at a time; a stream runs on a thread of its own until its client hangs up.
+static int RunService()
+{
+    int listenFd = ListenServiceSocket(SERVICE_SOCKET_PATH);
+    if (listenFd == -1) {
+        return -1;
+    }
+    // Without SA_RESTART, accept() returns when the service is told to stop.
+    struct sigaction action = {};
+    action.sa_handler = StopService;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    g_serviceMode = true;
+    g_serviceStartTime = chrono::steady_clock::now();
+    const vector<uid_t> uids = GetServiceUids();
+    printf("bytrace service listening on %s\n", SERVICE_SOCKET_PATH.c_str());
+    fflush(stdout);
+
+    while (!g_serviceStop) {
+        int client = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client == -1) {
+            continue;
+        }
+        // The socket is open to the shell group; root only serves the users it expects.
+        if (!CheckServicePeer(client, uids)) {
+            fprintf(stderr, "Warning: a request from an unexpected user was refused.\n");
+            close(client);
+            continue;
+        }
+        struct timeval timeout = { SERVICE_TIMEOUT_SEC, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ServiceRequest request;
+        if (!ReceiveServiceRequest(client, request)) {
+            close(request.outFd);
+            close(request.errFd);
+            close(request.outputFd);
+            close(client);
+            continue;
+        }
+        g_serviceRequests++;
+        if (request.args.size() > 1 && request.args[1] == "stream") {
+            thread([request, client]() {
+                SendServiceResult(client, RunStream(request.outFd, client));
+                close(request.outFd);
+                close(request.errFd);
+                close(request.outputFd);
+                close(client);
+            }).detach();
+            continue;
+        }
+        SendServiceResult(client, HandleServiceRequest(request));
+        close(request.outFd);
+        close(request.errFd);
+        close(request.outputFd);
+        close(client);
+    }
+    close(listenFd);
+    unlink(SERVICE_SOCKET_PATH.c_str());
+
+    // A capture the clients left running ends with the service, and the buffers are freed.
+    if (g_captureRunning) {
+        StopTrace();
+        ClearUserSpaceSettings();
+        g_captureRunning = false;
+    }
+    g_keepWarm = false;
+    return ClearKernelSpaceSettings() ? 0 : -1;
+}
+
+// The captures of a session and of the recorder, and rotated files, belong to the process that runs them.
+static bool IsServiceCommand(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--session") || !strcmp(argv[i], "--recorder") ||
+            !strncmp(argv[i], "--max_file_size", strlen("--max_file_size")) ||
+            !strncmp(argv[i], "--max_file_time", strlen("--max_file_time"))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The "-o" file of a command line, found the way HandleOpt() parses it, or "" without one.
+static string FindOutputFile(int argc, char** argv)
+{
+    vector<char*> args(argv, argv + argc);
+    args.push_back(nullptr);
+    string outputFile;
+    int optionIndex = 0;
+    int opt = 0;
+    optind = 0;
+    opterr = 0;
+    while ((opt = getopt_long(argc, args.data(), SHORT_OPTIONS.c_str(), g_longOptions, &optionIndex)) != -1) {
+        if (opt == 'o' || (opt == 0 && !strcmp(g_longOptions[optionIndex].name, "output"))) {
+            outputFile = optarg;
+        }
+    }
+    optind = 0;
+    opterr = 1;
+    return outputFile;
+}
+
+// Runs the command in the service; its output goes to the stdout and stderr of this process.
+static int ForwardToService(int sockFd, int argc, char** argv)
+{
+    ServiceRequest request;
+    request.args.assign(argv, argv + argc);
+    request.outFd = STDOUT_FILENO;
+    request.errFd = STDERR_FILENO;
+    // Opened here, with the rights of the user, and handed over to the service.
+    string outputFile = FindOutputFile(argc, argv);
+    if (!outputFile.empty()) {
+        request.outputFd = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (request.outputFd == -1) {
+            fprintf(stderr, "Error: opening %s: %s (%d)\n", outputFile.c_str(), strerror(errno), errno);
+            close(sockFd);
+            return -1;
+        }
+    }
+    int status = -1;
+    if (!SendServiceRequest(sockFd, request) || !ReceiveServiceResult(sockFd, status)) {
+        fprintf(stderr, "Error: the bytrace service did not complete the request.\n");
+        status = -1;
+    }
+    if (request.outputFd != -1) {
+        close(request.outputFd);
+    }
+    close(sockFd);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    signal(SIGKILL, InterruptExit);
+    signal(SIGINT, InterruptExit);
+    // Write errors on a closed pipe, e.g. the merged trace of --isolate, are handled where they occur.
+    signal(SIGPIPE, SIG_IGN);
+    // SIGUSR1 asks the flight recorder for a dump; one sent before it is armed or after it stops must
+    // not kill the process. FlightRecorder::Run handles it and restores this afterwards.
+    signal(SIGUSR1, SIG_IGN);
+
+    if (argc > 1 && !strcmp(argv[1], "extract")) {
+        return RunExtract(argc - 1, argv + 1);
+    } else if (argc > 1 && !strcmp(argv[1], "merge")) {
+        return RunMerge(argc - 1, argv + 1);
+    } else if (argc > 1 && !strcmp(argv[1], "convert")) {
+        return RunConvert(argc - 1, argv + 1);
+    }
+
+    bool runService = argc > 1 && !strcmp(argv[1], "service") && !(argc > 2 && !strcmp(argv[2], "--stop"));
+    if (!runService && IsServiceCommand(argc, argv)) {
+        int sockFd = ConnectServiceSocket(SERVICE_SOCKET_PATH);
+        if (sockFd != -1) {
+            return ForwardToService(sockFd, argc, argv);
+        }
+    }
+    if (argc > 1 && !strcmp(argv[1], "service") && !runService) {
+        fprintf(stderr, "Error: no bytrace service is running.\n");
+        return -1;
+    }
+
+    if (!IsTraceMounted()) {
+        exit(-1);
+    }
+
+    g_tagRegistry.LoadVendorTags(VENDOR_TAGS_PATH);
+
+    if (runService) {
+        return RunService();
+    } else if (argc > 1 && !strcmp(argv[1], "status")) {
+        return ShowStatus();
+    } else if (argc > 1 && !strcmp(argv[1], "stream")) {
+        return RunStream(STDOUT_FILENO, -1);
+    }
+    return RunBytrace(argc, argv);
+}
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_block_compress.h"
+#include "bytrace_dump.h"
+#include "bytrace_parser.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace std;
+namespace {
+const int READ_CHUNK_SIZE = 256 * 1024; // largest input handed over by the dump pipeline
+const int GZIP_WINDOW_BITS = 15 + 16; // deflate window of 32 KB with a gzip wrapper
+const int DEFAULT_MEM_LEVEL = 8;
+const size_t GZIP_HEADER_SIZE = 12;   // fixed header with FEXTRA set, including XLEN
+const size_t GZIP_TAIL_SIZE = 10;     // empty deflate block, CRC32 and ISIZE
+const size_t SUBFIELD_HEADER_SIZE = 4;
+const size_t INDEX_ENTRY_SIZE = 32;
+const size_t MAX_ENTRIES_PER_MEMBER = 2000; // keeps XLEN below 65535
+const size_t FOOTER_DATA_SIZE = 16;
+const uint64_t NS_PER_US = 1000;
+const int BYTE_BITS = 8;
+const uint8_t GZIP_ID1 = 0x1f;
+const uint8_t GZIP_ID2 = 0x8b;
+const uint8_t GZIP_CM_DEFLATE = 8;
+const uint8_t GZIP_FLAG_EXTRA = 4;
+const uint8_t GZIP_OS_UNIX = 3;
+const uint8_t EMPTY_DEFLATE_BLOCK[] = { 0x03, 0x00 };
+
+void PutLe(string& out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        out.push_back(static_cast<char>((value >> (i * BYTE_BITS)) & 0xff));
+    }
+}
+
+uint64_t GetLe(const uint8_t* in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << BYTE_BITS) | in[i];
+    }
+    return value;
+}
+
+// An empty gzip member whose only payload is one FEXTRA subfield.
+string MakeExtraMember(char si1, char si2, const string& data)
+{
+    string member;
+    member.push_back(static_cast<char>(GZIP_ID1));
+    member.push_back(static_cast<char>(GZIP_ID2));
+    member.push_back(static_cast<char>(GZIP_CM_DEFLATE));
+    member.push_back(static_cast<char>(GZIP_FLAG_EXTRA));
+    PutLe(member, 0, 4); // MTIME
+    member.push_back(0); // XFL
+    member.push_back(static_cast<char>(GZIP_OS_UNIX));
+    PutLe(member, SUBFIELD_HEADER_SIZE + data.size(), 2); // XLEN
+    member.push_back(si1);
+    member.push_back(si2);
+    PutLe(member, data.size(), 2);
+    member += data;
+    member.append(reinterpret_cast<const char*>(EMPTY_DEFLATE_BLOCK), sizeof(EMPTY_DEFLATE_BLOCK));
+    PutLe(member, 0, 4); // CRC32 of nothing
+    PutLe(member, 0, 4); // ISIZE
+    return member;
+}
+
+// Returns the subfield payload of an empty member built by MakeExtraMember().
+bool ParseExtraMember(const uint8_t* in, size_t len, char si1, char si2, const uint8_t*& data, size_t& dataLen)
+{
+    if (len < GZIP_HEADER_SIZE + SUBFIELD_HEADER_SIZE + GZIP_TAIL_SIZE || in[0] != GZIP_ID1 ||
+        in[1] != GZIP_ID2 || (in[3] & GZIP_FLAG_EXTRA) == 0) {
+        return false;
+    }
+    size_t xlen = GetLe(in + GZIP_HEADER_SIZE - 2, 2);
+    const uint8_t* sub = in + GZIP_HEADER_SIZE;
+    if (xlen < SUBFIELD_HEADER_SIZE || GZIP_HEADER_SIZE + xlen + GZIP_TAIL_SIZE > len ||
+        sub[0] != static_cast<uint8_t>(si1) || sub[1] != static_cast<uint8_t>(si2)) {
+        return false;
+    }
+    dataLen = GetLe(sub + 2, 2);
+    if (dataLen + SUBFIELD_HEADER_SIZE != xlen) {
+        return false;
+    }
+    data = sub + SUBFIELD_HEADER_SIZE;
+    return true;
+}
+
+size_t IndexMemberSize(size_t entries)
+{
+    return GZIP_HEADER_SIZE + SUBFIELD_HEADER_SIZE + entries * INDEX_ENTRY_SIZE + GZIP_TAIL_SIZE;
+}
+
+size_t IndexRegionSize(size_t entries)
+{
+    size_t size = 0;
+    while (entries > 0) {
+        size_t n = entries < MAX_ENTRIES_PER_MEMBER ? entries : MAX_ENTRIES_PER_MEMBER;
+        size += IndexMemberSize(n);
+        entries -= n;
+    }
+    return size;
+}
+
+bool PreadAll(int fd, uint8_t* buf, size_t len, off_t offset)
+{
+    while (len > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(pread(fd, buf, len, offset));
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+
+bool InflateBlock(const uint8_t* in, size_t inLen, string& out, size_t rawSize)
+{
+    z_stream zs {};
+    if (inflateInit2(&zs, GZIP_WINDOW_BITS) != Z_OK) {
+        fprintf(stderr, "Error: initializing zlib inflate.\n");
+        return false;
+    }
+    out.resize(rawSize);
+    zs.next_in = const_cast<Bytef*>(in);
+    zs.avail_in = inLen;
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = rawSize;
+    int ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (ret != Z_STREAM_END || zs.total_out != rawSize) {
+        fprintf(stderr, "Error: inflating trace block: %d\n", ret);
+        return false;
+    }
+    return true;
+}
+} // namespace
+
+bool ParseTraceTimestamp(const char* line, size_t len, uint64_t& us)
+{
+    string_view text(line, len);
+    if (!text.empty() && text.back() == '\n') {
+        text.remove_suffix(1);
+    }
+    TraceEvent event;
+    if (!ParseTraceLine(text, event)) {
+        return false;
+    }
+    us = event.timestampNs / NS_PER_US;
+    return true;
+}
+
+BlockTraceWriter::BlockTraceWriter(size_t blockSize) : blockSize_(blockSize)
+{
+    pending_.reserve(blockSize_ + READ_CHUNK_SIZE);
+}
+
+bool BlockTraceWriter::Compress(const char* data, size_t len, const DumpSink& sink)
+{
+    pending_.append(data, len);
+    while (pending_.size() >= blockSize_) {
+        size_t cut = pending_.rfind('\n', blockSize_ - 1);
+        cut = (cut == string::npos) ? blockSize_ : cut + 1;
+        if (!FlushBlock(cut, sink)) {
+            return false;
+        }
+        pending_.erase(0, cut);
+    }
+    return true;
+}
+
+bool BlockTraceWriter::FlushBlock(size_t len, const DumpSink& sink)
+{
+    TraceBlockIndex entry = { offset_, 0, static_cast<uint32_t>(len), UINT64_MAX, 0 };
+    const char* begin = pending_.data();
+    const char* end = begin + len;
+    for (const char* line = begin; line < end;) {
+        const char* eol = static_cast<const char*>(memchr(line, '\n', end - line));
+        size_t lineLen = (eol == nullptr ? end : eol) - line;
+        uint64_t us = 0;
+        if (ParseTraceTimestamp(line, lineLen, us)) {
+            entry.beginUs = us < entry.beginUs ? us : entry.beginUs;
+            entry.endUs = us > entry.endUs ? us : entry.endUs;
+        }
+        line += lineLen + 1;
+    }
+    if (entry.beginUs == UINT64_MAX) {
+        entry.beginUs = 0; // a block of header lines only
+    }
+
+    z_stream zs {};
+    int ret = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW_BITS, DEFAULT_MEM_LEVEL,
+        Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        fprintf(stderr, "Error: initializing zlib: %d\n", ret);
+        return false;
+    }
+    out_.resize(deflateBound(&zs, len));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(begin));
+    zs.avail_in = len;
+    zs.next_out = out_.data();
+    zs.avail_out = out_.size();
+    ret = deflate(&zs, Z_FINISH);
+    size_t have = zs.total_out;
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END) {
+        fprintf(stderr, "Error: deflate zlib: %d\n", ret);
+        return false;
+    }
+    if (!sink(out_.data(), have)) {
+        return false;
+    }
+    entry.compressedSize = static_cast<uint32_t>(have);
+    index_.push_back(entry);
+    offset_ += have;
+    return true;
+}
+
+bool BlockTraceWriter::WriteIndex(const DumpSink& sink)
+{
+    uint64_t indexOffset = offset_;
+    for (size_t first = 0; first < index_.size(); first += MAX_ENTRIES_PER_MEMBER) {
+        size_t last = min(first + MAX_ENTRIES_PER_MEMBER, index_.size());
+        string data;
+        data.reserve((last - first) * INDEX_ENTRY_SIZE);
+        for (size_t i = first; i < last; i++) {
+            PutLe(data, index_[i].offset, sizeof(uint64_t));
+            PutLe(data, index_[i].compressedSize, sizeof(uint32_t));
+            PutLe(data, index_[i].rawSize, sizeof(uint32_t));
+            PutLe(data, index_[i].beginUs, sizeof(uint64_t));
+            PutLe(data, index_[i].endUs, sizeof(uint64_t));
+        }
+        string member = MakeExtraMember('B', 'I', data);
+        if (!sink(member.data(), member.size())) {
+            return false;
+        }
+        offset_ += member.size();
+    }
+    string footer;
+    PutLe(footer, indexOffset, sizeof(uint64_t));
+    PutLe(footer, index_.size(), sizeof(uint32_t));
+    PutLe(footer, BLOCK_CONTAINER_VERSION, sizeof(uint32_t));
+    string member = MakeExtraMember('B', 'F', footer);
+    if (!sink(member.data(), member.size())) {
+        return false;
+    }
+    offset_ += member.size();
+    return true;
+}
+
+bool BlockTraceWriter::Finish(const DumpSink& sink)
+{
+    if (!pending_.empty()) {
+        if (!FlushBlock(pending_.size(), sink)) {
+            return false;
+        }
+        pending_.clear();
+    }
+    return WriteIndex(sink);
+}
+
+bool DumpBlockCompressedTrace(int traceFd, int outFd, size_t blockSize, const string& preamble,
+    DumpStageStats* stats)
+{
+    BlockTraceWriter writer(blockSize);
+    return DumpPipelined(traceFd, outFd, writer, preamble, stats);
+}
+
+bool ReadBlockIndex(int fd, vector<TraceBlockIndex>& index)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < BLOCK_FOOTER_SIZE) {
+        fprintf(stderr, "Error: not a block-compressed trace.\n");
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+    uint8_t footer[BLOCK_FOOTER_SIZE];
+    const uint8_t* data = nullptr;
+    size_t dataLen = 0;
+    if (!PreadAll(fd, footer, sizeof(footer), fileSize - BLOCK_FOOTER_SIZE) ||
+        !ParseExtraMember(footer, sizeof(footer), 'B', 'F', data, dataLen) || dataLen != FOOTER_DATA_SIZE) {
+        fprintf(stderr, "Error: block index footer not found.\n");
+        return false;
+    }
+    uint64_t indexOffset = GetLe(data, sizeof(uint64_t));
+    size_t count = GetLe(data + sizeof(uint64_t), sizeof(uint32_t));
+    uint32_t version = GetLe(data + sizeof(uint64_t) + sizeof(uint32_t), sizeof(uint32_t));
+    size_t regionSize = IndexRegionSize(count);
+    if (version != BLOCK_CONTAINER_VERSION || regionSize + indexOffset + BLOCK_FOOTER_SIZE > fileSize) {
+        fprintf(stderr, "Error: unsupported block index (version %u).\n", version);
+        return false;
+    }
+    // The container may be preceded by other output, e.g. when stdout was redirected.
+    uint64_t base = fileSize - BLOCK_FOOTER_SIZE - regionSize - indexOffset;
+    unique_ptr<uint8_t[]> region = make_unique<uint8_t[]>(regionSize + 1);
+    if (!PreadAll(fd, region.get(), regionSize, base + indexOffset)) {
+        fprintf(stderr, "Error: reading block index: %s (%d)\n", strerror(errno), errno);
+        return false;
+    }
+    index.clear();
+    index.reserve(count);
+    for (size_t pos = 0; pos < regionSize;) {
+        if (!ParseExtraMember(region.get() + pos, regionSize - pos, 'B', 'I', data, dataLen) ||
+            dataLen % INDEX_ENTRY_SIZE != 0) {
+            fprintf(stderr, "Error: corrupted block index.\n");
+            return false;
+        }
+        for (size_t i = 0; i < dataLen; i += INDEX_ENTRY_SIZE) {
+            const uint8_t* p = data + i;
+            TraceBlockIndex entry;
+            entry.offset = base + GetLe(p, sizeof(uint64_t));
+            entry.compressedSize = GetLe(p + 8, sizeof(uint32_t));  // 8: after offset
+            entry.rawSize = GetLe(p + 12, sizeof(uint32_t));        // 12: after compressedSize
+            entry.beginUs = GetLe(p + 16, sizeof(uint64_t));        // 16: after rawSize
+            entry.endUs = GetLe(p + 24, sizeof(uint64_t));          // 24: after beginUs
+            index.push_back(entry);
+        }
+        pos += IndexMemberSize(dataLen / INDEX_ENTRY_SIZE);
+    }
+    return index.size() == count;
+}
+
+bool ExtractTraceWindow(int inFd, int outFd, uint64_t beginUs, uint64_t endUs)
+{
+    vector<TraceBlockIndex> index;
+    if (!ReadBlockIndex(inFd, index)) {
+        return false;
+    }
+    string raw;
+    string kept;
+    for (size_t i = 0; i < index.size(); i++) {
+        const TraceBlockIndex& entry = index[i];
+        // The first block is always read so that header lines are kept.
+        bool overlaps = entry.endUs >= beginUs && entry.beginUs <= endUs;
+        if (i != 0 && !overlaps) {
+            continue;
+        }
+        unique_ptr<uint8_t[]> in = make_unique<uint8_t[]>(entry.compressedSize);
+        if (!PreadAll(inFd, in.get(), entry.compressedSize, entry.offset) ||
+            !InflateBlock(in.get(), entry.compressedSize, raw, entry.rawSize)) {
+            fprintf(stderr, "Error: reading block %zu failed.\n", i);
+            return false;
+        }
+        kept.clear();
+        const char* end = raw.data() + raw.size();
+        for (const char* line = raw.data(); line < end;) {
+            const char* eol = static_cast<const char*>(memchr(line, '\n', end - line));
+            size_t lineLen = (eol == nullptr ? end : eol + 1) - line;
+            uint64_t us = 0;
+            if (ParseTraceTimestamp(line, lineLen, us) ? (us >= beginUs && us <= endUs) : (i == 0)) {
+                kept.append(line, lineLen);
+            }
+            line += lineLen;
+        }
+        if (!WriteFully(outFd, kept.data(), kept.size())) {
+            return false;
+        }
+    }
+    return true;
+}
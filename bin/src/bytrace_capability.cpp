@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_capability.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include "bytrace_dump.h"
+
+using namespace std;
+namespace {
+const string CACHE_MAGIC = "bytrace-capabilities 1";
+const char STATE_WRITABLE = 'w';
+const char STATE_READONLY = 'r';
+const char STATE_MISSING = '-';
+const size_t READ_CHUNK_SIZE = 4096;
+
+char ToState(FileAccess access)
+{
+    switch (access) {
+        case FILE_WRITABLE:
+            return STATE_WRITABLE;
+        case FILE_READONLY:
+            return STATE_READONLY;
+        default:
+            return STATE_MISSING;
+    }
+}
+
+bool FromState(char state, FileAccess& access)
+{
+    switch (state) {
+        case STATE_WRITABLE:
+            access = FILE_WRITABLE;
+            return true;
+        case STATE_READONLY:
+            access = FILE_READONLY;
+            return true;
+        case STATE_MISSING:
+            access = FILE_MISSING;
+            return true;
+        default:
+            return false;
+    }
+}
+} // namespace
+
+CapabilityCache::CapabilityCache(TraceFs& traceFs, const string& cachePath)
+    : traceFs_(traceFs), cachePath_(cachePath + "." + to_string(geteuid()))
+{
+    key_ = MakeKey();
+}
+
+string CapabilityCache::MakeKey() const
+{
+    struct utsname name = {};
+    uname(&name);
+    struct stat st = {};
+    stat(traceFs_.GetRootPath().c_str(), &st);
+    return string(name.release) + "|" + name.version + "|" + traceFs_.GetRootPath() + "|" +
+        to_string(static_cast<uint64_t>(st.st_dev)) + "|" + to_string(geteuid());
+}
+
+bool CapabilityCache::Load()
+{
+    entries_.clear();
+    dirty_ = false;
+    // Only trust a cache written by this user: the directory is usually shared.
+    int fd = open(cachePath_.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st = {};
+    string content;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid()) {
+        char buffer[READ_CHUNK_SIZE];
+        ssize_t n = 0;
+        while ((n = TEMP_FAILURE_RETRY(read(fd, buffer, sizeof(buffer)))) > 0) {
+            content.append(buffer, static_cast<size_t>(n));
+        }
+    }
+    close(fd);
+    istringstream fin(content);
+    string line;
+    if (!getline(fin, line) || line != CACHE_MAGIC || !getline(fin, line) || line != key_) {
+        return false;
+    }
+    FileAccess access = FILE_MISSING;
+    while (getline(fin, line)) {
+        if (line.size() < 3 || line[1] != ' ' || !FromState(line[0], access)) {
+            entries_.clear();
+            return false;
+        }
+        entries_[line.substr(2)] = access;
+    }
+    return true;
+}
+
+bool CapabilityCache::Save()
+{
+    if (!dirty_) {
+        return true;
+    }
+    ostringstream out;
+    out << CACHE_MAGIC << "\n" << key_ << "\n";
+    for (const auto& entry : entries_) {
+        out << ToState(entry.second) << " " << entry.first << "\n";
+    }
+    string content = out.str();
+
+    // Written aside and renamed, so a concurrent reader never sees half a cache. The name of the temporary
+    // file is unpredictable and it is created exclusively: nothing planted in the directory is followed.
+    string tmpPath = cachePath_ + ".XXXXXX";
+    int fd = mkostemp(&tmpPath[0], O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool isTrue = fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0 &&
+        WriteFully(fd, content.data(), content.size());
+    close(fd);
+    if (!isTrue || rename(tmpPath.c_str(), cachePath_.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    dirty_ = false;
+    return true;
+}
+
+FileAccess CapabilityCache::Probe(const string& file)
+{
+    auto it = entries_.find(file);
+    if (it != entries_.end()) {
+        return it->second;
+    }
+    FileAccess access = FILE_MISSING;
+    if (traceFs_.IsWritable(file)) {
+        access = FILE_WRITABLE;
+    } else if (traceFs_.Exists(file)) {
+        access = FILE_READONLY;
+    }
+    entries_[file] = access;
+    dirty_ = true;
+    return access;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_clock_sync.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+const int SAMPLE_TRIES = 3;
+const int64_t NS_PER_SECOND = 1000000000;
+const int64_t NS_PER_MS = 1000000;
+const int64_t NS_PER_US = 1000;
+const string SYNC_PREFIX = "trace_event_clock_sync: ";
+const string BYTRACE_SYNC = "trace_event_clock_sync: bytrace ";
+
+atomic<uint64_t> g_syncSeq(0); // shared by every writer of the process
+
+bool ReadClock(clockid_t clock, int64_t& ns)
+{
+    struct timespec ts = {0, 0};
+    if (clock_gettime(clock, &ts) == -1) {
+        return false;
+    }
+    ns = static_cast<int64_t>(ts.tv_sec) * NS_PER_SECOND + ts.tv_nsec;
+    return true;
+}
+
+bool ReadField(const string& payload, const string& name, int64_t& value)
+{
+    size_t pos = payload.find(" " + name + "=");
+    if (pos == string::npos) {
+        return false;
+    }
+    const char* begin = payload.c_str() + pos + name.size() + 2; // 2: the space and '='
+    char* end = nullptr;
+    errno = 0;
+    long long num = strtoll(begin, &end, 10); // 10: decimal
+    if (errno != 0 || end == begin || (*end != '\0' && *end != ' ' && *end != '\n')) {
+        return false;
+    }
+    value = num;
+    return true;
+}
+} // namespace
+
+bool SampleClocks(ClockSyncSample& sample)
+{
+    bool sampled = false;
+    for (int i = 0; i < SAMPLE_TRIES; i++) {
+        int64_t before = 0;
+        int64_t after = 0;
+        ClockSyncSample current;
+        if (!ReadClock(CLOCK_BOOTTIME, before) || !ReadClock(CLOCK_MONOTONIC, current.monoNs) ||
+            !ReadClock(CLOCK_REALTIME, current.realtimeNs) || !ReadClock(CLOCK_BOOTTIME, after)) {
+            fprintf(stderr, "Error: reading the clocks: %s (%d)\n", strerror(errno), errno);
+            return false;
+        }
+        current.bootNs = before + (after - before) / 2; // 2: midpoint
+        current.errorNs = after - current.bootNs;
+        if (!sampled || current.errorNs < sample.errorNs) {
+            sample = current;
+            sampled = true;
+        }
+    }
+    return true;
+}
+
+string FormatClockSyncMarkers(const ClockSyncSample& sample)
+{
+    constexpr unsigned int bufferSize = 256;
+    char buffer[bufferSize] = { 0 };
+    int len = snprintf(buffer, sizeof(buffer),
+        "%srealtime_ts=%" PRId64 "\n"
+        "%sparent_ts=%" PRId64 ".%06" PRId64 "\n"
+        "%sseq=%" PRIu64 " boot=%" PRId64 " mono=%" PRId64 " realtime=%" PRId64 " error=%" PRId64 "\n",
+        SYNC_PREFIX.c_str(), sample.realtimeNs / NS_PER_MS,
+        SYNC_PREFIX.c_str(), sample.monoNs / NS_PER_SECOND, sample.monoNs % NS_PER_SECOND / NS_PER_US,
+        BYTRACE_SYNC.c_str(), sample.seq, sample.bootNs, sample.monoNs, sample.realtimeNs, sample.errorNs);
+    if (len < 0 || static_cast<size_t>(len) >= sizeof(buffer)) {
+        return "";
+    }
+    return string(buffer, len);
+}
+
+bool ParseClockSyncMarker(const string& payload, ClockSyncSample& sample)
+{
+    if (payload.compare(0, BYTRACE_SYNC.size(), BYTRACE_SYNC) != 0) {
+        return false;
+    }
+    // " seq=" is found from the space that ends BYTRACE_SYNC.
+    string fields = payload.substr(BYTRACE_SYNC.size() - 1);
+    int64_t seq = 0;
+    if (!ReadField(fields, "seq", seq) || !ReadField(fields, "boot", sample.bootNs) ||
+        !ReadField(fields, "mono", sample.monoNs) || !ReadField(fields, "realtime", sample.realtimeNs) ||
+        !ReadField(fields, "error", sample.errorNs) || seq < 0 || sample.errorNs < 0) {
+        return false;
+    }
+    sample.seq = static_cast<uint64_t>(seq);
+    return true;
+}
+
+ClockSyncWriter::~ClockSyncWriter()
+{
+    Stop();
+    close(markerFd_);
+}
+
+bool ClockSyncWriter::Mark()
+{
+    ClockSyncSample sample;
+    if (!SampleClocks(sample)) {
+        return false;
+    }
+    lock_guard<mutex> lock(markMutex_);
+    sample.seq = g_syncSeq++;
+    string markers = FormatClockSyncMarkers(sample);
+    // Each line is a marker of its own.
+    size_t begin = 0;
+    while (begin < markers.size()) {
+        size_t end = markers.find('\n', begin) + 1;
+        ssize_t ret = TEMP_FAILURE_RETRY(write(markerFd_, markers.data() + begin, end - begin));
+        if (ret != static_cast<ssize_t>(end - begin)) {
+            fprintf(stderr, "Error: writing clock sync marker %s (%d)\n", strerror(errno), errno);
+            break;
+        }
+        begin = end;
+    }
+    return true;
+}
+
+void ClockSyncWriter::Start(int intervalMs)
+{
+    if (thread_.joinable() || intervalMs <= 0) {
+        return;
+    }
+    stop_ = false;
+    thread_ = thread(&ClockSyncWriter::Run, this, intervalMs);
+}
+
+void ClockSyncWriter::Stop()
+{
+    if (!thread_.joinable()) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+}
+
+void ClockSyncWriter::Run(int intervalMs)
+{
+    unique_lock<mutex> lock(mutex_);
+    auto next = chrono::steady_clock::now() + chrono::milliseconds(intervalMs);
+    while (!cond_.wait_until(lock, next, [this] { return stop_; })) {
+        Mark();
+        next += chrono::milliseconds(intervalMs);
+    }
+}
@@ -0,0 +1,771 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_convert.h"
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "bytrace_parser.h"
+
+using namespace std;
+
+namespace {
+const size_t READ_BUFFER_SIZE = 1024 * 1024;
+const size_t SINK_CHUNK_SIZE = 256 * 1024;
+const size_t MAX_BUNDLE_SIZE = 64 * 1024;
+const uint64_t NS_PER_US = 1000;
+const string_view UNKNOWN_TASK = "<...>";
+
+// Wire types and field numbers of the Perfetto protos (protos/perfetto/trace/...).
+const uint32_t WIRE_VARINT = 0;
+const uint32_t WIRE_LENGTH = 2;
+const int WIRE_TYPE_BITS = 3;
+const uint32_t TRACE_PACKET = 1;
+const uint32_t PACKET_FTRACE_EVENTS = 1;
+const uint32_t PACKET_TIMESTAMP = 8;
+const uint32_t PACKET_SEQUENCE_ID = 10;
+const uint32_t PACKET_TRACK_EVENT = 11;
+const uint32_t PACKET_SEQUENCE_FLAGS = 13;
+const uint32_t PACKET_TRACK_DESCRIPTOR = 60;
+const uint32_t SEQ_INCREMENTAL_STATE_CLEARED = 1;
+const uint32_t SEQUENCE_ID = 1; // all the track events are on one sequence
+const uint32_t TRACK_UUID = 1;
+const uint32_t TRACK_NAME = 2;
+const uint32_t TRACK_PROCESS = 3;
+const uint32_t TRACK_THREAD = 4;
+const uint32_t TRACK_PARENT_UUID = 5;
+const uint32_t TRACK_COUNTER = 8;
+const uint32_t PROCESS_PID = 1;
+const uint32_t PROCESS_NAME = 6;
+const uint32_t THREAD_PID = 1;
+const uint32_t THREAD_TID = 2;
+const uint32_t THREAD_NAME = 5;
+const uint32_t EVENT_TYPE = 9;
+const uint32_t EVENT_TRACK_UUID = 11;
+const uint32_t EVENT_NAME = 23;
+const uint32_t EVENT_COUNTER_VALUE = 30;
+const uint32_t TYPE_SLICE_BEGIN = 1;
+const uint32_t TYPE_SLICE_END = 2;
+const uint32_t TYPE_COUNTER = 4;
+const uint32_t BUNDLE_CPU = 1;
+const uint32_t BUNDLE_EVENT = 2;
+const uint32_t FTRACE_TIMESTAMP = 1;
+const uint32_t FTRACE_PID = 2;
+const uint32_t FTRACE_SCHED_SWITCH = 4;
+const uint32_t FTRACE_SCHED_WAKEUP = 17;
+const uint32_t FTRACE_SCHED_WAKING = 20;
+const uint32_t SWITCH_PREV_COMM = 1;
+const uint32_t SWITCH_PREV_PID = 2;
+const uint32_t SWITCH_PREV_PRIO = 3;
+const uint32_t SWITCH_PREV_STATE = 4;
+const uint32_t SWITCH_NEXT_COMM = 5;
+const uint32_t SWITCH_NEXT_PID = 6;
+const uint32_t SWITCH_NEXT_PRIO = 7;
+const uint32_t WAKEUP_COMM = 1;
+const uint32_t WAKEUP_PID = 2;
+const uint32_t WAKEUP_PRIO = 3;
+const uint32_t WAKEUP_TARGET_CPU = 5;
+
+// Kinds of track uuids, in their top byte.
+const int UUID_KIND_SHIFT = 56;
+const uint64_t UUID_VALUE_MASK = (1ULL << UUID_KIND_SHIFT) - 1;
+const uint64_t UUID_PROCESS = 1;
+const uint64_t UUID_THREAD = 2;
+const uint64_t UUID_COUNTER = 3;
+const uint64_t UUID_ASYNC = 4;
+const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+const uint64_t FNV_PRIME = 1099511628211ULL;
+
+bool IsSchedEvent(string_view name)
+{
+    return name == "sched_switch" || name == "sched_waking" || name == "sched_wakeup" || name == "sched_wakeup_new";
+}
+
+// Reads the lines of a file through a buffer that only grows for a line longer than it.
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd_(fd), buffer_(READ_BUFFER_SIZE) {}
+
+    // The next line without its '\n', valid until the next call; false at the end or on an error.
+    bool Next(string_view& line)
+    {
+        while (true) {
+            const char* data = buffer_.data();
+            const void* newline = memchr(data + begin_, '\n', end_ - begin_);
+            if (newline != nullptr) {
+                size_t pos = static_cast<size_t>(static_cast<const char*>(newline) - data);
+                line = string_view(data + begin_, pos - begin_);
+                begin_ = pos + 1;
+                return true;
+            }
+            if (eof_) {
+                if (begin_ == end_) {
+                    return false;
+                }
+                line = string_view(data + begin_, end_ - begin_);
+                begin_ = end_;
+                return true;
+            }
+            if (begin_ > 0) {
+                memmove(buffer_.data(), data + begin_, end_ - begin_);
+                end_ -= begin_;
+                begin_ = 0;
+            }
+            if (end_ == buffer_.size()) {
+                buffer_.resize(buffer_.size() * 2); // 2: room for the rest of the line
+            }
+            ssize_t n = TEMP_FAILURE_RETRY(read(fd_, buffer_.data() + end_, buffer_.size() - end_));
+            if (n < 0) {
+                fprintf(stderr, "Error: reading the trace: %s (%d)\n", strerror(errno), errno);
+                failed_ = true;
+                return false;
+            }
+            eof_ = n == 0;
+            end_ += static_cast<size_t>(n);
+        }
+    }
+
+    bool Failed() const
+    {
+        return failed_;
+    }
+
+private:
+    int fd_;
+    vector<char> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    bool eof_ = false;
+    bool failed_ = false;
+};
+
+// The text of rest before delimiter, which is skipped.
+bool ReadUntil(string_view& rest, string_view delimiter, string_view& value)
+{
+    size_t pos = rest.find(delimiter);
+    if (pos == string_view::npos) {
+        return false;
+    }
+    value = rest.substr(0, pos);
+    rest.remove_prefix(pos + delimiter.size());
+    return true;
+}
+
+bool SkipPrefix(string_view& rest, string_view prefix)
+{
+    if (rest.substr(0, prefix.size()) != prefix) {
+        return false;
+    }
+    rest.remove_prefix(prefix.size());
+    return true;
+}
+
+bool ToInt(string_view text, int64_t& value)
+{
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size();
+}
+
+// "prev_comm=%s prev_pid=%d prev_prio=%d prev_state=%s ==> next_comm=%s next_pid=%d next_prio=%d"
+struct SchedSwitch {
+    string_view prevComm;
+    string_view prevState;
+    string_view nextComm;
+    int64_t prevPid = 0;
+    int64_t prevPrio = 0;
+    int64_t nextPid = 0;
+    int64_t nextPrio = 0;
+};
+
+bool ParseSchedSwitch(string_view payload, SchedSwitch& event)
+{
+    string_view prevPid;
+    string_view prevPrio;
+    string_view nextPid;
+    return SkipPrefix(payload, "prev_comm=") && ReadUntil(payload, " prev_pid=", event.prevComm) &&
+        ReadUntil(payload, " prev_prio=", prevPid) && ReadUntil(payload, " prev_state=", prevPrio) &&
+        ReadUntil(payload, " ==> next_comm=", event.prevState) && ReadUntil(payload, " next_pid=", event.nextComm) &&
+        ReadUntil(payload, " next_prio=", nextPid) && ToInt(prevPid, event.prevPid) &&
+        ToInt(prevPrio, event.prevPrio) && ToInt(nextPid, event.nextPid) && ToInt(payload, event.nextPrio);
+}
+
+// "comm=%s pid=%d prio=%d target_cpu=%03d", with "success=%d " ahead of target_cpu on older kernels.
+struct SchedWakeup {
+    string_view comm;
+    int64_t pid = 0;
+    int64_t prio = 0;
+    int64_t targetCpu = 0;
+};
+
+bool ParseSchedWakeup(string_view payload, SchedWakeup& event)
+{
+    string_view pid;
+    string_view prio;
+    string_view success;
+    if (!SkipPrefix(payload, "comm=") || !ReadUntil(payload, " pid=", event.comm) ||
+        !ReadUntil(payload, " prio=", pid) || !ReadUntil(payload, " ", prio)) {
+        return false;
+    }
+    if (SkipPrefix(payload, "success=") && !ReadUntil(payload, " ", success)) {
+        return false;
+    }
+    return SkipPrefix(payload, "target_cpu=") && ToInt(pid, event.pid) && ToInt(prio, event.prio) &&
+        ToInt(payload, event.targetCpu);
+}
+
+// The bits of prev_state that the kernel prints as letters, as of 4.14 (TASK_REPORT).
+int64_t ParseTaskState(string_view state)
+{
+    const string_view letters = "SDTtXZPI";
+    const int64_t preempted = 0x100; // TASK_REPORT_MAX, printed as "R+"
+    int64_t bits = 0;
+    for (char c : state) {
+        size_t bit = letters.find(c);
+        if (bit != string_view::npos) {
+            bits |= 1LL << bit;
+        } else if (c == '+') {
+            bits |= preempted;
+        }
+    }
+    return bits;
+}
+
+void AppendInt(string& out, int64_t value)
+{
+    char digits[24]; // 24: the longest int64 and its sign
+    auto result = to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, static_cast<size_t>(result.ptr - digits));
+}
+
+void AppendJsonEscaped(string& out, string_view text)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') { // 0x20: the first character that is not a control one
+            continue;
+        }
+        out.append(text.data() + start, i - start);
+        start = i + 1;
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default: {
+                char escaped[8]; // 8: "\u00xx" and the NUL
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+                break;
+            }
+        }
+    }
+    out.append(text.data() + start, text.size() - start);
+}
+
+void AppendJsonString(string& out, string_view text)
+{
+    out += '"';
+    AppendJsonEscaped(out, text);
+    out += '"';
+}
+
+void AppendVarint(string& out, uint64_t value)
+{
+    const uint64_t more = 0x80; // 0x80: another byte follows
+    while (value >= more) {
+        out += static_cast<char>((value & (more - 1)) | more);
+        value >>= 7; // 7: bits per byte
+    }
+    out += static_cast<char>(value);
+}
+
+void AppendVarintField(string& out, uint32_t field, uint64_t value)
+{
+    AppendVarint(out, (field << WIRE_TYPE_BITS) | WIRE_VARINT);
+    AppendVarint(out, value);
+}
+
+// int32 and int64 fields: a negative value takes the 10 bytes of its 64-bit two's complement.
+void AppendIntField(string& out, uint32_t field, int64_t value)
+{
+    AppendVarintField(out, field, static_cast<uint64_t>(value));
+}
+
+void AppendBytesField(string& out, uint32_t field, string_view value)
+{
+    AppendVarint(out, (field << WIRE_TYPE_BITS) | WIRE_LENGTH);
+    AppendVarint(out, value.size());
+    out.append(value.data(), value.size());
+}
+
+uint64_t HashUuid(uint64_t kind, int32_t pid, string_view name, int64_t value)
+{
+    uint64_t hash = FNV_OFFSET;
+    auto mix = [&hash](const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * FNV_PRIME;
+        }
+    };
+    mix(&pid, sizeof(pid));
+    mix(name.data(), name.size());
+    mix(&value, sizeof(value));
+    return (kind << UUID_KIND_SHIFT) | (hash & UUID_VALUE_MASK);
+}
+
+uint64_t ProcessUuid(int32_t pid)
+{
+    return (UUID_PROCESS << UUID_KIND_SHIFT) | static_cast<uint32_t>(pid);
+}
+
+uint64_t ThreadUuid(int32_t tid)
+{
+    return (UUID_THREAD << UUID_KIND_SHIFT) | static_cast<uint32_t>(tid);
+}
+
+// The output of a format. The events come in the order of the trace, and every thread and process is
+// described ahead of its first event, and again when it is renamed.
+class EventWriter {
+public:
+    EventWriter(const ConvertSink& sink, ConvertStats& counts) : counts_(counts), sink_(sink)
+    {
+        out_.reserve(SINK_CHUNK_SIZE * 2); // 2: a chunk and the events past it
+    }
+    virtual ~EventWriter() = default;
+
+    virtual void Begin() = 0;
+    virtual void AddSchedEvent(const TraceEvent& event) = 0;
+    // start: where the trace begins in inFd, -1 when it cannot seek.
+    virtual bool End(int inFd, off_t start) = 0;
+
+    void AddMarker(const TraceEvent& event, const TraceMarker& marker)
+    {
+        int32_t pid = ProcessOf(event, marker.pid);
+        string_view task = event.task == UNKNOWN_TASK ? string_view() : event.task;
+        if (Rename(processNames_, pid, event.pid == pid ? task : string_view())) {
+            WriteProcess(pid, processNames_[pid]);
+        }
+        if (Rename(threadNames_, event.pid, task)) {
+            WriteThread(event.pid, pid, threadNames_[event.pid]);
+        }
+        WriteMarker(event, marker, pid);
+        counts_.markers++;
+    }
+
+    // Hands the output to the sink once a chunk is full, or all of it with force.
+    bool Flush(bool force = false)
+    {
+        if (out_.empty() || (!force && out_.size() < SINK_CHUNK_SIZE)) {
+            return true;
+        }
+        bool isTrue = sink_(out_.data(), out_.size());
+        out_.clear();
+        return isTrue;
+    }
+
+protected:
+    virtual void WriteProcess(int32_t pid, const string& name) = 0;
+    virtual void WriteThread(int32_t tid, int32_t pid, const string& name) = 0;
+    virtual void WriteMarker(const TraceEvent& event, const TraceMarker& marker, int32_t pid) = 0;
+
+    string out_;
+    ConvertStats& counts_;
+
+private:
+    // The tgid of the line, else the pid of the marker, else the process the thread was last seen in.
+    int32_t ProcessOf(const TraceEvent& event, int32_t markerPid)
+    {
+        int32_t pid = event.tgid >= 0 ? event.tgid : markerPid;
+        if (pid >= 0) {
+            threadPids_[event.pid] = pid;
+            return pid;
+        }
+        auto it = threadPids_.find(event.pid);
+        return it != threadPids_.end() ? it->second : event.pid;
+    }
+
+    // True when id is new, or has a name other than the one it had; an empty name keeps the old one.
+    static bool Rename(unordered_map<int32_t, string>& names, int32_t id, string_view name)
+    {
+        auto [it, inserted] = names.try_emplace(id, name);
+        if (inserted) {
+            return true;
+        }
+        if (name.empty() || it->second == name) {
+            return false;
+        }
+        it->second = name;
+        return true;
+    }
+
+    const ConvertSink& sink_;
+    unordered_map<int32_t, int32_t> threadPids_;
+    unordered_map<int32_t, string> threadNames_;
+    unordered_map<int32_t, string> processNames_;
+};
+
+/**
+ * {"traceEvents":[...],"systemTraceEvents":"...","displayTimeUnit":"ns"}, with the markers as the events
+ * B, E, b, e and C, the names as the metadata events M, and the sched lines as a systrace.
+ */
+class JsonWriter : public EventWriter {
+public:
+    using EventWriter::EventWriter;
+
+    void Begin() override
+    {
+        out_ += "{\"traceEvents\":[";
+    }
+
+    void AddSchedEvent(const TraceEvent&) override {}
+
+    bool End(int inFd, off_t start) override
+    {
+        out_ += "\n]";
+        if (start < 0 || lseek(inFd, start, SEEK_SET) != start) {
+            fprintf(stderr, "Warning: the trace cannot be read twice, the thread states are left out.\n");
+        } else {
+            out_ += ",\n\"systemTraceEvents\":\"# tracer: nop\\n";
+            LineReader reader(inFd);
+            string_view line;
+            TraceEvent event;
+            while (reader.Next(line)) {
+                if (!ParseTraceLine(line, event) || !IsSchedEvent(event.name)) {
+                    continue;
+                }
+                AppendJsonEscaped(out_, line);
+                out_ += "\\n";
+                counts_.schedEvents++;
+                if (!Flush()) {
+                    return false;
+                }
+            }
+            if (reader.Failed()) {
+                return false;
+            }
+            out_ += '"';
+        }
+        out_ += ",\n\"displayTimeUnit\":\"ns\"}\n";
+        return Flush(true);
+    }
+
+protected:
+    void WriteProcess(int32_t pid, const string& name) override
+    {
+        if (!name.empty()) {
+            WriteMetadata("process_name", pid, -1, name);
+        }
+    }
+
+    void WriteThread(int32_t tid, int32_t pid, const string& name) override
+    {
+        if (!name.empty()) {
+            WriteMetadata("thread_name", pid, tid, name);
+        }
+    }
+
+    void WriteMarker(const TraceEvent& event, const TraceMarker& marker, int32_t pid) override
+    {
+        static const char* const phases[] = { "B", "E", "b", "e", "C" }; // by TraceMarkerType
+        Separate();
+        out_ += "{\"ph\":\"";
+        out_ += phases[marker.type];
+        out_ += '"';
+        if (marker.type != TRACE_MARKER_END || !marker.name.empty()) {
+            out_ += ",\"name\":";
+            AppendJsonString(out_, marker.name);
+        }
+        if (marker.type == TRACE_MARKER_ASYNC_BEGIN || marker.type == TRACE_MARKER_ASYNC_END) {
+            out_ += ",\"cat\":\"bytrace\",\"id\":";
+            AppendInt(out_, marker.value);
+        }
+        out_ += ",\"ts\":";
+        AppendInt(out_, static_cast<int64_t>(event.timestampNs / NS_PER_US));
+        char fraction[8]; // 8: ".nnn" and the NUL
+        snprintf(fraction, sizeof(fraction), ".%03u", static_cast<unsigned>(event.timestampNs % NS_PER_US));
+        out_ += fraction;
+        out_ += ",\"pid\":";
+        AppendInt(out_, pid);
+        out_ += ",\"tid\":";
+        AppendInt(out_, event.pid);
+        if (marker.type == TRACE_MARKER_COUNTER) {
+            out_ += ",\"args\":{\"value\":";
+            AppendInt(out_, marker.value);
+            out_ += '}';
+        }
+        out_ += '}';
+    }
+
+private:
+    void Separate()
+    {
+        out_ += first_ ? "\n" : ",\n";
+        first_ = false;
+    }
+
+    void WriteMetadata(const char* name, int32_t pid, int32_t tid, const string& value)
+    {
+        Separate();
+        out_ += "{\"ph\":\"M\",\"name\":\"";
+        out_ += name;
+        out_ += "\",\"pid\":";
+        AppendInt(out_, pid);
+        if (tid >= 0) {
+            out_ += ",\"tid\":";
+            AppendInt(out_, tid);
+        }
+        out_ += ",\"args\":{\"name\":";
+        AppendJsonString(out_, value);
+        out_ += "}}";
+    }
+
+    bool first_ = true;
+};
+
+/**
+ * A Trace of TracePackets: the threads, processes, async slices and counters as track descriptors, the
+ * markers as track events on one sequence, and the sched events as ftrace event bundles of their CPU.
+ */
+class PerfettoWriter : public EventWriter {
+public:
+    using EventWriter::EventWriter;
+
+    void Begin() override {}
+
+    void AddSchedEvent(const TraceEvent& event) override
+    {
+        event_.clear();
+        fields_.clear();
+        if (event.name == "sched_switch") {
+            SchedSwitch sched;
+            if (!ParseSchedSwitch(event.payload, sched)) {
+                counts_.skipped++;
+                return;
+            }
+            AppendBytesField(fields_, SWITCH_PREV_COMM, sched.prevComm);
+            AppendIntField(fields_, SWITCH_PREV_PID, sched.prevPid);
+            AppendIntField(fields_, SWITCH_PREV_PRIO, sched.prevPrio);
+            AppendIntField(fields_, SWITCH_PREV_STATE, ParseTaskState(sched.prevState));
+            AppendBytesField(fields_, SWITCH_NEXT_COMM, sched.nextComm);
+            AppendIntField(fields_, SWITCH_NEXT_PID, sched.nextPid);
+            AppendIntField(fields_, SWITCH_NEXT_PRIO, sched.nextPrio);
+        } else {
+            SchedWakeup sched;
+            if (!ParseSchedWakeup(event.payload, sched)) {
+                counts_.skipped++;
+                return;
+            }
+            AppendBytesField(fields_, WAKEUP_COMM, sched.comm);
+            AppendIntField(fields_, WAKEUP_PID, sched.pid);
+            AppendIntField(fields_, WAKEUP_PRIO, sched.prio);
+            AppendIntField(fields_, WAKEUP_TARGET_CPU, sched.targetCpu);
+        }
+        // sched_wakeup_new is a sched_wakeup of a new task.
+        uint32_t field = event.name == "sched_switch" ? FTRACE_SCHED_SWITCH :
+            event.name == "sched_waking" ? FTRACE_SCHED_WAKING : FTRACE_SCHED_WAKEUP;
+        AppendVarintField(event_, FTRACE_TIMESTAMP, event.timestampNs);
+        AppendVarintField(event_, FTRACE_PID, static_cast<uint32_t>(event.pid));
+        AppendBytesField(event_, field, fields_);
+        if (event.cpu != bundleCpu_ || bundle_.size() >= MAX_BUNDLE_SIZE) {
+            FlushBundle();
+            bundleCpu_ = event.cpu;
+        }
+        AppendBytesField(bundle_, BUNDLE_EVENT, event_);
+        counts_.schedEvents++;
+    }
+
+    bool End(int, off_t) override
+    {
+        FlushBundle();
+        return Flush(true);
+    }
+
+protected:
+    void WriteProcess(int32_t pid, const string& name) override
+    {
+        fields_.clear();
+        AppendIntField(fields_, PROCESS_PID, pid);
+        if (!name.empty()) {
+            AppendBytesField(fields_, PROCESS_NAME, name);
+        }
+        event_.clear();
+        AppendVarintField(event_, TRACK_UUID, ProcessUuid(pid));
+        AppendBytesField(event_, TRACK_PROCESS, fields_);
+        WritePacket(PACKET_TRACK_DESCRIPTOR, event_, 0);
+    }
+
+    void WriteThread(int32_t tid, int32_t pid, const string& name) override
+    {
+        fields_.clear();
+        AppendIntField(fields_, THREAD_PID, pid);
+        AppendIntField(fields_, THREAD_TID, tid);
+        if (!name.empty()) {
+            AppendBytesField(fields_, THREAD_NAME, name);
+        }
+        event_.clear();
+        AppendVarintField(event_, TRACK_UUID, ThreadUuid(tid));
+        AppendBytesField(event_, TRACK_THREAD, fields_);
+        WritePacket(PACKET_TRACK_DESCRIPTOR, event_, 0);
+    }
+
+    void WriteMarker(const TraceEvent& event, const TraceMarker& marker, int32_t pid) override
+    {
+        uint64_t track = ThreadUuid(event.pid);
+        if (marker.type == TRACE_MARKER_ASYNC_BEGIN || marker.type == TRACE_MARKER_ASYNC_END) {
+            // A track per async slice; described at every begin rather than remembered.
+            track = HashUuid(UUID_ASYNC, pid, marker.name, marker.value);
+            if (marker.type == TRACE_MARKER_ASYNC_BEGIN) {
+                WriteChildTrack(track, pid, marker.name, false);
+            }
+        } else if (marker.type == TRACE_MARKER_COUNTER) {
+            track = HashUuid(UUID_COUNTER, pid, marker.name, 0);
+            if (counterTracks_.insert(track).second) {
+                WriteChildTrack(track, pid, marker.name, true);
+            }
+        }
+        bool begin = marker.type == TRACE_MARKER_BEGIN || marker.type == TRACE_MARKER_ASYNC_BEGIN;
+        event_.clear();
+        AppendVarintField(event_, EVENT_TYPE, begin ? TYPE_SLICE_BEGIN :
+            marker.type == TRACE_MARKER_COUNTER ? TYPE_COUNTER : TYPE_SLICE_END);
+        AppendVarintField(event_, EVENT_TRACK_UUID, track);
+        if (begin) {
+            AppendBytesField(event_, EVENT_NAME, marker.name);
+        } else if (marker.type == TRACE_MARKER_COUNTER) {
+            AppendIntField(event_, EVENT_COUNTER_VALUE, marker.value);
+        }
+        WritePacket(PACKET_TRACK_EVENT, event_, event.timestampNs);
+    }
+
+private:
+    void WriteChildTrack(uint64_t uuid, int32_t pid, string_view name, bool counter)
+    {
+        event_.clear();
+        AppendVarintField(event_, TRACK_UUID, uuid);
+        AppendBytesField(event_, TRACK_NAME, name);
+        AppendVarintField(event_, TRACK_PARENT_UUID, ProcessUuid(pid));
+        if (counter) {
+            AppendBytesField(event_, TRACK_COUNTER, "");
+        }
+        WritePacket(PACKET_TRACK_DESCRIPTOR, event_, 0);
+    }
+
+    // A packet of the sequence of the track events, with the timestamp unless it is 0.
+    void WritePacket(uint32_t field, const string& message, uint64_t timestamp)
+    {
+        packet_.clear();
+        if (timestamp != 0) {
+            AppendVarintField(packet_, PACKET_TIMESTAMP, timestamp);
+        }
+        AppendBytesField(packet_, field, message);
+        AppendVarintField(packet_, PACKET_SEQUENCE_ID, SEQUENCE_ID);
+        if (firstPacket_) {
+            AppendVarintField(packet_, PACKET_SEQUENCE_FLAGS, SEQ_INCREMENTAL_STATE_CLEARED);
+            firstPacket_ = false;
+        }
+        AppendBytesField(out_, TRACE_PACKET, packet_);
+    }
+
+    void FlushBundle()
+    {
+        if (bundle_.empty()) {
+            return;
+        }
+        packet_.clear();
+        AppendVarintField(packet_, BUNDLE_CPU, static_cast<uint32_t>(bundleCpu_));
+        packet_ += bundle_;
+        string packet;
+        AppendBytesField(packet, PACKET_FTRACE_EVENTS, packet_);
+        AppendBytesField(out_, TRACE_PACKET, packet);
+        bundle_.clear();
+    }
+
+    // Scratch buffers, kept to reuse their memory.
+    string fields_;
+    string event_;
+    string packet_;
+    string bundle_; // the events of the current ftrace bundle
+    int32_t bundleCpu_ = -1;
+    bool firstPacket_ = true;
+    unordered_set<uint64_t> counterTracks_;
+};
+} // namespace
+
+bool ParseConvertFormat(string_view name, ConvertFormat& format)
+{
+    if (name == "json") {
+        format = CONVERT_JSON;
+    } else if (name == "perfetto") {
+        format = CONVERT_PERFETTO;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ConvertTrace(int inFd, ConvertFormat format, const ConvertSink& sink, ConvertStats* stats)
+{
+    ConvertStats localStats;
+    ConvertStats& counts = stats != nullptr ? *stats : localStats;
+    unique_ptr<EventWriter> writer;
+    if (format == CONVERT_JSON) {
+        writer = make_unique<JsonWriter>(sink, counts);
+    } else {
+        writer = make_unique<PerfettoWriter>(sink, counts);
+    }
+    off_t start = lseek(inFd, 0, SEEK_CUR);
+    writer->Begin();
+    LineReader reader(inFd);
+    string_view line;
+    TraceEvent event;
+    TraceMarker marker;
+    uint64_t events = 0;
+    while (reader.Next(line)) {
+        counts.lines++;
+        if (!ParseTraceLine(line, event)) {
+            counts.skipped++;
+            continue;
+        }
+        events++;
+        if (event.name == "tracing_mark_write") {
+            if (ParseTraceMarker(event.payload, marker)) {
+                writer->AddMarker(event, marker);
+            } else {
+                counts.skipped++;
+            }
+        } else if (IsSchedEvent(event.name)) {
+            writer->AddSchedEvent(event);
+        }
+        if (!writer->Flush()) {
+            return false;
+        }
+    }
+    if (reader.Failed()) {
+        return false;
+    }
+    if (events == 0) {
+        fprintf(stderr, "Warning: no event found in the trace; a trace captured with \"-z\" or \"--block_size\" "
+            "must be decompressed first.\n");
+    }
+    return writer->End(inFd, start);
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_cpu_stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <unistd.h>
+#include "bytrace_parser.h"
+
+using namespace std;
+namespace {
+const string PER_CPU_DIR = "per_cpu/cpu";
+const string STATS_FILE = "/stats";
+const int PAGE_SIZE_KB = 4;
+const int KB_BYTES = 1024;
+const int MAX_CPU_BUFFER_KB = 307200; // 300 MB
+const double BUFFER_HEADROOM = 1.25;
+const uint64_t US_PER_SECOND = 1000000;
+const uint64_t NS_PER_US = 1000;
+const int CPUS_PER_MASK_GROUP = 32;
+const int CPUS_PER_HEX_DIGIT = 4;
+
+// "1234.567890" -> microseconds, 0 when it cannot be parsed
+uint64_t ParseSeconds(const string& value)
+{
+    size_t pos = value.find_first_not_of(' ');
+    uint64_t ns = 0;
+    if (pos == string::npos || !ParseTraceSeconds(string_view(value).substr(pos), ns)) {
+        return 0;
+    }
+    return ns / NS_PER_US;
+}
+
+uint64_t Delta(uint64_t begin, uint64_t end)
+{
+    return end > begin ? end - begin : 0;
+}
+
+CpuTraceStats Between(const vector<CpuTraceStats>& begin, const vector<CpuTraceStats>& end, size_t cpu)
+{
+    CpuTraceStats stats = end[cpu];
+    if (cpu < begin.size()) {
+        stats.overrun = Delta(begin[cpu].overrun, end[cpu].overrun);
+        stats.commitOverrun = Delta(begin[cpu].commitOverrun, end[cpu].commitOverrun);
+        stats.dropped = Delta(begin[cpu].dropped, end[cpu].dropped);
+    }
+    return stats;
+}
+
+string FormatSeconds(uint64_t us)
+{
+    char buffer[32]; // 32: enough for a 64-bit number of seconds and 6 decimals
+    int len = snprintf(buffer, sizeof(buffer), "%llu.%06llu", static_cast<unsigned long long>(us / US_PER_SECOND),
+        static_cast<unsigned long long>(us % US_PER_SECOND));
+    return string(buffer, len > 0 ? static_cast<size_t>(len) : 0);
+}
+
+bool ParseCpuNumber(const string& text, int maxCpus, int& cpu)
+{
+    char* end = nullptr;
+    long value = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || value < 0 || value >= maxCpus) {
+        return false;
+    }
+    cpu = static_cast<int>(value);
+    return true;
+}
+
+int RoundUpToPage(double kb)
+{
+    int pages = static_cast<int>(ceil(kb / PAGE_SIZE_KB));
+    return max(pages * PAGE_SIZE_KB, MIN_CPU_BUFFER_KB);
+}
+} // namespace
+
+bool ParseCpuStats(const string& text, CpuTraceStats& stats)
+{
+    istringstream in(text);
+    string line;
+    bool found = false;
+    while (getline(in, line)) {
+        size_t colon = line.find(':');
+        if (colon == string::npos) {
+            continue;
+        }
+        string key = line.substr(0, colon);
+        string value = line.substr(colon + 1);
+        uint64_t number = strtoull(value.c_str(), nullptr, 10);
+        if (key == "entries") {
+            stats.entries = number;
+        } else if (key == "overrun") {
+            stats.overrun = number;
+        } else if (key == "commit overrun") {
+            stats.commitOverrun = number;
+        } else if (key == "bytes") {
+            stats.bytes = number;
+        } else if (key == "dropped events") {
+            stats.dropped = number;
+        } else if (key == "read events") {
+            stats.readEvents = number;
+        } else if (key == "oldest event ts") {
+            stats.oldestUs = ParseSeconds(value);
+        } else if (key == "now ts") {
+            stats.nowUs = ParseSeconds(value);
+        } else {
+            continue;
+        }
+        found = true;
+    }
+    return found;
+}
+
+bool ReadCpuStats(const TraceFs& traceFs, int cpu, CpuTraceStats& stats)
+{
+    string text;
+    stats = CpuTraceStats();
+    return traceFs.Read(PER_CPU_DIR + to_string(cpu) + STATS_FILE, text) && ParseCpuStats(text, stats);
+}
+
+int GetTraceCpuCount(const TraceFs& traceFs)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    int count = 0;
+    while (count < cpus && traceFs.Exists(PER_CPU_DIR + to_string(count))) {
+        count++;
+    }
+    return count;
+}
+
+string FormatCpuStats(const vector<CpuTraceStats>& begin, const vector<CpuTraceStats>& end)
+{
+    string section = "# cpu_stats: cpu entries overrun commit_overrun dropped bytes oldest_ts now_ts\n";
+    for (size_t cpu = 0; cpu < end.size(); cpu++) {
+        CpuTraceStats stats = Between(begin, end, cpu);
+        section += "# cpu_stats: " + to_string(cpu) + " " + to_string(stats.entries) + " " + to_string(stats.overrun) +
+            " " + to_string(stats.commitOverrun) + " " + to_string(stats.dropped) + " " + to_string(stats.bytes) +
+            " " + FormatSeconds(stats.oldestUs) + " " + FormatSeconds(stats.nowUs) + "\n";
+    }
+    return section;
+}
+
+string SummarizeCpuStats(const vector<CpuTraceStats>& begin, const vector<CpuTraceStats>& end)
+{
+    uint64_t kept = 0;
+    uint64_t lost = 0;
+    string lossByCpu;
+    for (size_t cpu = 0; cpu < end.size(); cpu++) {
+        CpuTraceStats stats = Between(begin, end, cpu);
+        uint64_t cpuLost = stats.overrun + stats.commitOverrun + stats.dropped;
+        kept += stats.entries;
+        lost += cpuLost;
+        if (cpuLost > 0) {
+            lossByCpu += " cpu" + to_string(cpu) + "=" + to_string(cpuLost);
+        }
+    }
+    if (lost == 0) {
+        return "cpu stats: " + to_string(kept) + " events, none lost";
+    }
+    return "cpu stats: " + to_string(kept) + " events, " + to_string(lost) + " lost (" + lossByCpu.substr(1) +
+        "), the buffer is too small for this capture";
+}
+
+vector<int> PlanCpuBufferSizes(const vector<CpuTraceStats>& begin, const vector<CpuTraceStats>& end,
+    double sampleSec, int durationSec, int budgetKB)
+{
+    size_t cpus = min(begin.size(), end.size());
+    vector<double> needKB(cpus, 0);
+    double totalKB = 0;
+    for (size_t i = 0; i < cpus; i++) {
+        double bytes = static_cast<double>(Delta(begin[i].bytes, end[i].bytes));
+        // A full buffer stops growing: scale by the events that were lost to estimate the real rate.
+        uint64_t kept = end[i].entries;
+        uint64_t lost = Delta(begin[i].overrun, end[i].overrun) + Delta(begin[i].dropped, end[i].dropped);
+        if (kept > 0 && lost > 0) {
+            bytes *= static_cast<double>(kept + lost) / static_cast<double>(kept);
+        }
+        double rate = sampleSec > 0 ? bytes / sampleSec : 0;
+        needKB[i] = max(rate * durationSec * BUFFER_HEADROOM / KB_BYTES, static_cast<double>(MIN_CPU_BUFFER_KB));
+        totalKB += needKB[i];
+    }
+
+    double scale = (totalKB > budgetKB && totalKB > 0) ? budgetKB / totalKB : 1.0;
+    vector<int> sizes(cpus, MIN_CPU_BUFFER_KB);
+    for (size_t i = 0; i < cpus; i++) {
+        sizes[i] = min(RoundUpToPage(needKB[i] * scale), MAX_CPU_BUFFER_KB);
+    }
+    return sizes;
+}
+
+bool ParseCpuList(const string& arg, int maxCpus, vector<int>& cpus)
+{
+    istringstream in(arg);
+    string item;
+    vector<int> parsed;
+    while (getline(in, item, ',')) {
+        size_t dash = item.find('-');
+        int first = 0;
+        int last = 0;
+        if (!ParseCpuNumber(item.substr(0, dash), maxCpus, first)) {
+            return false;
+        }
+        last = first;
+        if (dash != string::npos && (!ParseCpuNumber(item.substr(dash + 1), maxCpus, last) || last < first)) {
+            return false;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            parsed.push_back(cpu);
+        }
+    }
+    if (parsed.empty() || arg.back() == ',') {
+        return false;
+    }
+    sort(parsed.begin(), parsed.end());
+    parsed.erase(unique(parsed.begin(), parsed.end()), parsed.end());
+    cpus = parsed;
+    return true;
+}
+
+string FormatCpuMask(const vector<int>& cpus)
+{
+    int maxCpu = cpus.empty() ? 0 : *max_element(cpus.begin(), cpus.end());
+    vector<uint32_t> groups(static_cast<size_t>(maxCpu / CPUS_PER_MASK_GROUP + 1), 0);
+    for (int cpu : cpus) {
+        groups[static_cast<size_t>(cpu / CPUS_PER_MASK_GROUP)] |= 1u << (cpu % CPUS_PER_MASK_GROUP);
+    }
+    string mask;
+    char buffer[16]; // 16: one group of 8 hex digits
+    snprintf(buffer, sizeof(buffer), "%x", groups.back());
+    mask += buffer;
+    for (size_t i = groups.size() - 1; i-- > 0;) {
+        snprintf(buffer, sizeof(buffer), ",%0*x", CPUS_PER_MASK_GROUP / CPUS_PER_HEX_DIGIT, groups[i]);
+        mask += buffer;
+    }
+    return mask;
+}
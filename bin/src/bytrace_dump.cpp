@@ -0,0 +1,527 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_dump.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace std;
+namespace {
+const size_t TRANSFER_SIZE = 1024 * 1024; // bytes moved per sendfile/splice/read call
+const size_t BUFFER_ALIGN = 4096;
+const int PIPE_SIZE = 1024 * 1024;
+const size_t STAGE_BUFFER_SIZE = 256 * 1024;
+const int STAGE_BUFFER_COUNT = 4; // per queue: enough to keep both neighbours busy
+
+enum TransferResult { TRANSFER_DONE, TRANSFER_UNSUPPORTED, TRANSFER_ERROR };
+
+struct FreeDeleter {
+    void operator()(void* p) const
+    {
+        free(p);
+    }
+};
+
+bool IsUnsupported(int err)
+{
+    return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == EBADF || err == ESPIPE;
+}
+
+void CountSyscall(DumpStats& stats)
+{
+    stats.syscalls++;
+}
+
+TransferResult SendfileTrace(int traceFd, int outFd, DumpStats& stats)
+{
+    while (true) {
+        ssize_t n = sendfile(outFd, traceFd, nullptr, TRANSFER_SIZE);
+        CountSyscall(stats);
+        if (n > 0) {
+            stats.bytes += static_cast<uint64_t>(n);
+            continue;
+        } else if (n == 0) {
+            return TRANSFER_DONE;
+        } else if (errno == EINTR || errno == EAGAIN) {
+            continue;
+        }
+        // The file position of traceFd only advanced by what was sent, so any remainder can still be copied.
+        if (IsUnsupported(errno)) {
+            return TRANSFER_UNSUPPORTED;
+        }
+        fprintf(stderr, "Error: sendfile trace: %s (%d)\n", strerror(errno), errno);
+        return TRANSFER_ERROR;
+    }
+}
+
+// Move what is left in the pipe with plain reads when outFd cannot be spliced into.
+bool DrainPipe(int pipeFd, int outFd, size_t len, DumpStats& stats)
+{
+    unique_ptr<char[]> buffer = make_unique<char[]>(BUFFER_ALIGN);
+    while (len > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(read(pipeFd, buffer.get(), min(len, BUFFER_ALIGN)));
+        CountSyscall(stats);
+        if (n <= 0 || !WriteFully(outFd, buffer.get(), static_cast<size_t>(n))) {
+            return false;
+        }
+        stats.bytes += static_cast<uint64_t>(n);
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+TransferResult SpliceTrace(int traceFd, int outFd, DumpStats& stats)
+{
+    int pipeFds[2] = { -1, -1 };
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        return TRANSFER_UNSUPPORTED;
+    }
+    fcntl(pipeFds[1], F_SETPIPE_SZ, PIPE_SIZE);
+    TransferResult result = TRANSFER_DONE;
+    while (true) {
+        ssize_t in = TEMP_FAILURE_RETRY(splice(traceFd, nullptr, pipeFds[1], nullptr, TRANSFER_SIZE,
+            SPLICE_F_MOVE | SPLICE_F_MORE));
+        CountSyscall(stats);
+        if (in == 0) {
+            break;
+        } else if (in < 0) {
+            result = IsUnsupported(errno) ? TRANSFER_UNSUPPORTED : TRANSFER_ERROR;
+            break;
+        }
+        size_t left = static_cast<size_t>(in);
+        while (left > 0) {
+            ssize_t out = TEMP_FAILURE_RETRY(splice(pipeFds[0], nullptr, outFd, nullptr, left,
+                SPLICE_F_MOVE | SPLICE_F_MORE));
+            CountSyscall(stats);
+            if (out > 0) {
+                stats.bytes += static_cast<uint64_t>(out);
+                left -= static_cast<size_t>(out);
+                continue;
+            }
+            // Bytes already in the pipe must not be lost even if outFd refuses splice.
+            bool unsupported = out < 0 && IsUnsupported(errno);
+            bool drained = DrainPipe(pipeFds[0], outFd, left, stats);
+            result = (drained && unsupported) ? TRANSFER_UNSUPPORTED : TRANSFER_ERROR;
+            break;
+        }
+        if (result != TRANSFER_DONE) {
+            break;
+        }
+    }
+    if (result == TRANSFER_ERROR) {
+        fprintf(stderr, "Error: splice trace: %s (%d)\n", strerror(errno), errno);
+    }
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    return result;
+}
+
+bool CopyTrace(int traceFd, int outFd, DumpStats& stats)
+{
+    void* raw = nullptr;
+    if (posix_memalign(&raw, BUFFER_ALIGN, TRANSFER_SIZE) != 0) {
+        fprintf(stderr, "Error: couldn't allocate dump buffer.\n");
+        return false;
+    }
+    unique_ptr<char, FreeDeleter> buffer(static_cast<char*>(raw));
+    while (true) {
+        ssize_t n = TEMP_FAILURE_RETRY(read(traceFd, buffer.get(), TRANSFER_SIZE));
+        CountSyscall(stats);
+        if (n == 0) {
+            return true;
+        } else if (n < 0) {
+            fprintf(stderr, "Error: reading trace: %s (%d)\n", strerror(errno), errno);
+            return false;
+        }
+        if (!WriteFully(outFd, buffer.get(), static_cast<size_t>(n))) {
+            return false;
+        }
+        CountSyscall(stats);
+        stats.bytes += static_cast<uint64_t>(n);
+    }
+}
+
+struct DumpBuffer {
+    std::unique_ptr<char[]> data = std::make_unique<char[]>(STAGE_BUFFER_SIZE);
+    size_t len = 0;
+    bool eof = false;
+};
+
+// Unbounded FIFO of buffers; the bound comes from the fixed number of buffers in each pool.
+class BufferQueue {
+public:
+    void Push(DumpBuffer* buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(buffer);
+        cond_.notify_one();
+    }
+
+    // Returns nullptr once the queue has been aborted.
+    DumpBuffer* Pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return aborted_ || !queue_.empty(); });
+        if (aborted_) {
+            return nullptr;
+        }
+        DumpBuffer* buffer = queue_.front();
+        queue_.pop_front();
+        return buffer;
+    }
+
+    void Abort()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        aborted_ = true;
+        cond_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<DumpBuffer*> queue_;
+    bool aborted_ = false;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double ElapsedMs(Clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+class ZlibCompressor : public DumpCompressor {
+public:
+    ZlibCompressor()
+    {
+        int ret = deflateInit(&zs_, Z_DEFAULT_COMPRESSION);
+        if (ret != Z_OK) {
+            fprintf(stderr, "Error: initializing zlib: %d\n", ret);
+            return;
+        }
+        initialized_ = true;
+    }
+
+    ~ZlibCompressor() override
+    {
+        if (initialized_) {
+            deflateEnd(&zs_);
+        }
+    }
+
+    bool Compress(const char* data, size_t len, const DumpSink& sink) override
+    {
+        return Deflate(data, len, Z_NO_FLUSH, sink);
+    }
+
+    bool Finish(const DumpSink& sink) override
+    {
+        return Deflate(nullptr, 0, Z_FINISH, sink);
+    }
+
+private:
+    bool Deflate(const char* data, size_t len, int flush, const DumpSink& sink)
+    {
+        if (!initialized_) {
+            return false;
+        }
+        zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs_.avail_in = len;
+        do {
+            zs_.next_out = out_;
+            zs_.avail_out = sizeof(out_);
+            int ret = deflate(&zs_, flush);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                fprintf(stderr, "Error: deflate zlib: %d\n", ret);
+                return false;
+            }
+            size_t have = sizeof(out_) - zs_.avail_out;
+            if (have > 0 && !sink(out_, have)) {
+                return false;
+            }
+        } while (zs_.avail_out == 0);
+        return true;
+    }
+
+    z_stream zs_ {};
+    bool initialized_ = false;
+    Bytef out_[STAGE_BUFFER_SIZE];
+};
+
+class DumpPipeline {
+public:
+    DumpPipeline(int traceFd, int outFd, DumpCompressor& compressor)
+        : traceFd_(traceFd), outFd_(outFd), compressor_(compressor)
+    {
+        for (int i = 0; i < STAGE_BUFFER_COUNT; i++) {
+            buffers_.emplace_back(std::make_unique<DumpBuffer>());
+            readFree_.Push(buffers_.back().get());
+            buffers_.emplace_back(std::make_unique<DumpBuffer>());
+            writeFree_.Push(buffers_.back().get());
+        }
+    }
+
+    bool Run(const std::string& preamble, DumpStageStats& stats)
+    {
+        Clock::time_point begin = Clock::now();
+        std::thread reader(&DumpPipeline::ReadStage, this);
+        std::thread writer(&DumpPipeline::WriteStage, this);
+        CompressStage(preamble);
+        reader.join();
+        writer.join();
+        stats.totalMs = ElapsedMs(begin);
+        stats.readMs = readMs_;
+        stats.compressMs = compressMs_;
+        stats.writeMs = writeMs_;
+        stats.rawBytes = rawBytes_;
+        stats.outBytes = outBytes_;
+        return !failed_;
+    }
+
+private:
+    void Fail()
+    {
+        failed_ = true;
+        readFree_.Abort();
+        toCompress_.Abort();
+        writeFree_.Abort();
+        toWrite_.Abort();
+    }
+
+    void ReadStage()
+    {
+        while (true) {
+            DumpBuffer* buffer = readFree_.Pop();
+            if (buffer == nullptr) {
+                return;
+            }
+            Clock::time_point begin = Clock::now();
+            ssize_t n = TEMP_FAILURE_RETRY(read(traceFd_, buffer->data.get(), STAGE_BUFFER_SIZE));
+            readMs_ += ElapsedMs(begin);
+            if (n < 0) {
+                fprintf(stderr, "Error: reading trace: %s (%d)\n", strerror(errno), errno);
+                Fail();
+                return;
+            }
+            buffer->len = static_cast<size_t>(n);
+            buffer->eof = (n == 0);
+            rawBytes_ += buffer->len;
+            toCompress_.Push(buffer);
+            if (buffer->eof) {
+                return;
+            }
+        }
+    }
+
+    // Copies compressed output into writer buffers, handing each one over when it is full.
+    bool Emit(const void* data, size_t len, double& waitMs)
+    {
+        const char* p = static_cast<const char*>(data);
+        while (len > 0) {
+            if (current_ == nullptr) {
+                Clock::time_point begin = Clock::now();
+                current_ = writeFree_.Pop();
+                waitMs += ElapsedMs(begin);
+                if (current_ == nullptr) {
+                    return false;
+                }
+                current_->len = 0;
+                current_->eof = false;
+            }
+            size_t n = std::min(len, STAGE_BUFFER_SIZE - current_->len);
+            memcpy(current_->data.get() + current_->len, p, n);
+            current_->len += n;
+            p += n;
+            len -= n;
+            if (current_->len == STAGE_BUFFER_SIZE) {
+                toWrite_.Push(current_);
+                current_ = nullptr;
+            }
+        }
+        return true;
+    }
+
+    void CompressStage(const std::string& preamble)
+    {
+        double waitMs = 0;
+        DumpSink sink = [this, &waitMs](const void* data, size_t len) { return Emit(data, len, waitMs); };
+        Clock::time_point begin = Clock::now();
+        bool isTrue = compressor_.Compress(preamble.data(), preamble.size(), sink);
+        compressMs_ += ElapsedMs(begin);
+        while (isTrue) {
+            DumpBuffer* buffer = toCompress_.Pop();
+            if (buffer == nullptr) {
+                return;
+            }
+            begin = Clock::now();
+            if (buffer->eof) {
+                isTrue = compressor_.Finish(sink);
+            } else {
+                isTrue = compressor_.Compress(buffer->data.get(), buffer->len, sink);
+            }
+            compressMs_ += ElapsedMs(begin);
+            bool eof = buffer->eof;
+            readFree_.Push(buffer);
+            if (eof) {
+                break;
+            }
+        }
+        compressMs_ -= waitMs;
+        if (!isTrue) {
+            Fail();
+            return;
+        }
+        DumpBuffer* last = current_;
+        if (last == nullptr) {
+            last = writeFree_.Pop();
+            if (last == nullptr) {
+                return;
+            }
+            last->len = 0;
+        }
+        last->eof = true;
+        toWrite_.Push(last);
+        current_ = nullptr;
+    }
+
+    void WriteStage()
+    {
+        while (true) {
+            DumpBuffer* buffer = toWrite_.Pop();
+            if (buffer == nullptr) {
+                return;
+            }
+            Clock::time_point begin = Clock::now();
+            bool isTrue = WriteFully(outFd_, buffer->data.get(), buffer->len);
+            writeMs_ += ElapsedMs(begin);
+            if (!isTrue) {
+                Fail();
+                return;
+            }
+            outBytes_ += buffer->len;
+            bool eof = buffer->eof;
+            writeFree_.Push(buffer);
+            if (eof) {
+                return;
+            }
+        }
+    }
+
+    int traceFd_;
+    int outFd_;
+    DumpCompressor& compressor_;
+    std::vector<std::unique_ptr<DumpBuffer>> buffers_;
+    BufferQueue readFree_;
+    BufferQueue toCompress_;
+    BufferQueue writeFree_;
+    BufferQueue toWrite_;
+    DumpBuffer* current_ = nullptr;
+    std::atomic<bool> failed_ { false };
+    double readMs_ = 0;
+    double compressMs_ = 0;
+    double writeMs_ = 0;
+    uint64_t rawBytes_ = 0;
+    uint64_t outBytes_ = 0;
+};
+
+off_t Preallocate(int outFd, size_t sizeHint)
+{
+    struct stat st;
+    if (sizeHint == 0 || fstat(outFd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return -1;
+    }
+    off_t start = lseek(outFd, 0, SEEK_CUR);
+    if (start < 0 || fallocate(outFd, FALLOC_FL_KEEP_SIZE, start, static_cast<off_t>(sizeHint)) != 0) {
+        return -1;
+    }
+    return start;
+}
+} // namespace
+
+bool WriteFully(int fd, const void* data, size_t len)
+{
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, p, len));
+        if (n < 0) {
+            fprintf(stderr, "Error: writing trace: %s (%d)\n", strerror(errno), errno);
+            return false;
+        } else if (n == 0) {
+            fprintf(stderr, "Error: writing trace: no space left.\n");
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool DumpRawTrace(int traceFd, int outFd, size_t sizeHint, DumpStats* stats)
+{
+    DumpStats local;
+    DumpStats& st = (stats != nullptr) ? *stats : local;
+    off_t start = Preallocate(outFd, sizeHint);
+
+    bool isTrue = true;
+    st.method = DUMP_SENDFILE;
+    TransferResult result = SendfileTrace(traceFd, outFd, st);
+    if (result == TRANSFER_UNSUPPORTED) {
+        st.method = DUMP_SPLICE;
+        result = SpliceTrace(traceFd, outFd, st);
+    }
+    if (result == TRANSFER_UNSUPPORTED) {
+        st.method = DUMP_COPY;
+        isTrue = CopyTrace(traceFd, outFd, st);
+    } else {
+        isTrue = (result == TRANSFER_DONE);
+    }
+
+    if (start >= 0) {
+        // Give back the preallocated blocks past the end of what was written.
+        off_t end = lseek(outFd, 0, SEEK_CUR);
+        if (end >= 0 && ftruncate(outFd, end) != 0) {
+            fprintf(stderr, "Warning: trimming output: %s (%d)\n", strerror(errno), errno);
+        }
+    }
+    return isTrue;
+}
+
+std::unique_ptr<DumpCompressor> CreateZlibCompressor()
+{
+    return std::make_unique<ZlibCompressor>();
+}
+
+bool DumpPipelined(int traceFd, int outFd, DumpCompressor& compressor, const std::string& preamble,
+    DumpStageStats* stats)
+{
+    DumpStageStats local;
+    DumpPipeline pipeline(traceFd, outFd, compressor);
+    return pipeline.Run(preamble, (stats != nullptr) ? *stats : local);
+}
@@ -0,0 +1,961 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_event_format.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+using namespace std;
+
+struct EventFormat::Expr {
+    enum Op : uint8_t {
+        NUM, STR, FIELD, GET_STR, CAST, NEG, NOT, BIT_NOT,
+        MUL, DIV, MOD, ADD, SUB, SHL, SHR, LT, GT, LE, GE, EQ, NE, BIT_AND, BIT_XOR, BIT_OR, AND, OR,
+        COND, PRINT_FLAGS, PRINT_SYMBOLIC,
+    };
+    Op op = NUM;
+    bool isUnsigned = false; // of NUM and CAST
+    uint8_t castBytes = 0;
+    int64_t num = 0;
+    string str; // of STR, and the delimiter of PRINT_FLAGS
+    const EventField* field = nullptr;
+    unique_ptr<Expr> args[3]; // 3: the most operands, of "?:"
+    vector<pair<uint64_t, string>> symbols; // of PRINT_FLAGS and PRINT_SYMBOLIC
+};
+
+struct EventFormat::Conversion {
+    string prefix; // literal text ahead of the conversion
+    string spec;   // printf conversion, with "ll" as the length of an integer
+    char type = 's'; // 'd' signed, 'u' unsigned, 'c', 's' or 'p'
+    uint8_t bits = 32; // of an integer argument
+};
+
+namespace {
+const int MAX_SPEC_WIDTH = 200; // of a conversion, so that a number always fits the format buffer
+const size_t FORMAT_BUFFER_SIZE = 256;
+const int BITS_PER_BYTE = 8;
+const int INT64_BITS = 64;
+const uint32_t DATA_LOC_OFFSET_MASK = 0xffff;
+const int DATA_LOC_LENGTH_SHIFT = 16;
+
+using Expr = EventFormat::Expr;
+
+struct EventValue {
+    int64_t num = 0;
+    bool isUnsigned = false;
+    bool isString = false;
+    string str;
+};
+
+bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool IsIdentChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+string_view Trim(string_view text)
+{
+    while (!text.empty() && IsSpace(text.front())) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && IsSpace(text.back())) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// The number after key up to the next ';', e.g. "offset:8;".
+bool ParseAttribute(string_view line, string_view key, uint64_t& value)
+{
+    size_t pos = line.find(key);
+    if (pos == string_view::npos) {
+        return false;
+    }
+    string number(Trim(line.substr(pos + key.size(), line.find(';', pos) - pos - key.size())));
+    char* end = nullptr;
+    value = strtoull(number.c_str(), &end, 10); // 10: decimal
+    return !number.empty() && *end == '\0';
+}
+
+int64_t Truncate(uint64_t value, int bits, bool isSigned)
+{
+    if (bits >= INT64_BITS) {
+        return static_cast<int64_t>(value);
+    }
+    uint64_t mask = (1ULL << bits) - 1;
+    value &= mask;
+    if (isSigned && (value >> (bits - 1)) != 0) {
+        value |= ~mask;
+    }
+    return static_cast<int64_t>(value);
+}
+
+void AppendFormat(string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+void AppendFormat(string& out, const char* format, ...)
+{
+    char buffer[FORMAT_BUFFER_SIZE];
+    va_list args;
+    va_start(args, format);
+    va_list retry;
+    va_copy(retry, args);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len >= static_cast<int>(sizeof(buffer))) {
+        size_t pos = out.size();
+        out.resize(pos + len + 1);
+        vsnprintf(&out[pos], len + 1, format, retry);
+        out.resize(pos + len);
+    } else if (len > 0) {
+        out.append(buffer, len);
+    }
+    va_end(retry);
+}
+
+// Sizes of the type names a cast of a print fmt may use, 8 for a pointer; 0 when it is not a type.
+int TypeBytes(const vector<string_view>& words, bool isPointer, bool& isSigned)
+{
+    static const struct {
+        const char* name;
+        int bytes;
+        bool isSigned;
+    } typedefs[] = {
+        { "u8", 1, false }, { "s8", 1, true }, { "u16", 2, false }, { "s16", 2, true }, { "u32", 4, false },
+        { "s32", 4, true }, { "u64", 8, false }, { "s64", 8, true }, { "__u8", 1, false }, { "__s8", 1, true },
+        { "__u16", 2, false }, { "__s16", 2, true }, { "__u32", 4, false }, { "__s32", 4, true },
+        { "__u64", 8, false }, { "__s64", 8, true }, { "uint8_t", 1, false }, { "int8_t", 1, true },
+        { "uint16_t", 2, false }, { "int16_t", 2, true }, { "uint32_t", 4, false }, { "int32_t", 4, true },
+        { "uint64_t", 8, false }, { "int64_t", 8, true }, { "size_t", 8, false }, { "ssize_t", 8, true },
+        { "pid_t", 4, true }, { "gfp_t", 4, false }, { "dev_t", 4, false }, { "loff_t", 8, true },
+        { "sector_t", 8, false }, { "ino_t", 8, false }, { "umode_t", 2, false }, { "bool", 1, false },
+        { "_Bool", 1, false }, { "char", 1, true }, { "short", 2, true }, { "int", 4, true },
+        { "long", 8, true }, // long is 64 bits on the 64-bit kernels whose traces are decoded
+    };
+    int bytes = 0;
+    bool isUnsigned = false;
+    bool isVoid = false;
+    bool isStruct = false;
+    isSigned = true;
+    for (string_view word : words) {
+        if (isStruct) {
+            isStruct = false;
+            bytes = -1;
+        } else if (word == "unsigned") {
+            isUnsigned = true;
+        } else if (word == "signed" || word == "const" || word == "volatile") {
+            continue;
+        } else if (word == "void") {
+            isVoid = true;
+        } else if (word == "struct" || word == "enum") {
+            isStruct = true;
+        } else {
+            auto it = find_if(begin(typedefs), end(typedefs), [word](const auto& t) { return word == t.name; });
+            if (it == end(typedefs)) {
+                return 0;
+            }
+            // "long long", "short int", "long int": the widest word wins.
+            bytes = max(bytes, it->bytes);
+            isSigned = it->isSigned;
+        }
+    }
+    if (isPointer) {
+        isSigned = false;
+        return words.empty() ? 0 : sizeof(uint64_t);
+    }
+    if (isVoid || isStruct || bytes < 0) {
+        return 0;
+    }
+    if (bytes == 0 && isUnsigned) {
+        bytes = sizeof(int32_t);
+    }
+    isSigned = isSigned && !isUnsigned;
+    return bytes;
+}
+
+/**
+ * Recursive descent parser of the arguments of a print fmt, with the precedence of C.
+ */
+class PrintFormatParser {
+public:
+    PrintFormatParser(string_view text, const vector<EventField>& fields) : text_(text), fields_(fields)
+    {
+        Advance();
+    }
+
+    bool AtEnd() const
+    {
+        return kind_ == TOKEN_END;
+    }
+    bool Accept(string_view punct)
+    {
+        if (kind_ == TOKEN_PUNCT && token_ == punct) {
+            Advance();
+            return true;
+        }
+        return false;
+    }
+    // One or more adjacent string literals.
+    bool ParseString(string& value)
+    {
+        if (kind_ != TOKEN_STR) {
+            return false;
+        }
+        value.clear();
+        while (kind_ == TOKEN_STR) {
+            value += str_;
+            Advance();
+        }
+        return true;
+    }
+    unique_ptr<Expr> ParseExpr();
+
+private:
+    enum TokenKind { TOKEN_END, TOKEN_NUM, TOKEN_STR, TOKEN_IDENT, TOKEN_PUNCT, TOKEN_ERROR };
+
+    void Advance();
+    bool LexString();
+    unique_ptr<Expr> ParseBinary(int level);
+    unique_ptr<Expr> ParseUnary();
+    unique_ptr<Expr> ParseCast();
+    unique_ptr<Expr> ParsePrimary();
+    unique_ptr<Expr> ParseFunction(string_view name);
+    bool ParseSymbols(Expr& expr);
+    const EventField* FindField(string_view name) const
+    {
+        for (const auto& field : fields_) {
+            if (field.name == name) {
+                return &field;
+            }
+        }
+        return nullptr;
+    }
+
+    string_view text_;
+    const vector<EventField>& fields_;
+    size_t pos_ = 0;
+    TokenKind kind_ = TOKEN_END;
+    string_view token_;
+    uint64_t num_ = 0;
+    bool numUnsigned_ = false;
+    string str_;
+};
+
+void PrintFormatParser::Advance()
+{
+    while (pos_ < text_.size() && IsSpace(text_[pos_])) {
+        pos_++;
+    }
+    size_t begin = pos_;
+    if (pos_ >= text_.size()) {
+        kind_ = TOKEN_END;
+        token_ = string_view();
+        return;
+    }
+    char c = text_[pos_];
+    if (c == '"') {
+        kind_ = LexString() ? TOKEN_STR : TOKEN_ERROR;
+    } else if (c >= '0' && c <= '9') {
+        while (pos_ < text_.size() && IsIdentChar(text_[pos_])) {
+            pos_++;
+        }
+        string number(text_.substr(begin, pos_ - begin));
+        char* end = nullptr;
+        num_ = strtoull(number.c_str(), &end, 0); // 0: decimal, hex or octal as in C
+        numUnsigned_ = false;
+        kind_ = TOKEN_NUM;
+        for (; *end != '\0'; end++) {
+            if (*end == 'u' || *end == 'U') {
+                numUnsigned_ = true;
+            } else if (*end != 'l' && *end != 'L') {
+                kind_ = TOKEN_ERROR;
+            }
+        }
+    } else if (c == '\'' && pos_ + 2 < text_.size() && text_[pos_ + 2] == '\'') { // 2: 'c'
+        num_ = static_cast<unsigned char>(text_[pos_ + 1]);
+        numUnsigned_ = false;
+        pos_ += 3; // 3: 'c'
+        kind_ = TOKEN_NUM;
+    } else if (IsIdentChar(c)) {
+        while (pos_ < text_.size() && IsIdentChar(text_[pos_])) {
+            pos_++;
+        }
+        kind_ = TOKEN_IDENT;
+    } else {
+        static const char* twoCharPuncts[] = { "->", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||" };
+        pos_++;
+        for (const char* punct : twoCharPuncts) {
+            if (text_.compare(begin, 2, punct) == 0) { // 2: the length of punct
+                pos_++;
+                break;
+            }
+        }
+        kind_ = TOKEN_PUNCT;
+    }
+    token_ = text_.substr(begin, pos_ - begin);
+}
+
+bool PrintFormatParser::LexString()
+{
+    str_.clear();
+    for (pos_++; pos_ < text_.size(); pos_++) {
+        char c = text_[pos_];
+        if (c == '"') {
+            pos_++;
+            return true;
+        } else if (c != '\\') {
+            str_ += c;
+            continue;
+        }
+        if (++pos_ >= text_.size()) {
+            return false;
+        }
+        switch (text_[pos_]) {
+            case 'n': str_ += '\n'; break;
+            case 't': str_ += '\t'; break;
+            case 'r': str_ += '\r'; break;
+            case '0': str_ += '\0'; break;
+            default: str_ += text_[pos_]; break;
+        }
+    }
+    return false;
+}
+
+unique_ptr<Expr> PrintFormatParser::ParseExpr()
+{
+    auto cond = ParseBinary(0);
+    if (cond == nullptr || !Accept("?")) {
+        return cond;
+    }
+    auto expr = make_unique<Expr>();
+    expr->op = Expr::COND;
+    expr->args[0] = move(cond);
+    expr->args[1] = ParseExpr();
+    if (expr->args[1] == nullptr || !Accept(":")) {
+        return nullptr;
+    }
+    expr->args[2] = ParseExpr(); // 2: the operand when false
+    return expr->args[2] != nullptr ? move(expr) : nullptr;
+}
+
+unique_ptr<Expr> PrintFormatParser::ParseBinary(int level)
+{
+    // Binary operators from the loosest binding to the tightest.
+    static const vector<vector<pair<string_view, Expr::Op>>> levels = {
+        { { "||", Expr::OR } },
+        { { "&&", Expr::AND } },
+        { { "|", Expr::BIT_OR } },
+        { { "^", Expr::BIT_XOR } },
+        { { "&", Expr::BIT_AND } },
+        { { "==", Expr::EQ }, { "!=", Expr::NE } },
+        { { "<", Expr::LT }, { ">", Expr::GT }, { "<=", Expr::LE }, { ">=", Expr::GE } },
+        { { "<<", Expr::SHL }, { ">>", Expr::SHR } },
+        { { "+", Expr::ADD }, { "-", Expr::SUB } },
+        { { "*", Expr::MUL }, { "/", Expr::DIV }, { "%", Expr::MOD } },
+    };
+    if (level >= static_cast<int>(levels.size())) {
+        return ParseUnary();
+    }
+    auto left = ParseBinary(level + 1);
+    while (left != nullptr && kind_ == TOKEN_PUNCT) {
+        const auto& ops = levels[level];
+        auto it = find_if(ops.begin(), ops.end(), [this](const auto& op) { return op.first == token_; });
+        if (it == ops.end()) {
+            break;
+        }
+        Advance();
+        auto expr = make_unique<Expr>();
+        expr->op = it->second;
+        expr->args[0] = move(left);
+        expr->args[1] = ParseBinary(level + 1);
+        if (expr->args[1] == nullptr) {
+            return nullptr;
+        }
+        left = move(expr);
+    }
+    return left;
+}
+
+unique_ptr<Expr> PrintFormatParser::ParseUnary()
+{
+    static const pair<string_view, Expr::Op> unaryOps[] = {
+        { "-", Expr::NEG }, { "!", Expr::NOT }, { "~", Expr::BIT_NOT },
+    };
+    if (kind_ == TOKEN_PUNCT) {
+        if (Accept("+")) {
+            return ParseUnary();
+        }
+        for (const auto& unaryOp : unaryOps) {
+            if (Accept(unaryOp.first)) {
+                auto expr = make_unique<Expr>();
+                expr->op = unaryOp.second;
+                expr->args[0] = ParseUnary();
+                return expr->args[0] != nullptr ? move(expr) : nullptr;
+            }
+        }
+        if (token_ == "(") {
+            return ParseCast();
+        }
+    }
+    return ParsePrimary();
+}
+
+// "(type) operand", or a parenthesized expression.
+unique_ptr<Expr> PrintFormatParser::ParseCast()
+{
+    size_t savedPos = pos_;
+    Advance();
+    vector<string_view> words;
+    while (kind_ == TOKEN_IDENT) {
+        words.push_back(token_);
+        Advance();
+    }
+    bool isPointer = false;
+    while (kind_ == TOKEN_PUNCT && token_ == "*") {
+        isPointer = true;
+        Advance();
+    }
+    bool isSigned = true;
+    int bytes = TypeBytes(words, isPointer, isSigned);
+    if (bytes > 0 && Accept(")")) {
+        auto expr = make_unique<Expr>();
+        expr->op = Expr::CAST;
+        expr->castBytes = static_cast<uint8_t>(bytes);
+        expr->isUnsigned = !isSigned;
+        expr->args[0] = ParseUnary();
+        return expr->args[0] != nullptr ? move(expr) : nullptr;
+    }
+    pos_ = savedPos;
+    Advance();
+    auto expr = ParseExpr();
+    return expr != nullptr && Accept(")") ? move(expr) : nullptr;
+}
+
+unique_ptr<Expr> PrintFormatParser::ParsePrimary()
+{
+    auto expr = make_unique<Expr>();
+    if (kind_ == TOKEN_NUM) {
+        expr->num = static_cast<int64_t>(num_);
+        expr->isUnsigned = numUnsigned_;
+        Advance();
+        return expr;
+    } else if (kind_ == TOKEN_STR) {
+        expr->op = Expr::STR;
+        ParseString(expr->str);
+        return expr;
+    } else if (kind_ != TOKEN_IDENT) {
+        return nullptr;
+    }
+    string_view name = token_;
+    Advance();
+    if (name != "REC") {
+        return ParseFunction(name);
+    } else if (!Accept("->") || kind_ != TOKEN_IDENT) {
+        return nullptr;
+    }
+    expr->op = Expr::FIELD;
+    expr->field = FindField(token_);
+    Advance();
+    if (expr->field == nullptr || expr->field->kind == EVENT_FIELD_ARRAY) {
+        return nullptr;
+    }
+    return expr;
+}
+
+unique_ptr<Expr> PrintFormatParser::ParseFunction(string_view name)
+{
+    if (!Accept("(")) {
+        return nullptr;
+    }
+    auto expr = make_unique<Expr>();
+    if (name == "__get_str" || name == "__get_dynamic_array") {
+        expr->op = Expr::GET_STR;
+        expr->field = kind_ == TOKEN_IDENT ? FindField(token_) : nullptr;
+        Advance();
+        bool isString = expr->field != nullptr &&
+            (expr->field->kind == EVENT_FIELD_DATA_LOC || expr->field->kind == EVENT_FIELD_CHARS);
+        return isString && Accept(")") ? move(expr) : nullptr;
+    } else if (name == "__print_flags" || name == "__print_symbolic") {
+        expr->op = name == "__print_flags" ? Expr::PRINT_FLAGS : Expr::PRINT_SYMBOLIC;
+        expr->args[0] = ParseExpr();
+        if (expr->args[0] == nullptr || !Accept(",")) {
+            return nullptr;
+        }
+        if (expr->op == Expr::PRINT_FLAGS && (!ParseString(expr->str) || !Accept(","))) {
+            return nullptr;
+        }
+        return ParseSymbols(*expr) && Accept(")") ? move(expr) : nullptr;
+    }
+    return nullptr;
+}
+
+EventValue Evaluate(const Expr& expr, const uint8_t* data, size_t size);
+
+// "{ value, "name" }, ..." of __print_flags() and __print_symbolic(); the values are constants.
+bool PrintFormatParser::ParseSymbols(Expr& expr)
+{
+    do {
+        string symbol;
+        if (!Accept("{")) {
+            return false;
+        }
+        auto value = ParseExpr();
+        if (value == nullptr || !Accept(",") || !ParseString(symbol) || !Accept("}")) {
+            return false;
+        }
+        expr.symbols.emplace_back(static_cast<uint64_t>(Evaluate(*value, nullptr, 0).num), symbol);
+    } while (Accept(","));
+    return true;
+}
+
+// kernel/trace/trace_output.c: trace_print_flags_seq() and trace_print_symbols_seq().
+string PrintSymbols(const Expr& expr, uint64_t value)
+{
+    string text;
+    if (expr.op == Expr::PRINT_SYMBOLIC) {
+        for (const auto& symbol : expr.symbols) {
+            if (symbol.first == value) {
+                return symbol.second;
+            }
+        }
+        AppendFormat(text, "0x%llx", static_cast<unsigned long long>(value));
+        return text;
+    }
+    bool first = true;
+    for (size_t i = 0; i < expr.symbols.size() && value != 0; i++) {
+        uint64_t mask = expr.symbols[i].first;
+        if ((value & mask) != mask) {
+            continue;
+        }
+        value &= ~mask;
+        if (!first) {
+            text += expr.str;
+        }
+        first = false;
+        text += expr.symbols[i].second;
+    }
+    if (value != 0) {
+        if (!first) {
+            text += expr.str;
+        }
+        AppendFormat(text, "0x%llx", static_cast<unsigned long long>(value));
+    }
+    return text;
+}
+
+EventValue EvaluateBinary(Expr::Op op, const EventValue& left, const EventValue& right)
+{
+    EventValue result;
+    bool isUnsigned = left.isUnsigned || right.isUnsigned;
+    uint64_t ul = static_cast<uint64_t>(left.num);
+    uint64_t ur = static_cast<uint64_t>(right.num);
+    int64_t sl = left.num;
+    int64_t sr = right.num;
+    bool isDivisible = sr != 0 && (isUnsigned || sl != INT64_MIN || sr != -1);
+    switch (op) {
+        case Expr::MUL: ul *= ur; break;
+        case Expr::DIV: ul = !isDivisible ? 0 : isUnsigned ? ul / ur : static_cast<uint64_t>(sl / sr); break;
+        case Expr::MOD: ul = !isDivisible ? 0 : isUnsigned ? ul % ur : static_cast<uint64_t>(sl % sr); break;
+        case Expr::ADD: ul += ur; break;
+        case Expr::SUB: ul -= ur; break;
+        case Expr::SHL: ul <<= (ur % INT64_BITS); break;
+        case Expr::SHR: ul = isUnsigned ? ul >> (ur % INT64_BITS) : static_cast<uint64_t>(sl >> (ur % INT64_BITS)); break;
+        case Expr::LT: ul = isUnsigned ? ul < ur : sl < sr; isUnsigned = false; break;
+        case Expr::GT: ul = isUnsigned ? ul > ur : sl > sr; isUnsigned = false; break;
+        case Expr::LE: ul = isUnsigned ? ul <= ur : sl <= sr; isUnsigned = false; break;
+        case Expr::GE: ul = isUnsigned ? ul >= ur : sl >= sr; isUnsigned = false; break;
+        case Expr::EQ: ul = ul == ur; isUnsigned = false; break;
+        case Expr::NE: ul = ul != ur; isUnsigned = false; break;
+        case Expr::BIT_AND: ul &= ur; break;
+        case Expr::BIT_XOR: ul ^= ur; break;
+        case Expr::BIT_OR: ul |= ur; break;
+        default: break;
+    }
+    result.num = static_cast<int64_t>(ul);
+    result.isUnsigned = isUnsigned;
+    return result;
+}
+
+bool IsTrue(const EventValue& value)
+{
+    return value.isString || value.num != 0;
+}
+
+EventValue Evaluate(const Expr& expr, const uint8_t* data, size_t size)
+{
+    EventValue value;
+    switch (expr.op) {
+        case Expr::NUM:
+            value.num = expr.num;
+            value.isUnsigned = expr.isUnsigned;
+            break;
+        case Expr::STR:
+            value.isString = true;
+            value.str = expr.str;
+            break;
+        case Expr::FIELD:
+            if (expr.field->kind == EVENT_FIELD_CHARS) {
+                value.isString = true;
+                value.str = EventFormat::ReadString(*expr.field, data, size);
+            } else {
+                value.num = EventFormat::ReadInt(*expr.field, data, size);
+                value.isUnsigned = !expr.field->isSigned;
+            }
+            break;
+        case Expr::GET_STR:
+            value.isString = true;
+            value.str = EventFormat::ReadString(*expr.field, data, size);
+            break;
+        case Expr::CAST:
+            value = Evaluate(*expr.args[0], data, size);
+            if (!value.isString) {
+                value.num = Truncate(static_cast<uint64_t>(value.num), expr.castBytes * BITS_PER_BYTE,
+                    !expr.isUnsigned);
+                value.isUnsigned = expr.isUnsigned;
+            }
+            break;
+        case Expr::NEG:
+            value = Evaluate(*expr.args[0], data, size);
+            value.num = static_cast<int64_t>(0 - static_cast<uint64_t>(value.num));
+            break;
+        case Expr::NOT:
+            value.num = !IsTrue(Evaluate(*expr.args[0], data, size));
+            break;
+        case Expr::BIT_NOT:
+            value = Evaluate(*expr.args[0], data, size);
+            value.num = ~value.num;
+            break;
+        case Expr::AND:
+            value.num = IsTrue(Evaluate(*expr.args[0], data, size)) && IsTrue(Evaluate(*expr.args[1], data, size));
+            break;
+        case Expr::OR:
+            value.num = IsTrue(Evaluate(*expr.args[0], data, size)) || IsTrue(Evaluate(*expr.args[1], data, size));
+            break;
+        case Expr::COND:
+            return Evaluate(*expr.args[IsTrue(Evaluate(*expr.args[0], data, size)) ? 1 : 2], data, size);
+        case Expr::PRINT_FLAGS:
+        case Expr::PRINT_SYMBOLIC:
+            value.isString = true;
+            value.str = PrintSymbols(expr, static_cast<uint64_t>(Evaluate(*expr.args[0], data, size).num));
+            break;
+        default:
+            return EvaluateBinary(expr.op, Evaluate(*expr.args[0], data, size), Evaluate(*expr.args[1], data, size));
+    }
+    return value;
+}
+
+// The conversions of a printf format of the kernel, in the order of their arguments.
+bool ParseConversions(const string& format, vector<EventFormat::Conversion>& conversions, string& tail)
+{
+    string literal;
+    size_t pos = 0;
+    while (pos < format.size()) {
+        char c = format[pos++];
+        if (c != '%') {
+            literal += c;
+            continue;
+        } else if (pos < format.size() && format[pos] == '%') {
+            literal += format[pos++];
+            continue;
+        }
+        size_t begin = pos;
+        while (pos < format.size() && strchr("-+ #0", format[pos]) != nullptr) {
+            pos++;
+        }
+        int width = 0;
+        while (pos < format.size() && format[pos] >= '0' && format[pos] <= '9') {
+            width = width * 10 + (format[pos++] - '0'); // 10: decimal
+            if (width > MAX_SPEC_WIDTH) {
+                return false;
+            }
+        }
+        if (pos < format.size() && format[pos] == '.') {
+            pos++;
+            while (pos < format.size() && format[pos] >= '0' && format[pos] <= '9') {
+                pos++;
+            }
+        }
+        string flags = format.substr(begin, pos - begin);
+        EventFormat::Conversion conversion;
+        int longs = 0;
+        int shorts = 0;
+        while (pos < format.size() && strchr("hlLzjtq", format[pos]) != nullptr) {
+            char length = format[pos++];
+            length == 'h' ? shorts++ : longs++;
+        }
+        conversion.bits = longs > 0 ? INT64_BITS : shorts == 1 ? 16 : shorts > 1 ? 8 : 32; // 16, 8, 32: bits
+        if (pos >= format.size()) {
+            return false;
+        }
+        char type = format[pos++];
+        if (type == 'd' || type == 'i') {
+            conversion.type = 'd';
+            conversion.spec = "%" + flags + "lld";
+        } else if (type == 'u' || type == 'x' || type == 'X' || type == 'o') {
+            conversion.type = 'u';
+            conversion.spec = "%" + flags + "ll" + type;
+        } else if (type == 'c' || type == 's') {
+            conversion.type = type;
+            conversion.spec = "%" + flags + type;
+        } else if (type == 'p') {
+            // Like vsnprintf() of the kernel, the extension of %p is every alphanumeric that follows.
+            while (pos < format.size() && IsIdentChar(format[pos]) && format[pos] != '_') {
+                pos++;
+            }
+            conversion.type = 'p';
+            conversion.bits = INT64_BITS;
+            conversion.spec = "0x%llx";
+        } else {
+            return false;
+        }
+        conversion.prefix = move(literal);
+        literal.clear();
+        conversions.push_back(move(conversion));
+    }
+    tail = move(literal);
+    return true;
+}
+
+void AppendConversion(const EventFormat::Conversion& conversion, const EventValue& value, string& out)
+{
+    const char* spec = conversion.spec.c_str();
+    switch (conversion.type) {
+        case 'd':
+            AppendFormat(out, spec, static_cast<long long>(Truncate(value.num, conversion.bits, true)));
+            break;
+        case 'u':
+        case 'p':
+            AppendFormat(out, spec, static_cast<unsigned long long>(Truncate(value.num, conversion.bits, false)));
+            break;
+        case 'c':
+            AppendFormat(out, spec, static_cast<int>(static_cast<unsigned char>(value.num)));
+            break;
+        default:
+            if (!value.isString) {
+                AppendFormat(out, "%lld", static_cast<long long>(value.num));
+            } else if (conversion.spec == "%s") {
+                out += value.str;
+            } else {
+                AppendFormat(out, spec, value.str.c_str());
+            }
+            break;
+    }
+}
+} // namespace
+
+bool ParseEventFields(string_view text, vector<EventField>& fields)
+{
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        string_view line = text.substr(pos, end == string_view::npos ? string_view::npos : end - pos);
+        pos = end == string_view::npos ? text.size() : end + 1;
+        if (line.compare(0, strlen("print fmt:"), "print fmt:") == 0) {
+            break;
+        }
+        size_t fieldPos = line.find("field:");
+        size_t declEnd = line.find(';');
+        if (fieldPos == string_view::npos || declEnd == string_view::npos || declEnd < fieldPos) {
+            continue;
+        }
+        string_view decl = Trim(line.substr(fieldPos + strlen("field:"), declEnd - fieldPos - strlen("field:")));
+        EventField field;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint64_t isSigned = 0;
+        if (!ParseAttribute(line, "offset:", offset) || !ParseAttribute(line, "size:", size) ||
+            offset > UINT16_MAX || size > UINT16_MAX) {
+            return false;
+        }
+        field.offset = static_cast<uint16_t>(offset);
+        field.size = static_cast<uint16_t>(size);
+        field.isSigned = ParseAttribute(line, "signed:", isSigned) && isSigned != 0;
+
+        // "<type> <name>[<length>]": the array length goes to the type.
+        string_view array;
+        if (!decl.empty() && decl.back() == ']') {
+            size_t bracket = decl.rfind('[');
+            array = decl.substr(bracket);
+            decl = Trim(decl.substr(0, bracket));
+        }
+        size_t nameBegin = decl.size();
+        while (nameBegin > 0 && IsIdentChar(decl[nameBegin - 1])) {
+            nameBegin--;
+        }
+        field.name = string(decl.substr(nameBegin));
+        field.type = string(Trim(decl.substr(0, nameBegin))) + string(array);
+        if (field.name.empty()) {
+            return false;
+        }
+        if (field.type.compare(0, strlen("__data_loc"), "__data_loc") == 0) {
+            field.kind = EVENT_FIELD_DATA_LOC;
+        } else if (!array.empty() || field.type.find('[') != string::npos) {
+            field.kind = field.type.find("char") != string::npos ? EVENT_FIELD_CHARS : EVENT_FIELD_ARRAY;
+        } else if (size != sizeof(uint8_t) && size != sizeof(uint16_t) && size != sizeof(uint32_t) &&
+            size != sizeof(uint64_t)) {
+            field.kind = EVENT_FIELD_ARRAY;
+        }
+        fields.push_back(move(field));
+    }
+    return true;
+}
+
+EventFormat::EventFormat() = default;
+
+EventFormat::~EventFormat() = default;
+
+bool EventFormat::Parse(const string& system, string_view text)
+{
+    system_ = system;
+    size_t pos = 0;
+    bool hasId = false;
+    string_view printFormat;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        string_view line = text.substr(pos, end == string_view::npos ? string_view::npos : end - pos);
+        pos = end == string_view::npos ? text.size() : end + 1;
+        if (line.compare(0, strlen("name:"), "name:") == 0) {
+            name_ = string(Trim(line.substr(strlen("name:"))));
+        } else if (line.compare(0, strlen("ID:"), "ID:") == 0) {
+            string id(Trim(line.substr(strlen("ID:"))));
+            char* idEnd = nullptr;
+            unsigned long value = strtoul(id.c_str(), &idEnd, 10); // 10: decimal
+            hasId = !id.empty() && *idEnd == '\0' && value <= UINT16_MAX;
+            id_ = static_cast<uint16_t>(value);
+        } else if (line.compare(0, strlen("print fmt:"), "print fmt:") == 0) {
+            printFormat = Trim(line.substr(strlen("print fmt:")));
+        }
+    }
+    if (name_.empty() || !hasId || !ParseEventFields(text, fields_)) {
+        return false;
+    }
+    printable_ = CompilePrintFormat(printFormat);
+    return true;
+}
+
+bool EventFormat::CompilePrintFormat(string_view text)
+{
+    PrintFormatParser parser(text, fields_);
+    string format;
+    if (!parser.ParseString(format)) {
+        return false;
+    }
+    vector<unique_ptr<Expr>> args;
+    while (parser.Accept(",")) {
+        auto arg = parser.ParseExpr();
+        if (arg == nullptr) {
+            return false;
+        }
+        args.push_back(move(arg));
+    }
+    vector<Conversion> conversions;
+    string tail;
+    if (!parser.AtEnd() || !ParseConversions(format, conversions, tail) || conversions.size() != args.size()) {
+        return false;
+    }
+    conversions_ = move(conversions);
+    args_ = move(args);
+    tail_ = move(tail);
+    return true;
+}
+
+const EventField* EventFormat::FindField(string_view name) const
+{
+    for (const auto& field : fields_) {
+        if (field.name == name) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+int64_t EventFormat::ReadInt(const EventField& field, const uint8_t* data, size_t size)
+{
+    if (field.size > sizeof(uint64_t) || static_cast<size_t>(field.offset) + field.size > size) {
+        return 0;
+    }
+    uint64_t value = 0;
+    memcpy(&value, data + field.offset, field.size); // the ring buffer has the byte order of the CPU
+    return Truncate(value, field.size * BITS_PER_BYTE, field.isSigned);
+}
+
+string_view EventFormat::ReadString(const EventField& field, const uint8_t* data, size_t size)
+{
+    size_t offset = field.offset;
+    size_t length = field.size;
+    if (field.kind == EVENT_FIELD_DATA_LOC) {
+        uint32_t loc = static_cast<uint32_t>(ReadInt(field, data, size));
+        offset = loc & DATA_LOC_OFFSET_MASK;
+        length = loc >> DATA_LOC_LENGTH_SHIFT;
+    } else if (length == 0 && offset <= size) {
+        length = size - offset; // char name[], to the end of the record
+    }
+    if (offset + length > size) {
+        return string_view();
+    }
+    const char* text = reinterpret_cast<const char*>(data + offset);
+    return string_view(text, strnlen(text, length));
+}
+
+void EventFormat::FormatPayload(const uint8_t* data, size_t size, string& out) const
+{
+    if (!printable_) {
+        FormatFields(data, size, out);
+        return;
+    }
+    for (size_t i = 0; i < conversions_.size(); i++) {
+        out += conversions_[i].prefix;
+        AppendConversion(conversions_[i], Evaluate(*args_[i], data, size), out);
+    }
+    out += tail_;
+}
+
+// "name=value ..." of the fields after the common ones, as libtraceevent prints an event it cannot.
+void EventFormat::FormatFields(const uint8_t* data, size_t size, string& out) const
+{
+    bool first = true;
+    for (const auto& field : fields_) {
+        if (field.name.compare(0, strlen("common_"), "common_") == 0) {
+            continue;
+        }
+        out += first ? "" : " ";
+        first = false;
+        out += field.name;
+        out += '=';
+        if (field.kind == EVENT_FIELD_INT) {
+            int64_t value = ReadInt(field, data, size);
+            if (field.isSigned) {
+                AppendFormat(out, "%lld", static_cast<long long>(value));
+            } else {
+                AppendFormat(out, "%llu", static_cast<unsigned long long>(value));
+            }
+        } else if (field.kind == EVENT_FIELD_ARRAY) {
+            out += "ARRAY[";
+            for (size_t i = 0; i < field.size && field.offset + i < size; i++) {
+                AppendFormat(out, i == 0 ? "%02x" : ", %02x", data[field.offset + i]);
+            }
+            out += ']';
+        } else {
+            out += ReadString(field, data, size);
+        }
+    }
+}
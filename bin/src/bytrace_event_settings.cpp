@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_event_settings.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bytrace_dump.h"
+
+using namespace std;
+namespace {
+const string AVAILABLE_EVENTS_PATH = "available_events";
+const string SET_EVENT_PATH = "set_event";
+const string EVENTS_DIR = "events/";
+const string ENABLE_FILE = "/enable";
+const string ALL_EVENTS = "*";
+const string FILTER_FILE = "/filter";
+const string SET_EVENT_PID_PATH = "set_event_pid";
+const string EVENT_FORK_PATH = "options/event-fork";
+const string FILTER_NONE = "0";
+
+bool ReadEventList(const TraceFs& traceFs, const string& path, EventTable* table, set<string>* events)
+{
+    string content;
+    if (!traceFs.Read(path, content)) {
+        return false;
+    }
+    istringstream fin(content);
+    string line;
+    while (getline(fin, line)) {
+        size_t colon = line.find(':');
+        if (colon == string::npos || colon == 0 || colon + 1 == line.size()) {
+            continue;
+        }
+        if (table != nullptr) {
+            (*table)[line.substr(0, colon)].insert(line.substr(colon + 1));
+        }
+        if (events != nullptr) {
+            events->insert(line);
+        }
+    }
+    return true;
+}
+
+// Events of one system that are in the given set, in the order of the set.
+vector<string> EventsOfSystem(const set<string>& events, const string& system)
+{
+    vector<string> result;
+    const string prefix = system + ":";
+    for (auto it = events.lower_bound(prefix); it != events.end() && it->compare(0, prefix.size(), prefix) == 0;
+        ++it) {
+        result.push_back(it->substr(prefix.size()));
+    }
+    return result;
+}
+} // namespace
+
+bool ParseEventPath(const string& path, string& system, string& event)
+{
+    if (path.size() <= EVENTS_DIR.size() + ENABLE_FILE.size() || path.compare(0, EVENTS_DIR.size(), EVENTS_DIR) != 0 ||
+        path.compare(path.size() - ENABLE_FILE.size(), ENABLE_FILE.size(), ENABLE_FILE) != 0) {
+        return false;
+    }
+    string name = path.substr(EVENTS_DIR.size(), path.size() - EVENTS_DIR.size() - ENABLE_FILE.size());
+    size_t slash = name.find('/');
+    if (slash == string::npos) {
+        system = name;
+        event.clear();
+        return true;
+    }
+    if (slash == 0 || slash + 1 == name.size() || name.find('/', slash + 1) != string::npos) {
+        return false;
+    }
+    system = name.substr(0, slash);
+    event = name.substr(slash + 1);
+    return true;
+}
+
+vector<string> DiffEventCommands(const EventTable& available, const set<string>& enabled,
+    const set<string>& managed, const set<string>& wanted)
+{
+    vector<string> commands;
+    for (const auto& [system, events] : available) {
+        vector<string> turnOn;
+        vector<string> turnOff;
+        bool keepAny = false; // an event of the system is enabled afterwards
+        for (const auto& event : events) {
+            string name = system + ":" + event;
+            bool isEnabled = enabled.count(name) > 0;
+            bool isWanted = wanted.count(name) > 0;
+            if (isWanted && !isEnabled) {
+                turnOn.push_back(event);
+            } else if (!isWanted && isEnabled && managed.count(name) > 0) {
+                turnOff.push_back(event);
+            }
+            keepAny = keepAny || isWanted || (isEnabled && managed.count(name) == 0);
+        }
+        if (turnOn.size() > 1 && EventsOfSystem(wanted, system).size() == events.size()) {
+            commands.push_back(system + ":" + ALL_EVENTS);
+        } else {
+            for (const auto& event : turnOn) {
+                commands.push_back(system + ":" + event);
+            }
+        }
+        if (turnOff.size() > 1 && !keepAny) {
+            commands.push_back("!" + system + ":" + ALL_EVENTS);
+        } else {
+            for (const auto& event : turnOff) {
+                commands.push_back("!" + system + ":" + event);
+            }
+        }
+    }
+    return commands;
+}
+
+bool ParseEventFilter(const string& arg, EventFilter& filter)
+{
+    size_t colon = arg.find(':');
+    if (colon == string::npos || colon == 0 || arg.find_first_not_of(' ', colon + 1) == string::npos) {
+        return false;
+    }
+    string name = arg.substr(0, colon);
+    size_t slash = name.find('/');
+    if (name.find_first_of(" .") != string::npos || slash == 0 || slash + 1 == name.size() ||
+        (slash != string::npos && name.find('/', slash + 1) != string::npos)) {
+        return false;
+    }
+    filter.system = name.substr(0, slash);
+    filter.event = slash == string::npos ? "" : name.substr(slash + 1);
+    filter.expression = arg.substr(colon + 1);
+    return true;
+}
+
+bool ParsePidList(const string& arg, vector<int>& pids)
+{
+    istringstream in(arg);
+    string item;
+    vector<int> parsed;
+    while (getline(in, item, ',')) {
+        char* end = nullptr;
+        long pid = strtol(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || pid <= 0 || pid > INT32_MAX) {
+            return false;
+        }
+        parsed.push_back(static_cast<int>(pid));
+    }
+    if (parsed.empty() || arg.back() == ',') {
+        return false;
+    }
+    pids.insert(pids.end(), parsed.begin(), parsed.end());
+    return true;
+}
+
+vector<int> FindProcessPids(const string& name, const string& procDir)
+{
+    vector<int> pids;
+    DIR* dir = opendir(procDir.c_str());
+    if (dir == nullptr) {
+        return pids;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        char* end = nullptr;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (pid <= 0 || *end != '\0') {
+            continue;
+        }
+        ifstream fin(procDir + "/" + entry->d_name + "/cmdline");
+        string cmdline;
+        if (getline(fin, cmdline, '\0') && cmdline == name) {
+            pids.push_back(static_cast<int>(pid));
+        }
+    }
+    closedir(dir);
+    sort(pids.begin(), pids.end());
+    return pids;
+}
+
+vector<int> FindCgroupPids(const string& cgroupDir)
+{
+    vector<int> pids;
+    ifstream fin(cgroupDir + "/cgroup.procs");
+    if (!fin.is_open()) {
+        fin.open(cgroupDir + "/tasks");
+    }
+    int pid = 0;
+    while (fin >> pid) {
+        pids.push_back(pid);
+    }
+    sort(pids.begin(), pids.end());
+    pids.erase(unique(pids.begin(), pids.end()), pids.end());
+    return pids;
+}
+
+vector<int> FindProcessThreads(int pid, const string& procDir)
+{
+    vector<int> tids = { pid };
+    DIR* dir = opendir((procDir + "/" + to_string(pid) + "/task").c_str());
+    if (dir == nullptr) {
+        return tids;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        char* end = nullptr;
+        long tid = strtol(entry->d_name, &end, 10);
+        if (tid > 0 && *end == '\0' && tid != pid) {
+            tids.push_back(static_cast<int>(tid));
+        }
+    }
+    closedir(dir);
+    sort(tids.begin() + 1, tids.end());
+    return tids;
+}
+
+EventFilters::EventFilters(TraceFs& traceFs) : traceFs_(traceFs) {}
+
+bool EventFilters::Apply(const vector<EventFilter>& filters, const vector<int>& pids, bool followFork)
+{
+    for (const auto& filter : filters) {
+        string path = EVENTS_DIR + filter.system + (filter.event.empty() ? "" : "/" + filter.event) + FILTER_FILE;
+        if (!traceFs_.Write(path, filter.expression)) {
+            fprintf(stderr, "Error: filter \"%s\" on %s: %s (%d)\n", filter.expression.c_str(), path.c_str(),
+                strerror(errno), errno);
+            return false;
+        }
+        filterPaths_.push_back(path);
+    }
+    if (pids.empty()) {
+        return true;
+    }
+
+    string value;
+    for (int pid : pids) {
+        value += to_string(pid) + " ";
+    }
+    value.back() = '\n';
+    // O_TRUNC replaces the pids of an earlier capture instead of adding to them.
+    int fd = traceFs_.OpenFile(SET_EVENT_PID_PATH, O_WRONLY | O_TRUNC);
+    if (fd == -1) {
+        fprintf(stderr, "Error: opening %s: %s (%d)\n", SET_EVENT_PID_PATH.c_str(), strerror(errno), errno);
+        return false;
+    }
+    bool isTrue = WriteFully(fd, value.data(), value.size());
+    close(fd);
+    if (!isTrue) {
+        fprintf(stderr, "Error: writing %s.\n", SET_EVENT_PID_PATH.c_str());
+        return false;
+    }
+    pidsSet_ = true;
+
+    string current;
+    if (traceFs_.Read(EVENT_FORK_PATH, current) && current.compare(0, 1, followFork ? "1" : "0") != 0) {
+        if (!traceFs_.Write(EVENT_FORK_PATH, followFork ? "1" : "0")) {
+            fprintf(stderr, "Error: writing %s: %s (%d)\n", EVENT_FORK_PATH.c_str(), strerror(errno), errno);
+            return false;
+        }
+        eventFork_ = current.substr(0, 1);
+    } else if (followFork && current.empty()) {
+        fprintf(stderr, "Warning: %s is not supported, children of the pids are not traced.\n",
+            EVENT_FORK_PATH.c_str());
+    }
+    return true;
+}
+
+bool EventFilters::Clear()
+{
+    bool isTrue = true;
+    for (const auto& path : filterPaths_) {
+        isTrue = traceFs_.Write(path, FILTER_NONE) && isTrue;
+    }
+    filterPaths_.clear();
+    if (pidsSet_) {
+        int fd = traceFs_.OpenFile(SET_EVENT_PID_PATH, O_WRONLY | O_TRUNC);
+        if (fd == -1) {
+            isTrue = false;
+        } else {
+            close(fd);
+        }
+        pidsSet_ = false;
+    }
+    if (!eventFork_.empty()) {
+        isTrue = traceFs_.Write(EVENT_FORK_PATH, eventFork_) && isTrue;
+        eventFork_.clear();
+    }
+    return isTrue;
+}
+
+EventSettings::EventSettings(TraceFs& traceFs) : traceFs_(traceFs) {}
+
+bool EventSettings::Load()
+{
+    available_.clear();
+    enabled_.clear();
+    return ReadEventList(traceFs_, AVAILABLE_EVENTS_PATH, &available_, nullptr) &&
+        ReadEventList(traceFs_, SET_EVENT_PATH, nullptr, &enabled_);
+}
+
+void EventSettings::Expand(const vector<string>& paths, set<string>& events) const
+{
+    string system;
+    string event;
+    for (const auto& path : paths) {
+        if (!ParseEventPath(path, system, event)) {
+            continue;
+        }
+        auto it = available_.find(system);
+        if (it == available_.end()) {
+            continue;
+        }
+        if (event.empty()) {
+            for (const auto& name : it->second) {
+                events.insert(system + ":" + name);
+            }
+        } else if (it->second.count(event) > 0) {
+            events.insert(system + ":" + event);
+        }
+    }
+}
+
+bool EventSettings::ApplyPerFile(const vector<string>& managedPaths, const vector<string>& enabledPaths)
+{
+    bool isTrue = true;
+    for (const auto& path : managedPaths) {
+        if (find(enabledPaths.begin(), enabledPaths.end(), path) != enabledPaths.end() ||
+            !traceFs_.IsWritable(path)) {
+            continue;
+        }
+        isTrue = traceFs_.Write(path, "0") && isTrue;
+        stats_.commands++;
+    }
+    for (const auto& path : enabledPaths) {
+        if (!traceFs_.Write(path, "1")) {
+            fprintf(stderr, "Error: enabling %s: %s (%d)\n", path.c_str(), strerror(errno), errno);
+        }
+        stats_.commands++;
+    }
+    return isTrue;
+}
+
+bool EventSettings::Apply(const vector<string>& managedPaths, const vector<string>& enabledPaths)
+{
+    stats_ = EventSettingsStats();
+    if (!Load()) {
+        return ApplyPerFile(managedPaths, enabledPaths);
+    }
+
+    set<string> wanted;
+    set<string> managed;
+    Expand(enabledPaths, wanted);
+    Expand(managedPaths, managed);
+    vector<string> commands = DiffEventCommands(available_, enabled_, managed, wanted);
+    stats_.bulk = true;
+    if (commands.empty()) {
+        return true;
+    }
+
+    // No O_TRUNC: truncating set_event disables every event.
+    int fd = traceFs_.OpenFile(SET_EVENT_PATH, O_WRONLY | O_APPEND);
+    if (fd == -1) {
+        fprintf(stderr, "Error: opening %s: %s (%d)\n", SET_EVENT_PATH.c_str(), strerror(errno), errno);
+        stats_.bulk = false;
+        return ApplyPerFile(managedPaths, enabledPaths);
+    }
+    string buffer;
+    for (const auto& command : commands) {
+        buffer += command;
+        buffer += '\n';
+    }
+    // The kernel consumes one command per write(); WriteFully() keeps writing the rest.
+    bool isTrue = WriteFully(fd, buffer.data(), buffer.size());
+    close(fd);
+    if (!isTrue) {
+        fprintf(stderr, "Error: writing %s.\n", SET_EVENT_PATH.c_str());
+        return false;
+    }
+
+    for (const auto& name : wanted) {
+        stats_.enabled += enabled_.insert(name).second ? 1 : 0;
+    }
+    for (const auto& name : managed) {
+        if (wanted.count(name) == 0) {
+            stats_.disabled += enabled_.erase(name);
+        }
+    }
+    stats_.commands = commands.size();
+    return true;
+}
@@ -12,11 +12,15 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <atomic>
 #include <climits>
+#include <cstdlib>
 #include <fcntl.h>
 #include <fstream>
+#include <map>
 #include <mutex>
+#include <set>
 #include <thread>
 #include <unistd.h>
 #include <vector>
@@ -40,6 +44,25 @@ std::atomic<uint64_t> g_tagsProperty(BYTRACE_TAG_NOT_READY);
 const std::string KEY_TRACE_TAG = "debug.bytrace.tags.enableflags";
 const std::string KEY_APP_NUMBER = "debug.bytrace.app_number";
 const std::string KEY_RO_DEBUGGABLE = "ro.debuggable";
+const std::string KEY_INSTANCE_NUMBER = "debug.bytrace.instance_number";
+const std::string KEY_INSTANCE_PREFIX = "debug.bytrace.instance_";
+
+// Markers of some tags can go to the trace_marker of an ftrace instance instead, set with
+// debug.bytrace.instance_N = "<instance>:<tags>", N < debug.bytrace.instance_number.
+constexpr int MAX_MARKER_ROUTES = 4;
+struct MarkerRoute {
+    std::atomic<uint64_t> tags;
+    std::atomic<int> fd;
+};
+MarkerRoute g_markerRoutes[MAX_MARKER_ROUTES];
+std::atomic<uint64_t> g_routedTags(0);
+std::string g_tracingRoot;
+std::mutex g_routeMutex;
+struct InstanceMarker {
+    int fd;
+    bool attached; // fd refers to the instance's trace_marker, not the top-level one
+};
+std::map<std::string, InstanceMarker> g_instanceMarkers;
 
 constexpr int NAME_MAX_SIZE = 1000;
 static std::vector<std::string> g_markTypes = {"B", "E", "S", "F", "C"};
@@ -56,8 +79,9 @@ bool IsAppValid()
             return false;
         }
 
+        // The arguments are separated by '\0'; only the process name is compared.
         std::string lineStr;
-        std::getline(fs, lineStr);
+        std::getline(fs, lineStr, '\0');
         std::string keyPrefix = "debug.bytrace.app_";
         int nums = OHOS::system::GetIntParameter<int>(KEY_APP_NUMBER, 0);
         for (int i = 0; i < nums; i++) {
@@ -81,24 +105,106 @@ uint64_t GetSysParamTags()
         return 0;
     }
 
-    IsAppValid();
+    // With processes named in debug.bytrace.app_N, only those keep the app tag.
+    if ((tags & BYTRACE_TAG_APP) != 0 && OHOS::system::GetIntParameter<int>(KEY_APP_NUMBER, 0) > 0 &&
+        !IsAppValid()) {
+        tags &= ~BYTRACE_TAG_APP;
+    }
     return (tags | BYTRACE_TAG_ALWAYS) & BYTRACE_TAG_VALID_MASK;
 }
 
+int GetInstanceMarkerFd(const std::string& instance)
+{
+    auto it = g_instanceMarkers.find(instance);
+    if (it != g_instanceMarkers.end() && it->second.attached) {
+        return it->second.fd;
+    }
+    std::string path = g_tracingRoot + "instances/" + instance + "/trace_marker";
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (it == g_instanceMarkers.end()) {
+        g_instanceMarkers[instance] = { fd, true };
+        return fd;
+    }
+    // Reuse the fd number a concurrent writer may still hold.
+    dup2(fd, it->second.fd);
+    close(fd);
+    it->second.attached = true;
+    return it->second.fd;
+}
+
+void LoadMarkerRoutes()
+{
+    std::lock_guard<std::mutex> lock(g_routeMutex);
+    int nums = std::min(OHOS::system::GetIntParameter<int>(KEY_INSTANCE_NUMBER, 0), MAX_MARKER_ROUTES);
+    std::set<std::string> used;
+    uint64_t routedTags = 0;
+    int count = 0;
+    for (int i = 0; i < nums; i++) {
+        std::string val = OHOS::system::GetParameter(KEY_INSTANCE_PREFIX + std::to_string(i), "");
+        size_t colon = val.find(':');
+        if (colon == std::string::npos || colon == 0 || val[0] == '.' || val.find('/') != std::string::npos) {
+            continue;
+        }
+        std::string instance = val.substr(0, colon);
+        uint64_t tags = strtoull(val.c_str() + colon + 1, nullptr, 10);
+        int fd = GetInstanceMarkerFd(instance);
+        if (tags == 0 || fd == -1) {
+            continue;
+        }
+        g_markerRoutes[count].fd = fd;
+        g_markerRoutes[count].tags = tags;
+        routedTags |= tags;
+        used.insert(instance);
+        count++;
+    }
+    for (; count < MAX_MARKER_ROUTES; count++) {
+        g_markerRoutes[count].tags = 0;
+    }
+    g_routedTags = routedTags;
+
+    // An instance cannot be removed while its files are open. Its fd is pointed at the top-level
+    // trace_marker instead of being closed, so that a concurrent writer never writes to a reused fd.
+    for (auto& entry : g_instanceMarkers) {
+        if (entry.second.attached && used.count(entry.first) == 0) {
+            dup2(g_markerFd, entry.second.fd);
+            entry.second.attached = false;
+        }
+    }
+}
+
+int GetMarkerFd(uint64_t tag)
+{
+    if (EXPECTANTLY((g_routedTags.load(std::memory_order_relaxed) & tag) == 0)) {
+        return g_markerFd;
+    }
+    for (const auto& route : g_markerRoutes) {
+        if ((route.tags.load(std::memory_order_relaxed) & tag) != 0) {
+            return route.fd.load(std::memory_order_relaxed);
+        }
+    }
+    return g_markerFd;
+}
+
 // open file "trace_marker".
 void OpenTraceMarkerFile()
 {
-    const std::string debugFile = "/sys/kernel/debug/tracing/trace_marker";
-    const std::string traceFile = "/sys/kernel/tracing/trace_marker";
-    g_markerFd = open(debugFile.c_str(), O_WRONLY | O_CLOEXEC);
+    const std::string debugRoot = "/sys/kernel/debug/tracing/";
+    const std::string traceRoot = "/sys/kernel/tracing/";
+    g_tracingRoot = debugRoot;
+    g_markerFd = open((debugRoot + "trace_marker").c_str(), O_WRONLY | O_CLOEXEC);
     if (g_markerFd == -1) {
-        g_markerFd = open(traceFile.c_str(), O_WRONLY | O_CLOEXEC);
+        g_tracingRoot = traceRoot;
+        g_markerFd = open((traceRoot + "trace_marker").c_str(), O_WRONLY | O_CLOEXEC);
         if (g_markerFd == -1) {
             fprintf(stderr, "Error opening trace file.\n");
             g_tagsProperty = 0;
             return;
         }
     }
+    LoadMarkerRoutes();
     g_tagsProperty = GetSysParamTags();
     g_isBytraceInit = true;
 }
@@ -115,7 +221,7 @@ inline void AddBytraceMarker(MarkerType type, uint64_t tag, std::string name, st
         record += std::to_string(getpid()) + "|";
         record += (name.size() < NAME_MAX_SIZE) ? name : name.substr(0, NAME_MAX_SIZE);
         record += " " + value;
-        write(g_markerFd, record.c_str(), record.size());
+        write(GetMarkerFd(tag), record.c_str(), record.size());
     }
 }
 
@@ -124,6 +230,7 @@ void UpdateTraceLabel()
     if (!g_isBytraceInit) {
         return;
     }
+    LoadMarkerRoutes();
     g_tagsProperty = GetSysParamTags();
 }
 
@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_merge.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <queue>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bytrace_block_compress.h"
+#include "bytrace_dump.h"
+
+using namespace std;
+namespace {
+const size_t READ_CHUNK_SIZE = 256 * 1024;
+const size_t WRITE_BUFFER_SIZE = 1024 * 1024;
+
+// Lines of one trace: the current line, with the timestamp it sorts by.
+class TraceLineReader {
+public:
+    explicit TraceLineReader(int fd) : fd_(fd) {}
+
+    // Moves to the next line; false at EOF or on a read error, see Failed().
+    bool Next()
+    {
+        pos_ = end_;
+        size_t eol = buffer_.find('\n', pos_);
+        while (eol == string::npos) {
+            buffer_.erase(0, pos_);
+            pos_ = 0;
+            size_t size = buffer_.size();
+            buffer_.resize(size + READ_CHUNK_SIZE);
+            ssize_t n = TEMP_FAILURE_RETRY(read(fd_, &buffer_[size], READ_CHUNK_SIZE));
+            buffer_.resize(size + (n > 0 ? static_cast<size_t>(n) : 0));
+            if (n < 0) {
+                failed_ = true;
+                return false;
+            } else if (n == 0) {
+                if (buffer_.empty()) {
+                    return false;
+                }
+                buffer_ += '\n'; // last line without a newline
+            }
+            eol = buffer_.find('\n', size);
+        }
+        end_ = eol + 1;
+        uint64_t us = 0;
+        if (ParseTraceTimestamp(Data(), Size(), us)) {
+            us_ = us;
+        }
+        return true;
+    }
+
+    const char* Data() const
+    {
+        return buffer_.data() + pos_;
+    }
+    size_t Size() const
+    {
+        return end_ - pos_;
+    }
+    bool IsComment() const
+    {
+        return Size() > 0 && buffer_[pos_] == '#';
+    }
+    uint64_t Timestamp() const
+    {
+        return us_;
+    }
+    bool Failed() const
+    {
+        return failed_;
+    }
+
+private:
+    int fd_;
+    string buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    uint64_t us_ = 0; // of the last line with a timestamp
+    bool failed_ = false;
+};
+
+// What script/bytrace_multi.py writes ahead of the merged lines.
+const char MULTI_TRACE_HEADER[] =
+    "# tracer: nop\n"
+    "#\n"
+    "#                                      _-----=> irqs-off\n"
+    "#                                     / _----=> need-resched\n"
+    "#                                    | / _---=> hardirq/softirq\n"
+    "#                                    || / _--=> preempt-depth\n"
+    "#                                    ||| /     delay\n"
+    "#           TASK-PID    TGID   CPU#  ||||    TIMESTAMP  FUNCTION\n"
+    "#              | |        |      |   ||||       |         |\n";
+const int64_t DEFAULT_REALTIME_MS = 7983849599000; // 2222-12-31 23:59:59, a trace without a realtime_ts marker
+const double DEFAULT_REALTIME_OFFSET = 0.5;        // seconds after the first device, for such a trace
+const double MS_PER_SECOND = 1000;
+const char REALTIME_MARKER[] = "trace_event_clock_sync: realtime_ts=";
+const char MARK_WRITE[] = "tracing_mark_write:";
+
+bool IsRegexSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+size_t SkipSpaces(const char* line, size_t len, size_t pos)
+{
+    while (pos < len && IsRegexSpace(line[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+size_t SkipDigits(const char* line, size_t len, size_t pos)
+{
+    while (pos < len && IsDigit(line[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+bool Contains(const char* line, size_t len, const char* word)
+{
+    return memmem(line, len, word, strlen(word)) != nullptr;
+}
+
+// The rest of the regex from the pid on, see MatchMultiTraceLine().
+bool MatchAfterTask(const char* line, size_t len, size_t pos, size_t& tsBegin, size_t& tsEnd, size_t& matchEnd)
+{
+    size_t begin = pos;
+    pos = SkipDigits(line, len, pos);
+    if (pos == begin || pos == len || !IsRegexSpace(line[pos])) {
+        return false;
+    }
+    pos = SkipSpaces(line, len, pos);
+    if (pos == len || line[pos] != '(') {
+        return false;
+    }
+    begin = SkipSpaces(line, len, pos + 1);
+    pos = SkipDigits(line, len, begin);
+    if (pos == begin || pos == len || line[pos] != ')') {
+        return false;
+    }
+    begin = pos + 1;
+    pos = SkipSpaces(line, len, begin);
+    if (pos == begin || pos == len || line[pos] != '[') {
+        return false;
+    }
+    begin = pos + 1;
+    pos = SkipDigits(line, len, begin);
+    if (pos == begin || pos == len || line[pos] != ']') {
+        return false;
+    }
+    begin = pos + 1;
+    pos = SkipSpaces(line, len, begin);
+    if (pos == begin) {
+        return false;
+    }
+    // (.*?)\s+ stops at the first space, as the field before cannot be empty after the greedy \s+.
+    while (pos < len && !IsRegexSpace(line[pos])) {
+        pos++;
+    }
+    if (pos == len) {
+        return false;
+    }
+    tsBegin = SkipSpaces(line, len, pos);
+    for (pos = tsBegin; pos + 1 < len; pos++) {
+        if (line[pos] == ':' && IsRegexSpace(line[pos + 1])) {
+            tsEnd = pos;
+            matchEnd = SkipSpaces(line, len, pos + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Finds what the trace_regex of bytrace_multi.py captures as the timestamp, in the way a backtracking
+ * engine would:
+ *   \s*(.*?)-(\d+?)\s+\(\s*(\d+?)\)\s+\[\d+\]\s+(.*?)\s+(.*?):\s+
+ * The task name ends at the first '-' after which the rest matches.
+ */
+bool MatchMultiTraceLine(const char* line, size_t len, size_t& tsBegin, size_t& tsEnd, size_t& matchEnd)
+{
+    for (size_t pos = SkipSpaces(line, len, 0); pos < len; pos++) {
+        if (line[pos] == '-' && MatchAfterTask(line, len, pos + 1, tsBegin, tsEnd, matchEnd)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Python's float() and int() of a field, which ignore the spaces around it.
+string StripSpaces(const char* data, size_t len)
+{
+    size_t begin = SkipSpaces(data, len, 0);
+    while (len > begin && IsRegexSpace(data[len - 1])) {
+        len--;
+    }
+    return string(data + begin, len - begin);
+}
+
+bool ParseFloatField(const char* data, size_t len, double& value)
+{
+    string text = StripSpaces(data, len);
+    if (text.empty() || text.find_first_of("xX") != string::npos) {
+        return false;
+    }
+    char* end = nullptr;
+    value = strtod(text.c_str(), &end);
+    return end == text.c_str() + text.size() && std::isfinite(value);
+}
+
+bool ParseIntField(const char* data, size_t len, int64_t& value)
+{
+    string text = StripSpaces(data, len);
+    if (text.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    long long num = strtoll(text.c_str(), &end, 10); // 10: decimal
+    value = num;
+    return errno == 0 && end == text.c_str() + text.size();
+}
+
+string FormatTimestamp(double ts)
+{
+    char buffer[64] = { 0 }; // 64: enough for any "%.6f" of a trace timestamp
+    int len = snprintf(buffer, sizeof(buffer), "%.6f", ts);
+    return len > 0 && static_cast<size_t>(len) < sizeof(buffer) ? string(buffer, len) : "";
+}
+
+class MappedTrace {
+public:
+    MappedTrace() = default;
+    MappedTrace(const MappedTrace&) = delete;
+    MappedTrace& operator=(const MappedTrace&) = delete;
+    ~MappedTrace()
+    {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    bool Map(const string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat st = {};
+        bool isTrue = fstat(fd, &st) == 0;
+        if (isTrue && st.st_size > 0) {
+            void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            isTrue = data != MAP_FAILED;
+            if (isTrue) {
+                data_ = static_cast<const char*>(data);
+                size_ = static_cast<size_t>(st.st_size);
+                madvise(data, size_, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        return isTrue;
+    }
+
+    // The line at pos, without its '\n'; pos moves to the next one.
+    bool NextLine(size_t& pos, const char*& line, size_t& len) const
+    {
+        if (pos >= size_) {
+            return false;
+        }
+        line = data_ + pos;
+        const char* eol = static_cast<const char*>(memchr(line, '\n', size_ - pos));
+        len = eol != nullptr ? static_cast<size_t>(eol - line) : size_ - pos;
+        pos += len + 1;
+        return true;
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// A line that bytrace_multi.py keeps, with its timestamp.
+bool ParseMultiTraceLine(const char* line, size_t len, double& ts, size_t& tsEnd)
+{
+    size_t tsBegin = 0;
+    size_t matchEnd = 0;
+    if ((!Contains(line, len, "binder_transaction") && !Contains(line, len, "tracing_mark_write")) ||
+        !MatchMultiTraceLine(line, len, tsBegin, tsEnd, matchEnd)) {
+        return false;
+    }
+    return ParseFloatField(line + tsBegin, tsEnd - tsBegin, ts);
+}
+
+// tracing_mark_write:\s+trace_event_clock_sync: realtime_ts=(.*) after the match of the line.
+bool ParseRealtimeMarker(const char* line, size_t len, int64_t& realtimeMs)
+{
+    size_t tsBegin = 0;
+    size_t tsEnd = 0;
+    size_t pos = 0;
+    if (!Contains(line, len, "realtime_ts") || !MatchMultiTraceLine(line, len, tsBegin, tsEnd, pos)) {
+        return false;
+    }
+    size_t markWriteLen = strlen(MARK_WRITE);
+    if (len - pos < markWriteLen || memcmp(line + pos, MARK_WRITE, markWriteLen) != 0) {
+        return false;
+    }
+    size_t begin = pos + markWriteLen;
+    pos = SkipSpaces(line, len, begin);
+    size_t markerLen = strlen(REALTIME_MARKER);
+    if (pos == begin || len - pos < markerLen || memcmp(line + pos, REALTIME_MARKER, markerLen) != 0) {
+        return false;
+    }
+    return ParseIntField(line + pos + markerLen, len - pos - markerLen, realtimeMs);
+}
+
+struct DeviceTrace {
+    string name;
+    MappedTrace trace;
+    bool hasLines = false;
+    bool ordered = true; // the lines kept are in time order
+    int64_t realtimeMs = DEFAULT_REALTIME_MS;
+    double syncTs = 0;   // of the last realtime_ts marker, or of the last line kept without one
+    double offset = 0;   // subtracted from the timestamps of the device
+    size_t pos = 0;      // of the next line to merge
+    vector<pair<double, size_t>> sorted; // keys and line offsets of a trace that is not in time order
+    size_t sortedPos = 0;
+};
+
+// Finds the last realtime_ts marker and whether the trace is in time order.
+void ScanDeviceTrace(DeviceTrace& device)
+{
+    size_t pos = 0;
+    const char* line = nullptr;
+    size_t len = 0;
+    double lastTs = 0;
+    bool hasRealtime = false;
+    while (device.trace.NextLine(pos, line, len)) {
+        double ts = 0;
+        size_t tsEnd = 0;
+        if (!ParseMultiTraceLine(line, len, ts, tsEnd)) {
+            continue;
+        }
+        if (device.hasLines && ts < lastTs) {
+            device.ordered = false;
+        }
+        device.hasLines = true;
+        lastTs = ts;
+        int64_t realtimeMs = 0;
+        if (ParseRealtimeMarker(line, len, realtimeMs)) {
+            device.realtimeMs = realtimeMs;
+            device.syncTs = ts;
+            hasRealtime = true;
+        }
+    }
+    if (!hasRealtime) {
+        device.syncTs = lastTs;
+    }
+}
+
+// The timestamp a line is written with, and the one it sorts by.
+double MergeKey(const DeviceTrace& device, double ts, string& adjusted)
+{
+    adjusted = FormatTimestamp(ts - device.offset);
+    return strtod(adjusted.c_str(), nullptr);
+}
+
+// Lines of a trace that is not in time order, sorted without losing the order of equal keys.
+void SortDeviceTrace(DeviceTrace& device)
+{
+    size_t pos = 0;
+    size_t lineBegin = 0;
+    const char* line = nullptr;
+    size_t len = 0;
+    string adjusted;
+    while (device.trace.NextLine(pos, line, len)) {
+        double ts = 0;
+        size_t tsEnd = 0;
+        if (ParseMultiTraceLine(line, len, ts, tsEnd)) {
+            device.sorted.emplace_back(MergeKey(device, ts, adjusted), lineBegin);
+        }
+        lineBegin = pos;
+    }
+    stable_sort(device.sorted.begin(), device.sorted.end(),
+        [](const pair<double, size_t>& a, const pair<double, size_t>& b) { return a.first < b.first; });
+}
+
+bool NextDeviceLine(DeviceTrace& device, const char*& line, size_t& len, double& ts)
+{
+    size_t tsEnd = 0;
+    if (!device.ordered) {
+        if (device.sortedPos == device.sorted.size()) {
+            return false;
+        }
+        size_t pos = device.sorted[device.sortedPos++].second;
+        return device.trace.NextLine(pos, line, len) && ParseMultiTraceLine(line, len, ts, tsEnd);
+    }
+    while (device.trace.NextLine(device.pos, line, len)) {
+        if (ParseMultiTraceLine(line, len, ts, tsEnd)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// str.replace() of every timestamp of the line, as the script does it.
+void AppendReplaced(string& out, const char* line, size_t len, const string& from, const string& to)
+{
+    size_t pos = 0;
+    while (!from.empty() && pos < len) {
+        const char* hit = static_cast<const char*>(memmem(line + pos, len - pos, from.data(), from.size()));
+        if (hit == nullptr) {
+            break;
+        }
+        out.append(line + pos, static_cast<size_t>(hit - line) - pos);
+        out += to;
+        pos = static_cast<size_t>(hit - line) + from.size();
+    }
+    out.append(line + pos, len - pos);
+}
+
+struct MergeEntry {
+    double key;
+    size_t rank; // of the device, which orders equal keys
+    string adjusted;
+    const char* line;
+    size_t len;
+    double ts;
+};
+
+struct MergeEntryLater {
+    bool operator()(const MergeEntry& a, const MergeEntry& b) const
+    {
+        return a.key != b.key ? a.key > b.key : a.rank > b.rank;
+    }
+};
+} // namespace
+
+bool MergeTraces(const vector<int>& traceFds, int outFd)
+{
+    vector<unique_ptr<TraceLineReader>> readers;
+    vector<bool> hasLine;
+    for (size_t i = 0; i < traceFds.size(); i++) {
+        readers.push_back(make_unique<TraceLineReader>(traceFds[i]));
+        bool has = readers[i]->Next();
+        // Only the first trace keeps its header.
+        while (has && readers[i]->IsComment() && i > 0) {
+            has = readers[i]->Next();
+        }
+        hasLine.push_back(has);
+    }
+
+    string out;
+    out.reserve(WRITE_BUFFER_SIZE);
+    while (true) {
+        size_t next = readers.size();
+        for (size_t i = 0; i < readers.size(); i++) {
+            if (hasLine[i] && (next == readers.size() || readers[i]->Timestamp() < readers[next]->Timestamp())) {
+                next = i;
+            }
+        }
+        if (next == readers.size()) {
+            break;
+        }
+        out.append(readers[next]->Data(), readers[next]->Size());
+        if (out.size() >= WRITE_BUFFER_SIZE) {
+            if (!WriteFully(outFd, out.data(), out.size())) {
+                return false;
+            }
+            out.clear();
+        }
+        hasLine[next] = readers[next]->Next();
+    }
+    for (const auto& reader : readers) {
+        if (reader->Failed()) {
+            fprintf(stderr, "Error: reading trace to merge: %s (%d)\n", strerror(errno), errno);
+            return false;
+        }
+    }
+    return WriteFully(outFd, out.data(), out.size());
+}
+
+bool MergeDeviceTraces(const vector<string>& files, int outFd)
+{
+    vector<unique_ptr<DeviceTrace>> devices;
+    for (const auto& file : files) {
+        auto device = make_unique<DeviceTrace>();
+        if (!device->trace.Map(file)) {
+            fprintf(stderr, "Warning: %s is not found.\n", file.c_str());
+            continue;
+        }
+        device->name = "[device_" + to_string(devices.size()) + "]";
+        ScanDeviceTrace(*device);
+        devices.push_back(move(device));
+    }
+    if (devices.empty()) {
+        return false;
+    }
+
+    // The device with the earliest realtime_ts is the reference, ties in the order of the files.
+    vector<DeviceTrace*> ranked;
+    for (auto& device : devices) {
+        if (device->hasLines) {
+            ranked.push_back(device.get());
+        }
+    }
+    stable_sort(ranked.begin(), ranked.end(),
+        [](const DeviceTrace* a, const DeviceTrace* b) { return a->realtimeMs < b->realtimeMs; });
+
+    priority_queue<MergeEntry, vector<MergeEntry>, MergeEntryLater> heap;
+    auto push = [&heap, &ranked](size_t rank) {
+        MergeEntry entry = { 0, rank, "", nullptr, 0, 0 };
+        if (NextDeviceLine(*ranked[rank], entry.line, entry.len, entry.ts)) {
+            entry.key = MergeKey(*ranked[rank], entry.ts, entry.adjusted);
+            heap.push(move(entry));
+        }
+    };
+    for (size_t rank = 0; rank < ranked.size(); rank++) {
+        DeviceTrace& device = *ranked[rank];
+        double realtimeOffset = DEFAULT_REALTIME_OFFSET;
+        if (device.realtimeMs != DEFAULT_REALTIME_MS) {
+            realtimeOffset = static_cast<double>(device.realtimeMs - ranked[0]->realtimeMs) / MS_PER_SECOND;
+        }
+        device.offset = device.syncTs - (ranked[0]->syncTs + realtimeOffset);
+        if (!device.ordered) {
+            SortDeviceTrace(device);
+        }
+        push(rank);
+    }
+
+    string out = MULTI_TRACE_HEADER;
+    out.reserve(WRITE_BUFFER_SIZE);
+    while (!heap.empty()) {
+        MergeEntry entry = heap.top();
+        heap.pop();
+        out += ranked[entry.rank]->name;
+        AppendReplaced(out, entry.line, entry.len, FormatTimestamp(entry.ts), entry.adjusted);
+        out += '\n';
+        if (out.size() >= WRITE_BUFFER_SIZE) {
+            if (!WriteFully(outFd, out.data(), out.size())) {
+                return false;
+            }
+            out.clear();
+        }
+        push(entry.rank);
+    }
+    return WriteFully(outFd, out.data(), out.size());
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_parser.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+const size_t MIN_CHUNK_SIZE = 1024 * 1024; // smaller chunks cost more to start a thread for than to parse
+const size_t BYTES_PER_EVENT = 96;         // of a typical line, to size the event vectors ahead
+const int FRACTION_DIGITS = 9;             // of a timestamp in ns
+const int64_t INT32_LIMIT = 2147483647;
+
+bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+string_view TrimLeft(string_view text)
+{
+    size_t pos = 0;
+    while (pos < text.size() && IsSpace(text[pos])) {
+        pos++;
+    }
+    return text.substr(pos);
+}
+
+string_view TrimRight(string_view text)
+{
+    size_t size = text.size();
+    while (size > 0 && (IsSpace(text[size - 1]) || text[size - 1] == '\r' || text[size - 1] == '\n')) {
+        size--;
+    }
+    return text.substr(0, size);
+}
+
+// The whole text is a decimal number that fits maxValue.
+bool ParseDecimal(string_view text, uint64_t maxValue, uint64_t& value)
+{
+    if (text.empty()) {
+        return false;
+    }
+    const uint64_t maxTens = maxValue / 10; // 10: decimal
+    value = 0;
+    for (char c : text) {
+        if (!IsDigit(c)) {
+            return false;
+        }
+        uint64_t digit = static_cast<uint64_t>(c - '0');
+        if (value > maxTens || value * 10 > maxValue - digit) { // 10: decimal
+            return false;
+        }
+        value = value * 10 + digit; // 10: decimal
+    }
+    return true;
+}
+
+bool ParseInt32(string_view text, int32_t& value)
+{
+    uint64_t num = 0;
+    if (!ParseDecimal(text, INT32_LIMIT, num)) {
+        return false;
+    }
+    value = static_cast<int32_t>(num);
+    return true;
+}
+
+bool ParseInt64(string_view text, int64_t& value)
+{
+    bool negative = !text.empty() && text[0] == '-';
+    uint64_t num = 0;
+    if (!ParseDecimal(negative ? text.substr(1) : text, INT64_MAX, num)) {
+        return false;
+    }
+    value = negative ? -static_cast<int64_t>(num) : static_cast<int64_t>(num);
+    return true;
+}
+
+// The " [<cpu>] " field; its '[' is returned, npos without one.
+size_t FindCpuField(string_view line, int32_t& cpu, size_t& end)
+{
+    size_t pos = 0;
+    while ((pos = line.find('[', pos)) != string_view::npos) {
+        end = pos + 1;
+        while (end < line.size() && IsDigit(line[end])) {
+            end++;
+        }
+        if (pos > 0 && IsSpace(line[pos - 1]) && end < line.size() && line[end] == ']' &&
+            ParseInt32(line.substr(pos + 1, end - pos - 1), cpu)) {
+            end++;
+            return pos;
+        }
+        pos++;
+    }
+    return string_view::npos;
+}
+
+// "<task>-<pid> [(<tgid>)]" ahead of the cpu.
+bool ParseTaskField(string_view field, TraceEvent& event)
+{
+    field = TrimRight(field);
+    event.tgid = -1;
+    if (!field.empty() && field.back() == ')') {
+        size_t paren = field.rfind('(');
+        if (paren == string_view::npos) {
+            return false;
+        }
+        string_view tgid = TrimLeft(field.substr(paren + 1, field.size() - paren - 2)); // 2: the parentheses
+        if (tgid.find_first_not_of('-') != string_view::npos && !ParseInt32(tgid, event.tgid)) {
+            return false;
+        }
+        field = TrimRight(field.substr(0, paren));
+    }
+    size_t dash = field.rfind('-');
+    if (dash == string_view::npos || !ParseInt32(field.substr(dash + 1), event.pid)) {
+        return false;
+    }
+    event.task = TrimLeft(field.substr(0, dash));
+    return true;
+}
+
+void ParseChunk(string_view text, vector<TraceEvent>& events, TraceParseStats& stats)
+{
+    events.reserve(events.size() + text.size() / BYTES_PER_EVENT);
+    size_t pos = 0;
+    while (pos < text.size()) {
+        // memchr is the vectorized scan of the C library.
+        const char* eol = static_cast<const char*>(memchr(text.data() + pos, '\n', text.size() - pos));
+        size_t end = eol != nullptr ? static_cast<size_t>(eol - text.data()) : text.size();
+        TraceEvent event;
+        stats.lines++;
+        if (ParseTraceLine(text.substr(pos, end - pos), event)) {
+            events.push_back(event);
+        } else {
+            stats.skipped++;
+        }
+        pos = end + 1;
+    }
+}
+} // namespace
+
+bool ParseTraceLine(string_view line, TraceEvent& event)
+{
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    if (line.empty() || line[0] == '#') {
+        return false;
+    }
+    size_t cpuEnd = 0;
+    size_t cpuPos = FindCpuField(line, event.cpu, cpuEnd);
+    if (cpuPos == string_view::npos || !ParseTaskField(line.substr(0, cpuPos), event)) {
+        return false;
+    }
+
+    // "[<flags>] <timestamp>:", the flags never have a ':'.
+    size_t colon = line.find(':', cpuEnd);
+    if (colon == string_view::npos) {
+        return false;
+    }
+    string_view field = TrimLeft(line.substr(cpuEnd, colon - cpuEnd));
+    size_t space = field.size();
+    while (space > 0 && !IsSpace(field[space - 1])) {
+        space--;
+    }
+    event.flags = TrimRight(field.substr(0, space));
+    if (!ParseTraceSeconds(field.substr(space), event.timestampNs)) {
+        return false;
+    }
+
+    // "<event>: <payload>", or "<event>" alone.
+    string_view rest = TrimLeft(line.substr(colon + 1));
+    size_t end = 0;
+    while (end < rest.size() && rest[end] != ':' && !IsSpace(rest[end])) {
+        end++;
+    }
+    if (end == 0 || (end < rest.size() && rest[end] != ':')) {
+        return false;
+    }
+    event.name = rest.substr(0, end);
+    event.payload = string_view();
+    if (end < rest.size()) {
+        event.payload = rest.substr(end + 1);
+        if (!event.payload.empty() && event.payload[0] == ' ') {
+            event.payload.remove_prefix(1);
+        }
+    }
+    return true;
+}
+
+bool ParseTraceSeconds(string_view text, uint64_t& ns)
+{
+    size_t dot = text.find('.');
+    uint64_t seconds = 0;
+    if (!ParseDecimal(text.substr(0, dot), UINT64_MAX / 1000000000, seconds)) { // 1000000000: ns per second
+        return false;
+    }
+    uint64_t fraction = 0;
+    int digits = 0;
+    if (dot != string_view::npos) {
+        string_view fractionText = text.substr(dot + 1);
+        if (fractionText.empty()) {
+            return false;
+        }
+        for (char c : fractionText) {
+            if (!IsDigit(c)) {
+                return false;
+            }
+            if (digits < FRACTION_DIGITS) {
+                fraction = fraction * 10 + static_cast<uint64_t>(c - '0'); // 10: decimal
+                digits++;
+            }
+        }
+    }
+    for (; digits < FRACTION_DIGITS; digits++) {
+        fraction *= 10; // 10: decimal
+    }
+    ns = seconds * 1000000000 + fraction; // 1000000000: ns per second
+    return true;
+}
+
+bool ParseTraceMarker(string_view payload, TraceMarker& marker)
+{
+    payload = TrimRight(payload);
+    if (payload.empty()) {
+        return false;
+    }
+    marker = TraceMarker();
+    switch (payload[0]) {
+        case 'B': marker.type = TRACE_MARKER_BEGIN; break;
+        case 'E': marker.type = TRACE_MARKER_END; break;
+        case 'S': marker.type = TRACE_MARKER_ASYNC_BEGIN; break;
+        case 'F': marker.type = TRACE_MARKER_ASYNC_END; break;
+        case 'C': marker.type = TRACE_MARKER_COUNTER; break;
+        default: return false;
+    }
+    bool isEnd = marker.type == TRACE_MARKER_END;
+    if (payload.size() == 1) {
+        return isEnd;
+    } else if (payload[1] != '|') {
+        return false;
+    }
+    string_view rest = payload.substr(2); // 2: the type and its '|'
+    size_t bar = rest.find('|');
+    string_view pid = rest.substr(0, bar);
+    if (!(isEnd && pid.empty()) && !ParseInt32(pid, marker.pid)) {
+        return false;
+    }
+    if (bar == string_view::npos) {
+        return isEnd;
+    }
+    rest = TrimRight(rest.substr(bar + 1));
+    if (marker.type == TRACE_MARKER_BEGIN || isEnd) {
+        marker.name = rest;
+        return isEnd || !rest.empty();
+    }
+    // The value follows the name after a '|' in systrace and after a space in bytrace.
+    size_t sep = rest.rfind('|');
+    if (sep == string_view::npos) {
+        sep = rest.find_last_of(" \t");
+    }
+    if (sep == string_view::npos || !ParseInt64(rest.substr(sep + 1), marker.value)) {
+        return false;
+    }
+    marker.name = TrimRight(rest.substr(0, sep));
+    return !marker.name.empty();
+}
+
+TraceParseStats ParseTraceText(string_view text, vector<TraceEvent>& events, int threads)
+{
+    size_t count = threads > 0 ? static_cast<size_t>(threads) : max(thread::hardware_concurrency(), 1u);
+    count = max<size_t>(min(count, text.size() / MIN_CHUNK_SIZE), 1);
+    TraceParseStats stats;
+    if (count == 1) {
+        ParseChunk(text, events, stats);
+        return stats;
+    }
+
+    // Chunks end after the first line end past an even share of the text.
+    vector<string_view> chunks;
+    size_t begin = 0;
+    for (size_t i = 1; i <= count && begin < text.size(); i++) {
+        size_t end = i == count ? text.size() : max(begin, text.size() / count * i);
+        const char* eol = static_cast<const char*>(memchr(text.data() + end, '\n', text.size() - end));
+        end = eol != nullptr ? static_cast<size_t>(eol - text.data()) + 1 : text.size();
+        chunks.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+    vector<vector<TraceEvent>> results(chunks.size());
+    vector<TraceParseStats> chunkStats(chunks.size());
+    vector<thread> workers;
+    for (size_t i = 1; i < chunks.size(); i++) {
+        workers.emplace_back(ParseChunk, chunks[i], ref(results[i]), ref(chunkStats[i]));
+    }
+    ParseChunk(chunks[0], results[0], chunkStats[0]);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    size_t total = events.size();
+    for (size_t i = 0; i < chunks.size(); i++) {
+        total += results[i].size();
+        stats.lines += chunkStats[i].lines;
+        stats.skipped += chunkStats[i].skipped;
+    }
+    events.reserve(total);
+    for (const auto& result : results) {
+        events.insert(events.end(), result.begin(), result.end());
+    }
+    return stats;
+}
+
+MappedTraceFile::~MappedTraceFile()
+{
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+bool MappedTraceFile::Open(const string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st = {};
+    bool isTrue = fstat(fd, &st) == 0;
+    if (isTrue && st.st_size > 0) {
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        isTrue = data != MAP_FAILED;
+        if (isTrue) {
+            data_ = static_cast<const char*>(data);
+            size_ = static_cast<size_t>(st.st_size);
+        }
+    }
+    close(fd);
+    return isTrue;
+}
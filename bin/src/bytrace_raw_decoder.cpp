@@ -0,0 +1,464 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_raw_decoder.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <queue>
+#include <sstream>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+// Ring-buffer events of kernel/trace/ring_buffer.c: a 32-bit header of type_len:5 and time_delta:27.
+const uint32_t TYPE_LEN_MASK = 0x1f;
+const int TIME_DELTA_SHIFT = 5;
+const uint32_t TYPE_DATA_MAX = 28;
+const uint32_t TYPE_PADDING = 29;
+const uint32_t TYPE_TIME_EXTEND = 30;
+const uint32_t TYPE_TIME_STAMP = 31;
+const int TS_SHIFT = 27;
+const size_t EVENT_HEADER_SIZE = 4;
+const size_t EVENT_ALIGNMENT = 4;
+const uint64_t MISSED_EVENTS = 1ULL << 31; // flags in the commit of a page read by the reader
+const uint64_t MISSED_STORED = 1ULL << 30;
+
+// The fields every record starts with.
+const size_t COMMON_TYPE_OFFSET = 0;
+const size_t COMMON_FLAGS_OFFSET = 2;
+const size_t COMMON_PREEMPT_OFFSET = 3;
+const size_t COMMON_PID_OFFSET = 4;
+const size_t COMMON_SIZE = 8;
+
+// common_flags of kernel/trace/trace.h.
+const uint8_t FLAG_IRQS_OFF = 0x01;
+const uint8_t FLAG_IRQS_NOSUPPORT = 0x02;
+const uint8_t FLAG_NEED_RESCHED = 0x04;
+const uint8_t FLAG_HARDIRQ = 0x08;
+const uint8_t FLAG_SOFTIRQ = 0x10;
+const uint8_t FLAG_PREEMPT_RESCHED = 0x20;
+const uint8_t FLAG_NMI = 0x40;
+
+const size_t SINK_CHUNK_SIZE = 256 * 1024;
+const uint64_t NS_PER_US = 1000;
+const uint64_t US_PER_SECOND = 1000000;
+const char* const TRACE_HEADER =
+    "# tracer: nop\n"
+    "#\n"
+    "#                                      _-----=> irqs-off\n"
+    "#                                     / _----=> need-resched\n"
+    "#                                    | / _---=> hardirq/softirq\n"
+    "#                                    || / _--=> preempt-depth\n"
+    "#                                    ||| /     delay\n"
+    "#           TASK-PID    TGID   CPU#  ||||    TIMESTAMP  FUNCTION\n"
+    "#              | |        |      |   ||||       |         |\n";
+
+uint64_t ReadLe(const uint8_t* data, size_t size)
+{
+    uint64_t value = 0;
+    memcpy(&value, data, min(size, sizeof(value))); // the pages have the byte order of the CPU
+    return value;
+}
+
+bool ReadTextFile(const string& path, string& text)
+{
+    ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    stringstream content;
+    content << file.rdbuf();
+    text = content.str();
+    return true;
+}
+
+string JoinPath(const string& dir, const string& name)
+{
+    return !dir.empty() && dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+// kernel/trace/trace_output.c: trace_print_lat_fmt().
+void AppendIrqInfo(const RawEvent& event, string& out)
+{
+    uint8_t flags = event.flags;
+    out += (flags & FLAG_IRQS_OFF) ? 'd' : (flags & FLAG_IRQS_NOSUPPORT) ? 'X' : '.';
+    switch (flags & (FLAG_NEED_RESCHED | FLAG_PREEMPT_RESCHED)) {
+        case FLAG_NEED_RESCHED | FLAG_PREEMPT_RESCHED: out += 'N'; break;
+        case FLAG_NEED_RESCHED: out += 'n'; break;
+        case FLAG_PREEMPT_RESCHED: out += 'p'; break;
+        default: out += '.'; break;
+    }
+    bool nmi = (flags & FLAG_NMI) != 0;
+    bool hardirq = (flags & FLAG_HARDIRQ) != 0;
+    bool softirq = (flags & FLAG_SOFTIRQ) != 0;
+    out += (nmi && hardirq) ? 'Z' : nmi ? 'z' : (hardirq && softirq) ? 'H' : hardirq ? 'h' : softirq ? 's' : '.';
+    if (event.preemptCount != 0) {
+        char count[8]; // 8: "ff" and the NUL
+        snprintf(count, sizeof(count), "%x", event.preemptCount);
+        out += count;
+    } else {
+        out += '.';
+    }
+}
+} // namespace
+
+bool RawEventDecoder::SetHeaderPage(string_view text)
+{
+    vector<EventField> fields;
+    if (!ParseEventFields(text, fields)) {
+        return false;
+    }
+    const EventField* timestamp = nullptr;
+    const EventField* commit = nullptr;
+    const EventField* data = nullptr;
+    for (const auto& field : fields) {
+        if (field.name == "timestamp") {
+            timestamp = &field;
+        } else if (field.name == "commit") {
+            commit = &field;
+        } else if (field.name == "data") {
+            data = &field;
+        }
+    }
+    if (timestamp == nullptr || commit == nullptr || data == nullptr || data->size == 0 ||
+        commit->size > sizeof(uint64_t)) {
+        return false;
+    }
+    timestampOffset_ = timestamp->offset;
+    commitOffset_ = commit->offset;
+    commitSize_ = commit->size;
+    dataOffset_ = data->offset;
+    dataSize_ = data->size;
+    return true;
+}
+
+bool RawEventDecoder::AddFormat(const string& system, string_view text)
+{
+    auto format = make_unique<EventFormat>();
+    if (!format->Parse(system, text)) {
+        return false;
+    }
+    size_t id = format->GetId();
+    if (id >= formats_.size()) {
+        formats_.resize(id + 1);
+    }
+    formats_[id] = move(format);
+    return true;
+}
+
+bool RawEventDecoder::LoadFormats(const string& tracingPath, const vector<string>& eventDirs)
+{
+    string text;
+    if (ReadTextFile(JoinPath(tracingPath, "events/header_page"), text) && !SetHeaderPage(text)) {
+        fprintf(stderr, "Error: unexpected layout of events/header_page.\n");
+        return false;
+    }
+    vector<string> dirs = { "events/ftrace/print" };
+    dirs.insert(dirs.end(), eventDirs.begin(), eventDirs.end());
+    size_t loaded = 0;
+    for (const string& dir : dirs) {
+        // "events/<system>[/<event>]"
+        size_t systemBegin = dir.find('/') + 1;
+        string system = dir.substr(systemBegin, dir.find('/', systemBegin) - systemBegin);
+        vector<string> formatPaths;
+        if (dir.find('/', systemBegin) != string::npos) {
+            formatPaths.push_back(JoinPath(tracingPath, dir + "/format"));
+        } else if (DIR* events = opendir(JoinPath(tracingPath, dir).c_str())) {
+            while (struct dirent* entry = readdir(events)) {
+                if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
+                    formatPaths.push_back(JoinPath(tracingPath, dir + "/" + entry->d_name + "/format"));
+                }
+            }
+            closedir(events);
+        }
+        for (const string& path : formatPaths) {
+            if (!ReadTextFile(path, text)) {
+                continue;
+            }
+            if (!AddFormat(system, text)) {
+                fprintf(stderr, "Warning: cannot parse %s.\n", path.c_str());
+                continue;
+            }
+            loaded++;
+        }
+    }
+    if (loaded == 0) {
+        fprintf(stderr, "Error: no event format found under %s.\n", tracingPath.c_str());
+    }
+    return loaded > 0;
+}
+
+void RawEventDecoder::LoadTaskNames(const string& tracingPath)
+{
+    ifstream cmdlines(JoinPath(tracingPath, "saved_cmdlines"));
+    string line;
+    while (getline(cmdlines, line)) {
+        // "<pid> <comm>", the comm may have spaces
+        size_t space = line.find(' ');
+        if (space != string::npos) {
+            taskNames_[atoi(line.c_str())] = line.substr(space + 1);
+        }
+    }
+    ifstream tgids(JoinPath(tracingPath, "saved_tgids"));
+    int32_t pid = 0;
+    int32_t tgid = 0;
+    while (tgids >> pid >> tgid) {
+        tgids_[pid] = tgid;
+    }
+}
+
+void RawEventDecoder::SetTaskName(int32_t pid, const string& name)
+{
+    taskNames_[pid] = name;
+}
+
+void RawEventDecoder::SetTgid(int32_t pid, int32_t tgid)
+{
+    tgids_[pid] = tgid;
+}
+
+const EventFormat* RawEventDecoder::FindFormat(uint16_t id) const
+{
+    return id < formats_.size() ? formats_[id].get() : nullptr;
+}
+
+bool RawEventDecoder::DecodePage(const uint8_t* page, size_t size, vector<RawEvent>& events,
+    int64_t& lostEvents) const
+{
+    lostEvents = 0;
+    if (size < dataOffset_ || size < commitOffset_ + commitSize_) {
+        return false;
+    }
+    uint64_t commit = ReadLe(page + commitOffset_, commitSize_);
+    size_t length = static_cast<size_t>(commit & ~(MISSED_EVENTS | MISSED_STORED));
+    if (length > dataSize_ || dataOffset_ + length > size) {
+        return false;
+    }
+    if ((commit & MISSED_EVENTS) != 0) {
+        lostEvents = -1;
+        if ((commit & MISSED_STORED) != 0 && dataOffset_ + length + commitSize_ <= size) {
+            lostEvents = static_cast<int64_t>(ReadLe(page + dataOffset_ + length, commitSize_));
+        }
+    }
+
+    uint64_t timestamp = ReadLe(page + timestampOffset_, sizeof(uint64_t));
+    const uint8_t* data = page + dataOffset_;
+    size_t pos = 0;
+    while (pos + EVENT_HEADER_SIZE <= length) {
+        uint32_t header = static_cast<uint32_t>(ReadLe(data + pos, sizeof(uint32_t)));
+        uint32_t typeLen = header & TYPE_LEN_MASK;
+        uint64_t delta = header >> TIME_DELTA_SHIFT;
+        if (typeLen == TYPE_PADDING && delta == 0) {
+            break; // the rest of the page is padding
+        }
+        // array[0], the word after the header, is a length or the upper bits of a time.
+        bool hasArray = pos + EVENT_HEADER_SIZE + sizeof(uint32_t) <= length;
+        if (!hasArray && (typeLen == 0 || typeLen > TYPE_DATA_MAX)) {
+            return false;
+        }
+        uint64_t array0 = hasArray ? ReadLe(data + pos + EVENT_HEADER_SIZE, sizeof(uint32_t)) : 0;
+        size_t eventSize = 0;
+        size_t recordOffset = pos + EVENT_HEADER_SIZE;
+        size_t recordSize = 0;
+        if (typeLen == TYPE_PADDING) {
+            eventSize = EVENT_HEADER_SIZE + array0; // a discarded event
+        } else if (typeLen == TYPE_TIME_EXTEND || typeLen == TYPE_TIME_STAMP) {
+            uint64_t time = delta + (array0 << TS_SHIFT);
+            timestamp = typeLen == TYPE_TIME_EXTEND ? timestamp + time : time;
+            eventSize = EVENT_HEADER_SIZE + sizeof(uint32_t);
+        } else if (typeLen == 0) {
+            // array[0] holds the length, itself included, and the record follows it.
+            recordOffset += sizeof(uint32_t);
+            recordSize = array0 >= sizeof(uint32_t) ? array0 - sizeof(uint32_t) : 0;
+            eventSize = EVENT_HEADER_SIZE + array0;
+        } else {
+            recordSize = typeLen * EVENT_ALIGNMENT;
+            eventSize = EVENT_HEADER_SIZE + recordSize;
+        }
+        if (pos + eventSize > length) {
+            return false;
+        }
+        pos += eventSize;
+        if (typeLen > TYPE_DATA_MAX) {
+            continue;
+        }
+        timestamp += delta;
+        if (recordSize < COMMON_SIZE) {
+            return false;
+        }
+        RawEvent event;
+        event.timestamp = timestamp;
+        event.data = data + recordOffset;
+        event.size = static_cast<uint32_t>(recordSize);
+        event.id = static_cast<uint16_t>(ReadLe(event.data + COMMON_TYPE_OFFSET, sizeof(uint16_t)));
+        event.flags = event.data[COMMON_FLAGS_OFFSET];
+        event.preemptCount = event.data[COMMON_PREEMPT_OFFSET];
+        event.pid = static_cast<int32_t>(ReadLe(event.data + COMMON_PID_OFFSET, sizeof(int32_t)));
+        event.format = FindFormat(event.id);
+        events.push_back(event);
+    }
+    return true;
+}
+
+// kernel/trace/trace_output.c: trace_print_context(), then the output of the event.
+void RawEventDecoder::FormatEvent(const RawEvent& event, int cpu, string& out) const
+{
+    const char* comm = "<...>";
+    if (event.pid == 0) {
+        comm = "<idle>";
+    } else if (event.pid < 0) {
+        comm = "<XXX>";
+    } else {
+        auto it = taskNames_.find(event.pid);
+        if (it != taskNames_.end()) {
+            comm = it->second.c_str();
+        }
+    }
+    char context[128]; // 128: longer than the context of any event
+    int len = snprintf(context, sizeof(context), "%16s-%-5d ", comm, event.pid);
+    out.append(context, len > 0 ? min(static_cast<size_t>(len), sizeof(context) - 1) : 0);
+    if (options_.recordTgid) {
+        auto it = tgids_.find(event.pid);
+        if (it != tgids_.end() && it->second != 0) {
+            len = snprintf(context, sizeof(context), "(%5d) ", it->second);
+        } else {
+            len = snprintf(context, sizeof(context), "(-----) ");
+        }
+        out.append(context, len);
+    }
+    len = snprintf(context, sizeof(context), "[%03d] ", cpu);
+    out.append(context, len);
+    if (options_.irqInfo) {
+        AppendIrqInfo(event, out);
+    }
+    if (options_.timeInNs) {
+        uint64_t us = (event.timestamp + NS_PER_US / 2) / NS_PER_US; // 2: rounded to the nearest us
+        len = snprintf(context, sizeof(context), " %5" PRIu64 ".%06" PRIu64 ": ", us / US_PER_SECOND,
+            us % US_PER_SECOND);
+    } else {
+        len = snprintf(context, sizeof(context), " %12" PRIu64 ": ", event.timestamp);
+    }
+    out.append(context, len);
+
+    const EventFormat* format = event.format;
+    if (format == nullptr) {
+        len = snprintf(context, sizeof(context), "Unknown type %u\n", event.id);
+        out.append(context, len);
+        return;
+    }
+    if (format->GetSystem() == "ftrace" && format->GetName() == "print") {
+        // trace_print_print(): the symbol of the caller, always tracing_mark_write for trace_marker,
+        // and the buffer, which already ends with a newline.
+        const EventField* buf = format->FindField("buf");
+        out += "tracing_mark_write: ";
+        if (buf != nullptr) {
+            out += EventFormat::ReadString(*buf, event.data, event.size);
+        }
+        if (out.back() != '\n') {
+            out += '\n';
+        }
+        return;
+    }
+    out += format->GetName();
+    out += ": ";
+    format->FormatPayload(event.data, event.size, out);
+    out += '\n';
+}
+
+string RawEventDecoder::FormatHeader() const
+{
+    return options_.recordTgid && options_.irqInfo ? TRACE_HEADER : "# tracer: nop\n#\n";
+}
+
+bool DecodeRawBuffers(const RawEventDecoder& decoder, const vector<int>& cpuFds, const RawTextSink& sink,
+    RawDecodeStats* stats)
+{
+    struct CpuCursor {
+        int cpu = 0;
+        int fd = -1;
+        vector<uint8_t> page;
+        vector<RawEvent> events;
+        size_t next = 0;
+        int64_t lostEvents = 0; // ahead of the next event
+    };
+    RawDecodeStats localStats;
+    RawDecodeStats& counts = stats != nullptr ? *stats : localStats;
+    // The next page of the CPU that has an event; false once its fd has no page left.
+    auto fill = [&decoder, &counts](CpuCursor& cursor) {
+        while (cursor.next >= cursor.events.size()) {
+            ssize_t n = TEMP_FAILURE_RETRY(read(cursor.fd, cursor.page.data(), cursor.page.size()));
+            if (n <= 0) {
+                return false; // EAGAIN when empty, or 0 at the end of a snapshot
+            }
+            cursor.events.clear();
+            cursor.next = 0;
+            int64_t lost = 0;
+            counts.pages++;
+            if (!decoder.DecodePage(cursor.page.data(), static_cast<size_t>(n), cursor.events, lost)) {
+                counts.badPages++;
+            }
+            if (lost != 0) {
+                cursor.lostEvents = lost;
+                counts.lostEvents += lost > 0 ? static_cast<uint64_t>(lost) : 0;
+            }
+        }
+        return true;
+    };
+
+    vector<CpuCursor> cursors(cpuFds.size());
+    using Entry = pair<uint64_t, size_t>; // the timestamp of the next event of a CPU, and the CPU
+    priority_queue<Entry, vector<Entry>, greater<Entry>> heap;
+    for (size_t i = 0; i < cpuFds.size(); i++) {
+        cursors[i].cpu = static_cast<int>(i);
+        cursors[i].fd = cpuFds[i];
+        cursors[i].page.resize(decoder.GetPageSize());
+        if (cpuFds[i] != -1 && fill(cursors[i])) {
+            heap.emplace(cursors[i].events[0].timestamp, i);
+        }
+    }
+
+    string out;
+    out.reserve(SINK_CHUNK_SIZE * 2); // 2: a chunk and the lines past it
+    while (!heap.empty()) {
+        CpuCursor& cursor = cursors[heap.top().second];
+        heap.pop();
+        if (cursor.lostEvents != 0) {
+            char lost[64]; // 64: longer than the line
+            int len = cursor.lostEvents > 0 ?
+                snprintf(lost, sizeof(lost), "CPU:%d [LOST %" PRId64 " EVENTS]\n", cursor.cpu, cursor.lostEvents) :
+                snprintf(lost, sizeof(lost), "CPU:%d [LOST EVENTS]\n", cursor.cpu);
+            out.append(lost, len);
+            cursor.lostEvents = 0;
+        }
+        decoder.FormatEvent(cursor.events[cursor.next++], cursor.cpu, out);
+        counts.events++;
+        if (out.size() >= SINK_CHUNK_SIZE) {
+            if (!sink(out.data(), out.size())) {
+                return false;
+            }
+            out.clear();
+        }
+        if (fill(cursor)) {
+            heap.emplace(cursor.events[cursor.next].timestamp, static_cast<size_t>(cursor.cpu));
+        }
+    }
+    return out.empty() || sink(out.data(), out.size());
+}
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_recorder.h"
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "bytrace_block_compress.h"
+#include "bytrace_cpu_stats.h"
+#include "bytrace_dump.h"
+
+using namespace std;
+namespace {
+const string TRACING_ON_PATH = "tracing_on";
+const string PRINT_TRIGGER_PATH = "events/ftrace/print/trigger";
+const string CPU0_STATS_PATH = "per_cpu/cpu0/stats";
+const int POLL_INTERVAL_MS = 200;
+const int SOCKET_BACKLOG = 4;
+const int SOCKET_TIMEOUT_SEC = 1;
+const size_t COMMAND_MAX_LEN = 64;
+const size_t SKIP_CHUNK_SIZE = 256 * 1024;
+const int64_t NS_PER_SECOND = 1000000000;
+const uint64_t US_PER_SECOND = 1000000;
+
+volatile sig_atomic_t g_dumpRequested = 0;
+volatile sig_atomic_t g_stopRequested = 0;
+
+void RequestDump(int signo)
+{
+    g_dumpRequested = 1;
+}
+
+void RequestStop(int signo)
+{
+    g_stopRequested = 1;
+}
+
+int64_t MonotonicSeconds()
+{
+    struct timespec ts = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+int64_t GetMtimeNs(const string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * NS_PER_SECOND + st.st_mtim.tv_nsec;
+}
+
+// Removes the socket at path, if any; whatever else is there is not the recorder's to delete.
+bool RemoveSocketFile(const string& path)
+{
+    struct stat st = {};
+    if (lstat(path.c_str(), &st) != 0) {
+        return errno == ENOENT;
+    }
+    return S_ISSOCK(st.st_mode) && (unlink(path.c_str()) == 0 || errno == ENOENT);
+}
+} // namespace
+
+const char* GetTriggerName(RecorderTrigger trigger)
+{
+    switch (trigger) {
+        case TRIGGER_SIGNAL:
+            return "signal";
+        case TRIGGER_FILE:
+            return "file";
+        case TRIGGER_MARKER:
+            return "marker";
+        case TRIGGER_SOCKET:
+            return "socket";
+        default:
+            return "unknown";
+    }
+}
+
+FlightRecorder::FlightRecorder(const RecorderConfig& config, TraceFs& traceFs)
+    : config_(config), traceFs_(traceFs)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    Disarm();
+}
+
+bool FlightRecorder::ArmMarkerTrigger()
+{
+    // Turning tracing off at the marker freezes the history that led up to it until it is dumped.
+    string trigger = "traceoff:1 if buf ~ \"*" + config_.triggerMarker + "*\"";
+    if (!traceFs_.Write(PRINT_TRIGGER_PATH, trigger)) {
+        fprintf(stderr, "Error: writing %s: %s (%d), trace_marker triggers need kernel 4.17 or later.\n",
+            PRINT_TRIGGER_PATH.c_str(), strerror(errno), errno);
+        return false;
+    }
+    return true;
+}
+
+bool FlightRecorder::Arm()
+{
+    armed_ = true;
+    if (!config_.triggerMarker.empty()) {
+        if (!ArmMarkerTrigger()) {
+            return false;
+        }
+    }
+    if (!config_.triggerFile.empty()) {
+        fileMtimeNs_ = GetMtimeNs(config_.triggerFile);
+    }
+    if (!config_.triggerSocket.empty()) {
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (config_.triggerSocket.size() >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Error: socket path %s is too long.\n", config_.triggerSocket.c_str());
+            return false;
+        }
+        config_.triggerSocket.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+        if (!RemoveSocketFile(config_.triggerSocket)) {
+            fprintf(stderr, "Error: %s exists and is not a socket.\n", config_.triggerSocket.c_str());
+            return false;
+        }
+        listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd_ == -1 || bind(listenFd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(listenFd_, SOCKET_BACKLOG) != 0) {
+            fprintf(stderr, "Error: listening on %s: %s (%d)\n", config_.triggerSocket.c_str(),
+                strerror(errno), errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+void FlightRecorder::Disarm()
+{
+    if (!armed_) {
+        return;
+    }
+    armed_ = false;
+    if (!config_.triggerMarker.empty()) {
+        traceFs_.Write(PRINT_TRIGGER_PATH, "!traceoff");
+    }
+    if (listenFd_ != -1) {
+        close(listenFd_);
+        listenFd_ = -1;
+        RemoveSocketFile(config_.triggerSocket);
+    }
+}
+
+bool FlightRecorder::IsMarkerTriggered()
+{
+    if (config_.triggerMarker.empty()) {
+        return false;
+    }
+    bool enabled = true;
+    return traceFs_.ReadFlag(TRACING_ON_PATH, enabled) && !enabled;
+}
+
+bool FlightRecorder::IsFileTriggered()
+{
+    if (config_.triggerFile.empty()) {
+        return false;
+    }
+    int64_t mtime = GetMtimeNs(config_.triggerFile);
+    if (mtime == 0 || mtime == fileMtimeNs_) {
+        return false;
+    }
+    fileMtimeNs_ = mtime;
+    return true;
+}
+
+bool FlightRecorder::HandleSocket(bool& stop, bool& triggered)
+{
+    struct pollfd pfd = { listenFd_, POLLIN, 0 };
+    int ret = TEMP_FAILURE_RETRY(poll(&pfd, listenFd_ == -1 ? 0 : 1, POLL_INTERVAL_MS));
+    if (ret <= 0 || listenFd_ == -1) {
+        return true;
+    }
+    int client = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1) {
+        return errno == EINTR || errno == ECONNABORTED;
+    }
+    struct timeval timeout = { SOCKET_TIMEOUT_SEC, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char command[COMMAND_MAX_LEN] = { 0 };
+    ssize_t n = TEMP_FAILURE_RETRY(recv(client, command, sizeof(command) - 1, 0));
+    string cmd(command, n > 0 ? static_cast<size_t>(n) : 0);
+    cmd.erase(cmd.find_last_not_of(" \r\n") + 1);
+    string reply;
+    if (cmd == "dump") {
+        triggered = true;
+        reply = "ok\n";
+    } else if (cmd == "stop") {
+        stop = true;
+        reply = "ok\n";
+    } else if (cmd == "status") {
+        reply = "dumps=" + to_string(dumps_) + "\n";
+    } else {
+        reply = "error: unknown command\n";
+    }
+    send(client, reply.data(), reply.size(), MSG_NOSIGNAL);
+    close(client);
+    return true;
+}
+
+bool FlightRecorder::Fire(RecorderTrigger trigger, const RecorderDump& dump)
+{
+    int64_t now = MonotonicSeconds();
+    bool isTrue = true;
+    if (lastDumpSec_ >= 0 && now - lastDumpSec_ < config_.minInterval) {
+        fprintf(stderr, "Warning: %s trigger ignored, last dump was %" PRId64 "s ago.\n",
+            GetTriggerName(trigger), now - lastDumpSec_);
+        if (trigger == TRIGGER_MARKER) {
+            isTrue = traceFs_.Write(TRACING_ON_PATH, "1");
+        }
+    } else {
+        lastDumpSec_ = now;
+        isTrue = dump(trigger, dumps_++);
+    }
+    if (trigger == TRIGGER_MARKER) {
+        traceFs_.Write(PRINT_TRIGGER_PATH, "!traceoff");
+        isTrue = ArmMarkerTrigger() && isTrue;
+    }
+    return isTrue;
+}
+
+bool FlightRecorder::Run(const RecorderDump& dump)
+{
+    g_dumpRequested = 0;
+    g_stopRequested = 0;
+    struct sigaction action = {};
+    struct sigaction oldUsr1 = {};
+    struct sigaction oldInt = {};
+    struct sigaction oldTerm = {};
+    action.sa_handler = RequestDump;
+    sigaction(SIGUSR1, &action, &oldUsr1);
+    action.sa_handler = RequestStop;
+    sigaction(SIGINT, &action, &oldInt);
+    sigaction(SIGTERM, &action, &oldTerm);
+
+    bool isTrue = Arm();
+    bool stop = false;
+    while (isTrue && !stop && !g_stopRequested) {
+        bool socketTriggered = false;
+        isTrue = HandleSocket(stop, socketTriggered);
+        if (g_dumpRequested) {
+            g_dumpRequested = 0;
+            isTrue = Fire(TRIGGER_SIGNAL, dump) && isTrue;
+        }
+        if (socketTriggered) {
+            isTrue = Fire(TRIGGER_SOCKET, dump) && isTrue;
+        }
+        if (IsFileTriggered()) {
+            isTrue = Fire(TRIGGER_FILE, dump) && isTrue;
+        }
+        if (IsMarkerTriggered()) {
+            isTrue = Fire(TRIGGER_MARKER, dump) && isTrue;
+        }
+        if (config_.maxDumps > 0 && dumps_ >= config_.maxDumps) {
+            break;
+        }
+    }
+    Disarm();
+    sigaction(SIGUSR1, &oldUsr1, nullptr);
+    sigaction(SIGINT, &oldInt, nullptr);
+    sigaction(SIGTERM, &oldTerm, nullptr);
+    return isTrue;
+}
+
+bool ReadTraceClockNow(const TraceFs& traceFs, uint64_t& us)
+{
+    CpuTraceStats stats;
+    if (!ReadCpuStats(traceFs, 0, stats) || stats.nowUs == 0) {
+        fprintf(stderr, "Error: reading trace clock from %s failed.\n", CPU0_STATS_PATH.c_str());
+        return false;
+    }
+    us = stats.nowUs;
+    return true;
+}
+
+bool SkipTraceBefore(int traceFd, uint64_t cutoffUs, string& carry)
+{
+    unique_ptr<char[]> chunk = make_unique<char[]>(SKIP_CHUNK_SIZE);
+    string partial;
+    carry.clear();
+    while (true) {
+        ssize_t n = TEMP_FAILURE_RETRY(read(traceFd, chunk.get(), SKIP_CHUNK_SIZE));
+        if (n < 0) {
+            fprintf(stderr, "Error: reading trace: %s (%d)\n", strerror(errno), errno);
+            return false;
+        } else if (n == 0) {
+            return true;
+        }
+        partial.append(chunk.get(), n);
+        size_t pos = 0;
+        for (size_t eol = partial.find('\n'); eol != string::npos; eol = partial.find('\n', pos)) {
+            const char* line = partial.data() + pos;
+            size_t len = eol - pos + 1;
+            uint64_t us = 0;
+            if (line[0] == '#') {
+                carry.append(line, len);
+            } else if (ParseTraceTimestamp(line, len, us) && us >= cutoffUs) {
+                carry.append(partial, pos, string::npos);
+                return true;
+            }
+            pos = eol + 1;
+        }
+        partial.erase(0, pos);
+    }
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_rotate.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bytrace_dump.h"
+
+using namespace std;
+
+void FileRing::Add(const string& path)
+{
+    files_.push_back(path);
+    while (maxFiles_ > 0 && files_.size() > static_cast<size_t>(maxFiles_)) {
+        if (unlink(files_.front().c_str()) != 0 && errno != ENOENT) {
+            fprintf(stderr, "Warning: removing %s: %s (%d)\n", files_.front().c_str(), strerror(errno), errno);
+        }
+        files_.pop_front();
+    }
+}
+
+RotatingTraceWriter::RotatingTraceWriter(const RotationConfig& config, const RotationHook& header,
+    const RotationHook& footer)
+    : config_(config), header_(header), footer_(footer), ring_(config.maxFiles) {}
+
+RotatingTraceWriter::~RotatingTraceWriter()
+{
+    if (gz_ != nullptr) {
+        gzclose(gz_);
+    } else if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+bool RotatingTraceWriter::Open()
+{
+    string path = config_.output + "." + to_string(index_);
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd_ == -1) {
+        fprintf(stderr, "Error: opening %s: %s (%d)\n", path.c_str(), strerror(errno), errno);
+        return false;
+    }
+    if (config_.compress) {
+        gz_ = gzdopen(fd_, "wb");
+        if (gz_ == nullptr) {
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+    }
+    // The ring only deletes files older than this one.
+    ring_.Add(path);
+    fileBegin_ = chrono::steady_clock::now();
+    fileBytes_ = 0;
+    hasLines_ = false;
+    atLineStart_ = true;
+    string header = header_ ? header_(index_) : "";
+    index_++;
+    return WriteFile(header.data(), header.size());
+}
+
+bool RotatingTraceWriter::WriteFile(const char* data, size_t len)
+{
+    if (len == 0) {
+        return true;
+    }
+    fileBytes_ += len;
+    if (gz_ != nullptr) {
+        return gzwrite(gz_, data, static_cast<unsigned>(len)) == static_cast<int>(len);
+    }
+    return WriteFully(fd_, data, len);
+}
+
+bool RotatingTraceWriter::CloseFile()
+{
+    if (fd_ == -1) {
+        return true;
+    }
+    string footer = footer_ ? footer_(index_ - 1) : "";
+    bool isTrue = WriteFile(footer.data(), footer.size());
+    if (gz_ != nullptr) {
+        isTrue = gzclose(gz_) == Z_OK && isTrue;
+        gz_ = nullptr;
+    } else {
+        isTrue = close(fd_) == 0 && isTrue;
+    }
+    fd_ = -1;
+    return isTrue;
+}
+
+bool RotatingTraceWriter::IsExpired() const
+{
+    if (fd_ == -1 || !hasLines_ || !atLineStart_) {
+        return false;
+    }
+    return (config_.maxFileBytes > 0 && fileBytes_ >= config_.maxFileBytes) ||
+        (config_.maxFileSec > 0 && chrono::steady_clock::now() - fileBegin_ >= chrono::seconds(config_.maxFileSec));
+}
+
+bool RotatingTraceWriter::Write(const char* data, size_t len)
+{
+    rawBytes_ += len;
+    while (len > 0) {
+        // The next file only starts with new lines, so that none is left with a header alone.
+        if (IsExpired() && !CloseFile()) {
+            return false;
+        }
+        if (fd_ == -1 && !Open()) {
+            return false;
+        }
+        size_t step = len;
+        if (config_.maxFileBytes > 0 && fileBytes_ + len > config_.maxFileBytes) {
+            // Up to the first line end past the limit, so that no line is split between two files.
+            size_t need = fileBytes_ < config_.maxFileBytes ? config_.maxFileBytes - fileBytes_ : 0;
+            const char* eol = static_cast<const char*>(memchr(data + need, '\n', len - need));
+            step = eol != nullptr ? static_cast<size_t>(eol - data) + 1 : len;
+        }
+        if (!WriteFile(data, step)) {
+            fprintf(stderr, "Error: writing %s.%d: %s (%d)\n", config_.output.c_str(), index_ - 1,
+                strerror(errno), errno);
+            return false;
+        }
+        hasLines_ = true;
+        atLineStart_ = data[step - 1] == '\n';
+        data += step;
+        len -= step;
+    }
+    return true;
+}
+
+bool RotatingTraceWriter::Flush()
+{
+    // A file that is done is closed at once, to be complete on disk while the capture goes on.
+    return !IsExpired() || CloseFile();
+}
+
+bool RotatingTraceWriter::Close()
+{
+    return CloseFile();
+}
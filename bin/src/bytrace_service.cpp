@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_service.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <grp.h>
+#include <memory>
+#include <poll.h>
+#include <pwd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "bytrace_dump.h"
+
+using namespace std;
+namespace {
+const char REQUEST_MAGIC[] = "BYTRACE2";
+const size_t REQUEST_MAGIC_LEN = sizeof(REQUEST_MAGIC) - 1;
+const uint32_t MAX_ARG_NUMBER = 256;
+const uint32_t MAX_ARG_LEN = 4096;
+const int SOCKET_BACKLOG = 8;
+const int REQUEST_FD_NUMBER = 2; // stdout and stderr of the client
+const int MAX_REQUEST_FD_NUMBER = 3; // and the "-o" file
+const size_t STREAM_CHUNK_SIZE = 64 * 1024;
+const char CLIENT_GROUP[] = "shell";
+const char CLIENT_USER[] = "shell";
+
+bool MakeAddress(const string& path, struct sockaddr_un& addr)
+{
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path %s is too long.\n", path.c_str());
+        return false;
+    }
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+void AppendString(string& buffer, const string& value)
+{
+    uint32_t len = static_cast<uint32_t>(value.size());
+    buffer.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    buffer += value;
+}
+
+bool RecvFully(int fd, void* data, size_t len)
+{
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(recv(fd, p, len, 0));
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool SendFully(int fd, const void* data, size_t len)
+{
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(send(fd, p, len, MSG_NOSIGNAL));
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool RecvString(int fd, string& value)
+{
+    uint32_t len = 0;
+    if (!RecvFully(fd, &len, sizeof(len)) || len > MAX_ARG_LEN) {
+        return false;
+    }
+    value.resize(len);
+    return len == 0 || RecvFully(fd, &value[0], len);
+}
+} // namespace
+
+int ListenServiceSocket(const string& path)
+{
+    struct sockaddr_un addr;
+    if (!MakeAddress(path, addr)) {
+        return -1;
+    }
+    unlink(path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(fd, SOCKET_BACKLOG) != 0) {
+        fprintf(stderr, "Error: listening on %s: %s (%d)\n", path.c_str(), strerror(errno), errno);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    // The shell user runs the clients, the service runs as root: connecting needs write access, which
+    // the shell group is given on the socket file.
+    struct group* clientGroup = getgrnam(CLIENT_GROUP);
+    if (clientGroup == nullptr || chown(path.c_str(), static_cast<uid_t>(-1), clientGroup->gr_gid) != 0) {
+        fprintf(stderr, "Warning: %s not given to the %s group, only root can connect to it.\n", path.c_str(),
+            CLIENT_GROUP);
+    }
+    chmod(path.c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    return fd;
+}
+
+int ConnectServiceSocket(const string& path)
+{
+    struct sockaddr_un addr;
+    if (access(path.c_str(), F_OK) != 0 || !MakeAddress(path, addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (TEMP_FAILURE_RETRY(connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool CheckServicePeer(int sockFd, const vector<uid_t>& uids)
+{
+    struct ucred cred = {};
+    socklen_t len = sizeof(cred);
+    if (getsockopt(sockFd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || len != sizeof(cred)) {
+        return false;
+    }
+    return find(uids.begin(), uids.end(), cred.uid) != uids.end();
+}
+
+vector<uid_t> GetServiceUids()
+{
+    vector<uid_t> uids = { 0, geteuid() };
+    struct passwd* clientUser = getpwnam(CLIENT_USER);
+    if (clientUser != nullptr) {
+        uids.push_back(clientUser->pw_uid);
+    }
+    return uids;
+}
+
+bool SendServiceRequest(int sockFd, const ServiceRequest& request)
+{
+    string buffer = REQUEST_MAGIC;
+    uint32_t count = static_cast<uint32_t>(request.args.size());
+    buffer.append(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const auto& arg : request.args) {
+        AppendString(buffer, arg);
+    }
+
+    // The fds travel with the first byte of the request.
+    int fds[MAX_REQUEST_FD_NUMBER] = { request.outFd, request.errFd, request.outputFd };
+    size_t fdsLen = sizeof(int) * (request.outputFd != -1 ? MAX_REQUEST_FD_NUMBER : REQUEST_FD_NUMBER);
+    char control[CMSG_SPACE(sizeof(fds))] = { 0 };
+    struct iovec iov = { &buffer[0], buffer.size() };
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(fdsLen);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fdsLen);
+    memcpy(CMSG_DATA(cmsg), fds, fdsLen);
+    ssize_t n = TEMP_FAILURE_RETRY(sendmsg(sockFd, &msg, MSG_NOSIGNAL));
+    if (n <= 0) {
+        return false;
+    }
+    return SendFully(sockFd, buffer.data() + n, buffer.size() - static_cast<size_t>(n));
+}
+
+bool ReceiveServiceRequest(int sockFd, ServiceRequest& request)
+{
+    char header[REQUEST_MAGIC_LEN + sizeof(uint32_t)] = { 0 };
+    char control[CMSG_SPACE(sizeof(int) * MAX_REQUEST_FD_NUMBER)] = { 0 };
+    struct iovec iov = { header, sizeof(header) };
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = TEMP_FAILURE_RETRY(recvmsg(sockFd, &msg, MSG_CMSG_CLOEXEC));
+    if (n <= 0) {
+        return false;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        (cmsg->cmsg_len == CMSG_LEN(sizeof(int) * REQUEST_FD_NUMBER) ||
+        cmsg->cmsg_len == CMSG_LEN(sizeof(int) * MAX_REQUEST_FD_NUMBER))) {
+        int fds[MAX_REQUEST_FD_NUMBER] = { -1, -1, -1 };
+        memcpy(fds, CMSG_DATA(cmsg), cmsg->cmsg_len - CMSG_LEN(0));
+        request.outFd = fds[0];
+        request.errFd = fds[1];
+        request.outputFd = fds[2];
+    }
+    if (request.outFd == -1 || request.errFd == -1 ||
+        !RecvFully(sockFd, header + n, sizeof(header) - static_cast<size_t>(n)) ||
+        memcmp(header, REQUEST_MAGIC, REQUEST_MAGIC_LEN) != 0) {
+        return false;
+    }
+    uint32_t count = 0;
+    memcpy(&count, header + REQUEST_MAGIC_LEN, sizeof(count));
+    if (count == 0 || count > MAX_ARG_NUMBER) {
+        return false;
+    }
+    request.args.resize(count);
+    for (auto& arg : request.args) {
+        if (!RecvString(sockFd, arg)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SendServiceResult(int sockFd, int status)
+{
+    int32_t value = status;
+    return SendFully(sockFd, &value, sizeof(value));
+}
+
+bool ReceiveServiceResult(int sockFd, int& status)
+{
+    int32_t value = 0;
+    if (!RecvFully(sockFd, &value, sizeof(value))) {
+        return false;
+    }
+    status = value;
+    return true;
+}
+
+bool StreamTrace(int traceFd, int outFd, int stopFd)
+{
+    auto chunk = make_unique<char[]>(STREAM_CHUNK_SIZE);
+    struct pollfd pfds[] = { { traceFd, POLLIN, 0 }, { stopFd, POLLIN, 0 } };
+    while (true) {
+        int ret = poll(pfds, stopFd == -1 ? 1 : 2, -1);
+        if (ret == -1 && errno != EINTR) {
+            return false;
+        } else if (ret <= 0) {
+            continue;
+        }
+        if (stopFd != -1 && pfds[1].revents != 0) {
+            return true;
+        }
+        if ((pfds[0].revents & POLLIN) == 0) {
+            if (pfds[0].revents != 0) {
+                return false;
+            }
+            continue;
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(read(traceFd, chunk.get(), STREAM_CHUNK_SIZE));
+        if (n == 0) {
+            return true;
+        } else if (n < 0) {
+            if (errno == EAGAIN) {
+                continue;
+            }
+            return false;
+        }
+        if (!WriteFully(outFd, chunk.get(), static_cast<size_t>(n))) {
+            // The reader went away, e.g. the client was interrupted.
+            return errno == EPIPE;
+        }
+    }
+}
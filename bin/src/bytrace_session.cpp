@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_session.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+namespace {
+const string INSTANCES_DIR = "instances/";
+const string INSTANCE_PREFIX = "bytrace_";
+const string LOCK_PREFIX = "bytrace_session_";
+const string LOCK_SUFFIX = ".lock";
+const string TRACING_ON_FILE = "/tracing_on";
+const size_t MAX_NAME_LEN = 32;
+
+string LockPath(const string& lockDir, const string& name)
+{
+    return lockDir + LOCK_PREFIX + name + LOCK_SUFFIX;
+}
+
+bool IsTracingOn(const string& instancePath)
+{
+    int fd = open((instancePath + TRACING_ON_FILE).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    char flag = '0';
+    ssize_t len = read(fd, &flag, 1);
+    close(fd);
+    return len == 1 && flag == '1';
+}
+} // namespace
+
+TraceSession::TraceSession(const string& tracingRoot, const string& name, const string& lockDir)
+    : tracingRoot_(tracingRoot), name_(name), lockPath_(LockPath(lockDir, name)) {}
+
+TraceSession::~TraceSession()
+{
+    Release();
+}
+
+bool TraceSession::IsValidName(const string& name)
+{
+    if (name.empty() || name.size() > MAX_NAME_LEN) {
+        return false;
+    }
+    for (char c : name) {
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ||
+            c == '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+string TraceSession::GetRootPath() const
+{
+    return tracingRoot_ + INSTANCES_DIR + GetInstanceName() + "/";
+}
+
+string TraceSession::GetInstanceName() const
+{
+    return INSTANCE_PREFIX + name_;
+}
+
+bool TraceSession::Acquire()
+{
+    if (lockFd_ != -1) {
+        return true;
+    }
+    lockFd_ = open(lockPath_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (lockFd_ == -1) {
+        fprintf(stderr, "Error: opening %s: %s (%d)\n", lockPath_.c_str(), strerror(errno), errno);
+        return false;
+    }
+    if (flock(lockFd_, LOCK_EX | LOCK_NB) != 0) {
+        fprintf(stderr, "Error: session \"%s\" is used by another bytrace.\n", name_.c_str());
+        close(lockFd_);
+        lockFd_ = -1;
+        return false;
+    }
+    futimens(lockFd_, nullptr);
+    string path = GetRootPath();
+    if (mkdir(path.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: creating %s: %s (%d)\n", path.c_str(), strerror(errno), errno);
+        Release();
+        return false;
+    }
+    return true;
+}
+
+bool TraceSession::Remove()
+{
+    string path = GetRootPath();
+    if (rmdir(path.c_str()) != 0) {
+        if (errno == EBUSY) {
+            // Another process still has a file of the instance open; it is cleaned up once abandoned.
+            fprintf(stderr, "Warning: %s is still in use and is removed later.\n", path.c_str());
+        } else if (errno != ENOENT) {
+            fprintf(stderr, "Error: removing %s: %s (%d)\n", path.c_str(), strerror(errno), errno);
+            return false;
+        }
+    }
+    if (lockFd_ != -1) {
+        unlink(lockPath_.c_str());
+    }
+    return true;
+}
+
+void TraceSession::Release()
+{
+    if (lockFd_ == -1) {
+        return;
+    }
+    futimens(lockFd_, nullptr);
+    close(lockFd_);
+    lockFd_ = -1;
+}
+
+int CleanAbandonedSessions(const string& tracingRoot, const string& lockDir, int idleSec)
+{
+    DIR* dir = opendir((tracingRoot + INSTANCES_DIR).c_str());
+    if (dir == nullptr) {
+        return 0;
+    }
+    int removed = 0;
+    time_t now = time(nullptr);
+    while (struct dirent* entry = readdir(dir)) {
+        string instance = entry->d_name;
+        if (instance.compare(0, INSTANCE_PREFIX.size(), INSTANCE_PREFIX) != 0) {
+            continue;
+        }
+        string name = instance.substr(INSTANCE_PREFIX.size());
+        string lockPath = LockPath(lockDir, name);
+        int fd = open(lockPath.c_str(), O_RDWR | O_CLOEXEC);
+        struct stat st = {};
+        if (fd != -1 && (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0 || now - st.st_mtime < idleSec)) {
+            close(fd);
+            continue;
+        }
+        // A capture started with --trace_begin runs on without a process; it is not abandoned.
+        string instancePath = tracingRoot + INSTANCES_DIR + instance;
+        if (!IsTracingOn(instancePath) && rmdir(instancePath.c_str()) == 0) {
+            unlink(lockPath.c_str());
+            removed++;
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    closedir(dir);
+    return removed;
+}
@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_stream.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace std;
+namespace {
+const int BYTE_BITS = 8;
+const size_t ACK_SIZE = 8;
+const int ACK_TIMEOUT_MS = 10000;       // a collector that does not answer for 10s is taken as gone
+const int SEND_TIMEOUT_SEC = 10;
+const int RECONNECT_TIMEOUT_SEC = 30;   // a lost collector is retried for 30s before giving up
+const int RECONNECT_INTERVAL_MS = 1000;
+const int IDLE_FLUSH_MS = 200;          // a partial chunk is sent once the trace is idle for this long
+const size_t READ_CHUNK_SIZE = 64 * 1024;
+
+void PutLe(string& out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        out += static_cast<char>((value >> (i * BYTE_BITS)) & 0xff);
+    }
+}
+
+uint64_t GetLe(const char* in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << BYTE_BITS) | static_cast<uint8_t>(in[i]);
+    }
+    return value;
+}
+
+bool CompressChunk(const string& in, string& out)
+{
+    uLongf len = compressBound(in.size());
+    out.resize(len);
+    int ret = compress2(reinterpret_cast<Bytef*>(&out[0]), &len, reinterpret_cast<const Bytef*>(in.data()),
+        in.size(), Z_DEFAULT_COMPRESSION);
+    if (ret != Z_OK) {
+        fprintf(stderr, "Error: deflate zlib: %d\n", ret);
+        return false;
+    }
+    out.resize(len);
+    return true;
+}
+
+int ConnectUnix(const string& path)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd != -1 && TEMP_FAILURE_RETRY(connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ConnectTcp(const string& host, int port)
+{
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &result) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai != nullptr && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd != -1 && TEMP_FAILURE_RETRY(connect(fd, ai->ai_addr, ai->ai_addrlen)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+} // namespace
+
+bool ParseStreamTarget(const string& arg, StreamTarget& target)
+{
+    target = StreamTarget();
+    if (arg.compare(0, strlen("unix:"), "unix:") == 0) {
+        target.path = arg.substr(strlen("unix:"));
+        return !target.path.empty() && target.path.size() < sizeof(sockaddr_un::sun_path);
+    }
+    string address = arg.compare(0, strlen("tcp:"), "tcp:") == 0 ? arg.substr(strlen("tcp:")) : arg;
+    size_t colon = address.rfind(':');
+    if (colon == string::npos || colon == 0) {
+        return false;
+    }
+    char* end = nullptr;
+    long port = strtol(address.c_str() + colon + 1, &end, 10);
+    if (*end != '\0' || port <= 0 || port > 65535) { // 65535: largest tcp port
+        return false;
+    }
+    target.host = address.substr(0, colon);
+    // "[::1]:9000"
+    if (target.host.size() > 2 && target.host.front() == '[' && target.host.back() == ']') {
+        target.host = target.host.substr(1, target.host.size() - 2);
+    }
+    target.port = static_cast<int>(port);
+    return true;
+}
+
+TraceStreamer::TraceStreamer(const StreamTarget& target, bool compress, size_t chunkSize)
+    : target_(target), compress_(compress), chunkSize_(chunkSize)
+{
+    random_device rd;
+    streamId_ = (static_cast<uint64_t>(rd()) << 32) | rd(); // 32: upper half of the id
+}
+
+TraceStreamer::~TraceStreamer()
+{
+    if (sockFd_ != -1) {
+        close(sockFd_);
+    }
+}
+
+bool TraceStreamer::Connect()
+{
+    sockFd_ = target_.path.empty() ? ConnectTcp(target_.host, target_.port) : ConnectUnix(target_.path);
+    if (sockFd_ == -1) {
+        return false;
+    }
+    struct timeval timeout = { SEND_TIMEOUT_SEC, 0 };
+    setsockopt(sockFd_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    ackBuffer_.clear();
+    sentInPending_ = 0;
+    return Hello();
+}
+
+// The collector answers with the next chunk it expects: 0 for a new stream, more after a reconnection.
+bool TraceStreamer::Hello()
+{
+    return SendFrame(STREAM_HELLO, streamId_, compress_ ? STREAM_FLAG_ZLIB : 0, "") && ReadAcks(true);
+}
+
+bool TraceStreamer::Open()
+{
+    if (!Connect()) {
+        fprintf(stderr, "Error: connecting to the collector: %s (%d)\n", strerror(errno), errno);
+        return false;
+    }
+    return true;
+}
+
+bool TraceStreamer::Reconnect()
+{
+    if (sockFd_ != -1) {
+        close(sockFd_);
+        sockFd_ = -1;
+    }
+    fprintf(stderr, "Warning: the collector is gone, reconnecting...\n");
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(RECONNECT_TIMEOUT_SEC);
+    while (chrono::steady_clock::now() < deadline) {
+        if (Connect() && SendPending()) {
+            return true;
+        }
+        if (sockFd_ != -1) {
+            close(sockFd_);
+            sockFd_ = -1;
+        }
+        usleep(RECONNECT_INTERVAL_MS * 1000); // 1000: us per ms
+    }
+    fprintf(stderr, "Error: the collector did not come back within %d s.\n", RECONNECT_TIMEOUT_SEC);
+    return false;
+}
+
+bool TraceStreamer::SendFrame(uint32_t type, uint64_t seq, uint32_t flags, const string& payload)
+{
+    string header;
+    PutLe(header, STREAM_FRAME_MAGIC, sizeof(uint32_t));
+    PutLe(header, type, sizeof(uint32_t));
+    PutLe(header, seq, sizeof(uint64_t));
+    PutLe(header, flags, sizeof(uint32_t));
+    PutLe(header, payload.size(), sizeof(uint32_t));
+    struct iovec iov[] = {
+        { &header[0], header.size() },
+        { const_cast<char*>(payload.data()), payload.size() },
+    };
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = payload.empty() ? 1 : 2;
+    size_t left = header.size() + payload.size();
+    while (left > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(sendmsg(sockFd_, &msg, MSG_NOSIGNAL));
+        if (n <= 0) {
+            return false;
+        }
+        left -= static_cast<size_t>(n);
+        for (size_t done = static_cast<size_t>(n); done > 0;) {
+            size_t step = min(done, msg.msg_iov->iov_len);
+            msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + step;
+            msg.msg_iov->iov_len -= step;
+            done -= step;
+            if (msg.msg_iov->iov_len == 0 && msg.msg_iovlen > 1) {
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            }
+        }
+    }
+    sentBytes_ += header.size() + payload.size();
+    return true;
+}
+
+// Drops the acknowledged chunks. Chunks that the collector lost and that are no longer buffered are a gap.
+void TraceStreamer::Acknowledge(uint64_t next)
+{
+    while (!pending_.empty() && pending_.front().seq < next) {
+        pending_.pop_front();
+        if (sentInPending_ > 0) {
+            sentInPending_--;
+        }
+    }
+    uint64_t oldest = pending_.empty() ? nextSeq_ : pending_.front().seq;
+    if (next < oldest) {
+        fprintf(stderr, "Warning: chunks %" PRIu64 "-%" PRIu64 " of the stream were lost by the collector.\n",
+            next, oldest - 1);
+    }
+}
+
+// Takes the acknowledgements that have arrived; with wait, blocks until at least one more arrives.
+bool TraceStreamer::ReadAcks(bool wait)
+{
+    char buffer[ACK_SIZE * STREAM_WINDOW];
+    bool acked = false;
+    while (true) {
+        struct pollfd pfd = { sockFd_, POLLIN, 0 };
+        int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, (wait && !acked) ? ACK_TIMEOUT_MS : 0));
+        if (ret == 0) {
+            return acked || !wait;
+        }
+        ssize_t n = ret > 0 ? TEMP_FAILURE_RETRY(recv(sockFd_, buffer, sizeof(buffer), MSG_DONTWAIT)) : -1;
+        if (n <= 0) {
+            // The collector closes the connection after the acknowledgement of END.
+            return n == 0 && acked;
+        }
+        ackBuffer_.append(buffer, static_cast<size_t>(n));
+        while (ackBuffer_.size() >= ACK_SIZE) {
+            Acknowledge(GetLe(ackBuffer_.data(), ACK_SIZE));
+            ackBuffer_.erase(0, ACK_SIZE);
+            acked = true;
+        }
+    }
+}
+
+bool TraceStreamer::SendPending()
+{
+    while (sentInPending_ < pending_.size()) {
+        const Chunk& chunk = pending_[sentInPending_];
+        if (!SendFrame(STREAM_DATA, chunk.seq, chunk.flags, chunk.payload)) {
+            return false;
+        }
+        sentInPending_++;
+    }
+    return true;
+}
+
+bool TraceStreamer::Flush()
+{
+    if (!current_.empty()) {
+        Chunk chunk = { nextSeq_++, 0, "" };
+        if (compress_ && CompressChunk(current_, chunk.payload)) {
+            chunk.flags = STREAM_FLAG_ZLIB;
+        } else {
+            chunk.payload.swap(current_);
+        }
+        current_.clear();
+        pending_.push_back(move(chunk));
+    }
+    // With a full window, wait for the collector; the reader stalls and the kernel buffer takes the backlog.
+    while (true) {
+        bool isTrue = sockFd_ != -1 && SendPending() && ReadAcks(false);
+        while (isTrue && pending_.size() >= STREAM_WINDOW) {
+            isTrue = ReadAcks(true);
+        }
+        if (isTrue) {
+            return true;
+        }
+        if (!Reconnect()) {
+            return false;
+        }
+    }
+}
+
+bool TraceStreamer::Write(const char* data, size_t len)
+{
+    rawBytes_ += len;
+    while (len > 0) {
+        size_t step = min(len, chunkSize_ - current_.size());
+        current_.append(data, step);
+        data += step;
+        len -= step;
+        if (current_.size() == chunkSize_ && !Flush()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TraceStreamer::Close()
+{
+    if (!Flush()) {
+        return false;
+    }
+    // Everything is acknowledged once the collector expects the chunk after the last one.
+    while (true) {
+        bool isTrue = sockFd_ != -1 && SendPending();
+        while (isTrue && !pending_.empty()) {
+            isTrue = ReadAcks(true);
+        }
+        if (isTrue && SendFrame(STREAM_END, nextSeq_, 0, "") && ReadAcks(true)) {
+            break;
+        }
+        if (!Reconnect()) {
+            return false;
+        }
+    }
+    close(sockFd_);
+    sockFd_ = -1;
+    return true;
+}
+
+bool StreamTracePipe(int traceFd, TraceSink& sink, int durationMs)
+{
+    auto buffer = make_unique<char[]>(READ_CHUNK_SIZE);
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(durationMs);
+    while (true) {
+        // Checked before every read, so that a trace_pipe that never runs dry, or a collector slow enough
+        // to keep it full, does not extend the capture.
+        auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        if (durationMs > 0 && left <= 0) {
+            return sink.Flush();
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(read(traceFd, buffer.get(), READ_CHUNK_SIZE));
+        if (n > 0) {
+            if (!sink.Write(buffer.get(), static_cast<size_t>(n))) {
+                return false;
+            }
+            continue;
+        } else if (n == 0) {
+            return sink.Flush();
+        } else if (errno != EAGAIN) {
+            fprintf(stderr, "Error: reading the trace: %s (%d)\n", strerror(errno), errno);
+            return false;
+        }
+        // The pipe ran dry: a drain is done, a capture waits for more.
+        if (durationMs == 0) {
+            return sink.Flush();
+        }
+        struct pollfd pfd = { traceFd, POLLIN, 0 };
+        if (TEMP_FAILURE_RETRY(poll(&pfd, 1, static_cast<int>(min<long long>(left, IDLE_FLUSH_MS)))) > 0 &&
+            (pfd.revents & POLLIN) != 0) {
+            continue;
+        }
+        // The trace is idle: send what is there so that the collector keeps up.
+        if (!sink.Flush()) {
+            return false;
+        }
+    }
+}
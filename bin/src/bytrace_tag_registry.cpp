@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_tag_registry.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include "bytrace.h"
+
+using namespace std;
+namespace {
+const char FIELD_SEPARATOR = '|';
+const char FILE_SEPARATOR = ',';
+const size_t VENDOR_TAG_FIELDS = 3;
+
+template <size_t N>
+constexpr TagCategory KernelTag(string_view name, string_view description, const string_view (&files)[N])
+{
+    return { name, description, 0, KERNEL, files, N };
+}
+
+constexpr TagCategory UserTag(string_view name, string_view description, uint64_t tag)
+{
+    return { name, description, tag, USER, nullptr, 0 };
+}
+
+constexpr string_view DISK_FILES[] = {
+    "events/f2fs/f2fs_sync_file_enter/enable",
+    "events/f2fs/f2fs_sync_file_exit/enable",
+    "events/f2fs/f2fs_write_begin/enable",
+    "events/f2fs/f2fs_write_end/enable",
+    "events/ext4/ext4_da_write_begin/enable",
+    "events/ext4/ext4_da_write_end/enable",
+    "events/ext4/ext4_sync_file_enter/enable",
+    "events/ext4/ext4_sync_file_exit/enable",
+    "events/block/block_rq_issue/enable",
+    "events/block/block_rq_complete/enable",
+};
+constexpr string_view FREQ_FILES[] = {
+    "events/power/cpu_frequency/enable",
+    "events/power/clock_set_rate/enable",
+    "events/power/clock_disable/enable",
+    "events/power/clock_enable/enable",
+    "events/clk/clk_set_rate/enable",
+    "events/clk/clk_disable/enable",
+    "events/clk/clk_enable/enable",
+    "events/power/cpu_frequency_limits/enable",
+};
+constexpr string_view I2C_FILES[] = {
+    "events/i2c/enable",
+    "events/i2c/i2c_read/enable",
+    "events/i2c/i2c_write/enable",
+    "events/i2c/i2c_result/enable",
+    "events/i2c/i2c_reply/enable",
+    "events/i2c/smbus_read/enable",
+    "events/i2c/smbus_write/enable",
+    "events/i2c/smbus_result/enable",
+    "events/i2c/smbus_reply/enable",
+};
+constexpr string_view IDLE_FILES[] = {
+    "events/power/cpu_idle/enable",
+};
+constexpr string_view IRQ_FILES[] = {
+    "events/irq/enable",
+    "events/ipi/enable",
+};
+constexpr string_view IRQOFF_FILES[] = {
+    "events/preemptirq/irq_enable/enable",
+    "events/preemptirq/irq_disable/enable",
+};
+constexpr string_view LOAD_FILES[] = {
+    "events/cpufreq_interactive/enable",
+};
+constexpr string_view MEMBUS_FILES[] = {
+    "events/memory_bus/enable",
+};
+constexpr string_view MEMORY_FILES[] = {
+    "events/kmem/rss_stat/enable",
+    "events/kmem/ion_heap_grow/enable",
+    "events/kmem/ion_heap_shrink/enable",
+};
+constexpr string_view MEMRECLAIM_FILES[] = {
+    "events/vmscan/mm_vmscan_direct_reclaim_begin/enable",
+    "events/vmscan/mm_vmscan_direct_reclaim_end/enable",
+    "events/vmscan/mm_vmscan_kswapd_wake/enable",
+    "events/vmscan/mm_vmscan_kswapd_sleep/enable",
+    "events/lowmemorykiller/enable",
+};
+constexpr string_view MMC_FILES[] = {
+    "events/mmc/enable",
+};
+constexpr string_view PAGECACHE_FILES[] = {
+    "events/filemap/enable",
+};
+constexpr string_view PREEMPTOFF_FILES[] = {
+    "events/preemptirq/preempt_enable/enable",
+    "events/preemptirq/preempt_disable/enable",
+};
+constexpr string_view REGULATORS_FILES[] = {
+    "events/regulator/enable",
+};
+constexpr string_view SCHED_FILES[] = {
+    "events/sched/sched_switch/enable",
+    "events/sched/sched_wakeup/enable",
+    "events/sched/sched_wakeup_new/enable",
+    "events/sched/sched_waking/enable",
+    "events/sched/sched_blocked_reason/enable",
+    "events/sched/sched_pi_setprio/enable",
+    "events/sched/sched_process_exit/enable",
+    "events/cgroup/enable",
+    "events/oom/oom_score_adj_update/enable",
+    "events/task/task_rename/enable",
+    "events/task/task_newtask/enable",
+};
+constexpr string_view SYNC_FILES[] = {
+    // linux kernel > 4.9
+    "events/dma_fence/enable",
+};
+constexpr string_view UFS_FILES[] = {
+    "events/ufs/enable",
+};
+constexpr string_view WORKQ_FILES[] = {
+    "events/workqueue/enable",
+};
+constexpr string_view ZBINDER_FILES[] = {
+    "events/zbinder/enable",
+};
+
+// Keep sorted by name.
+constexpr TagCategory BUILTIN_TAGS[] = {
+    UserTag("ability", "Ability Manager", BYTRACE_TAG_ABILITY_MANAGER),
+    UserTag("ace", "ACE development framework", BYTRACE_TAG_ACE),
+    UserTag("app", "APP Module", BYTRACE_TAG_APP),
+    KernelTag("disk", "Disk I/O", DISK_FILES),
+    UserTag("distributeddatamgr", "Distributed Data Manager", BYTRACE_TAG_DISTRIBUTEDDATA),
+    KernelTag("freq", "CPU Frequency", FREQ_FILES),
+    UserTag("graphic", "Graphic Module", BYTRACE_TAG_GRAPHIC_AGP),
+    KernelTag("i2c", "I2C Events", I2C_FILES),
+    KernelTag("idle", "CPU Idle", IDLE_FILES),
+    KernelTag("irq", "IRQ Events", IRQ_FILES),
+    KernelTag("irqoff", "IRQ-disabled code section tracing", IRQOFF_FILES),
+    KernelTag("load", "CPU Load", LOAD_FILES),
+    UserTag("mdfs", "Mobile Distributed File System", BYTRACE_TAG_MDFS),
+    KernelTag("membus", "Memory Bus Utilization", MEMBUS_FILES),
+    KernelTag("memory", "Memory", MEMORY_FILES),
+    KernelTag("memreclaim", "Kernel Memory Reclaim", MEMRECLAIM_FILES),
+    KernelTag("mmc", "eMMC commands", MMC_FILES),
+    UserTag("notification", "Notification Module", BYTRACE_TAG_NOTIFICATION),
+    UserTag("ohos", "OpenHarmony", BYTRACE_TAG_OHOS),
+    KernelTag("pagecache", "Page cache", PAGECACHE_FILES),
+    KernelTag("preemptoff", "Preempt-disabled code section tracing", PREEMPTOFF_FILES),
+    KernelTag("regulators", "Voltage and Current Regulators", REGULATORS_FILES),
+    KernelTag("sched", "CPU Scheduling", SCHED_FILES),
+    KernelTag("sync", "Synchronization", SYNC_FILES),
+    KernelTag("ufs", "UFS commands", UFS_FILES),
+    KernelTag("workq", "Kernel Workqueues", WORKQ_FILES),
+    UserTag("zaudio", "OpenHarmony Audio Module", BYTRACE_TAG_ZAUDIO),
+    KernelTag("zbinder", "Harmony binder communication", ZBINDER_FILES),
+    UserTag("zcamera", "OpenHarmony Camera Module", BYTRACE_TAG_ZCAMERA),
+    UserTag("zimage", "OpenHarmony Image Module", BYTRACE_TAG_ZIMAGE),
+    UserTag("zmedia", "OpenHarmony Media Module", BYTRACE_TAG_ZMEDIA),
+};
+
+template <size_t N>
+constexpr bool IsSortedByName(const TagCategory (&tags)[N])
+{
+    for (size_t i = 1; i < N; i++) {
+        if (!(tags[i - 1].name < tags[i].name)) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(IsSortedByName(BUILTIN_TAGS), "BUILTIN_TAGS must be sorted by name");
+
+const TagCategory* FindBuiltinTag(string_view name)
+{
+    auto it = lower_bound(begin(BUILTIN_TAGS), end(BUILTIN_TAGS), name,
+        [](const TagCategory& tag, string_view key) { return tag.name < key; });
+    return (it != end(BUILTIN_TAGS) && it->name == name) ? it : nullptr;
+}
+
+vector<string> Split(const string& str, char separator)
+{
+    vector<string> fields;
+    size_t begin = 0;
+    while (true) {
+        size_t end = str.find(separator, begin);
+        fields.push_back(str.substr(begin, end == string::npos ? string::npos : end - begin));
+        if (end == string::npos) {
+            return fields;
+        }
+        begin = end + 1;
+    }
+}
+} // namespace
+
+bool TagRegistry::LoadVendorTags(const string& path)
+{
+    ifstream fin(path);
+    if (!fin.is_open()) {
+        return false;
+    }
+    string line;
+    int lineNumber = 0;
+    while (getline(fin, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        vector<string> fields = Split(line, FIELD_SEPARATOR);
+        if (fields.size() != VENDOR_TAG_FIELDS || fields[0].empty() || fields[2].empty()) {
+            fprintf(stderr, "Warning: %s:%d: expected \"name|description|files\".\n", path.c_str(), lineNumber);
+            continue;
+        }
+        if (Find(fields[0]) != nullptr) {
+            fprintf(stderr, "Warning: %s:%d: category \"%s\" already exists.\n", path.c_str(), lineNumber,
+                fields[0].c_str());
+            continue;
+        }
+        auto tag = make_unique<VendorTag>();
+        tag->name = fields[0];
+        tag->description = fields[1];
+        tag->files = Split(fields[2], FILE_SEPARATOR);
+        tag->fileViews.assign(tag->files.begin(), tag->files.end());
+        tag->category = { tag->name, tag->description, 0, KERNEL, tag->fileViews.data(), tag->fileViews.size() };
+        auto pos = lower_bound(vendorTags_.begin(), vendorTags_.end(), tag->name,
+            [](const unique_ptr<VendorTag>& entry, const string& key) { return entry->name < key; });
+        vendorTags_.insert(pos, move(tag));
+    }
+    return true;
+}
+
+const TagCategory* TagRegistry::Find(string_view name) const
+{
+    const TagCategory* tag = FindBuiltinTag(name);
+    if (tag != nullptr || vendorTags_.empty()) {
+        return tag;
+    }
+    auto it = lower_bound(vendorTags_.begin(), vendorTags_.end(), name,
+        [](const unique_ptr<VendorTag>& entry, string_view key) { return string_view(entry->name) < key; });
+    return (it != vendorTags_.end() && (*it)->name == name) ? &(*it)->category : nullptr;
+}
+
+vector<const TagCategory*> TagRegistry::GetAll() const
+{
+    vector<const TagCategory*> tags;
+    tags.reserve(size(BUILTIN_TAGS) + vendorTags_.size());
+    for (const auto& tag : BUILTIN_TAGS) {
+        tags.push_back(&tag);
+    }
+    for (const auto& tag : vendorTags_) {
+        tags.push_back(&tag->category);
+    }
+    inplace_merge(tags.begin(), tags.begin() + size(BUILTIN_TAGS), tags.end(),
+        [](const TagCategory* a, const TagCategory* b) { return a->name < b->name; });
+    return tags;
+}
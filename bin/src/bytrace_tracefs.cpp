@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytrace_tracefs.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+namespace {
+const size_t READ_CHUNK_SIZE = 4096;
+const char ENABLE_SUFFIX[] = "/enable";
+
+// Files toggled on every start, stop or marker write. Any other file written is opened and closed again,
+// so a long-running process does not collect an fd for each control file it ever touched.
+bool IsHotFile(const string& file)
+{
+    if (file == "tracing_on" || file == "trace_marker" || file == "set_event") {
+        return true;
+    }
+    size_t suffixLength = strlen(ENABLE_SUFFIX);
+    return file.size() >= suffixLength && file.compare(file.size() - suffixLength, suffixLength, ENABLE_SUFFIX) == 0;
+}
+
+bool WriteFd(int fd, const string& value)
+{
+    ssize_t ret = -1;
+    do {
+        ret = pwrite(fd, value.data(), value.size(), 0);
+        if (ret == -1 && errno == ESPIPE) {
+            ret = write(fd, value.data(), value.size());
+        }
+    } while (ret == -1 && errno == EINTR);
+    return ret == static_cast<ssize_t>(value.size());
+}
+} // namespace
+
+TraceFs::~TraceFs()
+{
+    Close();
+}
+
+bool TraceFs::Open(const string& rootPath)
+{
+    Close();
+    rootFd_ = open(rootPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd_ == -1) {
+        return false;
+    }
+    rootPath_ = rootPath;
+    return true;
+}
+
+void TraceFs::Close()
+{
+    for (auto& entry : fds_) {
+        close(entry.second);
+    }
+    fds_.clear();
+    if (rootFd_ != -1) {
+        close(rootFd_);
+        rootFd_ = -1;
+    }
+}
+
+bool TraceFs::Exists(const string& file) const
+{
+    return faccessat(rootFd_, file.c_str(), F_OK, 0) != -1;
+}
+
+bool TraceFs::IsWritable(const string& file) const
+{
+    return faccessat(rootFd_, file.c_str(), W_OK, 0) != -1;
+}
+
+int TraceFs::OpenFile(const string& file, int flags) const
+{
+    int fd = -1;
+    do {
+        fd = openat(rootFd_, file.c_str(), flags | O_CLOEXEC);
+    } while (fd == -1 && errno == EINTR);
+    return fd;
+}
+
+int TraceFs::GetFd(const string& file)
+{
+    auto it = fds_.find(file);
+    if (it != fds_.end()) {
+        return it->second;
+    }
+    // Never readable: a reader of snapshot or trace sets up an iterator on its buffer, which stops the
+    // kernel from resizing, allocating or freeing that buffer for as long as the fd stays open.
+    int fd = OpenFile(file, O_WRONLY);
+    if (fd != -1) {
+        fds_[file] = fd;
+    }
+    return fd;
+}
+
+bool TraceFs::Write(const string& file, const string& value)
+{
+    if (IsHotFile(file)) {
+        int fd = GetFd(file);
+        return fd != -1 && WriteFd(fd, value);
+    }
+    int fd = OpenFile(file, O_WRONLY);
+    if (fd == -1) {
+        return false;
+    }
+    bool ret = WriteFd(fd, value);
+    int savedErrno = errno;
+    close(fd);
+    errno = savedErrno;
+    return ret;
+}
+
+bool TraceFs::Read(const string& file, string& value) const
+{
+    int fd = OpenFile(file, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    value.clear();
+    char buffer[READ_CHUNK_SIZE];
+    ssize_t ret = 0;
+    while ((ret = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            return false;
+        }
+        value.append(buffer, static_cast<size_t>(ret));
+    }
+    close(fd);
+    return true;
+}
+
+bool TraceFs::ReadFlag(const string& file, bool& enabled) const
+{
+    int fd = OpenFile(file, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    char flag = 0;
+    ssize_t ret = -1;
+    do {
+        ret = pread(fd, &flag, 1, 0);
+    } while (ret == -1 && errno == EINTR);
+    close(fd);
+    if (ret != 1) {
+        return false;
+    }
+    enabled = flag != '0';
+    return true;
+}
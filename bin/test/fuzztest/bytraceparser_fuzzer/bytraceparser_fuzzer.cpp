@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "bytrace_parser.h"
+
+using namespace std;
+
+namespace {
+// Every view of an event has to stay within the parsed text.
+bool IsWithin(string_view text, string_view view)
+{
+    return view.empty() || (view.data() >= text.data() && view.data() + view.size() <= text.data() + text.size());
+}
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    string_view text(reinterpret_cast<const char*>(data), size);
+    vector<TraceEvent> events;
+    TraceParseStats stats = ParseTraceText(text, events, 1);
+    if (stats.lines - stats.skipped != events.size()) {
+        __builtin_trap();
+    }
+    for (const TraceEvent& event : events) {
+        if (!IsWithin(text, event.task) || !IsWithin(text, event.flags) || !IsWithin(text, event.name) ||
+            !IsWithin(text, event.payload)) {
+            __builtin_trap();
+        }
+        TraceMarker marker;
+        if (ParseTraceMarker(event.payload, marker) && !IsWithin(text, marker.name)) {
+            __builtin_trap();
+        }
+    }
+    return 0;
+}
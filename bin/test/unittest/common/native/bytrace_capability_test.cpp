@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bytrace_capability.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string FAKE_TRACEFS = "/data/local/tmp/bytrace_capability_tracefs/";
+const string ENABLE_FILE = "events/sched/enable";
+const string CACHE_PATH = "/data/local/tmp/bytrace_capability_test";
+const string USER_CACHE_PATH = CACHE_PATH + "." + to_string(geteuid());
+const string VICTIM_PATH = "/data/local/tmp/bytrace_capability_victim";
+
+class BytraceCapabilityTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp()
+    {
+        mkdir(FAKE_TRACEFS.c_str(), S_IRWXU);
+        mkdir((FAKE_TRACEFS + "events").c_str(), S_IRWXU);
+        mkdir((FAKE_TRACEFS + "events/sched").c_str(), S_IRWXU);
+        ofstream(FAKE_TRACEFS + ENABLE_FILE) << "0\n";
+    };
+    void TearDown()
+    {
+        unlink((FAKE_TRACEFS + ENABLE_FILE).c_str());
+        rmdir((FAKE_TRACEFS + "events/sched").c_str());
+        rmdir((FAKE_TRACEFS + "events").c_str());
+        rmdir(FAKE_TRACEFS.c_str());
+        unlink(USER_CACHE_PATH.c_str());
+        unlink(VICTIM_PATH.c_str());
+    };
+};
+
+string ReadAll(const string& path)
+{
+    ifstream fin(path);
+    stringstream ss;
+    ss << fin.rdbuf();
+    return ss.str();
+}
+
+// A cache of the fake tracefs that knows the enable file and a missing one.
+bool WriteCache(TraceFs& traceFs)
+{
+    CapabilityCache cache(traceFs, CACHE_PATH);
+    return !cache.Load() && cache.Probe(ENABLE_FILE) == FILE_WRITABLE &&
+        cache.Probe("events/gone/enable") == FILE_MISSING && cache.Save();
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a saved probe is a hit on the next run, a file never probed is a miss that is probed.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceCapabilityTest, CapabilityCache_001, TestSize.Level0)
+{
+    TraceFs traceFs;
+    ASSERT_TRUE(traceFs.Open(FAKE_TRACEFS));
+    ASSERT_TRUE(WriteCache(traceFs));
+    struct stat st = {};
+    ASSERT_EQ(lstat(USER_CACHE_PATH.c_str(), &st), 0);
+    EXPECT_TRUE(S_ISREG(st.st_mode));
+
+    // The hit comes from the cache: the file is gone from the tracefs by now.
+    unlink((FAKE_TRACEFS + ENABLE_FILE).c_str());
+    CapabilityCache cache(traceFs, CACHE_PATH);
+    ASSERT_TRUE(cache.Load());
+    EXPECT_EQ(cache.Probe(ENABLE_FILE), FILE_WRITABLE);
+    EXPECT_EQ(cache.Probe("events/gone/enable"), FILE_MISSING);
+    EXPECT_EQ(cache.Probe("events/other/enable"), FILE_MISSING);
+    EXPECT_TRUE(cache.Save());
+    EXPECT_NE(ReadAll(USER_CACHE_PATH).find("- events/other/enable\n"), string::npos);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a cache written for another kernel, mount or user is not loaded.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceCapabilityTest, CapabilityCache_002, TestSize.Level0)
+{
+    TraceFs traceFs;
+    ASSERT_TRUE(traceFs.Open(FAKE_TRACEFS));
+    ASSERT_TRUE(WriteCache(traceFs));
+    string content = ReadAll(USER_CACHE_PATH);
+    CapabilityCache cache(traceFs, CACHE_PATH);
+    size_t keyPos = content.find(cache.GetKey());
+    ASSERT_NE(keyPos, string::npos);
+    ofstream(USER_CACHE_PATH) << content.substr(0, keyPos) << "0.0.0|other build" <<
+        content.substr(keyPos + cache.GetKey().size());
+    EXPECT_FALSE(cache.Load());
+    EXPECT_EQ(cache.Probe(ENABLE_FILE), FILE_WRITABLE);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a cache file of another owner or a symlink is not read, and a planted symlink is not written through.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceCapabilityTest, CapabilityCache_003, TestSize.Level0)
+{
+    TraceFs traceFs;
+    ASSERT_TRUE(traceFs.Open(FAKE_TRACEFS));
+    ASSERT_TRUE(WriteCache(traceFs));
+    if (geteuid() == 0) {
+        ASSERT_EQ(chown(USER_CACHE_PATH.c_str(), 1, static_cast<gid_t>(-1)), 0); // 1: any user but root
+        CapabilityCache foreign(traceFs, CACHE_PATH);
+        EXPECT_FALSE(foreign.Load());
+        ASSERT_EQ(chown(USER_CACHE_PATH.c_str(), 0, static_cast<gid_t>(-1)), 0);
+    }
+
+    string content = ReadAll(USER_CACHE_PATH);
+    ASSERT_EQ(rename(USER_CACHE_PATH.c_str(), VICTIM_PATH.c_str()), 0);
+    ASSERT_EQ(symlink(VICTIM_PATH.c_str(), USER_CACHE_PATH.c_str()), 0);
+    CapabilityCache cache(traceFs, CACHE_PATH);
+    EXPECT_FALSE(cache.Load());
+    EXPECT_EQ(cache.Probe("events/other/enable"), FILE_MISSING);
+    EXPECT_TRUE(cache.Save());
+    // The link is replaced, its target left as it was.
+    EXPECT_EQ(ReadAll(VICTIM_PATH), content);
+    struct stat st = {};
+    ASSERT_EQ(lstat(USER_CACHE_PATH.c_str(), &st), 0);
+    EXPECT_TRUE(S_ISREG(st.st_mode));
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
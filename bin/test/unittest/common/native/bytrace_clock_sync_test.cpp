@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "bytrace_clock_sync.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string SYNC_PREFIX = "trace_event_clock_sync: ";
+
+class BytraceClockSyncTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown() {};
+};
+
+vector<string> SplitLines(const string& text)
+{
+    vector<string> lines;
+    size_t begin = 0;
+    size_t end = 0;
+    while ((end = text.find('\n', begin)) != string::npos) {
+        lines.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return lines;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the clocks of a sample are read within its error of the boot clock.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceClockSyncTest, SampleClocks_001, TestSize.Level0)
+{
+    struct timespec ts = {0, 0};
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    int64_t before = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec; // 1000000000: ns per second
+    ClockSyncSample sample;
+    ASSERT_TRUE(SampleClocks(sample));
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    int64_t after = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec; // 1000000000: ns per second
+    EXPECT_GE(sample.errorNs, 0);
+    EXPECT_GE(sample.bootNs - sample.errorNs, before);
+    EXPECT_LE(sample.bootNs + sample.errorNs, after);
+    EXPECT_GT(sample.realtimeNs, sample.bootNs);
+    EXPECT_LE(sample.monoNs, sample.bootNs + sample.errorNs);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the markers keep full precision and the bytrace one parses back to the sample.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceClockSyncTest, ClockSyncMarkers_001, TestSize.Level0)
+{
+    ClockSyncSample sample;
+    sample.seq = 7;                            // 7: any sequence
+    sample.bootNs = 123456789012345678;        // about 3.9 years of uptime
+    sample.monoNs = 123456000000001234;
+    sample.realtimeNs = 1634567890123456789;
+    sample.errorNs = 321;
+    vector<string> lines = SplitLines(FormatClockSyncMarkers(sample));
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_EQ(lines[0], SYNC_PREFIX + "realtime_ts=1634567890123");
+    EXPECT_EQ(lines[1], SYNC_PREFIX + "parent_ts=123456000.000001");
+
+    ClockSyncSample parsed;
+    ASSERT_TRUE(ParseClockSyncMarker(lines[2], parsed));
+    EXPECT_EQ(parsed.seq, sample.seq);
+    EXPECT_EQ(parsed.bootNs, sample.bootNs);
+    EXPECT_EQ(parsed.monoNs, sample.monoNs);
+    EXPECT_EQ(parsed.realtimeNs, sample.realtimeNs);
+    EXPECT_EQ(parsed.errorNs, sample.errorNs);
+
+    EXPECT_FALSE(ParseClockSyncMarker(lines[0], parsed));
+    EXPECT_FALSE(ParseClockSyncMarker(SYNC_PREFIX + "bytrace seq=1 boot=2 mono=3", parsed));
+    EXPECT_FALSE(ParseClockSyncMarker(SYNC_PREFIX + "bytrace seq=1 boot=2x mono=3 realtime=4 error=5", parsed));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the writer marks on demand and periodically, each line with a write of its own.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceClockSyncTest, ClockSyncWriter_001, TestSize.Level0)
+{
+    int fds[2] = { -1, -1 };
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+    {
+        ClockSyncWriter writer(fds[1]);
+        ASSERT_TRUE(writer.Mark());
+        writer.Start(20);                                // 20: interval in ms
+        this_thread::sleep_for(chrono::milliseconds(110)); // 110: about 5 intervals
+        writer.Stop();
+    }
+    string text;
+    char buffer[4096]; // 4096: read size
+    ssize_t n = 0;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, n);
+    }
+    close(fds[0]);
+
+    vector<int64_t> boots;
+    uint64_t seq = 0;
+    for (const string& line : SplitLines(text)) {
+        ClockSyncSample sample;
+        if (ParseClockSyncMarker(line, sample)) {
+            if (!boots.empty()) {
+                EXPECT_EQ(sample.seq, seq + 1);
+                EXPECT_GT(sample.bootNs, boots.back());
+            }
+            seq = sample.seq;
+            boots.push_back(sample.bootNs);
+        }
+    }
+    EXPECT_GE(boots.size(), 4u); // 4: the first one and at least 3 periodic ones
+    EXPECT_LE(boots.size(), 7u); // 7: the first one and at most 6 periodic ones
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include "bytrace_convert.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string TRACE_FILE = "/data/local/tmp/bytrace_convert_test.ftrace";
+const string TRACE_TEXT =
+    "TRACE:\n"
+    "# tracer: nop\n"
+    "     RenderThread-612   (  600) [001] ...1   100.000001: tracing_mark_write: B|600|draw \"frame\"\n"
+    "      com.example-600   (  600) [000] ...1   100.000002: tracing_mark_write: S|600|load 7\n"
+    "     RenderThread-612   (  600) [001] d..2   100.000003: sched_switch: prev_comm=RenderThread prev_pid=612 "
+    "prev_prio=120 prev_state=R+ ==> next_comm=swapper/1 next_pid=0 next_prio=120\n"
+    "          <idle>-0     (-----) [000] dn.2   100.000004: sched_wakeup: comm=RenderThread pid=612 prio=120 "
+    "target_cpu=001\n"
+    "     RenderThread-612   (  600) [001] ...1   100.000005: tracing_mark_write: E|600\n"
+    "      com.example-600   (  600) [000] ...1   100.000006: tracing_mark_write: C|600|queue -3\n"
+    "      com.example-600   (  600) [000] ...1   100.000007: tracing_mark_write: F|600|load 7\n"
+    "      com.example-600   (  600) [000] ...1   100.000008: tracing_mark_write: garbage\n";
+const string SYSTEM_TRACE_EVENTS =
+    "\"systemTraceEvents\":\"# tracer: nop\\n"
+    "     RenderThread-612   (  600) [001] d..2   100.000003: sched_switch: prev_comm=RenderThread prev_pid=612 "
+    "prev_prio=120 prev_state=R+ ==> next_comm=swapper/1 next_pid=0 next_prio=120\\n"
+    "          <idle>-0     (-----) [000] dn.2   100.000004: sched_wakeup: comm=RenderThread pid=612 prio=120 "
+    "target_cpu=001\\n\"";
+const string TRACE_EVENTS =
+    "{\"traceEvents\":[\n"
+    "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":600,\"tid\":612,\"args\":{\"name\":\"RenderThread\"}},\n"
+    "{\"ph\":\"B\",\"name\":\"draw \\\"frame\\\"\",\"ts\":100000001.000,\"pid\":600,\"tid\":612},\n"
+    "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":600,\"args\":{\"name\":\"com.example\"}},\n"
+    "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":600,\"tid\":600,\"args\":{\"name\":\"com.example\"}},\n"
+    "{\"ph\":\"b\",\"name\":\"load\",\"cat\":\"bytrace\",\"id\":7,\"ts\":100000002.000,\"pid\":600,\"tid\":600},\n"
+    "{\"ph\":\"E\",\"ts\":100000005.000,\"pid\":600,\"tid\":612},\n"
+    "{\"ph\":\"C\",\"name\":\"queue\",\"ts\":100000006.000,\"pid\":600,\"tid\":600,\"args\":{\"value\":-3}},\n"
+    "{\"ph\":\"e\",\"name\":\"load\",\"cat\":\"bytrace\",\"id\":7,\"ts\":100000007.000,\"pid\":600,\"tid\":600}\n"
+    "]";
+
+class BytraceConvertTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown()
+    {
+        unlink(TRACE_FILE.c_str());
+    };
+};
+
+bool Convert(int fd, ConvertFormat format, string& out, ConvertStats& stats)
+{
+    return ConvertTrace(fd, format, [&out](const char* data, size_t len) {
+        out.append(data, len);
+        return true;
+    }, &stats);
+}
+
+bool ConvertFile(ConvertFormat format, string& out, ConvertStats& stats)
+{
+    ofstream(TRACE_FILE) << TRACE_TEXT;
+    int fd = open(TRACE_FILE.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    bool isTrue = Convert(fd, format, out, stats);
+    close(fd);
+    return isTrue;
+}
+
+// The fields of a protobuf message: the number and, by wire type, the value or the bytes.
+struct ProtoField {
+    uint32_t number = 0;
+    uint64_t value = 0;
+    string bytes;
+};
+
+vector<ProtoField> ParseProto(const string& data)
+{
+    vector<ProtoField> fields;
+    size_t pos = 0;
+    auto varint = [&data, &pos]() {
+        uint64_t value = 0;
+        for (int shift = 0; pos < data.size(); shift += 7) { // 7: bits per byte
+            uint8_t byte = static_cast<uint8_t>(data[pos++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift; // 0x7f: the bits of the value
+            if ((byte & 0x80) == 0) { // 0x80: another byte follows
+                break;
+            }
+        }
+        return value;
+    };
+    while (pos < data.size()) {
+        ProtoField field;
+        uint64_t key = varint();
+        field.number = static_cast<uint32_t>(key >> 3); // 3: the bits of the wire type
+        if ((key & 7) == 2) { // 7: the wire type; 2: length-delimited
+            size_t len = static_cast<size_t>(varint());
+            field.bytes = data.substr(pos, len);
+            pos += len;
+        } else {
+            field.value = varint();
+        }
+        fields.push_back(move(field));
+    }
+    return fields;
+}
+
+const ProtoField* FindField(const vector<ProtoField>& fields, uint32_t number)
+{
+    for (const auto& field : fields) {
+        if (field.number == number) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: markers become slice, async and counter events, sched lines the systemTraceEvents.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceConvertTest, ConvertJson_001, TestSize.Level0)
+{
+    ConvertFormat format = CONVERT_PERFETTO;
+    EXPECT_TRUE(ParseConvertFormat("json", format));
+    EXPECT_EQ(format, CONVERT_JSON);
+    EXPECT_FALSE(ParseConvertFormat("xml", format));
+
+    string out;
+    ConvertStats stats;
+    ASSERT_TRUE(ConvertFile(CONVERT_JSON, out, stats));
+    EXPECT_EQ(out, TRACE_EVENTS + ",\n" + SYSTEM_TRACE_EVENTS + ",\n\"displayTimeUnit\":\"ns\"}\n");
+    EXPECT_EQ(stats.lines, 10u);
+    EXPECT_EQ(stats.markers, 5u);
+    EXPECT_EQ(stats.schedEvents, 2u);
+    EXPECT_EQ(stats.skipped, 3u); // 3: "TRACE:", the comment and the garbage marker
+
+    // A pipe cannot be read twice, so the thread states are left out.
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(write(fds[1], TRACE_TEXT.data(), TRACE_TEXT.size()), static_cast<ssize_t>(TRACE_TEXT.size()));
+    close(fds[1]);
+    out.clear();
+    stats = ConvertStats();
+    EXPECT_TRUE(Convert(fds[0], CONVERT_JSON, out, stats));
+    close(fds[0]);
+    EXPECT_EQ(out, TRACE_EVENTS + ",\n\"displayTimeUnit\":\"ns\"}\n");
+    EXPECT_EQ(stats.schedEvents, 0u);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: markers become track events with their track descriptors, sched events ftrace bundles.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceConvertTest, ConvertPerfetto_001, TestSize.Level0)
+{
+    string out;
+    ConvertStats stats;
+    ASSERT_TRUE(ConvertFile(CONVERT_PERFETTO, out, stats));
+    EXPECT_EQ(stats.markers, 5u);
+    EXPECT_EQ(stats.schedEvents, 2u);
+
+    vector<string> names;
+    vector<uint64_t> types;
+    int64_t counter = 0;
+    vector<vector<ProtoField>> ftraceEvents;
+    for (const auto& packet : ParseProto(out)) {
+        ASSERT_EQ(packet.number, 1u); // 1: Trace.packet
+        vector<ProtoField> fields = ParseProto(packet.bytes);
+        if (const ProtoField* descriptor = FindField(fields, 60)) { // 60: TracePacket.track_descriptor
+            vector<ProtoField> track = ParseProto(descriptor->bytes);
+            if (const ProtoField* thread = FindField(track, 4)) { // 4: TrackDescriptor.thread
+                const ProtoField* name = FindField(ParseProto(thread->bytes), 5); // 5: ThreadDescriptor.thread_name
+                names.push_back(name != nullptr ? name->bytes : "");
+            }
+        } else if (const ProtoField* event = FindField(fields, 11)) { // 11: TracePacket.track_event
+            EXPECT_EQ(FindField(fields, 10)->value, 1u); // 10: trusted_packet_sequence_id
+            vector<ProtoField> trackEvent = ParseProto(event->bytes);
+            types.push_back(FindField(trackEvent, 9)->value); // 9: TrackEvent.type
+            if (const ProtoField* value = FindField(trackEvent, 30)) { // 30: TrackEvent.counter_value
+                counter = static_cast<int64_t>(value->value);
+            }
+        } else if (const ProtoField* bundle = FindField(fields, 1)) { // 1: TracePacket.ftrace_events
+            for (const auto& field : ParseProto(bundle->bytes)) {
+                if (field.number == 2) { // 2: FtraceEventBundle.event
+                    ftraceEvents.push_back(ParseProto(field.bytes));
+                }
+            }
+        }
+    }
+    EXPECT_EQ(names, (vector<string> { "RenderThread", "com.example" }));
+    EXPECT_EQ(types, (vector<uint64_t> { 1, 1, 2, 4, 2 })); // 1, 2, 4: slice begin, slice end, counter
+    EXPECT_EQ(counter, -3);
+    ASSERT_EQ(ftraceEvents.size(), 2u);
+    EXPECT_EQ(FindField(ftraceEvents[0], 1)->value, 100000003000u); // 1: FtraceEvent.timestamp
+    const ProtoField* sched = FindField(ftraceEvents[0], 4); // 4: FtraceEvent.sched_switch
+    ASSERT_NE(sched, nullptr);
+    vector<ProtoField> schedSwitch = ParseProto(sched->bytes);
+    EXPECT_EQ(FindField(schedSwitch, 1)->bytes, "RenderThread"); // 1: prev_comm
+    EXPECT_EQ(FindField(schedSwitch, 4)->value, 0x100u);        // 4: prev_state, R+ is preempted
+    EXPECT_EQ(FindField(schedSwitch, 6)->value, 0u);            // 6: next_pid
+    EXPECT_NE(FindField(ftraceEvents[1], 17), nullptr);         // 17: FtraceEvent.sched_wakeup
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "bytrace_cpu_stats.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string CPU_STATS = "entries: 1200\n"
+    "overrun: 300\n"
+    "commit overrun: 2\n"
+    "bytes: 65536\n"
+    "oldest event ts:  5321.123456\n"
+    "now ts:  5323.5\n"
+    "dropped events: 7\n"
+    "read events: 0\n";
+constexpr int KB = 1024;
+
+class BytraceCpuStatsTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown() {};
+};
+
+CpuTraceStats MakeStats(uint64_t bytes, uint64_t entries, uint64_t overrun)
+{
+    CpuTraceStats stats;
+    stats.bytes = bytes;
+    stats.entries = entries;
+    stats.overrun = overrun;
+    return stats;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: every counter of per_cpu/cpuN/stats is parsed, timestamps in microseconds.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceCpuStatsTest, ParseCpuStats_001, TestSize.Level0)
+{
+    CpuTraceStats stats;
+    ASSERT_TRUE(ParseCpuStats(CPU_STATS, stats));
+    EXPECT_EQ(stats.entries, 1200u);
+    EXPECT_EQ(stats.overrun, 300u);
+    EXPECT_EQ(stats.commitOverrun, 2u);
+    EXPECT_EQ(stats.bytes, 65536u);
+    EXPECT_EQ(stats.dropped, 7u);
+    EXPECT_EQ(stats.readEvents, 0u);
+    EXPECT_EQ(stats.oldestUs, 5321123456u);
+    EXPECT_EQ(stats.nowUs, 5323500000u);
+    EXPECT_FALSE(ParseCpuStats("", stats));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: busy CPUs get buffers for the whole duration, idle ones the minimum, lost events count too.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceCpuStatsTest, PlanCpuBufferSizes_001, TestSize.Level0)
+{
+    vector<CpuTraceStats> begin(3);
+    // 1 MB/s, 4 MB/s of which half was overwritten, idle.
+    vector<CpuTraceStats> end = { MakeStats(KB * KB, 1000, 0), MakeStats(2 * KB * KB, 1000, 1000),
+        MakeStats(0, 0, 0) };
+    vector<int> sizes = PlanCpuBufferSizes(begin, end, 1.0, 10, 1024 * KB);
+    ASSERT_EQ(sizes.size(), 3u);
+    EXPECT_EQ(sizes[0], 12800); // 10 s * 1 MB/s * 1.25
+    EXPECT_EQ(sizes[1], 51200);
+    EXPECT_EQ(sizes[2], MIN_CPU_BUFFER_KB);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: sizes that exceed the budget are scaled down in proportion.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceCpuStatsTest, PlanCpuBufferSizes_002, TestSize.Level0)
+{
+    vector<CpuTraceStats> begin(2);
+    vector<CpuTraceStats> end = { MakeStats(KB * KB, 1000, 0), MakeStats(3 * KB * KB, 1000, 0) };
+    vector<int> sizes = PlanCpuBufferSizes(begin, end, 1.0, 10, 20480);
+    ASSERT_EQ(sizes.size(), 2u);
+    EXPECT_EQ(sizes[0], 5120);
+    EXPECT_EQ(sizes[1], 15360);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the metadata section has one line per CPU with the losses since the capture began.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceCpuStatsTest, FormatCpuStats_001, TestSize.Level0)
+{
+    vector<CpuTraceStats> begin = { MakeStats(0, 0, 10), MakeStats(0, 0, 0) };
+    vector<CpuTraceStats> end = { MakeStats(4096, 100, 25), MakeStats(0, 0, 0) };
+    end[0].oldestUs = 5321123456;
+    end[0].nowUs = 5326000001;
+    string section = FormatCpuStats(begin, end);
+    EXPECT_EQ(section, "# cpu_stats: cpu entries overrun commit_overrun dropped bytes oldest_ts now_ts\n"
+        "# cpu_stats: 0 100 15 0 0 4096 5321.123456 5326.000001\n"
+        "# cpu_stats: 1 0 0 0 0 0 0.000000 0.000000\n");
+    EXPECT_EQ(SummarizeCpuStats(begin, end),
+        "cpu stats: 100 events, 15 lost (cpu0=15), the buffer is too small for this capture");
+    EXPECT_EQ(SummarizeCpuStats({}, { MakeStats(0, 7, 0) }), "cpu stats: 7 events, none lost");
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: CPU lists are parsed and written in the format of tracing_cpumask.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceCpuStatsTest, ParseCpuList_001, TestSize.Level0)
+{
+    vector<int> cpus;
+    ASSERT_TRUE(ParseCpuList("6,4-7,0", 8, cpus));
+    EXPECT_EQ(cpus, vector<int>({ 0, 4, 5, 6, 7 }));
+    EXPECT_EQ(FormatCpuMask(cpus), "f1");
+    EXPECT_FALSE(ParseCpuList("4-8", 8, cpus));
+    EXPECT_FALSE(ParseCpuList("7-4", 8, cpus));
+    EXPECT_FALSE(ParseCpuList("1,", 8, cpus));
+    EXPECT_FALSE(ParseCpuList("a", 8, cpus));
+    EXPECT_EQ(FormatCpuMask({ 1, 32 }), "1,00000002");
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "bytrace_block_compress.h"
+#include "bytrace_dump.h"
+#include "bytrace_merge.h"
+#include "bytrace_recorder.h"
+#include "bytrace_test_utils.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string FAKE_TRACE_PATH = "/data/local/tmp/bytrace_fake.ftrace";
+const string OUTPUT_PATH = "/data/local/tmp/bytrace_dump_test.out";
+const string TRACE_HEADER = "# tracer: nop\n#\n#           TASK-PID    TGID   CPU#  ||||    TIMESTAMP  FUNCTION\n";
+constexpr int FAKE_TRACE_LINES = 200000;
+constexpr size_t TEST_BLOCK_SIZE = 1024 * 1024;
+constexpr size_t LEGACY_BLOCK_SIZE = 4096;
+constexpr double BYTES_PER_MB = 1024.0 * 1024.0;
+constexpr int BENCHMARK_ROUNDS = 5;
+
+class BytraceDumpTest : public testing::Test {
+public:
+    static void SetUpTestCase(void);
+    static void TearDownTestCase(void);
+    void SetUp() {};
+    void TearDown() {};
+};
+
+void BytraceDumpTest::SetUpTestCase()
+{
+    ofstream out(FAKE_TRACE_PATH, ios::out | ios::trunc);
+    out << TRACE_HEADER;
+    for (int i = 0; i < FAKE_TRACE_LINES; i++) {
+        out << MakeTraceLine(i);
+    }
+    out.close();
+}
+
+void BytraceDumpTest::TearDownTestCase()
+{
+    unlink(FAKE_TRACE_PATH.c_str());
+    unlink(OUTPUT_PATH.c_str());
+}
+
+string ReadAll(const string& path)
+{
+    ifstream fin(path);
+    stringstream ss;
+    ss << fin.rdbuf();
+    return ss.str();
+}
+
+// The dump loop used before DumpRawTrace(), kept as the benchmark baseline.
+bool LegacyDump(int traceFd, int outFd)
+{
+    char buffer[LEGACY_BLOCK_SIZE];
+    ssize_t bytesRead;
+    ssize_t bytesWritten = 0;
+    do {
+        bytesRead = TEMP_FAILURE_RETRY(read(traceFd, buffer, LEGACY_BLOCK_SIZE));
+        if ((bytesRead == 0) || (bytesRead == -1)) {
+            break;
+        }
+        bytesWritten = TEMP_FAILURE_RETRY(write(outFd, buffer, bytesRead));
+    } while (bytesWritten > 0);
+    return bytesRead == 0;
+}
+
+template <typename Dump>
+double MeasureThroughput(Dump dump)
+{
+    double best = 0;
+    for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+        int traceFd = open(FAKE_TRACE_PATH.c_str(), O_RDONLY);
+        int outFd = open(OUTPUT_PATH.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (traceFd == -1 || outFd == -1) {
+            return 0;
+        }
+        auto begin = chrono::steady_clock::now();
+        bool isTrue = dump(traceFd, outFd);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+        off_t size = lseek(outFd, 0, SEEK_END);
+        close(traceFd);
+        close(outFd);
+        if (!isTrue) {
+            return 0;
+        }
+        best = max(best, size / BYTES_PER_MB / elapsed.count());
+    }
+    return best;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: timestamps are parsed from ftrace text lines and ignored in header lines.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceDumpTest, ParseTraceTimestamp_001, TestSize.Level0)
+{
+    uint64_t us = 0;
+    string line = "  <idle>-0     (-----) [003] d..2 4321.012345: sched_switch: prev_comm=swapper/3";
+    ASSERT_TRUE(ParseTraceTimestamp(line.c_str(), line.size(), us));
+    EXPECT_EQ(us, 4321012345ULL);
+    line = "  kworker-1:2-77    (   77) [000] .... 12.5: tracing_mark_write: E|77|";
+    ASSERT_TRUE(ParseTraceTimestamp(line.c_str(), line.size(), us));
+    EXPECT_EQ(us, 12500000ULL);
+    line = "#           TASK-PID    TGID   CPU#  ||||    TIMESTAMP  FUNCTION";
+    EXPECT_FALSE(ParseTraceTimestamp(line.c_str(), line.size(), us));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a block-compressed trace has an index and a time window extracts only its own lines.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceDumpTest, BlockCompress_001, TestSize.Level0)
+{
+    int traceFd = open(FAKE_TRACE_PATH.c_str(), O_RDONLY);
+    int outFd = open(OUTPUT_PATH.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(traceFd != -1 && outFd != -1);
+    ASSERT_TRUE(DumpBlockCompressedTrace(traceFd, outFd, TEST_BLOCK_SIZE, "TRACE:\n"));
+    close(traceFd);
+
+    vector<TraceBlockIndex> index;
+    ASSERT_TRUE(ReadBlockIndex(outFd, index));
+    ASSERT_GT(index.size(), 1u);
+    for (size_t i = 1; i < index.size(); i++) {
+        EXPECT_LE(index[i - 1].endUs, index[i].beginUs);
+        EXPECT_LE(index[i].rawSize, TEST_BLOCK_SIZE);
+    }
+
+    const int first = 1000;
+    const int last = 1999;
+    uint64_t beginUs = FAKE_TRACE_START_US + first * FAKE_TRACE_STEP_US;
+    uint64_t endUs = FAKE_TRACE_START_US + last * FAKE_TRACE_STEP_US;
+    string windowPath = OUTPUT_PATH + ".window";
+    int windowFd = open(windowPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(windowFd != -1);
+    ASSERT_TRUE(ExtractTraceWindow(outFd, windowFd, beginUs, endUs));
+    close(windowFd);
+    close(outFd);
+
+    string expected = "TRACE:\n" + TRACE_HEADER;
+    for (int i = first; i <= last; i++) {
+        expected += MakeTraceLine(i);
+    }
+    EXPECT_EQ(ReadAll(windowPath), expected);
+    unlink(windowPath.c_str());
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the dump engine copies the whole trace and preallocation does not change the output size.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceDumpTest, DumpRawTrace_001, TestSize.Level0)
+{
+    int traceFd = open(FAKE_TRACE_PATH.c_str(), O_RDONLY);
+    int outFd = open(OUTPUT_PATH.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(traceFd != -1 && outFd != -1);
+    ASSERT_TRUE(WriteFully(outFd, "TRACE:\n", strlen("TRACE:\n")));
+    DumpStats stats;
+    const size_t sizeHint = 64 * 1024 * 1024;
+    ASSERT_TRUE(DumpRawTrace(traceFd, outFd, sizeHint, &stats));
+    close(traceFd);
+    close(outFd);
+    string expected = "TRACE:\n" + ReadAll(FAKE_TRACE_PATH);
+    EXPECT_EQ(stats.bytes + strlen("TRACE:\n"), expected.size());
+    EXPECT_EQ(ReadAll(OUTPUT_PATH), expected);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: throughput of the dump engine against the former 4 KB read/write loop.
+ * @tc.type: PERF
+ */
+HWTEST_F(BytraceDumpTest, DumpRawTrace_Benchmark, TestSize.Level1)
+{
+    struct stat st = {};
+    ASSERT_EQ(stat(FAKE_TRACE_PATH.c_str(), &st), 0);
+    // The size of the trace is the hint, so the output is preallocated as in a capture.
+    size_t sizeHint = static_cast<size_t>(st.st_size);
+    double legacy = MeasureThroughput(LegacyDump);
+    double engine = MeasureThroughput([sizeHint](int traceFd, int outFd) {
+        return DumpRawTrace(traceFd, outFd, sizeHint);
+    });
+    printf("dump throughput of %.1f MB: 4 KB read/write %.1f MB/s, DumpRawTrace %.1f MB/s\n",
+        sizeHint / BYTES_PER_MB, legacy, engine);
+    EXPECT_GT(legacy, 0);
+    EXPECT_GE(engine, legacy);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the pipelined zlib dump inflates back to the trace and reports the time of every stage.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceDumpTest, DumpPipelined_001, TestSize.Level0)
+{
+    int traceFd = open(FAKE_TRACE_PATH.c_str(), O_RDONLY);
+    int outFd = open(OUTPUT_PATH.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(traceFd != -1 && outFd != -1);
+    unique_ptr<DumpCompressor> compressor = CreateZlibCompressor();
+    DumpStageStats stats;
+    ASSERT_TRUE(DumpPipelined(traceFd, outFd, *compressor, "", &stats));
+    close(traceFd);
+    close(outFd);
+    // Every stage runs on its own thread within the dump.
+    EXPECT_GT(stats.totalMs, 0);
+    EXPECT_GE(stats.readMs, 0);
+    EXPECT_LE(stats.readMs, stats.totalMs);
+    EXPECT_GE(stats.compressMs, 0);
+    EXPECT_LE(stats.compressMs, stats.totalMs);
+    EXPECT_GE(stats.writeMs, 0);
+    EXPECT_LE(stats.writeMs, stats.totalMs);
+
+    string expected = ReadAll(FAKE_TRACE_PATH);
+    string compressed = ReadAll(OUTPUT_PATH);
+    EXPECT_EQ(stats.rawBytes, expected.size());
+    EXPECT_EQ(stats.outBytes, compressed.size());
+    uLongf rawLen = expected.size();
+    string raw(rawLen, '\0');
+    ASSERT_EQ(uncompress(reinterpret_cast<Bytef*>(&raw[0]), &rawLen,
+        reinterpret_cast<const Bytef*>(compressed.data()), compressed.size()), Z_OK);
+    EXPECT_EQ(raw, expected);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the recorder keeps the header and exactly the lines at or after the cutoff.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceDumpTest, SkipTraceBefore_001, TestSize.Level0)
+{
+    const int firstKept = FAKE_TRACE_LINES - 1000;
+    uint64_t cutoffUs = FAKE_TRACE_START_US + static_cast<uint64_t>(firstKept) * FAKE_TRACE_STEP_US;
+    int traceFd = open(FAKE_TRACE_PATH.c_str(), O_RDONLY);
+    int outFd = open(OUTPUT_PATH.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(traceFd != -1 && outFd != -1);
+    string carry;
+    ASSERT_TRUE(SkipTraceBefore(traceFd, cutoffUs, carry));
+    ASSERT_TRUE(WriteFully(outFd, carry.data(), carry.size()));
+    ASSERT_TRUE(DumpRawTrace(traceFd, outFd, 0));
+    close(traceFd);
+    close(outFd);
+    string expected = TRACE_HEADER;
+    for (int i = firstKept; i < FAKE_TRACE_LINES; i++) {
+        expected += MakeTraceLine(i);
+    }
+    EXPECT_EQ(ReadAll(OUTPUT_PATH), expected);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: traces of several instances are merged by timestamp with the header of the first one.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceDumpTest, MergeTraces_001, TestSize.Level0)
+{
+    const string secondPath = OUTPUT_PATH + ".second";
+    const int lines = 20000;
+    string first = TRACE_HEADER;
+    string second = TRACE_HEADER;
+    string expected = TRACE_HEADER;
+    for (int i = 0; i < lines; i++) {
+        // Runs of lines from each side, so both the interleaving and the buffering are exercised.
+        ((i / 7) % 3 == 0 ? second : first) += MakeTraceLine(i);
+        expected += MakeTraceLine(i);
+    }
+    ofstream(FAKE_TRACE_PATH + ".first", ios::out | ios::trunc) << first;
+    ofstream(secondPath, ios::out | ios::trunc) << second;
+
+    int firstFd = open((FAKE_TRACE_PATH + ".first").c_str(), O_RDONLY);
+    int secondFd = open(secondPath.c_str(), O_RDONLY);
+    int outFd = open(OUTPUT_PATH.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(firstFd != -1 && secondFd != -1 && outFd != -1);
+    EXPECT_TRUE(MergeTraces({ firstFd, secondFd }, outFd));
+    close(firstFd);
+    close(secondFd);
+    close(outFd);
+    EXPECT_EQ(ReadAll(OUTPUT_PATH), expected);
+    unlink((FAKE_TRACE_PATH + ".first").c_str());
+    unlink(secondPath.c_str());
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "bytrace_event_format.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string COMMON_FIELDS =
+    "format:\n"
+    "\tfield:unsigned short common_type;\toffset:0;\tsize:2;\tsigned:0;\n"
+    "\tfield:unsigned char common_flags;\toffset:2;\tsize:1;\tsigned:0;\n"
+    "\tfield:unsigned char common_preempt_count;\toffset:3;\tsize:1;\tsigned:0;\n"
+    "\tfield:int common_pid;\toffset:4;\tsize:4;\tsigned:1;\n"
+    "\n";
+// The sched_switch of a 5.10 kernel, with the state expression the kernel prints as S, R+, ...
+const string TASK_STATES = "((((0x0000 | 0x0001 | 0x0002 | 0x0004 | 0x0008 | 0x0010 | 0x0020 | 0x0040) + 1) << 1) - 1)";
+const string SCHED_SWITCH_FORMAT = "name: sched_switch\nID: 316\n" + COMMON_FIELDS +
+    "\tfield:char prev_comm[16];\toffset:8;\tsize:16;\tsigned:1;\n"
+    "\tfield:pid_t prev_pid;\toffset:24;\tsize:4;\tsigned:1;\n"
+    "\tfield:int prev_prio;\toffset:28;\tsize:4;\tsigned:1;\n"
+    "\tfield:long prev_state;\toffset:32;\tsize:8;\tsigned:1;\n"
+    "\tfield:char next_comm[16];\toffset:40;\tsize:16;\tsigned:1;\n"
+    "\tfield:pid_t next_pid;\toffset:56;\tsize:4;\tsigned:1;\n"
+    "\tfield:int next_prio;\toffset:60;\tsize:4;\tsigned:1;\n"
+    "\n"
+    "print fmt: \"prev_comm=%s prev_pid=%d prev_prio=%d prev_state=%s%s ==> next_comm=%s next_pid=%d "
+    "next_prio=%d\", REC->prev_comm, REC->prev_pid, REC->prev_prio, (REC->prev_state & " + TASK_STATES + ") ? "
+    "__print_flags(REC->prev_state & " + TASK_STATES + ", \"|\", { 0x0001, \"S\" }, { 0x0002, \"D\" }, "
+    "{ 0x0004, \"T\" }, { 0x0008, \"t\" }, { 0x0010, \"X\" }, { 0x0020, \"Z\" }, { 0x0040, \"P\" }, "
+    "{ 0x0080, \"I\" }) : \"R\", REC->prev_state & (((0x0000 | 0x0001 | 0x0002 | 0x0004 | 0x0008 | 0x0010 | "
+    "0x0020 | 0x0040) + 1) << 1) ? \"+\" : \"\", REC->next_comm, REC->next_pid, REC->next_prio\n";
+
+class BytraceEventFormatTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown() {};
+};
+
+template <typename T>
+void Put(vector<uint8_t>& record, size_t offset, T value)
+{
+    memcpy(record.data() + offset, &value, sizeof(value));
+}
+
+void PutString(vector<uint8_t>& record, size_t offset, const string& value)
+{
+    memcpy(record.data() + offset, value.c_str(), value.size() + 1);
+}
+
+vector<uint8_t> MakeSchedSwitch(int64_t prevState)
+{
+    vector<uint8_t> record(64); // 64: the size of the record
+    Put<uint16_t>(record, 0, 316); // 316: the id
+    PutString(record, 8, "kworker/0:1");  // 8: prev_comm
+    Put<int32_t>(record, 24, 123);        // 24: prev_pid
+    Put<int32_t>(record, 28, 120);        // 28: prev_prio
+    Put<int64_t>(record, 32, prevState);  // 32: prev_state
+    PutString(record, 40, "swapper/0");   // 40: next_comm
+    Put<int32_t>(record, 56, 0);          // 56: next_pid
+    Put<int32_t>(record, 60, -1);         // 60: next_prio
+    return record;
+}
+
+string Payload(const EventFormat& format, const vector<uint8_t>& record)
+{
+    string out;
+    format.FormatPayload(record.data(), record.size(), out);
+    return out;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the fields of a format file are parsed with their kind, and its print fmt is compiled.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventFormatTest, EventFormat_001, TestSize.Level0)
+{
+    EventFormat format;
+    ASSERT_TRUE(format.Parse("sched", SCHED_SWITCH_FORMAT));
+    EXPECT_EQ(format.GetId(), 316);
+    EXPECT_EQ(format.GetName(), "sched_switch");
+    EXPECT_EQ(format.GetSystem(), "sched");
+    EXPECT_TRUE(format.HasPrintFormat());
+    ASSERT_EQ(format.GetFields().size(), 11u); // 11: 4 common fields and 7 of the event
+
+    const EventField* comm = format.FindField("prev_comm");
+    ASSERT_NE(comm, nullptr);
+    EXPECT_EQ(comm->kind, EVENT_FIELD_CHARS);
+    EXPECT_EQ(comm->type, "char[16]");
+    EXPECT_EQ(comm->offset, 8);
+    EXPECT_EQ(comm->size, 16);
+    const EventField* state = format.FindField("prev_state");
+    ASSERT_NE(state, nullptr);
+    EXPECT_EQ(state->kind, EVENT_FIELD_INT);
+    EXPECT_TRUE(state->isSigned);
+    EXPECT_EQ(format.FindField("none"), nullptr);
+
+    vector<uint8_t> record = MakeSchedSwitch(1);
+    EXPECT_EQ(EventFormat::ReadInt(*format.FindField("next_prio"), record.data(), record.size()), -1);
+    EXPECT_EQ(EventFormat::ReadString(*comm, record.data(), record.size()), "kworker/0:1");
+    EXPECT_EQ(EventFormat::ReadInt(*state, record.data(), 16), 0); // 16: a record cut before the field
+
+    EXPECT_FALSE(EventFormat().Parse("sched", "name: sched_switch\n" + COMMON_FIELDS));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a record prints as the kernel prints it, through ?:, __print_flags and the integer operators.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventFormatTest, FormatPayload_001, TestSize.Level0)
+{
+    EventFormat format;
+    ASSERT_TRUE(format.Parse("sched", SCHED_SWITCH_FORMAT));
+    const string prefix = "prev_comm=kworker/0:1 prev_pid=123 prev_prio=120 prev_state=";
+    const string suffix = " ==> next_comm=swapper/0 next_pid=0 next_prio=-1";
+    EXPECT_EQ(Payload(format, MakeSchedSwitch(0)), prefix + "R" + suffix);
+    EXPECT_EQ(Payload(format, MakeSchedSwitch(1)), prefix + "S" + suffix);
+    EXPECT_EQ(Payload(format, MakeSchedSwitch(0x2 | 0x80)), prefix + "D|I" + suffix);
+    EXPECT_EQ(Payload(format, MakeSchedSwitch(0x100)), prefix + "R+" + suffix);
+
+    EventFormat irq;
+    ASSERT_TRUE(irq.Parse("irq", "name: irq_handler_entry\nID: 42\n" + COMMON_FIELDS +
+        "\tfield:int irq;\toffset:8;\tsize:4;\tsigned:1;\n"
+        "\tfield:__data_loc char[] name;\toffset:12;\tsize:4;\tsigned:1;\n\n"
+        "print fmt: \"irq=%d name=%s\", REC->irq, __get_str(name)\n"));
+    EXPECT_EQ(irq.FindField("name")->kind, EVENT_FIELD_DATA_LOC);
+    vector<uint8_t> record(24); // 24: the fields and "uart"
+    Put<int32_t>(record, 8, 27);                    // 8: irq
+    Put<uint32_t>(record, 12, (5u << 16) | 16u);    // 12: name, 5 bytes at 16
+    PutString(record, 16, "uart");
+    EXPECT_EQ(Payload(irq, record), "irq=27 name=uart");
+
+    EventFormat freq;
+    ASSERT_TRUE(freq.Parse("power", "name: cpu_frequency\nID: 20\n" + COMMON_FIELDS +
+        "\tfield:u32 state;\toffset:8;\tsize:4;\tsigned:0;\n"
+        "\tfield:u32 cpu_id;\toffset:12;\tsize:4;\tsigned:0;\n\n"
+        "print fmt: \"state=%lu cpu_id=%lu flag=%s %5.2s|%-4x|%c%%\", (unsigned long)REC->state, "
+        "(unsigned long)REC->cpu_id, __print_symbolic(REC->cpu_id, { 0, \"zero\" }, { 1, \"one\" }), \"abc\", "
+        "(u8)-1, 'k'\n"));
+    record.assign(16, 0); // 16: the size of the record
+    Put<uint32_t>(record, 8, 4294967295u); // 8: state
+    Put<uint32_t>(record, 12, 1);          // 12: cpu_id
+    EXPECT_EQ(Payload(freq, record), "state=4294967295 cpu_id=1 flag=one    ab|ff  |k%");
+    Put<uint32_t>(record, 12, 7);
+    EXPECT_EQ(Payload(freq, record), "state=4294967295 cpu_id=7 flag=0x7    ab|ff  |k%");
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a print fmt that cannot be compiled prints the fields as name=value.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventFormatTest, FormatPayload_002, TestSize.Level0)
+{
+    EventFormat format;
+    ASSERT_TRUE(format.Parse("net", "name: net_dev_xmit\nID: 900\n" + COMMON_FIELDS +
+        "\tfield:unsigned int len;\toffset:8;\tsize:4;\tsigned:0;\n"
+        "\tfield:u8 addr[2];\toffset:12;\tsize:2;\tsigned:0;\n"
+        "\tfield:char dev[4];\toffset:14;\tsize:4;\tsigned:1;\n\n"
+        "print fmt: \"len=%u addr=%s\", REC->len, __print_hex(REC->addr, 2)\n"));
+    EXPECT_FALSE(format.HasPrintFormat());
+    vector<uint8_t> record(18); // 18: the size of the record
+    Put<uint32_t>(record, 8, 1500); // 8: len
+    record[12] = 0xab;              // 12: addr
+    record[13] = 0x01;
+    PutString(record, 14, "wl0");   // 14: dev
+    EXPECT_EQ(Payload(format, record), "len=1500 addr=ARRAY[ab, 01] dev=wl0");
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bytrace_event_settings.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string FAKE_TRACEFS = "/data/local/tmp/bytrace_fake_tracefs/";
+const EventTable AVAILABLE = {
+    { "irq", { "irq_handler_entry", "irq_handler_exit", "softirq_entry", "softirq_exit" } },
+    { "sched", { "sched_switch", "sched_wakeup", "sched_waking" } },
+    { "power", { "cpu_frequency", "cpu_idle" } },
+};
+
+class BytraceEventSettingsTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown() {};
+};
+
+string ReadAll(const string& path)
+{
+    ifstream fin(path);
+    stringstream ss;
+    ss << fin.rdbuf();
+    return ss.str();
+}
+
+size_t CountOpenFds()
+{
+    size_t count = 0;
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir == nullptr) {
+        return count;
+    }
+    while (readdir(dir) != nullptr) {
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: tag enable files are split into system and event names.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventSettingsTest, ParseEventPath_001, TestSize.Level0)
+{
+    string system;
+    string event;
+    ASSERT_TRUE(ParseEventPath("events/sched/sched_switch/enable", system, event));
+    EXPECT_EQ(system, "sched");
+    EXPECT_EQ(event, "sched_switch");
+    ASSERT_TRUE(ParseEventPath("events/irq/enable", system, event));
+    EXPECT_EQ(system, "irq");
+    EXPECT_TRUE(event.empty());
+    EXPECT_FALSE(ParseEventPath("events/enable", system, event));
+    EXPECT_FALSE(ParseEventPath("options/overwrite", system, event));
+    EXPECT_FALSE(ParseEventPath("events/a/b/c/enable", system, event));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: only the events whose state changes are written, whole systems with one command.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventSettingsTest, DiffEventCommands_001, TestSize.Level0)
+{
+    set<string> enabled = { "sched:sched_switch", "power:cpu_idle", "power:cpu_frequency" };
+    set<string> managed = { "irq:irq_handler_entry", "irq:irq_handler_exit", "irq:softirq_entry",
+        "irq:softirq_exit", "sched:sched_switch", "sched:sched_wakeup", "power:cpu_idle", "power:cpu_frequency" };
+    set<string> wanted = { "irq:irq_handler_entry", "irq:irq_handler_exit", "irq:softirq_entry",
+        "irq:softirq_exit", "sched:sched_switch", "sched:sched_wakeup" };
+    vector<string> expected = { "irq:*", "!power:*", "sched:sched_wakeup" };
+    EXPECT_EQ(DiffEventCommands(AVAILABLE, enabled, managed, wanted), expected);
+
+    // Nothing changes when the kernel already has the wanted state.
+    EXPECT_TRUE(DiffEventCommands(AVAILABLE, wanted, managed, wanted).empty());
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: events enabled by someone else are left alone, so systems they share are switched per event.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventSettingsTest, DiffEventCommands_002, TestSize.Level0)
+{
+    set<string> enabled = { "sched:sched_switch", "sched:sched_wakeup", "sched:sched_waking" };
+    set<string> managed = { "sched:sched_switch", "sched:sched_wakeup" };
+    vector<string> expected = { "!sched:sched_switch", "!sched:sched_wakeup" };
+    EXPECT_EQ(DiffEventCommands(AVAILABLE, enabled, managed, {}), expected);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the diff is written to set_event with one open.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventSettingsTest, EventSettingsApply_001, TestSize.Level0)
+{
+    mkdir(FAKE_TRACEFS.c_str(), S_IRWXU);
+    ofstream(FAKE_TRACEFS + "available_events") << "irq:irq_handler_entry\nirq:irq_handler_exit\n"
+        "sched:sched_switch\nsched:sched_wakeup\n";
+    ofstream(FAKE_TRACEFS + "set_event") << "sched:sched_switch\n";
+
+    TraceFs traceFs;
+    ASSERT_TRUE(traceFs.Open(FAKE_TRACEFS));
+    EventSettings settings(traceFs);
+    ASSERT_TRUE(settings.Apply({ "events/irq/enable", "events/sched/sched_switch/enable" }, { "events/irq/enable" }));
+    EXPECT_EQ(ReadAll(FAKE_TRACEFS + "set_event"), "sched:sched_switch\nirq:*\n!sched:sched_switch\n");
+    EXPECT_TRUE(settings.GetStats().bulk);
+    EXPECT_EQ(settings.GetStats().enabled, 2u);
+    EXPECT_EQ(settings.GetStats().disabled, 1u);
+    EXPECT_EQ(settings.GetStats().commands, 2u);
+
+    unlink((FAKE_TRACEFS + "available_events").c_str());
+    unlink((FAKE_TRACEFS + "set_event").c_str());
+    rmdir(FAKE_TRACEFS.c_str());
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: command line filters and pid lists are parsed, malformed ones rejected.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventSettingsTest, ParseEventFilter_001, TestSize.Level0)
+{
+    EventFilter filter;
+    ASSERT_TRUE(ParseEventFilter("sched/sched_switch:prev_pid == 1 || next_comm ~ \"a:b*\"", filter));
+    EXPECT_EQ(filter.system, "sched");
+    EXPECT_EQ(filter.event, "sched_switch");
+    EXPECT_EQ(filter.expression, "prev_pid == 1 || next_comm ~ \"a:b*\"");
+    ASSERT_TRUE(ParseEventFilter("irq:irq > 3", filter));
+    EXPECT_EQ(filter.system, "irq");
+    EXPECT_TRUE(filter.event.empty());
+    EXPECT_FALSE(ParseEventFilter("sched/sched_switch", filter));
+    EXPECT_FALSE(ParseEventFilter("sched/sched_switch: ", filter));
+    EXPECT_FALSE(ParseEventFilter("../sched:pid == 1", filter));
+    EXPECT_FALSE(ParseEventFilter("a/b/c:pid == 1", filter));
+
+    vector<int> pids;
+    ASSERT_TRUE(ParsePidList("12,34", pids));
+    ASSERT_TRUE(ParsePidList("56", pids));
+    EXPECT_EQ(pids, vector<int>({ 12, 34, 56 }));
+    EXPECT_FALSE(ParsePidList("12,", pids));
+    EXPECT_FALSE(ParsePidList("-1", pids));
+    EXPECT_FALSE(ParsePidList("12x", pids));
+    EXPECT_EQ(pids.size(), 3u);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: filters and pids are written on Apply and reset on Clear, event-fork is restored.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventSettingsTest, EventFiltersApply_001, TestSize.Level0)
+{
+    const string filterPath = FAKE_TRACEFS + "events/sched/sched_switch/filter";
+    mkdir(FAKE_TRACEFS.c_str(), S_IRWXU);
+    mkdir((FAKE_TRACEFS + "events").c_str(), S_IRWXU);
+    mkdir((FAKE_TRACEFS + "events/sched").c_str(), S_IRWXU);
+    mkdir((FAKE_TRACEFS + "events/sched/sched_switch").c_str(), S_IRWXU);
+    mkdir((FAKE_TRACEFS + "options").c_str(), S_IRWXU);
+    ofstream(filterPath) << "none\n";
+    ofstream(FAKE_TRACEFS + "set_event_pid") << "99\n";
+    ofstream(FAKE_TRACEFS + "options/event-fork") << "0\n";
+
+    TraceFs traceFs;
+    ASSERT_TRUE(traceFs.Open(FAKE_TRACEFS));
+    EventFilters filters(traceFs);
+    EventFilter filter = { "sched", "sched_switch", "prev_pid == 12" };
+    ASSERT_TRUE(filters.Apply({ filter }, { 12, 34 }, true));
+    EXPECT_EQ(ReadAll(filterPath), "prev_pid == 12");
+    EXPECT_EQ(ReadAll(FAKE_TRACEFS + "set_event_pid"), "12 34\n");
+    EXPECT_EQ(ReadAll(FAKE_TRACEFS + "options/event-fork").substr(0, 1), "1");
+
+    ASSERT_TRUE(filters.Clear());
+    EXPECT_EQ(ReadAll(filterPath).substr(0, 1), "0");
+    EXPECT_EQ(ReadAll(FAKE_TRACEFS + "set_event_pid"), "");
+    EXPECT_EQ(ReadAll(FAKE_TRACEFS + "options/event-fork").substr(0, 1), "0");
+    EXPECT_FALSE(filters.Apply({ { "irq", "", "irq > 3" } }, {}, false));
+
+    traceFs.Close();
+    unlink(filterPath.c_str());
+    unlink((FAKE_TRACEFS + "set_event_pid").c_str());
+    unlink((FAKE_TRACEFS + "options/event-fork").c_str());
+    rmdir((FAKE_TRACEFS + "options").c_str());
+    rmdir((FAKE_TRACEFS + "events/sched/sched_switch").c_str());
+    rmdir((FAKE_TRACEFS + "events/sched").c_str());
+    rmdir((FAKE_TRACEFS + "events").c_str());
+    rmdir(FAKE_TRACEFS.c_str());
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: only tracing_on, trace_marker, set_event and enable files keep an fd open after a write.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventSettingsTest, TraceFsWrite_001, TestSize.Level0)
+{
+    const vector<string> hotFiles = { "tracing_on", "trace_marker", "set_event", "events/enable" };
+    const vector<string> coldFiles = { "buffer_size_kb", "trace_clock", "events/filter" };
+    mkdir(FAKE_TRACEFS.c_str(), S_IRWXU);
+    mkdir((FAKE_TRACEFS + "events").c_str(), S_IRWXU);
+    for (const auto& file : hotFiles) {
+        ofstream(FAKE_TRACEFS + file) << "0\n";
+    }
+    for (const auto& file : coldFiles) {
+        ofstream(FAKE_TRACEFS + file) << "0\n";
+    }
+
+    TraceFs traceFs;
+    ASSERT_TRUE(traceFs.Open(FAKE_TRACEFS));
+    size_t fdCount = CountOpenFds();
+    for (const auto& file : coldFiles) {
+        EXPECT_TRUE(traceFs.Write(file, "1"));
+        EXPECT_TRUE(traceFs.Write(file, "2"));
+        EXPECT_EQ(ReadAll(FAKE_TRACEFS + file), "2\n");
+    }
+    EXPECT_EQ(CountOpenFds(), fdCount);
+    for (const auto& file : hotFiles) {
+        EXPECT_TRUE(traceFs.Write(file, "1"));
+        EXPECT_TRUE(traceFs.Write(file, "1"));
+        EXPECT_EQ(ReadAll(FAKE_TRACEFS + file), "1\n");
+    }
+    EXPECT_EQ(CountOpenFds(), fdCount + hotFiles.size());
+    EXPECT_FALSE(traceFs.Write("missing", "1"));
+    EXPECT_EQ(CountOpenFds(), fdCount + hotFiles.size());
+
+    traceFs.Close();
+    for (const auto& file : hotFiles) {
+        unlink((FAKE_TRACEFS + file).c_str());
+    }
+    for (const auto& file : coldFiles) {
+        unlink((FAKE_TRACEFS + file).c_str());
+    }
+    rmdir((FAKE_TRACEFS + "events").c_str());
+    rmdir(FAKE_TRACEFS.c_str());
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: processes are found by the first word of their cmdline, with all of their threads.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceEventSettingsTest, FindProcessPids_001, TestSize.Level0)
+{
+    const string fakeProc = "/data/local/tmp/bytrace_fake_proc";
+    const vector<string> dirs = { "", "/12", "/12/task", "/12/task/12", "/12/task/15", "/34", "/self" };
+    for (const auto& dir : dirs) {
+        mkdir((fakeProc + dir).c_str(), S_IRWXU);
+    }
+    ofstream(fakeProc + "/12/cmdline") << string("com.example.app\0--flag\0", 23);
+    ofstream(fakeProc + "/34/cmdline") << string("com.example.app:remote\0", 23);
+
+    EXPECT_EQ(FindProcessPids("com.example.app", fakeProc), vector<int>({ 12 }));
+    EXPECT_TRUE(FindProcessPids("com.example", fakeProc).empty());
+    EXPECT_EQ(FindProcessThreads(12, fakeProc), vector<int>({ 12, 15 }));
+    EXPECT_EQ(FindProcessThreads(34, fakeProc), vector<int>({ 34 }));
+
+    ofstream(fakeProc + "/tasks") << "34\n12\n15\n12\n";
+    EXPECT_EQ(FindCgroupPids(fakeProc), vector<int>({ 12, 15, 34 }));
+    ofstream(fakeProc + "/cgroup.procs") << "34\n12\n";
+    EXPECT_EQ(FindCgroupPids(fakeProc), vector<int>({ 12, 34 }));
+    unlink((fakeProc + "/tasks").c_str());
+    unlink((fakeProc + "/cgroup.procs").c_str());
+
+    unlink((fakeProc + "/12/cmdline").c_str());
+    unlink((fakeProc + "/34/cmdline").c_str());
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+        rmdir((fakeProc + *it).c_str());
+    }
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
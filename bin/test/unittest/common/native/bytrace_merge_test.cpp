@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "bytrace_merge.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string TRACE_A = "/data/local/tmp/bytrace_merge_test_a.ftrace";
+const string TRACE_B = "/data/local/tmp/bytrace_merge_test_b.ftrace";
+const string OUTPUT_PATH = "/data/local/tmp/bytrace_merge_test.ftrace";
+const string MULTI_HEADER =
+    "# tracer: nop\n"
+    "#\n"
+    "#                                      _-----=> irqs-off\n"
+    "#                                     / _----=> need-resched\n"
+    "#                                    | / _---=> hardirq/softirq\n"
+    "#                                    || / _--=> preempt-depth\n"
+    "#                                    ||| /     delay\n"
+    "#           TASK-PID    TGID   CPU#  ||||    TIMESTAMP  FUNCTION\n"
+    "#              | |        |      |   ||||       |         |\n";
+
+class BytraceMergeTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown()
+    {
+        unlink(TRACE_A.c_str());
+        unlink(TRACE_B.c_str());
+        unlink(OUTPUT_PATH.c_str());
+    };
+};
+
+string MergeFiles(const vector<string>& files)
+{
+    int outFd = open(OUTPUT_PATH.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644); // 0644: file mode
+    if (outFd == -1) {
+        return "";
+    }
+    bool isTrue = MergeDeviceTraces(files, outFd);
+    close(outFd);
+    if (!isTrue) {
+        return "";
+    }
+    ifstream file(OUTPUT_PATH);
+    stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the devices are aligned by their realtime_ts markers, and only the lines that
+ *           bytrace_multi.py keeps are merged, with equal timestamps in the order of the devices.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceMergeTest, MergeDeviceTraces_001, TestSize.Level0)
+{
+    ofstream(TRACE_A) << "# tracer: nop\n"
+        "          ui-100   (  100) [000] d..2 10.000000: tracing_mark_write: trace_event_clock_sync: "
+        "realtime_ts=5000\n"
+        "          ui-100   (  100) [000] d..2 10.500000: tracing_mark_write: B|100|draw\n"
+        "          ui-100   (  100) [000] d..2 10.600000: sched_switch: prev_comm=ui\n"
+        "          ui-100   (-----) [000] d..2 10.700000: tracing_mark_write: E|100\n";
+    ofstream(TRACE_B) << "# tracer: nop\n"
+        "   kworker/0:1-a-200   (  200) [001] d..2 20.000000: tracing_mark_write: trace_event_clock_sync: "
+        "realtime_ts=4000\n"
+        "   kworker/0:1-a-200   (  200) [001] d..2 21.500000: binder_transaction: at 21.500000";
+    string expected = MULTI_HEADER +
+        "[device_1]   kworker/0:1-a-200   (  200) [001] d..2 20.000000: tracing_mark_write: trace_event_clock_sync: "
+        "realtime_ts=4000\n"
+        "[device_0]          ui-100   (  100) [000] d..2 21.000000: tracing_mark_write: trace_event_clock_sync: "
+        "realtime_ts=5000\n"
+        "[device_1]   kworker/0:1-a-200   (  200) [001] d..2 21.500000: binder_transaction: at 21.500000\n"
+        "[device_0]          ui-100   (  100) [000] d..2 21.500000: tracing_mark_write: B|100|draw\n";
+    EXPECT_EQ(MergeFiles({ TRACE_A, "/data/local/tmp/bytrace_merge_test_none.ftrace", TRACE_B }), expected);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a trace without a realtime_ts marker goes 0.5s after the reference device by its last
+ *           line, and a trace out of time order is sorted.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceMergeTest, MergeDeviceTraces_002, TestSize.Level0)
+{
+    ofstream(TRACE_A) << "           sf-7     (    7) [002] d..2 5.000000: tracing_mark_write: trace_event_clock_sync: "
+        "realtime_ts=1000\n";
+    ofstream(TRACE_B) << "           ui-9     (    9) [003] d..2 3.000000: tracing_mark_write: B|9|b\n"
+        "           ui-9     (    9) [003] d..2 1.000000: tracing_mark_write: B|9|a\n"
+        "           ui-9     (    9) [003] d..2 2.000000: tracing_mark_write: E|9\n";
+    // 2.0 is the last line of B and goes to 5.5, so B moves by 3.5.
+    string expected = MULTI_HEADER +
+        "[device_1]           ui-9     (    9) [003] d..2 4.500000: tracing_mark_write: B|9|a\n"
+        "[device_0]           sf-7     (    7) [002] d..2 5.000000: tracing_mark_write: trace_event_clock_sync: "
+        "realtime_ts=1000\n"
+        "[device_1]           ui-9     (    9) [003] d..2 5.500000: tracing_mark_write: E|9\n"
+        "[device_1]           ui-9     (    9) [003] d..2 6.500000: tracing_mark_write: B|9|b\n";
+    EXPECT_EQ(MergeFiles({ TRACE_A, TRACE_B }), expected);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: nothing is merged without a trace to read.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceMergeTest, MergeDeviceTraces_003, TestSize.Level0)
+{
+    EXPECT_EQ(MergeFiles({ "/data/local/tmp/bytrace_merge_test_none.ftrace" }), "");
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
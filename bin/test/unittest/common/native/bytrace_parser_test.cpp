@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "bytrace_parser.h"
+#include "bytrace_test_utils.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string TRACE_PATH = "/data/local/tmp/bytrace_parser_test.ftrace";
+constexpr double BYTES_PER_GB = 1024.0 * 1024.0 * 1024.0;
+constexpr int BENCHMARK_ROUNDS = 5;
+constexpr int BENCHMARK_LINES = 2000000;
+
+class BytraceParserTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown()
+    {
+        unlink(TRACE_PATH.c_str());
+    };
+};
+
+double MeasureThroughput(string_view text, int threads, size_t& count)
+{
+    double best = 0;
+    for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+        vector<TraceEvent> events;
+        auto begin = chrono::steady_clock::now();
+        ParseTraceText(text, events, threads);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+        count = events.size();
+        best = max(best, text.size() / BYTES_PER_GB / elapsed.count());
+    }
+    return best;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: every field of an event line is parsed, with or without the tgid and flags.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceParserTest, ParseTraceLine_001, TestSize.Level0)
+{
+    TraceEvent event;
+    ASSERT_TRUE(ParseTraceLine("  kworker/0:1-a-200   (  150) [003] dN.2 4321.012345: sched_wakeup: comm=ui pid=9",
+        event));
+    EXPECT_EQ(event.task, "kworker/0:1-a");
+    EXPECT_EQ(event.pid, 200);
+    EXPECT_EQ(event.tgid, 150);
+    EXPECT_EQ(event.cpu, 3);
+    EXPECT_EQ(event.flags, "dN.2");
+    EXPECT_EQ(event.timestampNs, 4321012345000u);
+    EXPECT_EQ(event.name, "sched_wakeup");
+    EXPECT_EQ(event.payload, "comm=ui pid=9");
+
+    ASSERT_TRUE(ParseTraceLine("<idle>-0 (-----) [1] 7.123456789123: cpu_idle: state=1 cpu_id=1\r", event));
+    EXPECT_EQ(event.task, "<idle>");
+    EXPECT_EQ(event.pid, 0);
+    EXPECT_EQ(event.tgid, -1);
+    EXPECT_EQ(event.cpu, 1);
+    EXPECT_EQ(event.flags, "");
+    EXPECT_EQ(event.timestampNs, 7123456789u);
+    EXPECT_EQ(event.payload, "state=1 cpu_id=1");
+
+    ASSERT_TRUE(ParseTraceLine("sh-77 [000] .... 1.5: tracing_mark_write: trace_event_clock_sync: realtime_ts=1",
+        event));
+    EXPECT_EQ(event.tgid, -1);
+    EXPECT_EQ(event.timestampNs, 1500000000u);
+    EXPECT_EQ(event.name, "tracing_mark_write");
+    EXPECT_EQ(event.payload, "trace_event_clock_sync: realtime_ts=1");
+
+    EXPECT_FALSE(ParseTraceLine("# tracer: nop", event));
+    EXPECT_FALSE(ParseTraceLine("TRACE:", event));
+    EXPECT_FALSE(ParseTraceLine("", event));
+    EXPECT_FALSE(ParseTraceLine("sh [000] 1.5: sched_switch: x", event));
+    EXPECT_FALSE(ParseTraceLine("sh-77 [000] 1.x: sched_switch: x", event));
+    EXPECT_FALSE(ParseTraceLine("sh-77 [000] 1.5 sched_switch", event));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the B/E/S/F/C payloads of bytrace and systrace are parsed, and the others are not markers.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceParserTest, ParseTraceMarker_001, TestSize.Level0)
+{
+    TraceMarker marker;
+    ASSERT_TRUE(ParseTraceMarker("B|512|onVsync frame ", marker));
+    EXPECT_EQ(marker.type, TRACE_MARKER_BEGIN);
+    EXPECT_EQ(marker.pid, 512);
+    EXPECT_EQ(marker.name, "onVsync frame");
+
+    ASSERT_TRUE(ParseTraceMarker("E|512| ", marker));
+    EXPECT_EQ(marker.type, TRACE_MARKER_END);
+    EXPECT_EQ(marker.name, "");
+    ASSERT_TRUE(ParseTraceMarker("E", marker));
+    EXPECT_EQ(marker.pid, -1);
+
+    ASSERT_TRUE(ParseTraceMarker("S|7|load image 42", marker));
+    EXPECT_EQ(marker.type, TRACE_MARKER_ASYNC_BEGIN);
+    EXPECT_EQ(marker.name, "load image");
+    EXPECT_EQ(marker.value, 42);
+    ASSERT_TRUE(ParseTraceMarker("F|7|load image|42", marker));
+    EXPECT_EQ(marker.type, TRACE_MARKER_ASYNC_END);
+    EXPECT_EQ(marker.name, "load image");
+    EXPECT_EQ(marker.value, 42);
+    ASSERT_TRUE(ParseTraceMarker("C|7|free memory -4096", marker));
+    EXPECT_EQ(marker.type, TRACE_MARKER_COUNTER);
+    EXPECT_EQ(marker.value, -4096);
+
+    EXPECT_FALSE(ParseTraceMarker("trace_event_clock_sync: realtime_ts=1", marker));
+    EXPECT_FALSE(ParseTraceMarker("B|512|", marker));
+    EXPECT_FALSE(ParseTraceMarker("B|x|name", marker));
+    EXPECT_FALSE(ParseTraceMarker("C|7|count", marker));
+    EXPECT_FALSE(ParseTraceMarker("C|7|count 9223372036854775808", marker));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a mapped trace parses to the same events in the same order on one thread and on several.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceParserTest, ParseTraceText_001, TestSize.Level0)
+{
+    const int lines = 100000;
+    {
+        ofstream file(TRACE_PATH);
+        file << "# tracer: nop\n#\n";
+        for (int i = 0; i < lines; i++) {
+            file << MakeTraceLine(i);
+        }
+    }
+    MappedTraceFile trace;
+    ASSERT_TRUE(trace.Open(TRACE_PATH));
+    ASSERT_GT(trace.Text().size(), 2u * 1024 * 1024); // 2 MB: enough for several chunks
+
+    vector<TraceEvent> single;
+    TraceParseStats stats = ParseTraceText(trace.Text(), single, 1);
+    EXPECT_EQ(stats.lines, lines + 2u);   // 2: the header lines
+    EXPECT_EQ(stats.skipped, 2u);
+    ASSERT_EQ(single.size(), static_cast<size_t>(lines));
+
+    vector<TraceEvent> parallel;
+    stats = ParseTraceText(trace.Text(), parallel, 4); // 4: threads
+    EXPECT_EQ(stats.lines, lines + 2u);
+    ASSERT_EQ(parallel.size(), single.size());
+    for (size_t i = 0; i < single.size(); i++) {
+        ASSERT_EQ(parallel[i].timestampNs, single[i].timestampNs);
+        ASSERT_EQ(parallel[i].payload.data(), single[i].payload.data());
+    }
+    uint64_t lastUs = FAKE_TRACE_START_US + static_cast<uint64_t>(lines - 1) * FAKE_TRACE_STEP_US;
+    EXPECT_EQ(single.back().timestampNs, lastUs * 1000); // 1000: ns per us
+
+    MappedTraceFile missing;
+    EXPECT_FALSE(missing.Open(TRACE_PATH + ".none"));
+    EXPECT_TRUE(missing.Text().empty());
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: parser throughput in GB/s on one thread and on all CPUs.
+ * @tc.type: PERF
+ */
+HWTEST_F(BytraceParserTest, ParseTraceText_Benchmark, TestSize.Level1)
+{
+    string text;
+    text.reserve(BENCHMARK_LINES * 128); // 128: longer than a line
+    for (int i = 0; i < BENCHMARK_LINES; i++) {
+        text += MakeTraceLine(i);
+    }
+    size_t singleCount = 0;
+    size_t parallelCount = 0;
+    double single = MeasureThroughput(text, 1, singleCount);
+    double parallel = MeasureThroughput(text, 0, parallelCount);
+    printf("parse throughput of %.1f MB: 1 thread %.2f GB/s, all CPUs %.2f GB/s\n",
+        text.size() / 1024.0 / 1024.0, single, parallel); // 1024.0: bytes per KB, KB per MB
+    EXPECT_EQ(singleCount, static_cast<size_t>(BENCHMARK_LINES));
+    EXPECT_EQ(parallelCount, static_cast<size_t>(BENCHMARK_LINES));
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
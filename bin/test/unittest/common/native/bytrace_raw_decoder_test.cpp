@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <gtest/gtest.h>
+#include "bytrace_raw_decoder.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string TRACING_DIR = "/data/local/tmp/bytrace_raw_test";
+const string COMMON_FIELDS =
+    "format:\n"
+    "\tfield:unsigned short common_type;\toffset:0;\tsize:2;\tsigned:0;\n"
+    "\tfield:unsigned char common_flags;\toffset:2;\tsize:1;\tsigned:0;\n"
+    "\tfield:unsigned char common_preempt_count;\toffset:3;\tsize:1;\tsigned:0;\n"
+    "\tfield:int common_pid;\toffset:4;\tsize:4;\tsigned:1;\n"
+    "\n";
+const string PRINT_FORMAT = "name: print\nID: 5\n" + COMMON_FIELDS +
+    "\tfield:unsigned long ip;\toffset:8;\tsize:8;\tsigned:0;\n"
+    "\tfield:char buf[];\toffset:16;\tsize:0;\tsigned:1;\n\n"
+    "print fmt: \"%ps: %s\", (void *)REC->ip, REC->buf\n";
+const string SAMPLE_FORMAT = "name: sample\nID: 7\n" + COMMON_FIELDS +
+    "\tfield:int value;\toffset:8;\tsize:4;\tsigned:1;\n\n"
+    "print fmt: \"value=%d\", REC->value\n";
+const uint16_t PRINT_ID = 5;
+const uint16_t SAMPLE_ID = 7;
+const size_t PAGE_SIZE_4K = 4096;
+const size_t PAGE_HEADER_SIZE = 16;
+
+class BytraceRawDecoderTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown() {};
+};
+
+// A page as trace_pipe_raw returns it: u64 timestamp, u64 commit, then the events.
+class PageBuilder {
+public:
+    explicit PageBuilder(uint64_t timestamp) : page_(PAGE_SIZE_4K, 0)
+    {
+        memcpy(page_.data(), &timestamp, sizeof(timestamp));
+    }
+
+    void AddEvent(uint32_t delta, const vector<uint8_t>& record)
+    {
+        vector<uint8_t> padded = record;
+        padded.resize((record.size() + 3) / 4 * 4); // 3, 4: aligned to 4 bytes
+        uint32_t typeLen = static_cast<uint32_t>(padded.size() / 4); // 4: type_len counts words
+        if (typeLen <= 28) { // 28: the longest record that fits in type_len
+            PutWord((delta << 5) | typeLen); // 5: time_delta above type_len
+        } else {
+            PutWord(delta << 5); // 5: type_len 0, the length in array[0]
+            PutWord(static_cast<uint32_t>(padded.size() + 4)); // 4: array[0] counts itself
+        }
+        Put(padded.data(), padded.size());
+    }
+
+    void AddTimeExtend(uint64_t delta)
+    {
+        PutWord(((static_cast<uint32_t>(delta) & 0x7ffffff) << 5) | 30); // 0x7ffffff, 5, 30: low 27 bits
+        PutWord(static_cast<uint32_t>(delta >> 27)); // 27: the upper bits
+    }
+
+    vector<uint8_t> Build(uint64_t flags = 0, int64_t lost = 0)
+    {
+        uint64_t commit = (length_ - PAGE_HEADER_SIZE) | flags;
+        memcpy(page_.data() + 8, &commit, sizeof(commit)); // 8: after the timestamp
+        if (lost != 0) {
+            memcpy(page_.data() + length_, &lost, sizeof(lost));
+        }
+        return page_;
+    }
+
+private:
+    void PutWord(uint32_t word)
+    {
+        Put(reinterpret_cast<const uint8_t*>(&word), sizeof(word));
+    }
+    void Put(const uint8_t* data, size_t size)
+    {
+        memcpy(page_.data() + length_, data, size);
+        length_ += size;
+    }
+
+    vector<uint8_t> page_;
+    size_t length_ = PAGE_HEADER_SIZE;
+};
+
+vector<uint8_t> MakeRecord(uint16_t id, int32_t pid, uint8_t flags, uint8_t preemptCount, size_t size)
+{
+    vector<uint8_t> record(size);
+    memcpy(record.data(), &id, sizeof(id));
+    record[2] = flags;        // 2: common_flags
+    record[3] = preemptCount; // 3: common_preempt_count
+    memcpy(record.data() + 4, &pid, sizeof(pid)); // 4: common_pid
+    return record;
+}
+
+vector<uint8_t> MakeSample(int32_t pid, int32_t value)
+{
+    vector<uint8_t> record = MakeRecord(SAMPLE_ID, pid, 0, 0, 12); // 12: the size of sample
+    memcpy(record.data() + 8, &value, sizeof(value)); // 8: value
+    return record;
+}
+
+vector<uint8_t> MakePrint(int32_t pid, const string& buf)
+{
+    vector<uint8_t> record = MakeRecord(PRINT_ID, pid, 0, 0, 16 + buf.size() + 1); // 16: buf
+    memcpy(record.data() + 16, buf.c_str(), buf.size() + 1);
+    return record;
+}
+
+RawEventDecoder MakeDecoder()
+{
+    RawEventDecoder decoder;
+    decoder.AddFormat("ftrace", PRINT_FORMAT);
+    decoder.AddFormat("test", SAMPLE_FORMAT);
+    decoder.SetTaskName(100, "sh");
+    decoder.SetTgid(100, 90);
+    return decoder;
+}
+
+void WriteFile(const string& path, const string& content)
+{
+    ofstream file(path);
+    file << content;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a page is decoded through time extends and long records, with its lost events.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceRawDecoderTest, DecodePage_001, TestSize.Level0)
+{
+    RawEventDecoder decoder = MakeDecoder();
+    PageBuilder builder(1000);
+    builder.AddEvent(10, MakeSample(100, 1));
+    builder.AddTimeExtend(1ULL << 30); // 30: beyond the 27 bits of a delta
+    builder.AddEvent(5, MakePrint(100, string(200, 'x'))); // 200: a record longer than type_len can hold
+    builder.AddEvent(0, MakeSample(101, -2));
+    vector<uint8_t> page = builder.Build(1ULL << 31 | 1ULL << 30, 42); // 31, 30: missed and stored; 42: lost
+
+    vector<RawEvent> events;
+    int64_t lost = 0;
+    ASSERT_TRUE(decoder.DecodePage(page.data(), page.size(), events, lost));
+    EXPECT_EQ(lost, 42);
+    ASSERT_EQ(events.size(), 3u);
+    EXPECT_EQ(events[0].timestamp, 1010u);
+    EXPECT_EQ(events[0].id, SAMPLE_ID);
+    EXPECT_EQ(events[0].pid, 100);
+    EXPECT_EQ(events[0].format, decoder.FindFormat(SAMPLE_ID));
+    EXPECT_EQ(events[1].timestamp, 1010u + (1ULL << 30) + 5);
+    EXPECT_EQ(events[1].id, PRINT_ID);
+    EXPECT_EQ(events[1].size, 16u + 200 + 4); // 16, 200, 4: the fields, the text and its NUL aligned
+    EXPECT_EQ(events[2].timestamp, events[1].timestamp);
+    EXPECT_EQ(events[2].pid, 101);
+
+    // Missed events that were not counted, and a page whose commit runs past the data.
+    events.clear();
+    page = PageBuilder(0).Build(1ULL << 31); // 31: missed
+    ASSERT_TRUE(decoder.DecodePage(page.data(), page.size(), events, lost));
+    EXPECT_EQ(lost, -1);
+    EXPECT_TRUE(events.empty());
+    EXPECT_FALSE(decoder.DecodePage(page.data(), 8, events, lost)); // 8: shorter than the header
+    uint64_t commit = PAGE_SIZE_4K;
+    memcpy(page.data() + 8, &commit, sizeof(commit)); // 8: the commit
+    EXPECT_FALSE(decoder.DecodePage(page.data(), page.size(), events, lost));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: an event is formatted as the line of the trace file, with the columns of the options.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceRawDecoderTest, FormatEvent_001, TestSize.Level0)
+{
+    RawEventDecoder decoder = MakeDecoder();
+    vector<uint8_t> sample = MakeSample(100, -3);
+    sample[2] = 0x01 | 0x04 | 0x08; // 2, 0x01, 0x04, 0x08: irqs off, need resched, hardirq
+    sample[3] = 2;                  // 3, 2: preempt count
+    vector<uint8_t> print = MakePrint(0, "B|90|draw\n");
+    vector<uint8_t> unknown = MakeRecord(99, -1, 0, 0, 8); // 99: no format
+    PageBuilder builder(1234567499);
+    builder.AddEvent(0, sample);
+    builder.AddEvent(1, print);
+    builder.AddEvent(0, unknown);
+    vector<uint8_t> page = builder.Build();
+    vector<RawEvent> events;
+    int64_t lost = 0;
+    ASSERT_TRUE(decoder.DecodePage(page.data(), page.size(), events, lost));
+    ASSERT_EQ(events.size(), 3u);
+
+    string out;
+    decoder.FormatEvent(events[0], 1, out);
+    EXPECT_EQ(out, "              sh-100   (   90) [001] dnh2     1.234567: sample: value=-3\n");
+    out.clear();
+    decoder.FormatEvent(events[1], 0, out);
+    EXPECT_EQ(out, "          <idle>-0     (-----) [000] ....     1.234568: tracing_mark_write: B|90|draw\n");
+    out.clear();
+    decoder.FormatEvent(events[2], 2, out);
+    EXPECT_EQ(out, "           <XXX>--1    (-----) [002] ....     1.234568: Unknown type 99\n");
+
+    decoder.SetTextOptions({ false, false, false });
+    out.clear();
+    decoder.FormatEvent(events[0], 1, out);
+    EXPECT_EQ(out, "              sh-100   [001]    1234567499: sample: value=-3\n");
+    EXPECT_EQ(decoder.FormatHeader(), "# tracer: nop\n#\n");
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the pages of several CPUs are merged in time order, with the lost events of each.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceRawDecoderTest, DecodeRawBuffers_001, TestSize.Level0)
+{
+    RawEventDecoder decoder = MakeDecoder();
+    decoder.SetTextOptions({ false, false, false });
+    int cpu0[2];
+    int cpu1[2];
+    ASSERT_EQ(pipe(cpu0), 0);
+    ASSERT_EQ(pipe(cpu1), 0);
+    PageBuilder first(100);
+    first.AddEvent(0, MakeSample(100, 1));
+    first.AddEvent(200, MakeSample(100, 3)); // 200: at 300
+    PageBuilder second(500);
+    second.AddEvent(0, MakeSample(100, 5));
+    PageBuilder other(200);
+    other.AddEvent(0, MakeSample(100, 2));
+    other.AddEvent(200, MakeSample(100, 4)); // 200: at 400
+    vector<uint8_t> pages[] = { first.Build(), second.Build(1ULL << 31 | 1ULL << 30, 7), other.Build() };
+    ASSERT_EQ(write(cpu0[1], pages[0].data(), PAGE_SIZE_4K), static_cast<ssize_t>(PAGE_SIZE_4K));
+    ASSERT_EQ(write(cpu0[1], pages[1].data(), PAGE_SIZE_4K), static_cast<ssize_t>(PAGE_SIZE_4K));
+    ASSERT_EQ(write(cpu1[1], pages[2].data(), PAGE_SIZE_4K), static_cast<ssize_t>(PAGE_SIZE_4K));
+    close(cpu0[1]);
+    close(cpu1[1]);
+
+    string text;
+    RawDecodeStats stats;
+    ASSERT_TRUE(DecodeRawBuffers(decoder, { cpu0[0], -1, cpu1[0] }, [&text](const char* data, size_t len) {
+        text.append(data, len);
+        return true;
+    }, &stats));
+    close(cpu0[0]);
+    close(cpu1[0]);
+    EXPECT_EQ(text,
+        "              sh-100   [000]           100: sample: value=1\n"
+        "              sh-100   [002]           200: sample: value=2\n"
+        "              sh-100   [000]           300: sample: value=3\n"
+        "              sh-100   [002]           400: sample: value=4\n"
+        "CPU:0 [LOST 7 EVENTS]\n"
+        "              sh-100   [000]           500: sample: value=5\n");
+    EXPECT_EQ(stats.pages, 3u);
+    EXPECT_EQ(stats.events, 5u);
+    EXPECT_EQ(stats.lostEvents, 7u);
+    EXPECT_EQ(stats.badPages, 0u);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: the formats, the page layout and the task names are read from the tracing directory.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceRawDecoderTest, LoadFormats_001, TestSize.Level0)
+{
+    mkdir(TRACING_DIR.c_str(), 0755); // 0755: rwxr-xr-x
+    mkdir((TRACING_DIR + "/events").c_str(), 0755);
+    mkdir((TRACING_DIR + "/events/ftrace").c_str(), 0755);
+    mkdir((TRACING_DIR + "/events/ftrace/print").c_str(), 0755);
+    mkdir((TRACING_DIR + "/events/test").c_str(), 0755);
+    mkdir((TRACING_DIR + "/events/test/sample").c_str(), 0755);
+    WriteFile(TRACING_DIR + "/events/ftrace/print/format", PRINT_FORMAT);
+    WriteFile(TRACING_DIR + "/events/test/sample/format", SAMPLE_FORMAT);
+    WriteFile(TRACING_DIR + "/events/header_page",
+        "\tfield: u64 timestamp;\toffset:0;\tsize:8;\tsigned:0;\n"
+        "\tfield: local_t commit;\toffset:8;\tsize:4;\tsigned:1;\n"
+        "\tfield: int overwrite;\toffset:8;\tsize:1;\tsigned:1;\n"
+        "\tfield: char data;\toffset:12;\tsize:4084;\tsigned:1;\n");
+    WriteFile(TRACING_DIR + "/saved_cmdlines", "100 sh\n101 kworker/u16:2\n");
+    WriteFile(TRACING_DIR + "/saved_tgids", "100 90\n");
+
+    RawEventDecoder decoder;
+    ASSERT_TRUE(decoder.LoadFormats(TRACING_DIR, { "events/test", "events/missing/none" }));
+    ASSERT_NE(decoder.FindFormat(PRINT_ID), nullptr);
+    ASSERT_NE(decoder.FindFormat(SAMPLE_ID), nullptr);
+    EXPECT_EQ(decoder.FindFormat(SAMPLE_ID)->GetSystem(), "test");
+    EXPECT_EQ(decoder.FindFormat(SAMPLE_ID + 1), nullptr);
+    EXPECT_EQ(decoder.GetPageSize(), PAGE_SIZE_4K);
+    decoder.LoadTaskNames(TRACING_DIR);
+
+    // A page of a 32-bit kernel: a 4-byte commit and the data at 12.
+    vector<uint8_t> page(PAGE_SIZE_4K, 0);
+    uint64_t timestamp = 2000000000;
+    memcpy(page.data(), &timestamp, sizeof(timestamp));
+    vector<uint8_t> record = MakeSample(101, 9);
+    uint32_t header = static_cast<uint32_t>(record.size() / 4); // 4: type_len counts words
+    memcpy(page.data() + 12, &header, sizeof(header));          // 12: the data
+    memcpy(page.data() + 16, record.data(), record.size());     // 16: after the event header
+    uint32_t commit = sizeof(header) + record.size();
+    memcpy(page.data() + 8, &commit, sizeof(commit));           // 8: the commit
+    vector<RawEvent> events;
+    int64_t lost = 0;
+    ASSERT_TRUE(decoder.DecodePage(page.data(), page.size(), events, lost));
+    ASSERT_EQ(events.size(), 1u);
+    string out;
+    decoder.FormatEvent(events[0], 3, out);
+    EXPECT_EQ(out, "   kworker/u16:2-101   (-----) [003] ....     2.000000: sample: value=9\n");
+
+    RawEventDecoder empty;
+    EXPECT_FALSE(empty.LoadFormats(TRACING_DIR + "/events/none", {}));
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
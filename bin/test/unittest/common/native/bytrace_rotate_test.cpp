@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "bytrace_rotate.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string OUTPUT_PATH = "/data/local/tmp/bytrace_rotate_test";
+const int FILE_COUNT = 8;
+
+class BytraceRotateTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown()
+    {
+        for (int i = 0; i < FILE_COUNT; i++) {
+            unlink((OUTPUT_PATH + "." + to_string(i)).c_str());
+        }
+    };
+};
+
+string ReadFile(const string& path)
+{
+    ifstream file(path);
+    stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+string ReadGzFile(const string& path)
+{
+    gzFile gz = gzopen(path.c_str(), "rb");
+    if (gz == nullptr) {
+        return "";
+    }
+    string content;
+    char buffer[4096]; // 4096: read size
+    int n = 0;
+    while ((n = gzread(gz, buffer, sizeof(buffer))) > 0) {
+        content.append(buffer, n);
+    }
+    gzclose(gz);
+    return content;
+}
+
+bool IsFile(const string& path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+RotationHook Header()
+{
+    return [](int index) { return "TRACE:\n# file " + to_string(index) + "\n"; };
+}
+
+RotationHook Footer()
+{
+    return [](int index) { return "# end " + to_string(index) + "\n"; };
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: only the newest files of a ring are kept.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceRotateTest, FileRing_001, TestSize.Level0)
+{
+    FileRing ring(2); // 2: files kept
+    for (int i = 0; i < 3; i++) { // 3: files written
+        string path = OUTPUT_PATH + "." + to_string(i);
+        ofstream(path) << "x";
+        ring.Add(path);
+    }
+    EXPECT_FALSE(IsFile(OUTPUT_PATH + ".0"));
+    EXPECT_TRUE(IsFile(OUTPUT_PATH + ".1"));
+    EXPECT_TRUE(IsFile(OUTPUT_PATH + ".2"));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: files rotate at the first line end past the size limit, each with its header and footer,
+ *           and only the newest maxFiles remain.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceRotateTest, RotatingTraceWriter_001, TestSize.Level0)
+{
+    RotationConfig config;
+    config.output = OUTPUT_PATH;
+    config.maxFileBytes = 64; // 64: bytes per file, about three lines
+    config.maxFiles = 3;      // 3: files kept
+    RotatingTraceWriter writer(config, Header(), Footer());
+    string line = "<idle>-0 [000] d..2 1.000000: sched_switch: x\n";
+    // Written in pieces that do not end at a line boundary.
+    string trace;
+    for (int i = 0; i < 10; i++) { // 10: lines
+        trace += line;
+    }
+    for (size_t offset = 0; offset < trace.size(); offset += 30) { // 30: bytes per write
+        ASSERT_TRUE(writer.Write(trace.data() + offset, min<size_t>(30, trace.size() - offset)));
+    }
+    ASSERT_TRUE(writer.Close());
+    EXPECT_EQ(writer.GetRawBytes(), trace.size());
+    int files = writer.GetFileCount();
+    ASSERT_GT(files, 3);
+
+    EXPECT_FALSE(IsFile(OUTPUT_PATH + "." + to_string(files - 4))); // 4: the newest file not kept
+    for (int i = files - 3; i < files; i++) {
+        string content = ReadFile(OUTPUT_PATH + "." + to_string(i));
+        string header = "TRACE:\n# file " + to_string(i) + "\n";
+        string footer = "# end " + to_string(i) + "\n";
+        ASSERT_EQ(content.compare(0, header.size(), header), 0);
+        ASSERT_EQ(content.compare(content.size() - footer.size(), footer.size(), footer), 0);
+        string body = content.substr(header.size(), content.size() - header.size() - footer.size());
+        EXPECT_FALSE(body.empty());
+        for (size_t offset = 0; offset < body.size(); offset += line.size()) {
+            EXPECT_EQ(body.compare(offset, line.size(), line), 0);
+        }
+    }
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: with compression every file is a gzip file of its own.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceRotateTest, RotatingTraceWriter_002, TestSize.Level0)
+{
+    RotationConfig config;
+    config.output = OUTPUT_PATH;
+    config.maxFileBytes = 16; // 16: bytes per file
+    config.compress = true;
+    RotatingTraceWriter writer(config, Header(), Footer());
+    string line = "a line of trace text\n";
+    ASSERT_TRUE(writer.Write(line.data(), line.size()));
+    ASSERT_TRUE(writer.Write(line.data(), line.size()));
+    ASSERT_TRUE(writer.Close());
+    ASSERT_EQ(writer.GetFileCount(), 2); // 2: one line each
+    for (int i = 0; i < 2; i++) {
+        string content = ReadGzFile(OUTPUT_PATH + "." + to_string(i));
+        EXPECT_EQ(content, "TRACE:\n# file " + to_string(i) + "\n" + line + "# end " + to_string(i) + "\n");
+    }
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
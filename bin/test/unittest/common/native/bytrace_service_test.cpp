@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "bytrace_service.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string SOCKET_PATH = "/data/local/tmp/bytrace_service_test.sock";
+
+class BytraceServiceTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown() {};
+};
+
+string ReadAll(int fd)
+{
+    string text;
+    char buffer[256];
+    ssize_t n = 0;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, static_cast<size_t>(n));
+    }
+    return text;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a request reaches the service with its arguments and output fds, the status comes back.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceServiceTest, ServiceRequest_001, TestSize.Level0)
+{
+    EXPECT_EQ(ConnectServiceSocket(SOCKET_PATH), -1);
+    int listenFd = ListenServiceSocket(SOCKET_PATH);
+    ASSERT_NE(listenFd, -1);
+    int outPipe[2] = { -1, -1 };
+    int filePipe[2] = { -1, -1 };
+    ASSERT_EQ(pipe(outPipe), 0);
+    ASSERT_EQ(pipe(filePipe), 0);
+
+    thread client([&outPipe, &filePipe]() {
+        int sockFd = ConnectServiceSocket(SOCKET_PATH);
+        ASSERT_NE(sockFd, -1);
+        ServiceRequest request;
+        request.args = { "bytrace", "-t", "1", "-o", "trace.ftrace", "" };
+        request.outFd = outPipe[1];
+        request.errFd = outPipe[1];
+        request.outputFd = filePipe[1];
+        EXPECT_TRUE(SendServiceRequest(sockFd, request));
+        int status = 0;
+        EXPECT_TRUE(ReceiveServiceResult(sockFd, status));
+        EXPECT_EQ(status, 1);
+        close(sockFd);
+    });
+
+    int sockFd = accept(listenFd, nullptr, nullptr);
+    ASSERT_NE(sockFd, -1);
+    ServiceRequest request;
+    ASSERT_TRUE(ReceiveServiceRequest(sockFd, request));
+    EXPECT_EQ(request.args, vector<string>({ "bytrace", "-t", "1", "-o", "trace.ftrace", "" }));
+    // The fds are new ones for the same pipes.
+    EXPECT_NE(request.outFd, -1);
+    EXPECT_EQ(write(request.outFd, "ok", 2), 2);
+    EXPECT_NE(request.outputFd, -1);
+    EXPECT_EQ(write(request.outputFd, "trace", 5), 5);
+    EXPECT_TRUE(SendServiceResult(sockFd, 1));
+    client.join();
+    close(request.outFd);
+    close(request.errFd);
+    close(request.outputFd);
+    close(sockFd);
+    close(listenFd);
+    unlink(SOCKET_PATH.c_str());
+
+    close(outPipe[1]);
+    EXPECT_EQ(ReadAll(outPipe[0]), "ok");
+    close(outPipe[0]);
+    close(filePipe[1]);
+    EXPECT_EQ(ReadAll(filePipe[0]), "trace");
+    close(filePipe[0]);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a peer that does not run as one of the users of the service is refused.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceServiceTest, ServicePeer_001, TestSize.Level0)
+{
+    int fds[2] = { -1, -1 };
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    EXPECT_TRUE(CheckServicePeer(fds[0], { getuid() }));
+    EXPECT_FALSE(CheckServicePeer(fds[0], { getuid() + 1 }));
+    EXPECT_FALSE(CheckServicePeer(fds[0], {}));
+    close(fds[0]);
+    close(fds[1]);
+
+    // Not a socket: nobody to check, nobody served.
+    int pipeFds[2] = { -1, -1 };
+    ASSERT_EQ(pipe(pipeFds), 0);
+    EXPECT_FALSE(CheckServicePeer(pipeFds[0], { getuid() }));
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+
+    vector<uid_t> uids = GetServiceUids();
+    EXPECT_NE(find(uids.begin(), uids.end(), 0u), uids.end());
+    EXPECT_NE(find(uids.begin(), uids.end(), geteuid()), uids.end());
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a stream copies the trace until the client hangs up, and a garbled request is refused.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceServiceTest, StreamTrace_001, TestSize.Level0)
+{
+    int tracePipe[2] = { -1, -1 };
+    int outPipe[2] = { -1, -1 };
+    int control[2] = { -1, -1 };
+    ASSERT_EQ(pipe(tracePipe), 0);
+    ASSERT_EQ(pipe(outPipe), 0);
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, control), 0);
+
+    const string events = "  <idle>-0     [000] .... 100.000001: sched_switch: prev_pid=0\n";
+    ASSERT_EQ(write(tracePipe[1], events.data(), events.size()), static_cast<ssize_t>(events.size()));
+    thread streamer([&]() {
+        EXPECT_TRUE(StreamTrace(tracePipe[0], outPipe[1], control[1]));
+        close(outPipe[1]);
+    });
+    string streamed;
+    char buffer[256];
+    while (streamed.size() < events.size()) {
+        ssize_t n = read(outPipe[0], buffer, sizeof(buffer));
+        ASSERT_GT(n, 0);
+        streamed.append(buffer, static_cast<size_t>(n));
+    }
+    EXPECT_EQ(streamed, events);
+    close(control[0]);
+    streamer.join();
+    close(control[1]);
+    EXPECT_EQ(ReadAll(outPipe[0]), "");
+
+    // Without the fds and the magic, nothing is taken.
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, control), 0);
+    EXPECT_EQ(write(control[0], "GET / HTTP/1.0\r\n\r\n", 18), 18);
+    ServiceRequest request;
+    EXPECT_FALSE(ReceiveServiceRequest(control[1], request));
+
+    close(control[0]);
+    close(control[1]);
+    close(tracePipe[0]);
+    close(tracePipe[1]);
+    close(outPipe[0]);
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
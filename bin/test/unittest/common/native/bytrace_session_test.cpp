@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bytrace_session.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string FAKE_TRACEFS = "/data/local/tmp/bytrace_fake_tracefs/";
+const string LOCK_DIR = "/data/local/tmp/";
+
+class BytraceSessionTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp()
+    {
+        mkdir(FAKE_TRACEFS.c_str(), S_IRWXU);
+        mkdir((FAKE_TRACEFS + "instances").c_str(), S_IRWXU);
+    };
+    void TearDown()
+    {
+        rmdir((FAKE_TRACEFS + "instances").c_str());
+        rmdir(FAKE_TRACEFS.c_str());
+    };
+};
+
+bool IsDir(const string& path)
+{
+    struct stat st = {};
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a session owns its instance until it is released, a second user is refused.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceSessionTest, TraceSession_001, TestSize.Level0)
+{
+    EXPECT_TRUE(TraceSession::IsValidName("ci-job_1"));
+    EXPECT_FALSE(TraceSession::IsValidName("../x"));
+    EXPECT_FALSE(TraceSession::IsValidName(""));
+
+    TraceSession session(FAKE_TRACEFS, "test", LOCK_DIR);
+    ASSERT_TRUE(session.Acquire());
+    EXPECT_EQ(session.GetRootPath(), FAKE_TRACEFS + "instances/bytrace_test/");
+    EXPECT_TRUE(IsDir(session.GetRootPath()));
+
+    TraceSession other(FAKE_TRACEFS, "test", LOCK_DIR);
+    EXPECT_FALSE(other.Acquire());
+    // Held sessions are never cleaned up.
+    EXPECT_EQ(CleanAbandonedSessions(FAKE_TRACEFS, LOCK_DIR, 0), 0);
+
+    EXPECT_TRUE(session.Remove());
+    EXPECT_FALSE(IsDir(session.GetRootPath()));
+    session.Release();
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: instances of sessions nobody holds are removed once idle, other instances are left alone.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceSessionTest, CleanAbandonedSessions_001, TestSize.Level0)
+{
+    const string abandoned = FAKE_TRACEFS + "instances/bytrace_gone";
+    const string foreign = FAKE_TRACEFS + "instances/perfetto";
+    mkdir(abandoned.c_str(), S_IRWXU);
+    mkdir(foreign.c_str(), S_IRWXU);
+    {
+        TraceSession session(FAKE_TRACEFS, "idle", LOCK_DIR);
+        ASSERT_TRUE(session.Acquire());
+    }
+    // Just used: kept until it has been idle long enough.
+    EXPECT_EQ(CleanAbandonedSessions(FAKE_TRACEFS, LOCK_DIR, 600), 1);
+    EXPECT_FALSE(IsDir(abandoned));
+    EXPECT_TRUE(IsDir(FAKE_TRACEFS + "instances/bytrace_idle"));
+    EXPECT_EQ(CleanAbandonedSessions(FAKE_TRACEFS, LOCK_DIR, 0), 1);
+    EXPECT_FALSE(IsDir(FAKE_TRACEFS + "instances/bytrace_idle"));
+    EXPECT_TRUE(IsDir(foreign));
+    rmdir(foreign.c_str());
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
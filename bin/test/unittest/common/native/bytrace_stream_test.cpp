@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "bytrace_stream.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string SOCKET_PATH = "/data/local/tmp/bytrace_stream_test.sock";
+
+class BytraceStreamTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown() {};
+};
+
+struct Frame {
+    uint32_t type = 0;
+    uint64_t seq = 0;
+    uint32_t flags = 0;
+    string payload;
+};
+
+uint64_t GetLe(const string& data, size_t offset, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | static_cast<uint8_t>(data[offset + i]); // 8: bits per byte
+    }
+    return value;
+}
+
+bool RecvExact(int fd, string& data, size_t len)
+{
+    data.resize(len);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = recv(fd, &data[done], len - done, 0);
+        if (n <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool RecvFrame(int fd, Frame& frame)
+{
+    string header;
+    if (!RecvExact(fd, header, STREAM_HEADER_SIZE) || GetLe(header, 0, 4) != STREAM_FRAME_MAGIC) {
+        return false;
+    }
+    frame.type = static_cast<uint32_t>(GetLe(header, 4, 4));
+    frame.seq = GetLe(header, 8, 8);
+    frame.flags = static_cast<uint32_t>(GetLe(header, 16, 4));
+    return RecvExact(fd, frame.payload, GetLe(header, 20, 4));
+}
+
+void SendAck(int fd, uint64_t next)
+{
+    send(fd, &next, sizeof(next), MSG_NOSIGNAL); // little-endian hosts only, as the test devices are
+}
+
+string Inflate(const Frame& frame)
+{
+    if ((frame.flags & STREAM_FLAG_ZLIB) == 0) {
+        return frame.payload;
+    }
+    string out(1024, '\0');
+    uLongf len = out.size();
+    uncompress(reinterpret_cast<Bytef*>(&out[0]), &len, reinterpret_cast<const Bytef*>(frame.payload.data()),
+        frame.payload.size());
+    out.resize(len);
+    return out;
+}
+
+class CountingSink : public TraceSink {
+public:
+    bool Write(const char* data, size_t len) override
+    {
+        bytes += len;
+        return true;
+    }
+    bool Flush() override
+    {
+        return true;
+    }
+    bool Close() override
+    {
+        return true;
+    }
+    size_t bytes = 0;
+};
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: stream targets are unix paths and tcp addresses.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceStreamTest, ParseStreamTarget_001, TestSize.Level0)
+{
+    StreamTarget target;
+    ASSERT_TRUE(ParseStreamTarget("tcp:127.0.0.1:9999", target));
+    EXPECT_EQ(target.host, "127.0.0.1");
+    EXPECT_EQ(target.port, 9999);
+    ASSERT_TRUE(ParseStreamTarget("[::1]:9000", target));
+    EXPECT_EQ(target.host, "::1");
+    ASSERT_TRUE(ParseStreamTarget("unix:/data/local/tmp/c.sock", target));
+    EXPECT_EQ(target.path, "/data/local/tmp/c.sock");
+    EXPECT_FALSE(ParseStreamTarget("tcp:host", target));
+    EXPECT_FALSE(ParseStreamTarget("tcp:host:70000", target));
+    EXPECT_FALSE(ParseStreamTarget("unix:", target));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a chunk the collector did not acknowledge before the connection dropped is sent again.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceStreamTest, TraceStreamer_001, TestSize.Level0)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    SOCKET_PATH.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+    unlink(SOCKET_PATH.c_str());
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(bind(listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(listenFd, 1), 0);
+
+    vector<Frame> received;
+    thread collector([listenFd, &received]() {
+        // The first connection takes chunk 0 and drops chunk 1 unacknowledged.
+        int fd = accept(listenFd, nullptr, nullptr);
+        Frame frame;
+        for (uint64_t ack : { 0, 1 }) {
+            ASSERT_TRUE(RecvFrame(fd, frame));
+            received.push_back(frame);
+            SendAck(fd, ack);
+        }
+        ASSERT_TRUE(RecvFrame(fd, frame));
+        close(fd);
+        // The second one resumes the same stream from chunk 1.
+        fd = accept(listenFd, nullptr, nullptr);
+        for (uint64_t ack : { 1, 2, 2 }) {
+            ASSERT_TRUE(RecvFrame(fd, frame));
+            received.push_back(frame);
+            SendAck(fd, ack);
+        }
+        close(fd);
+    });
+
+    StreamTarget target;
+    ASSERT_TRUE(ParseStreamTarget("unix:" + SOCKET_PATH, target));
+    TraceStreamer streamer(target, true, 16); // 16: two chunks of 16 bytes
+    ASSERT_TRUE(streamer.Open());
+    const string text = "0123456789abcdef0123456789ABCDEF";
+    EXPECT_TRUE(streamer.Write(text.data(), text.size()));
+    EXPECT_TRUE(streamer.Close());
+    EXPECT_EQ(streamer.GetRawBytes(), text.size());
+    collector.join();
+    close(listenFd);
+    unlink(SOCKET_PATH.c_str());
+
+    ASSERT_EQ(received.size(), 5u);
+    EXPECT_EQ(received[0].type, STREAM_HELLO);
+    EXPECT_EQ(received[0].flags, STREAM_FLAG_ZLIB);
+    EXPECT_EQ(received[1].type, STREAM_DATA);
+    EXPECT_EQ(received[1].seq, 0u);
+    EXPECT_EQ(Inflate(received[1]), "0123456789abcdef");
+    EXPECT_EQ(received[2].type, STREAM_HELLO);
+    EXPECT_EQ(received[2].seq, received[0].seq);
+    EXPECT_EQ(received[3].type, STREAM_DATA);
+    EXPECT_EQ(received[3].seq, 1u);
+    EXPECT_EQ(Inflate(received[3]), "0123456789ABCDEF");
+    EXPECT_EQ(received[4].type, STREAM_END);
+    EXPECT_EQ(received[4].seq, 2u);
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a trace_pipe that never runs dry does not extend the capture, and a drain stops when it is dry.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceStreamTest, StreamTracePipe_001, TestSize.Level0)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+    ASSERT_EQ(fcntl(fds[1], F_SETFL, O_NONBLOCK), 0);
+    atomic<bool> stop(false);
+    thread writer([&fds, &stop]() {
+        const string chunk(4096, 'x');
+        while (!stop) {
+            if (write(fds[1], chunk.data(), chunk.size()) < 0 && errno != EAGAIN) {
+                break;
+            }
+        }
+    });
+    CountingSink sink;
+    auto start = chrono::steady_clock::now();
+    EXPECT_TRUE(StreamTracePipe(fds[0], sink, 200)); // 200: ms
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    EXPECT_LT(elapsed, 2000); // 2000: ms, generous for loaded test devices
+    EXPECT_GT(sink.bytes, 0u);
+    stop = true;
+    writer.join();
+
+    CountingSink drained;
+    EXPECT_TRUE(StreamTracePipe(fds[0], drained, 0));
+    char byte;
+    EXPECT_EQ(read(fds[0], &byte, 1), -1);
+    close(fds[0]);
+    close(fds[1]);
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "bytrace_tag_registry.h"
+
+using namespace testing::ext;
+using namespace std;
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+const string VENDOR_TAGS_PATH = "/data/local/tmp/bytrace_vendor_tags";
+
+class BytraceTagRegistryTest : public testing::Test {
+public:
+    static void SetUpTestCase(void) {};
+    static void TearDownTestCase(void) {};
+    void SetUp() {};
+    void TearDown()
+    {
+        unlink(VENDOR_TAGS_PATH.c_str());
+    };
+};
+
+vector<string> GetFiles(const TagCategory& tag)
+{
+    return vector<string>(tag.sysfiles, tag.sysfiles + tag.sysfileCount);
+}
+
+bool IsSortedByName(const vector<const TagCategory*>& tags)
+{
+    for (size_t i = 1; i < tags.size(); i++) {
+        if (!(tags[i - 1]->name < tags[i]->name)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: built-in categories are found by their exact name only.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceTagRegistryTest, TagRegistry_001, TestSize.Level0)
+{
+    TagRegistry registry;
+    const TagCategory* sched = registry.Find("sched");
+    ASSERT_NE(sched, nullptr);
+    EXPECT_EQ(sched->type, KERNEL);
+    EXPECT_EQ(sched->tag, 0u);
+    ASSERT_GT(sched->sysfileCount, 0u);
+    EXPECT_EQ(sched->sysfiles[0], "events/sched/sched_switch/enable");
+
+    // The first, the last and a user category of the table.
+    const TagCategory* ability = registry.Find("ability");
+    ASSERT_NE(ability, nullptr);
+    EXPECT_EQ(ability->type, USER);
+    EXPECT_NE(ability->tag, 0u);
+    EXPECT_EQ(ability->sysfileCount, 0u);
+    ASSERT_NE(registry.Find("zmedia"), nullptr);
+
+    EXPECT_EQ(registry.Find(""), nullptr);
+    EXPECT_EQ(registry.Find("sche"), nullptr);
+    EXPECT_EQ(registry.Find("schedx"), nullptr);
+    EXPECT_EQ(registry.Find("aaa"), nullptr);
+    EXPECT_EQ(registry.Find("zzz"), nullptr);
+
+    vector<const TagCategory*> tags = registry.GetAll();
+    ASSERT_FALSE(tags.empty());
+    EXPECT_TRUE(IsSortedByName(tags));
+    for (const TagCategory* tag : tags) {
+        EXPECT_EQ(registry.Find(tag->name), tag);
+    }
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: a "name|description|files" line of the vendor file adds a kernel category.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceTagRegistryTest, TagRegistry_002, TestSize.Level0)
+{
+    TagRegistry registry;
+    EXPECT_FALSE(registry.LoadVendorTags(VENDOR_TAGS_PATH));
+
+    ofstream(VENDOR_TAGS_PATH) << "gpu|GPU Events|events/gpu/enable,events/gpu/gpu_freq/enable\n" <<
+        "npu||events/npu/enable";
+    ASSERT_TRUE(registry.LoadVendorTags(VENDOR_TAGS_PATH));
+    const TagCategory* gpu = registry.Find("gpu");
+    ASSERT_NE(gpu, nullptr);
+    EXPECT_EQ(gpu->name, "gpu");
+    EXPECT_EQ(gpu->description, "GPU Events");
+    EXPECT_EQ(gpu->type, KERNEL);
+    EXPECT_EQ(gpu->tag, 0u);
+    EXPECT_EQ(GetFiles(*gpu), (vector<string> { "events/gpu/enable", "events/gpu/gpu_freq/enable" }));
+
+    // The description may be empty, and the last line needs no newline.
+    const TagCategory* npu = registry.Find("npu");
+    ASSERT_NE(npu, nullptr);
+    EXPECT_EQ(npu->description, "");
+    EXPECT_EQ(GetFiles(*npu), (vector<string> { "events/npu/enable" }));
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: comments, malformed lines and duplicate names are skipped, a built-in category is never replaced.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceTagRegistryTest, TagRegistry_003, TestSize.Level0)
+{
+    TagRegistry registry;
+    const TagCategory* sched = registry.Find("sched");
+    size_t builtinCount = registry.GetAll().size();
+    ofstream(VENDOR_TAGS_PATH) << "# name|description|files\n" <<
+        "\n" <<
+        "nofiles|No files\n" <<
+        "toomany|Too|many|fields\n" <<
+        "|No name|events/noname/enable\n" <<
+        "emptyfiles|Empty files|\n" <<
+        "sched|Vendor sched|events/vendor_sched/enable\n" <<
+        "gpu|GPU Events|events/gpu/enable\n" <<
+        "gpu|GPU again|events/gpu2/enable\n";
+    ASSERT_TRUE(registry.LoadVendorTags(VENDOR_TAGS_PATH));
+
+    EXPECT_EQ(registry.GetAll().size(), builtinCount + 1);
+    EXPECT_EQ(registry.Find("sched"), sched);
+    EXPECT_EQ(sched->description, "CPU Scheduling");
+    const TagCategory* gpu = registry.Find("gpu");
+    ASSERT_NE(gpu, nullptr);
+    EXPECT_EQ(gpu->description, "GPU Events");
+    EXPECT_EQ(registry.Find("nofiles"), nullptr);
+    EXPECT_EQ(registry.Find("toomany"), nullptr);
+    EXPECT_EQ(registry.Find("emptyfiles"), nullptr);
+    EXPECT_EQ(registry.Find(""), nullptr);
+
+    // A second file cannot replace a vendor category either.
+    ofstream(VENDOR_TAGS_PATH) << "gpu|GPU later|events/gpu3/enable\n";
+    ASSERT_TRUE(registry.LoadVendorTags(VENDOR_TAGS_PATH));
+    EXPECT_EQ(registry.Find("gpu"), gpu);
+    EXPECT_EQ(gpu->description, "GPU Events");
+}
+
+/**
+ * @tc.name: bytrace
+ * @tc.desc: GetAll merges the vendor categories into the built-in ones in name order.
+ * @tc.type: FUNC
+ */
+HWTEST_F(BytraceTagRegistryTest, TagRegistry_004, TestSize.Level0)
+{
+    TagRegistry registry;
+    vector<const TagCategory*> builtinTags = registry.GetAll();
+    // Out of order in the file: before, between and after the built-in names.
+    ofstream(VENDOR_TAGS_PATH) << "zzz|Last|events/zzz/enable\n" <<
+        "aaa|First|events/aaa/enable\n" <<
+        "schedx|Middle|events/schedx/enable\n";
+    ASSERT_TRUE(registry.LoadVendorTags(VENDOR_TAGS_PATH));
+
+    vector<const TagCategory*> tags = registry.GetAll();
+    ASSERT_EQ(tags.size(), builtinTags.size() + 3); // 3: vendor categories
+    EXPECT_TRUE(IsSortedByName(tags));
+    EXPECT_EQ(tags.front()->name, "aaa");
+    EXPECT_EQ(tags.back()->name, "zzz");
+    auto sched = find(tags.begin(), tags.end(), registry.Find("sched"));
+    ASSERT_NE(sched, tags.end());
+    ASSERT_NE(sched + 1, tags.end());
+    EXPECT_EQ((*(sched + 1))->name, "schedx");
+
+    // The built-in entries keep their relative order and identity.
+    vector<const TagCategory*> builtinOnly;
+    for (const TagCategory* tag : tags) {
+        if (tag->name != "aaa" && tag->name != "schedx" && tag->name != "zzz") {
+            builtinOnly.push_back(tag);
+        }
+    }
+    EXPECT_EQ(builtinOnly, builtinTags);
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
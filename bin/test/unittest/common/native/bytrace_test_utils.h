@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2021 Huawei Device Co., Ltd.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVELOPTOOLS_BYTRACE_ADAPTER_TEST_BYTRACE_TEST_UTILS_H
+#define DEVELOPTOOLS_BYTRACE_ADAPTER_TEST_BYTRACE_TEST_UTILS_H
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace OHOS {
+namespace Developtools {
+namespace BytraceTest {
+constexpr uint64_t FAKE_TRACE_START_US = 100000000; // 100 s
+constexpr uint64_t FAKE_TRACE_STEP_US = 50;
+
+/**
+ * Line i of a fake trace: render_thread events FAKE_TRACE_STEP_US apart from FAKE_TRACE_START_US, on
+ * 8 threads and 4 CPUs, with begin, end, sched_switch and counter payloads in turn.
+ */
+inline std::string MakeTraceLine(int i)
+{
+    int pid = 1000 + i % 8; // 8: threads
+    const char* payloads[] = {
+        "tracing_mark_write: B|%d|H:fake slice",
+        "tracing_mark_write: E|%d",
+        "sched_switch: prev_comm=render prev_pid=%d prev_prio=120 prev_state=S ==> next_comm=swapper next_pid=0",
+        "tracing_mark_write: C|%d|queued 3",
+    };
+    char payload[160]; // 160: longer than any payload above
+    snprintf(payload, sizeof(payload), payloads[i % 4], pid); // 4: payloads
+    uint64_t us = FAKE_TRACE_START_US + static_cast<uint64_t>(i) * FAKE_TRACE_STEP_US;
+    char line[256]; // 256: longer than any line
+    int len = snprintf(line, sizeof(line), "     render_thread-%d    (  %d) [00%d] d..2 %" PRIu64 ".%06" PRIu64
+        ": %s\n", pid, pid, i % 4, us / 1000000, us % 1000000, payload); // 1000000: us per second
+    return std::string(line, len);
+}
+} // namespace BytraceTest
+} // namespace Developtools
+} // namespace OHOS
+#endif // DEVELOPTOOLS_BYTRACE_ADAPTER_TEST_BYTRACE_TEST_UTILS_H
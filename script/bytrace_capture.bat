@@ -12,10 +12,27 @@
 @rem limitations under the License.
 
 @echo off
+@rem The trace is streamed to the collector on this host while it is captured, nothing is stored on the device.
 hdc shell "echo > /sys/kernel/debug/tracing/trace"
 hdc shell "echo 4096 > /d/tracing/saved_cmdlines_size"
-hdc shell "bytrace -t 10 -b 4096 --overwrite ohos zimage zmedia zcamera zaudio ability distributeddatamgr sched freq irq workq  rs idle load disk pagecache memreclaim > /data/mynewtrace.ftrace"
+hdc rport tcp:9999 tcp:9999
+start /b python "%~dp0bytrace_collector.py" --listen tcp:127.0.0.1:9999 -o mynewtrace.ftrace
+@rem bytrace gives up when nobody listens, so the capture waits for the collector to be up.
+set tries=0
+:wait_collector
+netstat -an | findstr /r /c:"127\.0\.0\.1:9999 .*LISTENING" > nul
+if not errorlevel 1 goto collector_up
+set /a tries+=1
+if %tries% geq 30 (
+    echo the collector did not start
+    hdc fport rm tcp:9999 tcp:9999
+    pause
+    exit /b 1
+)
+timeout /t 1 /nobreak > nul
+goto wait_collector
+:collector_up
+hdc shell "bytrace -t 10 -b 4096 --overwrite -z --stream_to tcp:127.0.0.1:9999 ohos zimage zmedia zcamera zaudio ability distributeddatamgr sched freq irq workq  rs idle load disk pagecache memreclaim"
 hdc shell "echo > /sys/kernel/debug/tracing/trace"
-hdc shell "sed -i '1,2d' /data/mynewtrace.ftrace"
-hdc pull /data/mynewtrace.ftrace .
+hdc fport rm tcp:9999 tcp:9999
 pause
@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+# Copyright (C) 2021 Huawei Device Co., Ltd.
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Receives the captures that "bytrace --stream_to" sends, see bin/include/bytrace_stream.h.
+# The files are plain ftrace text: the "TRACE:" line bytrace starts its output with is left out.
+#
+#   python3 bytrace_collector.py --listen tcp:0.0.0.0:9999 -o mytrace.ftrace
+#   hdc rport tcp:9999 tcp:9999
+#   hdc shell "bytrace -t 10 -z --stream_to tcp:127.0.0.1:9999 sched freq"
+
+import argparse
+import os
+import socket
+import socketserver
+import struct
+import sys
+import threading
+import zlib
+
+FRAME_MAGIC = 0x46545942 # "BYTF"
+FRAME_HEADER = struct.Struct("<IIQII") # magic, type, sequence, flags, payload length
+FRAME_ACK = struct.Struct("<Q")
+FRAME_HELLO = 1
+FRAME_DATA = 2
+FRAME_END = 3
+FLAG_ZLIB = 1
+MAX_PAYLOAD = 64 * 1024 * 1024
+PREAMBLE = b"TRACE:\n"
+
+streams = {} # {stream id: Stream}, kept across reconnections
+streams_lock = threading.Lock()
+done = threading.Event()
+
+
+class Stream(object):
+    def __init__(self, stream_id, path):
+        self.stream_id = stream_id
+        self.path = path
+        self.fp = open(path, "wb")
+        self.next_seq = 0
+        self.raw_bytes = 0
+        self.preamble = PREAMBLE # what is left of it to strip
+        self.lock = threading.Lock()
+
+    def strip_preamble(self, data):
+        keep = min(len(self.preamble), len(data))
+        if data[:keep] != self.preamble[:keep]:
+            self.preamble = b""
+            return data
+        self.preamble = self.preamble[keep:]
+        return data[keep:]
+
+    def write(self, seq, flags, payload):
+        if seq < self.next_seq:
+            return # sent again after a reconnection
+        if seq > self.next_seq:
+            sys.stderr.write("stream %016x: chunks %d-%d are missing\n" % (self.stream_id, self.next_seq, seq - 1))
+        data = zlib.decompress(payload) if flags & FLAG_ZLIB else payload
+        if self.preamble:
+            data = self.strip_preamble(data)
+        self.fp.write(data)
+        self.raw_bytes += len(data)
+        self.next_seq = seq + 1
+
+
+def recv_exact(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def recv_frame(sock):
+    header = recv_exact(sock, FRAME_HEADER.size)
+    if header is None:
+        return None
+    magic, frame_type, seq, flags, length = FRAME_HEADER.unpack(header)
+    if magic != FRAME_MAGIC or length > MAX_PAYLOAD:
+        raise ValueError("not a bytrace stream")
+    payload = recv_exact(sock, length) if length else b""
+    if payload is None:
+        return None
+    return frame_type, seq, flags, payload
+
+
+def open_stream(server, stream_id):
+    with streams_lock:
+        stream = streams.get(stream_id)
+        if stream is None:
+            if server.output_file:
+                path = server.output_file
+            else:
+                path = os.path.join(server.output_dir, "bytrace_%016x.ftrace" % stream_id)
+            stream = Stream(stream_id, path)
+            streams[stream_id] = stream
+            sys.stderr.write("stream %016x: writing %s\n" % (stream_id, path))
+        return stream
+
+
+class StreamHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        sock = self.request
+        try:
+            frame = recv_frame(sock)
+            if frame is None or frame[0] != FRAME_HELLO:
+                return
+            stream = open_stream(self.server, frame[1])
+            sock.sendall(FRAME_ACK.pack(stream.next_seq))
+            while True:
+                frame = recv_frame(sock)
+                if frame is None:
+                    sys.stderr.write("stream %016x: connection lost, waiting for it to resume\n" % stream.stream_id)
+                    return
+                frame_type, seq, flags, payload = frame
+                with stream.lock:
+                    if frame_type == FRAME_DATA:
+                        stream.write(seq, flags, payload)
+                    sock.sendall(FRAME_ACK.pack(stream.next_seq))
+                if frame_type == FRAME_END:
+                    self.finish_stream(stream)
+                    return
+        except (ValueError, zlib.error, socket.error) as e:
+            sys.stderr.write("connection dropped: %s\n" % e)
+
+    def finish_stream(self, stream):
+        with streams_lock:
+            streams.pop(stream.stream_id, None)
+        stream.fp.close()
+        sys.stderr.write("stream %016x: %d chunks, %d bytes in %s\n" %
+                         (stream.stream_id, stream.next_seq, stream.raw_bytes, stream.path))
+        if self.server.output_file:
+            done.set()
+
+
+class TcpServer(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+class UnixServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+
+def create_server(listen):
+    if listen.startswith("unix:"):
+        path = listen[len("unix:"):]
+        if os.path.exists(path):
+            os.unlink(path)
+        return UnixServer(path, StreamHandler)
+    address = listen[len("tcp:"):] if listen.startswith("tcp:") else listen
+    host, port = address.rsplit(":", 1)
+    if host.startswith("[") and host.endswith("]"):
+        host = host[1:-1]
+        TcpServer.address_family = socket.AF_INET6
+    return TcpServer((host, int(port)), StreamHandler)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Collects the captures of \"bytrace --stream_to\".")
+    parser.add_argument("--listen", default="tcp:127.0.0.1:9999",
+                        help="tcp:host:port or unix:path (default: tcp:127.0.0.1:9999)")
+    parser.add_argument("-o", dest="output_file",
+                        help="writes the first stream to this file and exits once it ends")
+    parser.add_argument("-d", dest="output_dir", default=".",
+                        help="directory of the streams, one bytrace_<id>.ftrace each (default: .)")
+    args = parser.parse_args()
+
+    server = create_server(args.listen)
+    server.output_file = args.output_file
+    server.output_dir = args.output_dir
+    thread = threading.Thread(target=server.serve_forever)
+    thread.daemon = True
+    thread.start()
+    sys.stderr.write("listening on %s\n" % args.listen)
+    try:
+        while not done.wait(1):
+            pass
+    except KeyboardInterrupt:
+        pass
+    server.shutdown()
+    server.server_close()
+
+
+if __name__ == "__main__":
+    main()
@@ -13,6 +13,8 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+# "bytrace merge file1.ftrace file2.ftrace ..." writes the same output natively, in bounded memory.
+
 import codecs
 import sys
 import os
@@ -128,7 +130,7 @@ def main():
                           base_time_stamp, \
                           target_device)
     # Sort by timestamp from small to large
-    all_trace_sorted_list = sorted(all_trace_list, key=lambda x: x[0])
+    all_trace_sorted_list = sorted(all_trace_list, key=lambda x: float(x[0]))
     curtime = time.strftime("%Y%m%d_%H%M%S", time.localtime())
     write_to_file(all_trace_sorted_list, "multi_trace_"+str(curtime)+".ftrace")
 